@@ -50,6 +50,24 @@ typedef struct jwt jwt_t;
 /** Opaque JWT validation object. */
 typedef struct jwt_valid jwt_valid_t;
 
+/** Opaque prepared key object. */
+typedef struct jwt_key jwt_key_t;
+
+/** Opaque keyring object. */
+typedef struct jwt_keyring jwt_keyring_t;
+
+/** Opaque key set object. */
+typedef struct jwt_keyset jwt_keyset_t;
+
+/** Opaque worker pool object. */
+typedef struct jwt_async jwt_async_t;
+
+/** Opaque job of a worker pool. */
+typedef struct jwt_async_job jwt_async_job_t;
+
+/** Called on a worker thread when a job is done, see jwt_async_encode(). */
+typedef void (*jwt_async_cb_t)(jwt_async_job_t *job, void *data);
+
 /** JWT algorithm types. */
 typedef enum jwt_alg {
 	JWT_ALG_NONE = 0,
@@ -62,9 +80,49 @@ typedef enum jwt_alg {
 	JWT_ALG_ES256,
 	JWT_ALG_ES384,
 	JWT_ALG_ES512,
+	JWT_ALG_EDDSA,
 	JWT_ALG_TERM
 } jwt_alg_t;
 
+/** Encodings of key data, see jwt_key_new_format(). */
+typedef enum jwt_key_format {
+	JWT_KEY_FORMAT_AUTO = 0,	/**< PEM or DER, told apart by the data. */
+	JWT_KEY_FORMAT_PEM,		/**< PEM armoured key. */
+	JWT_KEY_FORMAT_DER,		/**< SPKI, PKCS#8, PKCS#1 or SEC1 DER. */
+	JWT_KEY_FORMAT_RAW_PUB,		/**< EC point or EdDSA public key. */
+	JWT_KEY_FORMAT_RAW_PRIV,	/**< EC scalar or EdDSA private key. */
+} jwt_key_format_t;
+
+/** Cache statistics. */
+typedef struct jwt_cache_stats {
+	unsigned int size;		/**< Maximum number of entries. */
+	unsigned int entries;		/**< Entries currently held. */
+	unsigned long hits;		/**< Lookups answered from the cache. */
+	unsigned long misses;		/**< Lookups that were not. */
+	unsigned long evictions;	/**< Entries dropped to make room. */
+} jwt_cache_stats_t;
+
+/** Crypto provider for one algorithm, see jwt_set_crypto_provider(). */
+typedef struct jwt_crypto_provider {
+	/** Name of the provider, for reporting only. */
+	const char *name;
+	/** Optional. Parse key once and keep the result in *state. */
+	int (*prepare)(jwt_alg_t alg, const unsigned char *key, int len,
+		       void **state);
+	/** Optional. Release what prepare() left in state. */
+	void (*release)(void *state);
+	/** Sign data, storing in *sig a signature allocated with the
+	 *  functions set by jwt_set_alloc(), or malloc(). */
+	int (*sign)(void *state, jwt_alg_t alg, const unsigned char *key,
+		    int len, const char *data, unsigned char **sig,
+		    unsigned int *sig_len);
+	/** Return 0 if sig is a valid signature of data, EINVAL if it is
+	 *  not, or another errno if it could not be checked. */
+	int (*verify)(void *state, jwt_alg_t alg, const unsigned char *key,
+		      int len, const char *data, const unsigned char *sig,
+		      unsigned int sig_len);
+} jwt_crypto_provider_t;
+
 typedef void *(*jwt_malloc_t)(size_t);
 typedef void *(*jwt_realloc_t)(void *, size_t);
 typedef void(*jwt_free_t)(void *);
@@ -80,10 +138,10 @@ typedef void(*jwt_free_t)(void *);
  * existing token.
  *
  * Note, when using RSA keys (e.g. with RS256), the key is expected to be
- * a private key in PEM format. If the RSA private key requires a passphrase,
- * the default is to request it on the command line from stdin. However,
- * you can override this using OpenSSL's default_passwd routines. For
- * example, using SSL_CTX_set_default_passwd_cb().
+ * a private key in PEM or DER format. If the RSA private key requires a
+ * passphrase, the default is to request it on the command line from
+ * stdin. However, you can override this using OpenSSL's default_passwd
+ * routines. For example, using SSL_CTX_set_default_passwd_cb().
  * @{
  */
 
@@ -109,6 +167,11 @@ JWT_EXPORT int jwt_new(jwt_t **jwt);
  * verify it. If the JWT is encrypted and no key is supplied, an error
  * is returned.
  *
+ * The header is parsed first, and a token whose alg does not suit the
+ * key is refused straight away. The signature is then checked before
+ * the payload is decoded, so the claims of a token that does not verify
+ * are never parsed.
+ *
  * @param jwt Pointer to a JWT object pointer. Will be allocated on
  *     success.
  * @param token Pointer to a valid JWT string, nul terminated.
@@ -126,6 +189,103 @@ JWT_EXPORT int jwt_new(jwt_t **jwt);
 JWT_EXPORT int jwt_decode(jwt_t **jwt, const char *token,
 	                 const unsigned char *key, int key_len);
 
+/**
+ * Verify an existing JWT with a prepared key and allocate a new JWT
+ * object from it.
+ *
+ * Works the same as jwt_decode(), but the signature is checked with a
+ * key previously created with jwt_key_new(), so the key does not need to
+ * be parsed again for every token. The alg of the token must belong to
+ * the same family (HMAC, RSA, EC or EdDSA) as the key.
+ *
+ * @param jwt Pointer to a JWT object pointer. Will be allocated on
+ *     success.
+ * @param token Pointer to a valid JWT string, nul terminated.
+ * @param key Pointer to a prepared key, or NULL if no validation is to
+ *     be performed.
+ * @return 0 on success, valid errno otherwise.
+ */
+JWT_EXPORT int jwt_decode_with_key(jwt_t **jwt, const char *token,
+				   jwt_key_t *key);
+
+/**
+ * Verify a JWT with the current key of a keyring and allocate a new JWT
+ * object.
+ *
+ * Works like jwt_decode_with_key(), with the key the keyring held when
+ * the call was made. A rotation meanwhile does not affect it.
+ *
+ * @param jwt Pointer to a JWT object pointer. Will be allocated on
+ *     success.
+ * @param token Pointer to a valid JWT string, nul terminated.
+ * @param ring Pointer to a keyring.
+ * @return 0 on success, EINVAL if the keyring is empty, or valid errno
+ *     otherwise.
+ */
+JWT_EXPORT int jwt_decode_keyring(jwt_t **jwt, const char *token,
+				  jwt_keyring_t *ring);
+
+/**
+ * Verify a JWT with the key a key set holds for it and allocate a new
+ * JWT object.
+ *
+ * The key is looked up by the kid in the JWT's header, or among the keys
+ * without a kid if it has none, and must suit the header's alg. Keys
+ * loaded from a JWK that named an alg are only used with that alg.
+ *
+ * @param jwt Pointer to a JWT object pointer. Will be allocated on
+ *     success.
+ * @param token Pointer to a valid JWT string, nul terminated.
+ * @param set Pointer to a key set.
+ * @return 0 on success, EINVAL if the set has no key for the JWT, or
+ *     valid errno otherwise.
+ */
+JWT_EXPORT int jwt_decode_keyset(jwt_t **jwt, const char *token,
+				 jwt_keyset_t *set);
+
+/**
+ * Verify a batch of tokens with one prepared key and allocate a new JWT
+ * object for each.
+ *
+ * Each token is handled as by jwt_decode_with_key(). The key is set up
+ * once for the whole batch rather than once per token.
+ * With an HMAC key, the signatures of the whole batch are checked
+ * together as by jwt_verify_batch() before any claims are parsed.
+ *
+ * @param jwts Array of count JWT object pointers. Each one is allocated
+ *     if its token verified, and set to NULL otherwise.
+ * @param tokens Array of count JWT strings, nul terminated.
+ * @param results Array of count ints, set to 0 for each token that
+ *     verified, or to a valid errno for each one that did not.
+ * @param count Number of tokens.
+ * @param key Pointer to a prepared key.
+ * @return 0 if every token verified, EINVAL if an argument is NULL, or
+ *     the error of the first token that failed.
+ */
+JWT_EXPORT int jwt_decode_batch(jwt_t **jwts, const char **tokens,
+				int *results, unsigned int count,
+				jwt_key_t *key);
+
+/**
+ * Check the signatures of a batch of tokens with one prepared key.
+ *
+ * Like jwt_decode_batch(), but no JWT objects are created and the claims
+ * are not parsed, only the header needed to check the signature. Use it
+ * when only the signature matters, for example to filter out forged
+ * tokens before decoding the rest. HMAC signatures are checked all at
+ * once, as jwt_encode_batch() makes them.
+ *
+ * @param tokens Array of count JWT strings, nul terminated.
+ * @param results Array of count ints, set to 0 for each token that
+ *     verified, or to a valid errno for each one that did not.
+ * @param count Number of tokens.
+ * @param key Pointer to a prepared key.
+ * @return 0 if every token verified, EINVAL if an argument is NULL, or
+ *     the error of the first token that failed.
+ */
+JWT_EXPORT int jwt_verify_batch(const char **tokens, int *results,
+				unsigned int count, jwt_key_t *key);
+
 /**
  * Free a JWT object and any other resources it is using.
  *
@@ -554,6 +714,30 @@ JWT_EXPORT int jwt_encode_fp(jwt_t *jwt, FILE *fp);
  */
 JWT_EXPORT char *jwt_encode_str(jwt_t *jwt);
 
+/**
+ * Encode a batch of JWT objects, all signed with one prepared key.
+ *
+ * Each JWT is first given the key and its algorithm as by
+ * jwt_set_alg_key(), then encoded as by jwt_encode_str(). HS256, HS384
+ * and HS512 tokens are signed all at once by a built in HMAC that hashes
+ * several tokens side by side with the vector units of the CPU, which is
+ * several times faster than signing them one at a time. Only a provider
+ * set with jwt_set_crypto_provider() for the algorithm takes precedence
+ * over it. Other algorithms are signed one token at a time.
+ *
+ * @param jwts Array of count pointers to JWT objects.
+ * @param tokens Array of count string pointers. Each one is set to the
+ *     token, to be freed with jwt_free_str(), or to NULL on error.
+ * @param results Array of count ints, set to 0 for each JWT that was
+ *     encoded, or to a valid errno for each one that was not.
+ * @param count Number of JWT objects.
+ * @param key Pointer to a prepared key.
+ * @return 0 if every JWT was encoded, EINVAL if an argument is NULL, or
+ *     the error of the first JWT that failed.
+ */
+JWT_EXPORT int jwt_encode_batch(jwt_t **jwts, char **tokens, int *results,
+				unsigned int count, jwt_key_t *key);
+
 /**
  * Free a string returned from the library.
  *
@@ -564,6 +748,76 @@ JWT_EXPORT void jwt_free_str(char *str);
 
 /** @} */
 
+/**
+ * @defgroup jwt_b64url JWT Base64url Functions
+ * Encode and decode base64url the way tokens use it.
+ *
+ * These are the same routines that encode and decode the parts of a
+ * token, for applications that need base64url for anything else, such
+ * as cookies and nonces. Output is the URL safe alphabet of RFC 4648,
+ * without padding. Decoding is strict: padding, characters outside the
+ * URL safe alphabet and leftover bits that are not zero are all refused,
+ * so any given data has exactly one encoding that decodes.
+ *
+ * Input is taken as a pointer and a length and need not be nul
+ * terminated, output goes to a buffer of the caller's, and nothing is
+ * allocated.
+ * @{
+ */
+
+/**
+ * Length of the base64url encoding of some data.
+ *
+ * @param len Length of the data in bytes.
+ * @return The number of characters jwt_b64url_encode_into() writes for
+ *     it, not counting a nul.
+ */
+JWT_EXPORT size_t jwt_b64url_encoded_len(size_t len);
+
+/**
+ * Length of the data a base64url string decodes to.
+ *
+ * @param len Length of the string in characters.
+ * @return The number of bytes jwt_b64url_decode_into() writes if the
+ *     string is valid.
+ */
+JWT_EXPORT size_t jwt_b64url_decoded_len(size_t len);
+
+/**
+ * Encode data as base64url.
+ *
+ * A nul is written after the encoding if dst has room for it.
+ *
+ * @param dst Buffer for the encoding.
+ * @param dst_len Size of dst, at least jwt_b64url_encoded_len(src_len).
+ * @param src Data to encode.
+ * @param src_len Length of src in bytes.
+ * @param out_len If not NULL, set to the length of the encoding.
+ * @return 0 on success, ENOSPC if dst is too small, valid errno
+ *     otherwise.
+ */
+JWT_EXPORT int jwt_b64url_encode_into(char *dst, size_t dst_len,
+				      const void *src, size_t src_len,
+				      size_t *out_len);
+
+/**
+ * Decode a base64url string.
+ *
+ * @param dst Buffer for the decoded data.
+ * @param dst_len Size of dst, at least jwt_b64url_decoded_len(src_len).
+ * @param src String to decode, which need not be nul terminated.
+ * @param src_len Length of src in characters.
+ * @param out_len If not NULL, set to the length of the decoded data.
+ * @return 0 on success, EINVAL if src is not canonical base64url, ENOSPC
+ *     if dst is too small, valid errno otherwise. dst may have been
+ *     written to on error.
+ */
+JWT_EXPORT int jwt_b64url_decode_into(void *dst, size_t dst_len,
+				      const char *src, size_t src_len,
+				      size_t *out_len);
+
+/** @} */
+
 /**
  * @defgroup jwt_alg JWT Algorithm Functions
  * Set and check algorithms and algorithm specific values.
@@ -581,7 +835,8 @@ JWT_EXPORT void jwt_free_str(char *str);
  * Specifies an algorithm for a JWT object. If JWT_ALG_NONE is used, then
  * key must be NULL and len must be 0. All other algorithms must have a
  * valid pointer to key data, which may be specific to the algorithm (e.g
- * RS256 expects a PEM formatted RSA key).
+ * RS256 expects a PEM or DER formatted RSA key). EdDSA takes either an Ed25519
+ * or an Ed448 key, and the key decides which curve is used.
  *
  * @param jwt Pointer to a JWT object.
  * @param alg A valid jwt_alg_t specifier.
@@ -627,6 +882,711 @@ JWT_EXPORT jwt_alg_t jwt_str_alg(const char *alg);
 
 /** @} */
 
+/**
+ * @defgroup jwt_key JWT Prepared Keys
+ * Parse a key once and share it between many JWT objects.
+ *
+ * A prepared key holds the key data already parsed by the crypto
+ * backend (e.g. an OpenSSL EVP_PKEY), so signing and verifying with it
+ * does not parse the PEM data again for every token. Prepared keys are
+ * reference counted and immutable once created, so a single key can be
+ * used from several threads at the same time.
+ * @{
+ */
+
+/**
+ * Allocate a new prepared key.
+ *
+ * The key data is copied and parsed immediately, so errors in the key
+ * are reported here instead of when a token is signed or verified. For
+ * RSA, EC and EdDSA algorithms, either a private or a public key in PEM
+ * or DER format may be passed. A public key can only be used for
+ * verifying.
+ *
+ * @param key Pointer to a key object pointer. Will be allocated on
+ *     success with a reference count of one.
+ * @param alg A valid jwt_alg_t specifier other than JWT_ALG_NONE.
+ * @param data The key data to use for the algorithm.
+ * @param len The length of the key data.
+ * @return 0 on success, valid errno otherwise.
+ */
+JWT_EXPORT int jwt_key_new(jwt_key_t **key, jwt_alg_t alg,
+			   const unsigned char *data, int len);
+
+/**
+ * Allocate a new prepared key from data in a given format.
+ *
+ * Works like jwt_key_new(), which is the same as passing
+ * JWT_KEY_FORMAT_AUTO. DER skips decoding the PEM armour, which adds up
+ * when loading many large keys.
+ *
+ * Raw keys can't be told apart from other data, so they must be asked
+ * for. For EC algorithms, a raw public key is a point as in SEC 1, and a
+ * raw private key is the big endian scalar. The alg picks the curve:
+ * P-256 for ES256, P-384 for ES384 and P-521 for ES512. For EdDSA, they
+ * are the keys of RFC 8032, 32 bytes for Ed25519 and 57 for Ed448. The
+ * GnuTLS backend can't take raw EC private keys. RSA keys have no raw
+ * format, and HMAC keys are always raw, whatever the format.
+ *
+ * @param key Pointer to a key object pointer. Will be allocated on
+ *     success with a reference count of one.
+ * @param alg A valid jwt_alg_t specifier other than JWT_ALG_NONE.
+ * @param format The format of the key data.
+ * @param data The key data to use for the algorithm.
+ * @param len The length of the key data.
+ * @return 0 on success, valid errno otherwise.
+ */
+JWT_EXPORT int jwt_key_new_format(jwt_key_t **key, jwt_alg_t alg,
+				  jwt_key_format_t format,
+				  const unsigned char *data, int len);
+
+/**
+ * Take a new reference to a prepared key.
+ *
+ * @param key Pointer to a key object.
+ * @return The same key, which must be released with jwt_key_free().
+ */
+JWT_EXPORT jwt_key_t *jwt_key_ref(jwt_key_t *key);
+
+/**
+ * Release a reference to a prepared key.
+ *
+ * When the last reference is dropped, the key material is scrubbed and
+ * the memory is freed. Copies other threads hold in cached crypto contexts
+ * are freed the next time each of those threads signs or verifies.
+ *
+ * @param key Pointer to a key object or NULL.
+ */
+JWT_EXPORT void jwt_key_free(jwt_key_t *key);
+
+/**
+ * Get the jwt_alg_t a prepared key was created for.
+ *
+ * @param key Pointer to a key object.
+ * @returns Returns a jwt_alg_t type for this key.
+ */
+JWT_EXPORT jwt_alg_t jwt_key_get_alg(jwt_key_t *key);
+
+/**
+ * Keep ECDSA signing nonces for a prepared key computed in advance.
+ *
+ * Most of the cost of an ECDSA signature does not depend on the message:
+ * picking the random nonce k, the point multiplication k*G and inverting
+ * k. With this turned on, a background thread owned by the key keeps up
+ * to depth of those ready, and signing a token with the key only has to
+ * do the few modular multiplications that involve the message. Each
+ * nonce is used for exactly one signature and wiped as soon as it has
+ * been taken. When they run out, signing falls back to the normal path,
+ * so tokens are never held up waiting for the thread.
+ *
+ * This can be called again to change the depth, and a depth of 0 stops
+ * the thread and wipes any nonces not yet used. Both also happen when the
+ * last reference to the key is released. Signing with the key may go on
+ * while this runs. A child of fork() starts with no nonces and no thread,
+ * so it never signs with one its parent may also use; it can call this
+ * again to get its own.
+ *
+ * @param key Pointer to a key object holding an EC private key.
+ * @param depth Number of nonces to keep ready, at most 4096.
+ * @return 0 on success, EINVAL if the key is not an EC private key,
+ *     ENOTSUP if the crypto backend cannot do this, or another errno.
+ */
+JWT_EXPORT int jwt_key_precompute(jwt_key_t *key, unsigned int depth);
+
+/**
+ * Set an algorithm and a prepared key for this JWT object.
+ *
+ * Works like jwt_set_alg(), but takes a reference to a key created with
+ * jwt_key_new() instead of copying raw key data. The alg must belong to
+ * the same family (HMAC, RSA, EC or EdDSA) as the key.
+ *
+ * @param jwt Pointer to a JWT object.
+ * @param alg A valid jwt_alg_t specifier.
+ * @param key Pointer to a key object. Must be NULL for JWT_ALG_NONE.
+ * @return Returns 0 on success, valid errno otherwise.
+ */
+JWT_EXPORT int jwt_set_alg_key(jwt_t *jwt, jwt_alg_t alg, jwt_key_t *key);
+
+/**
+ * Set the size of the process wide key cache.
+ *
+ * Keys passed as raw data to jwt_set_alg() and jwt_decode() are looked
+ * up in a process wide cache of prepared keys, so the same key bytes are
+ * only parsed once no matter how many tokens are signed or verified with
+ * them. The cache holds up to 16 keys by default and drops the least
+ * recently used key when full.
+ *
+ * Cached keys stay in memory after the JWT objects that used them are
+ * freed. Setting the size to 0 turns the cache off and scrubs every
+ * cached key that is not in use.
+ *
+ * @param size Maximum number of keys to keep, or 0 to turn the cache off.
+ * @return Returns 0 on success, valid errno otherwise.
+ */
+JWT_EXPORT int jwt_key_cache_set_size(unsigned int size);
+
+/**
+ * Drop all keys from the process wide key cache.
+ *
+ * Keys are scrubbed once they are no longer in use. The size of the
+ * cache and its statistics are not changed.
+ */
+JWT_EXPORT void jwt_key_cache_flush(void);
+
+/**
+ * Get statistics for the process wide key cache.
+ *
+ * @param stats Pointer to a structure to fill in.
+ */
+JWT_EXPORT void jwt_key_cache_get_stats(jwt_cache_stats_t *stats);
+
+/** @} */
+
+/**
+ * @defgroup jwt_keyring JWT Keyrings
+ * Rotate a key while other threads are using it.
+ *
+ * A keyring holds the current generation of a prepared key. Any number
+ * of threads can get the key from it without taking a lock, while
+ * another thread swaps in a new one. Each reader gets its own reference,
+ * so signing or verifying that is already under way finishes with the
+ * key it started with, and the old key is only scrubbed once the last
+ * of them is done.
+ * @{
+ */
+
+/**
+ * Allocate a new keyring.
+ *
+ * @param ring Pointer to a keyring pointer. Will be allocated on success.
+ * @param key Pointer to the first key, which the keyring takes a
+ *     reference to, or NULL to start empty.
+ * @return 0 on success, valid errno otherwise.
+ */
+JWT_EXPORT int jwt_keyring_new(jwt_keyring_t **ring, jwt_key_t *key);
+
+/**
+ * Free a keyring and drop its reference to the current key.
+ *
+ * No other thread may be using the keyring. Keys already handed out by
+ * jwt_keyring_get() remain valid.
+ *
+ * @param ring Pointer to a keyring or NULL.
+ */
+JWT_EXPORT void jwt_keyring_free(jwt_keyring_t *ring);
+
+/**
+ * Make key the current key of a keyring.
+ *
+ * Readers never wait for this. It returns once no reader can get the
+ * previous key from the keyring any more, which takes at most as long as
+ * a reader takes to get a key.
+ *
+ * @param ring Pointer to a keyring.
+ * @param key Pointer to the new key, which the keyring takes a reference
+ *     to, or NULL to empty the keyring.
+ * @return 0 on success, valid errno otherwise.
+ */
+JWT_EXPORT int jwt_keyring_set(jwt_keyring_t *ring, jwt_key_t *key);
+
+/**
+ * Get the current key of a keyring.
+ *
+ * This never blocks. To sign with it, pass it to jwt_set_alg_key().
+ *
+ * @param ring Pointer to a keyring.
+ * @return A reference to the key, which must be released with
+ *     jwt_key_free(), or NULL if the keyring is empty.
+ */
+JWT_EXPORT jwt_key_t *jwt_keyring_get(jwt_keyring_t *ring);
+
+/**
+ * Get the generation of a keyring.
+ *
+ * It goes up by one each time jwt_keyring_set() is called, so callers
+ * can tell whether a key they kept is still the current one.
+ *
+ * @param ring Pointer to a keyring.
+ * @return The generation, 0 for a keyring that never held a key.
+ */
+JWT_EXPORT unsigned long jwt_keyring_generation(jwt_keyring_t *ring);
+
+/** @} */
+
+/**
+ * @defgroup jwt_keyset JWT Key Sets
+ * Pick the key to verify a JWT with by its kid.
+ *
+ * A key set holds prepared keys indexed by key ID, usually loaded from
+ * the JSON Web Key Set (RFC 7517) an issuer publishes. RSA, EC (P-256,
+ * P-384 and P-521), OKP (Ed25519 and Ed448) and oct keys are supported.
+ * Finding a key takes the same time however many keys the set holds.
+ *
+ * A key set is not locked. Fill it before sharing it between threads,
+ * or put a new one in place when the issuer's keys change.
+ * @{
+ */
+
+/**
+ * Allocate a new, empty key set.
+ *
+ * @param set Pointer to a key set pointer. Will be allocated on success.
+ * @return 0 on success, valid errno otherwise.
+ */
+JWT_EXPORT int jwt_keyset_new(jwt_keyset_t **set);
+
+/**
+ * Free a key set and drop its references to its keys.
+ *
+ * @param set Pointer to a key set or NULL.
+ */
+JWT_EXPORT void jwt_keyset_free(jwt_keyset_t *set);
+
+/**
+ * Add a prepared key to a key set.
+ *
+ * The key is used with any alg it is compatible with. A key added with
+ * the same kid as an earlier one is found first.
+ *
+ * @param set Pointer to a key set.
+ * @param kid The key ID, or NULL for a key without one.
+ * @param key Pointer to the key, which the set takes a reference to.
+ * @return 0 on success, valid errno otherwise.
+ */
+JWT_EXPORT int jwt_keyset_add(jwt_keyset_t *set, const char *kid,
+			      jwt_key_t *key);
+
+/**
+ * Add the keys of a JSON Web Key Set to a key set.
+ *
+ * Takes a JWK Set, {"keys":[...]}, or a single JWK. Each key is prepared
+ * with the alg its JWK names, or else with RS256 for RSA keys, ES256,
+ * ES384 or ES512 depending on the curve for EC keys, EdDSA for OKP keys
+ * and HS256 for oct keys. Keys that are not for signing, by their "use"
+ * or "crv", or that name an alg this library does not know, are
+ * skipped. Public and private keys are both accepted.
+ *
+ * Either all keys are added or, on error, none.
+ *
+ * @param set Pointer to a key set.
+ * @param jwks The JSON document, nul terminated.
+ * @return 0 on success, EINVAL if the document or a key in it is not
+ *     valid, or valid errno otherwise.
+ */
+JWT_EXPORT int jwt_keyset_load_jwks(jwt_keyset_t *set, const char *jwks);
+
+/**
+ * Get the number of keys in a key set.
+ *
+ * @param set Pointer to a key set.
+ * @return The number of keys.
+ */
+JWT_EXPORT unsigned int jwt_keyset_count(jwt_keyset_t *set);
+
+/**
+ * Find a key in a key set by its kid.
+ *
+ * @param set Pointer to a key set.
+ * @param kid The key ID, or NULL for a key without one.
+ * @return A reference to the key, which must be released with
+ *     jwt_key_free(), or NULL if there is none.
+ */
+JWT_EXPORT jwt_key_t *jwt_keyset_find(jwt_keyset_t *set, const char *kid);
+
+/** @} */
+
+/**
+ * @defgroup jwt_token_cache JWT Verified Token Cache
+ * Skip verifying tokens that were verified before.
+ *
+ * Clients tend to present the same bearer token over and over until it
+ * expires. With the token cache turned on, jwt_decode(),
+ * jwt_decode_with_key(), jwt_decode_keyring() and jwt_decode_batch()
+ * remember the header and claims of each token that verified, and the
+ * next time the exact same token comes with the same key they are
+ * copied from the cache, without checking the signature or parsing any
+ * JSON again.
+ *
+ * Tokens are looked up by an HMAC-SHA256 of the token under the key, so
+ * a token only ever matches the key it was verified with. A prepared key
+ * is told apart from every other key, even one with the same bytes.
+ * Tokens decoded with a key set, without a key, or that failed are not
+ * cached. An entry lasts until the token's exp, or the cache's time to
+ * live if that is sooner, and tokens with an exp that is not a number
+ * are not cached at all. Decoding never checked exp, nbf and so on, and
+ * still does not, that is left to jwt_valid_t as before.
+ *
+ * The cache is process wide, split into shards that are locked
+ * separately, and drops the least recently used token of a shard when
+ * that shard is full.
+ * @{
+ */
+
+/**
+ * Set the size of the process wide token cache.
+ *
+ * The cache is off until this is called. Any tokens already cached are
+ * dropped.
+ *
+ * @param size Maximum number of tokens to keep, or 0 to turn the cache
+ *     off.
+ * @return Returns 0 on success, valid errno otherwise.
+ */
+JWT_EXPORT int jwt_token_cache_set_size(unsigned int size);
+
+/**
+ * Set how long a token may stay in the token cache.
+ *
+ * A token never stays past its own exp. The default is 300 seconds. The
+ * new value only applies to tokens cached from now on.
+ *
+ * @param seconds Time to live, greater than 0.
+ * @return Returns 0 on success, valid errno otherwise.
+ */
+JWT_EXPORT int jwt_token_cache_set_ttl(unsigned int seconds);
+
+/**
+ * Drop all tokens from the process wide token cache.
+ *
+ * The size of the cache and its statistics are not changed.
+ */
+JWT_EXPORT void jwt_token_cache_flush(void);
+
+/**
+ * Get statistics for the process wide token cache.
+ *
+ * Tokens dropped because they expired count as evictions.
+ *
+ * @param stats Pointer to a structure to fill in.
+ */
+JWT_EXPORT void jwt_token_cache_get_stats(jwt_cache_stats_t *stats);
+
+/** @} */
+
+/**
+ * @defgroup jwt_reject_cache JWT Rejected Token Cache
+ * Turn away tokens that failed a moment ago without checking them again.
+ *
+ * A broken or hostile client may send the same bad token again and
+ * again, each time costing a full signature check. With the reject cache
+ * turned on, jwt_decode(), jwt_decode_with_key(), jwt_decode_keyring()
+ * and jwt_decode_batch() remember each token whose signature did not
+ * verify, and fail it with EINVAL straight away if it comes again with
+ * the same key before its time to live is up.
+ *
+ * Tokens are known by the same keyed hash as in the token cache, and
+ * only the hash is kept. As with that cache, tokens decoded with a key
+ * set or without a key are never looked for. Tokens that fail for any
+ * other reason are not kept: a malformed header is cheap to refuse, and
+ * a signature that could not be checked, say for lack of memory, is not
+ * known to be bad.
+ *
+ * The cache is process wide and of a fixed size. Each lookup compares
+ * only a handful of hashes, and when there is no room left the token
+ * that would expire first is dropped.
+ * @{
+ */
+
+/**
+ * Set the size of the process wide reject cache.
+ *
+ * The cache is off until this is called. Any tokens already cached are
+ * dropped.
+ *
+ * @param size Maximum number of tokens to keep, or 0 to turn the cache
+ *     off. Rounded up to fill whole sets.
+ * @return Returns 0 on success, valid errno otherwise.
+ */
+JWT_EXPORT int jwt_reject_cache_set_size(unsigned int size);
+
+/**
+ * Set how long a rejected token is remembered.
+ *
+ * The default is 10 seconds. The new value only applies to tokens
+ * rejected from now on.
+ *
+ * @param seconds Time to live, greater than 0.
+ * @return Returns 0 on success, valid errno otherwise.
+ */
+JWT_EXPORT int jwt_reject_cache_set_ttl(unsigned int seconds);
+
+/**
+ * Drop all tokens from the process wide reject cache.
+ *
+ * The size of the cache and its statistics are not changed.
+ */
+JWT_EXPORT void jwt_reject_cache_flush(void);
+
+/**
+ * Get statistics for the process wide reject cache.
+ *
+ * Hits are tokens refused from the cache. Tokens dropped for room, or
+ * found expired, count as evictions.
+ *
+ * @param stats Pointer to a structure to fill in.
+ */
+JWT_EXPORT void jwt_reject_cache_get_stats(jwt_cache_stats_t *stats);
+
+/** @} */
+
+/**
+ * @defgroup jwt_async JWT Worker Pools
+ * Sign and verify on other threads.
+ *
+ * Signing with a large RSA key takes milliseconds, which is far too long
+ * to block an event loop for. A worker pool runs jwt_encode_str() and
+ * jwt_decode_with_key() on threads of its own, and tells the submitting
+ * thread when each job is done in one of two ways:
+ *
+ * - A callback, called on the worker thread as soon as the job is done.
+ * - A file descriptor, see jwt_async_get_fd(), that is readable while
+ *   finished jobs wait to be picked up with jwt_async_next(). Add it to
+ *   epoll, poll or select along with the sockets.
+ *
+ * Jobs are started in the order they were submitted, but finish in any
+ * order if the pool has more than one thread. Submitting never blocks.
+ * @{
+ */
+
+/**
+ * Allocate a new worker pool and start its threads.
+ *
+ * @param pool Pointer to a pool pointer. Will be allocated on success.
+ * @param threads Number of worker threads, at most 256, or 0 for one per
+ *     CPU up to that many.
+ * @return 0 on success, valid errno otherwise.
+ */
+JWT_EXPORT int jwt_async_new(jwt_async_t **pool, unsigned int threads);
+
+/**
+ * Free a worker pool.
+ *
+ * Waits for every job already submitted to finish, calling its callback
+ * if it has one, then stops the threads. Finished jobs nobody picked up
+ * with jwt_async_next() are freed. No other thread may be submitting to
+ * the pool.
+ *
+ * @param pool Pointer to a pool or NULL.
+ */
+JWT_EXPORT void jwt_async_free(jwt_async_t *pool);
+
+/**
+ * Get the file descriptor that signals finished jobs.
+ *
+ * It is readable exactly while jwt_async_next() has a job to return.
+ * Only poll it, never read from it or close it. This is an eventfd on
+ * Linux and a pipe on other POSIX systems. Windows has none, so use
+ * callbacks there.
+ *
+ * @param pool Pointer to a pool.
+ * @return The descriptor, or -1 if there is none.
+ */
+JWT_EXPORT int jwt_async_get_fd(jwt_async_t *pool);
+
+/**
+ * Sign a JWT on a worker thread.
+ *
+ * The JWT is copied, so it may be changed or freed as soon as this
+ * returns. The token is made as jwt_encode_str() would, and is taken
+ * from the finished job with jwt_async_job_take_token().
+ *
+ * If cb is given, it is called on the worker thread with the finished
+ * job, which it then owns and must free with jwt_async_job_free().
+ * Otherwise the job is queued for jwt_async_next().
+ *
+ * @param pool Pointer to a pool.
+ * @param jwt Pointer to a JWT object with its alg and key set.
+ * @param cb Function to call when done, or NULL.
+ * @param data Passed to cb, and returned by jwt_async_job_data().
+ * @return 0 if the job was submitted, valid errno otherwise. Errors
+ *     signing are reported by jwt_async_job_result().
+ */
+JWT_EXPORT int jwt_async_encode(jwt_async_t *pool, jwt_t *jwt,
+				jwt_async_cb_t cb, void *data);
+
+/**
+ * Verify a JWT on a worker thread.
+ *
+ * The token is copied and the pool takes a reference to the key. The JWT
+ * is decoded as by jwt_decode_with_key(), and is taken from the finished
+ * job with jwt_async_job_take_jwt(). Completion is reported as for
+ * jwt_async_encode().
+ *
+ * @param pool Pointer to a pool.
+ * @param token Pointer to a JWT string, nul terminated.
+ * @param key Pointer to a prepared key, or NULL if no validation is to
+ *     be performed.
+ * @param cb Function to call when done, or NULL.
+ * @param data Passed to cb, and returned by jwt_async_job_data().
+ * @return 0 if the job was submitted, valid errno otherwise. Errors
+ *     verifying are reported by jwt_async_job_result().
+ */
+JWT_EXPORT int jwt_async_decode(jwt_async_t *pool, const char *token,
+				jwt_key_t *key, jwt_async_cb_t cb,
+				void *data);
+
+/**
+ * Pick up a finished job that has no callback.
+ *
+ * This never blocks. Call it until it returns NULL each time the pool's
+ * file descriptor is readable.
+ *
+ * @param pool Pointer to a pool.
+ * @return A finished job, which must be freed with jwt_async_job_free(),
+ *     or NULL if there is none right now.
+ */
+JWT_EXPORT jwt_async_job_t *jwt_async_next(jwt_async_t *pool);
+
+/**
+ * Get the outcome of a finished job.
+ *
+ * @param job Pointer to a finished job.
+ * @return 0 if the token was signed or verified, valid errno otherwise.
+ */
+JWT_EXPORT int jwt_async_job_result(jwt_async_job_t *job);
+
+/**
+ * Get the data a job was submitted with.
+ *
+ * @param job Pointer to a job.
+ * @return The data passed to jwt_async_encode() or jwt_async_decode().
+ */
+JWT_EXPORT void *jwt_async_job_data(jwt_async_job_t *job);
+
+/**
+ * Take the token made by a finished jwt_async_encode() job.
+ *
+ * @param job Pointer to a finished job.
+ * @return The token, which the caller must free with jwt_free_str(), or
+ *     NULL if signing failed, the job was a decode or the token was
+ *     already taken.
+ */
+JWT_EXPORT char *jwt_async_job_take_token(jwt_async_job_t *job);
+
+/**
+ * Take the JWT made by a finished jwt_async_decode() job.
+ *
+ * @param job Pointer to a finished job.
+ * @return The JWT object, which the caller must free with jwt_free(), or
+ *     NULL if verifying failed, the job was an encode or the JWT was
+ *     already taken.
+ */
+JWT_EXPORT jwt_t *jwt_async_job_take_jwt(jwt_async_job_t *job);
+
+/**
+ * Free a finished job and whatever was not taken from it.
+ *
+ * @param job Pointer to a finished job or NULL.
+ */
+JWT_EXPORT void jwt_async_job_free(jwt_async_job_t *job);
+
+/** @} */
+
+/**
+ * @defgroup jwt_init JWT Library Initialization
+ * Set up and tear down process wide crypto state.
+ *
+ * Calling these is optional. LibJWT sets up its crypto state the first
+ * time it is needed. With OpenSSL 3, this fetches the digests and MAC
+ * used by every supported algorithm once, instead of looking them up in
+ * the provider on every token.
+ * @{
+ */
+
+/**
+ * Initialize LibJWT's crypto state.
+ *
+ * This is only needed to do the setup at a known time, e.g. before
+ * starting threads. It is safe to call more than once.
+ *
+ * @return 0 on success, valid errno otherwise.
+ */
+JWT_EXPORT int jwt_init(void);
+
+/**
+ * Initialize LibJWT's crypto state within a crypto library context.
+ *
+ * With OpenSSL 3, libctx is an OSSL_LIB_CTX pointer. All algorithms
+ * and keys are then fetched from that context instead of the default
+ * one.
+ *
+ * This must not be called while other threads are using LibJWT. The
+ * prepared key cache is flushed, but keys from jwt_key_new() that were
+ * prepared before the call keep using the context they were created
+ * in, so this is best called before any key is created. The context
+ * must stay valid until jwt_shutdown() is called. If the algorithms
+ * can't be fetched from it, the context stays bound and signing and
+ * verifying fail, rather than falling back to the default context.
+ *
+ * @param libctx The crypto library context.
+ * @return 0 on success, EINVAL if libctx is NULL or the crypto backend
+ *     does not support library contexts, or valid errno otherwise.
+ */
+JWT_EXPORT int jwt_init_libctx(void *libctx);
+
+/**
+ * Release LibJWT's crypto state.
+ *
+ * This flushes the prepared key cache and drops the cached algorithm
+ * handles. It must not be called while other threads are using LibJWT.
+ * LibJWT can still be used afterwards, and will set itself up again.
+ */
+JWT_EXPORT void jwt_shutdown(void);
+
+/** @} */
+
+/**
+ * @defgroup jwt_crypto JWT Crypto Providers
+ * Choose what does the signing and verifying at runtime.
+ *
+ * Every crypto backend LibJWT was built with can be selected by name,
+ * and an application can install its own provider for any algorithm
+ * while the rest stay with the backend.
+ *
+ * Keys prepared before a change keep working. They are parsed again by
+ * the new provider when they are used. These functions must not be
+ * called while other threads are using LibJWT.
+ * @{
+ */
+
+/**
+ * Select the crypto backend used for algorithms that have no provider
+ * installed.
+ *
+ * @param name Backend name: "openssl", "gnutls" or "wincrypt".
+ * @return 0 on success, EINVAL if name is NULL, or ENOENT if LibJWT was
+ *     not built with that backend.
+ */
+JWT_EXPORT int jwt_set_crypto_backend(const char *name);
+
+/**
+ * Get the name of the crypto backend currently in use.
+ *
+ * @return Name of the backend, see jwt_set_crypto_backend().
+ */
+JWT_EXPORT const char *jwt_get_crypto_backend(void);
+
+/**
+ * Install a crypto provider for one algorithm.
+ *
+ * Signatures are passed to and from the provider in their JWS form, e.g.
+ * r||s for ECDSA. The provider must stay valid until it is replaced and
+ * every key prepared with it has been freed.
+ *
+ * Only EINVAL from verify() marks a token as forged, which the reject
+ * cache remembers. Any other error, such as ENOMEM, is passed on to the
+ * caller as is.
+ *
+ * @param alg The algorithm, other than JWT_ALG_NONE.
+ * @param provider The provider, or NULL to go back to the backend.
+ * @return 0 on success, EINVAL if alg is not supported or provider has
+ *     no sign or verify function.
+ */
+JWT_EXPORT int jwt_set_crypto_provider(jwt_alg_t alg,
+				       const jwt_crypto_provider_t *provider);
+
+/** @} */
+
 /**
  * @defgroup jwt_memory JWT memory functions
  * These functions allow you to get or set memory allocation functions.
@@ -0,0 +1,470 @@
+/* Copyright (C) 2015-2018 Ben Collins <ben@cyphre.com>
+   This file is part of the JWT C Library
+
+   This Source Code Form is subject to the terms of the Mozilla Public
+   License, v. 2.0. If a copy of the MPL was not distributed with this
+   file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <fcntl.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+#endif
+
+#include <jwt.h>
+
+#include "jwt-private.h"
+#include "config.h"
+
+/* A pool of worker threads that sign and verify on behalf of threads
+ * that must not block, such as event loops. Jobs wait in a FIFO for a
+ * worker. Finished ones are either handed to the job's callback on the
+ * worker, or put on a second FIFO that the owner drains with
+ * jwt_async_next(), woken up by a file descriptor it can poll.
+ *
+ * The descriptor is an eventfd on Linux and a pipe on other POSIX
+ * systems. It is written and drained with the lock held, so it is
+ * readable exactly while the done FIFO is not empty. */
+
+#define JWT_ASYNC_MAX_THREADS	256
+
+enum jwt_async_op {
+	JWT_ASYNC_ENCODE,
+	JWT_ASYNC_DECODE,
+};
+
+struct jwt_async_job {
+	enum jwt_async_op op;
+	jwt_async_cb_t cb;
+	void *data;
+	int result;
+
+	/* Encode takes a copy of the JWT and gives back a token, decode
+	 * the other way around. */
+	jwt_t *jwt;
+	char *token;
+	jwt_key_t *key;
+
+	struct jwt_async_job *next;
+};
+
+struct job_fifo {
+	jwt_async_job_t *head;
+	jwt_async_job_t **tail;
+};
+
+struct jwt_async {
+	jwt_mutex_t lock;
+	/* Signalled when a job is queued or the workers should stop. */
+	jwt_cond_t cond;
+	int stop;
+
+	struct job_fifo queue;
+	struct job_fifo done;
+
+	/* fds[0] is polled, fds[1] written. The same for an eventfd. */
+	int fds[2];
+
+	unsigned int nthreads;
+	jwt_thread_t threads[];
+};
+
+static void fifo_init(struct job_fifo *fifo)
+{
+	fifo->head = NULL;
+	fifo->tail = &fifo->head;
+}
+
+static void fifo_push(struct job_fifo *fifo, jwt_async_job_t *job)
+{
+	job->next = NULL;
+	*fifo->tail = job;
+	fifo->tail = &job->next;
+}
+
+static jwt_async_job_t *fifo_pop(struct job_fifo *fifo)
+{
+	jwt_async_job_t *job = fifo->head;
+
+	if (job == NULL)
+		return NULL;
+
+	fifo->head = job->next;
+	if (fifo->head == NULL)
+		fifo->tail = &fifo->head;
+
+	return job;
+}
+
+#ifdef _WIN32
+
+/* No pollable descriptor, use callbacks or poll jwt_async_next(). */
+static int notify_open(jwt_async_t *pool)
+{
+	pool->fds[0] = pool->fds[1] = -1;
+
+	return 0;
+}
+
+static void notify_close(jwt_async_t *pool)
+{
+}
+
+static void notify_raise(jwt_async_t *pool)
+{
+}
+
+static void notify_clear(jwt_async_t *pool)
+{
+}
+
+#else
+
+static int notify_open(jwt_async_t *pool)
+{
+#ifdef __linux__
+	pool->fds[0] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (pool->fds[0] < 0)
+		return errno;
+
+	pool->fds[1] = pool->fds[0];
+#else
+	int i;
+
+	if (pipe(pool->fds))
+		return errno;
+
+	for (i = 0; i < 2; i++) {
+		if (fcntl(pool->fds[i], F_SETFL, O_NONBLOCK) ||
+		    fcntl(pool->fds[i], F_SETFD, FD_CLOEXEC)) {
+			close(pool->fds[0]);
+			close(pool->fds[1]);
+			return errno;
+		}
+	}
+#endif
+
+	return 0;
+}
+
+static void notify_close(jwt_async_t *pool)
+{
+	close(pool->fds[0]);
+	if (pool->fds[1] != pool->fds[0])
+		close(pool->fds[1]);
+}
+
+/* Called with the lock held when the done FIFO stops being empty. */
+static void notify_raise(jwt_async_t *pool)
+{
+#ifdef __linux__
+	uint64_t one = 1;
+
+	/* This only fails if the descriptor is readable already, which is
+	 * all that matters. */
+	if (write(pool->fds[1], &one, sizeof(one)) < 0)
+		return;
+#else
+	if (write(pool->fds[1], "", 1) < 0)
+		return;
+#endif
+}
+
+/* Called with the lock held when the done FIFO becomes empty. */
+static void notify_clear(jwt_async_t *pool)
+{
+	char buf[64];
+
+	while (read(pool->fds[0], buf, sizeof(buf)) > 0)
+		;
+}
+
+#endif
+
+static void job_run(jwt_async_job_t *job)
+{
+	jwt_t *jwt = NULL;
+
+	switch (job->op) {
+	case JWT_ASYNC_ENCODE:
+		job->token = jwt_encode_str(job->jwt);
+		job->result = job->token ? 0 : errno;
+		jwt_free(job->jwt);
+		job->jwt = NULL;
+		break;
+
+	case JWT_ASYNC_DECODE:
+		job->result = jwt_decode_with_key(&jwt, job->token, job->key);
+		job->jwt = jwt;
+		jwt_free_str(job->token);
+		job->token = NULL;
+		break;
+	}
+
+	jwt_key_free(job->key);
+	job->key = NULL;
+}
+
+static void worker_main(void *arg)
+{
+	jwt_async_t *pool = arg;
+	jwt_async_job_t *job;
+
+	jwt_mutex_lock(&pool->lock);
+	for (;;) {
+		job = fifo_pop(&pool->queue);
+		if (job == NULL) {
+			/* Queued jobs are finished before stopping. */
+			if (pool->stop)
+				break;
+			jwt_cond_wait(&pool->cond, &pool->lock);
+			continue;
+		}
+		jwt_mutex_unlock(&pool->lock);
+
+		job_run(job);
+
+		if (job->cb) {
+			job->cb(job, job->data);
+			jwt_mutex_lock(&pool->lock);
+			continue;
+		}
+
+		jwt_mutex_lock(&pool->lock);
+		if (pool->done.head == NULL)
+			notify_raise(pool);
+		fifo_push(&pool->done, job);
+	}
+	jwt_mutex_unlock(&pool->lock);
+}
+
+static void jwt_async_stop(jwt_async_t *pool)
+{
+	unsigned int i;
+
+	jwt_mutex_lock(&pool->lock);
+	pool->stop = 1;
+	jwt_cond_broadcast(&pool->cond);
+	jwt_mutex_unlock(&pool->lock);
+
+	for (i = 0; i < pool->nthreads; i++)
+		jwt_thread_join(pool->threads[i]);
+}
+
+int jwt_async_new(jwt_async_t **pool, unsigned int threads)
+{
+	jwt_async_t *new;
+	int ret;
+
+	if (!pool)
+		return EINVAL;
+
+	*pool = NULL;
+
+	if (threads > JWT_ASYNC_MAX_THREADS)
+		return EINVAL;
+
+	/* The default is capped rather than refused on very large hosts. */
+	if (threads == 0) {
+		threads = jwt_thread_cpus();
+		if (threads > JWT_ASYNC_MAX_THREADS)
+			threads = JWT_ASYNC_MAX_THREADS;
+	}
+
+	new = jwt_malloc(sizeof(*new) + threads * sizeof(new->threads[0]));
+	if (!new)
+		return ENOMEM;
+
+	memset(new, 0, sizeof(*new));
+	jwt_mutex_init(&new->lock);
+	jwt_cond_init(&new->cond);
+	fifo_init(&new->queue);
+	fifo_init(&new->done);
+
+	ret = notify_open(new);
+	if (ret) {
+		jwt_cond_destroy(&new->cond);
+		jwt_mutex_destroy(&new->lock);
+		jwt_freemem(new);
+		return ret;
+	}
+
+	for (; new->nthreads < threads; new->nthreads++) {
+		ret = jwt_thread_start(&new->threads[new->nthreads],
+				       worker_main, new);
+		if (ret) {
+			jwt_async_free(new);
+			return ret;
+		}
+	}
+
+	*pool = new;
+
+	return 0;
+}
+
+void jwt_async_free(jwt_async_t *pool)
+{
+	jwt_async_job_t *job;
+
+	if (!pool)
+		return;
+
+	jwt_async_stop(pool);
+
+	while ((job = fifo_pop(&pool->done)) != NULL)
+		jwt_async_job_free(job);
+
+	notify_close(pool);
+	jwt_cond_destroy(&pool->cond);
+	jwt_mutex_destroy(&pool->lock);
+
+	jwt_freemem(pool);
+}
+
+int jwt_async_get_fd(jwt_async_t *pool)
+{
+	return pool ? pool->fds[0] : -1;
+}
+
+static void jwt_async_queue(jwt_async_t *pool, jwt_async_job_t *job)
+{
+	jwt_mutex_lock(&pool->lock);
+	fifo_push(&pool->queue, job);
+	jwt_cond_signal(&pool->cond);
+	jwt_mutex_unlock(&pool->lock);
+}
+
+static jwt_async_job_t *job_new(enum jwt_async_op op, jwt_async_cb_t cb,
+				void *data)
+{
+	jwt_async_job_t *job;
+
+	job = jwt_malloc(sizeof(*job));
+	if (!job)
+		return NULL;
+
+	memset(job, 0, sizeof(*job));
+	job->op = op;
+	job->cb = cb;
+	job->data = data;
+
+	return job;
+}
+
+int jwt_async_encode(jwt_async_t *pool, jwt_t *jwt, jwt_async_cb_t cb,
+		     void *data)
+{
+	jwt_async_job_t *job;
+
+	if (!pool || !jwt)
+		return EINVAL;
+
+	job = job_new(JWT_ASYNC_ENCODE, cb, data);
+	if (!job)
+		return ENOMEM;
+
+	job->jwt = jwt_dup(jwt);
+	if (!job->jwt) {
+		jwt_freemem(job);
+		return ENOMEM;
+	}
+
+	jwt_async_queue(pool, job);
+
+	return 0;
+}
+
+int jwt_async_decode(jwt_async_t *pool, const char *token, jwt_key_t *key,
+		     jwt_async_cb_t cb, void *data)
+{
+	jwt_async_job_t *job;
+
+	if (!pool || !token)
+		return EINVAL;
+
+	job = job_new(JWT_ASYNC_DECODE, cb, data);
+	if (!job)
+		return ENOMEM;
+
+	job->token = jwt_strdup(token);
+	if (!job->token) {
+		jwt_freemem(job);
+		return ENOMEM;
+	}
+
+	job->key = jwt_key_ref(key);
+
+	jwt_async_queue(pool, job);
+
+	return 0;
+}
+
+jwt_async_job_t *jwt_async_next(jwt_async_t *pool)
+{
+	jwt_async_job_t *job;
+
+	if (!pool)
+		return NULL;
+
+	jwt_mutex_lock(&pool->lock);
+	job = fifo_pop(&pool->done);
+	if (job && pool->done.head == NULL)
+		notify_clear(pool);
+	jwt_mutex_unlock(&pool->lock);
+
+	return job;
+}
+
+int jwt_async_job_result(jwt_async_job_t *job)
+{
+	return job ? job->result : EINVAL;
+}
+
+void *jwt_async_job_data(jwt_async_job_t *job)
+{
+	return job ? job->data : NULL;
+}
+
+char *jwt_async_job_take_token(jwt_async_job_t *job)
+{
+	char *token;
+
+	if (!job || job->op != JWT_ASYNC_ENCODE)
+		return NULL;
+
+	token = job->token;
+	job->token = NULL;
+
+	return token;
+}
+
+jwt_t *jwt_async_job_take_jwt(jwt_async_job_t *job)
+{
+	jwt_t *jwt;
+
+	if (!job || job->op != JWT_ASYNC_DECODE)
+		return NULL;
+
+	jwt = job->jwt;
+	job->jwt = NULL;
+
+	return jwt;
+}
+
+void jwt_async_job_free(jwt_async_job_t *job)
+{
+	if (!job)
+		return;
+
+	jwt_free(job->jwt);
+	jwt_free_str(job->token);
+	jwt_key_free(job->key);
+	jwt_freemem(job);
+}
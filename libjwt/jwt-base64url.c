@@ -0,0 +1,540 @@
+/* Copyright (C) 2015-2018 Ben Collins <ben@cyphre.com>
+   This file is part of the JWT C Library
+
+   This Source Code Form is subject to the terms of the Mozilla Public
+   License, v. 2.0. If a copy of the MPL was not distributed with this
+   file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+
+#include <jwt.h>
+
+#include "jwt-private.h"
+#include "config.h"
+
+/* Base64url as JWS wants it: the URL safe alphabet, no padding, and no
+ * leftover bits. Decoding is strict, anything else is an error, so there
+ * is only ever one encoding of a given header, payload or signature.
+ *
+ * Large segments go through vector kernels, 16, 32 or 64 characters at
+ * a time with SSSE3, AVX2 and AVX-512 VBMI, picked at run time. They
+ * only take whole blocks, and what is left, including the last few
+ * characters that need the canonical checks, goes through the table
+ * driven scalar code, which also does everything on other CPUs. */
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define JWT_B64_X86
+#include <immintrin.h>
+#endif
+
+#define XX	0x80
+
+/* Value of each character, or XX if it is not in the alphabet. */
+static const unsigned char b64uri_values[256] = {
+	XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+	XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+	XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, 62, XX, XX,
+	52, 53, 54, 55, 56, 57, 58, 59, 60, 61, XX, XX, XX, XX, XX, XX,
+	XX,  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14,
+	15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, XX, XX, XX, XX, 63,
+	XX, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40,
+	41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, XX, XX, XX, XX, XX,
+	XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+	XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+	XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+	XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+	XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+	XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+	XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+	XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+};
+
+#undef XX
+
+static const char b64uri_alphabet[65] =
+	"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+
+/* The kernels decode whole blocks from *src and advance *src and *dst
+ * past what they did. Most of them store more than they decode, so they
+ * stop while enough input is left for the extra bytes to land in what
+ * its output will be anyway. They return -1 on a character that is not
+ * in the alphabet. */
+typedef int (*b64uri_decoder_t)(unsigned char **dst,
+			       const unsigned char **src,
+			       const unsigned char *end);
+
+#ifdef JWT_B64_X86
+/* Each character is classified by its high and low nibbles, and is valid
+ * if no class bit is set in both. The offset to its value only depends
+ * on the high nibble, except for '_'. */
+__attribute__((target("ssse3")))
+static int b64uri_decode_ssse3(unsigned char **dst,
+			       const unsigned char **src,
+			       const unsigned char *end)
+{
+	const __m128i lut_lo = _mm_setr_epi8(
+		0x25, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21,
+		0x21, 0x21, 0x23, 0x3b, 0x3b, 0x3a, 0x3b, 0x33);
+	const __m128i lut_hi = _mm_setr_epi8(
+		0x20, 0x20, 0x01, 0x02, 0x04, 0x08, 0x04, 0x10,
+		0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20);
+	const __m128i lut_off = _mm_setr_epi8(
+		0, 0, 17, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+	const __m128i pack = _mm_setr_epi8(
+		2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+	const __m128i nibble = _mm_set1_epi8(0x0f);
+	const __m128i zero = _mm_setzero_si128();
+	const unsigned char *s = *src;
+	unsigned char *d = *dst;
+	__m128i in, hi, lo, v;
+
+	/* 16 bytes are stored for every 12 decoded. */
+	while (end - s >= 24) {
+		in = _mm_loadu_si128((const __m128i *)s);
+		hi = _mm_and_si128(_mm_srli_epi32(in, 4), nibble);
+		lo = _mm_and_si128(in, nibble);
+
+		v = _mm_and_si128(_mm_shuffle_epi8(lut_lo, lo),
+				  _mm_shuffle_epi8(lut_hi, hi));
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(v, zero)) != 0xffff)
+			return -1;
+
+		v = _mm_shuffle_epi8(lut_off, hi);
+		v = _mm_add_epi8(v, _mm_and_si128(
+			_mm_cmpeq_epi8(in, _mm_set1_epi8('_')),
+			_mm_set1_epi8(33)));
+		v = _mm_add_epi8(in, v);
+
+		/* Four 6 bit values to three bytes, in order. */
+		v = _mm_maddubs_epi16(v, _mm_set1_epi32(0x01400140));
+		v = _mm_madd_epi16(v, _mm_set1_epi32(0x00011000));
+		v = _mm_shuffle_epi8(v, pack);
+
+		_mm_storeu_si128((__m128i *)d, v);
+		s += 16;
+		d += 12;
+	}
+
+	*src = s;
+	*dst = d;
+
+	return 0;
+}
+
+/* As above, with each 128 bit lane packed on its own and the two joined
+ * up after. */
+__attribute__((target("avx2")))
+static int b64uri_decode_avx2(unsigned char **dst,
+			      const unsigned char **src,
+			      const unsigned char *end)
+{
+	const __m256i lut_lo = _mm256_setr_epi8(
+		0x25, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21,
+		0x21, 0x21, 0x23, 0x3b, 0x3b, 0x3a, 0x3b, 0x33,
+		0x25, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21,
+		0x21, 0x21, 0x23, 0x3b, 0x3b, 0x3a, 0x3b, 0x33);
+	const __m256i lut_hi = _mm256_setr_epi8(
+		0x20, 0x20, 0x01, 0x02, 0x04, 0x08, 0x04, 0x10,
+		0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+		0x20, 0x20, 0x01, 0x02, 0x04, 0x08, 0x04, 0x10,
+		0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20);
+	const __m256i lut_off = _mm256_setr_epi8(
+		0, 0, 17, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0,
+		0, 0, 17, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+	const __m256i pack = _mm256_setr_epi8(
+		2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+		2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+	const __m256i join = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7);
+	const __m256i nibble = _mm256_set1_epi8(0x0f);
+	const __m256i zero = _mm256_setzero_si256();
+	const unsigned char *s = *src;
+	unsigned char *d = *dst;
+	__m256i in, hi, lo, v;
+
+	/* 32 bytes are stored for every 24 decoded. */
+	while (end - s >= 44) {
+		in = _mm256_loadu_si256((const __m256i *)s);
+		hi = _mm256_and_si256(_mm256_srli_epi32(in, 4), nibble);
+		lo = _mm256_and_si256(in, nibble);
+
+		v = _mm256_and_si256(_mm256_shuffle_epi8(lut_lo, lo),
+				     _mm256_shuffle_epi8(lut_hi, hi));
+		if ((unsigned int)_mm256_movemask_epi8(
+			    _mm256_cmpeq_epi8(v, zero)) != 0xffffffffU)
+			return -1;
+
+		v = _mm256_shuffle_epi8(lut_off, hi);
+		v = _mm256_add_epi8(v, _mm256_and_si256(
+			_mm256_cmpeq_epi8(in, _mm256_set1_epi8('_')),
+			_mm256_set1_epi8(33)));
+		v = _mm256_add_epi8(in, v);
+
+		v = _mm256_maddubs_epi16(v, _mm256_set1_epi32(0x01400140));
+		v = _mm256_madd_epi16(v, _mm256_set1_epi32(0x00011000));
+		v = _mm256_shuffle_epi8(v, pack);
+		v = _mm256_permutevar8x32_epi32(v, join);
+
+		_mm256_storeu_si256((__m256i *)d, v);
+		s += 32;
+		d += 24;
+	}
+
+	*src = s;
+	*dst = d;
+
+	return 0;
+}
+
+/* Byte order of the 48 decoded bytes among the 64 after merging. */
+static const unsigned char b64uri_pack512[64] = {
+	 2,  1,  0,  6,  5,  4, 10,  9,  8, 14, 13, 12,
+	18, 17, 16, 22, 21, 20, 26, 25, 24, 30, 29, 28,
+	34, 33, 32, 38, 37, 36, 42, 41, 40, 46, 45, 44,
+	50, 49, 48, 54, 53, 52, 58, 57, 56, 62, 61, 60,
+};
+
+/* With VBMI the whole table for 7 bit characters fits in two registers,
+ * so each character is looked up directly, and a masked store means
+ * nothing is written past the decoded bytes. */
+__attribute__((target("avx512f,avx512bw,avx512vbmi")))
+static int b64uri_decode_vbmi(unsigned char **dst,
+			      const unsigned char **src,
+			      const unsigned char *end)
+{
+	const __m512i lut0 = _mm512_loadu_si512(b64uri_values);
+	const __m512i lut1 = _mm512_loadu_si512(b64uri_values + 64);
+	const __m512i pack = _mm512_loadu_si512(b64uri_pack512);
+	const __m512i high = _mm512_set1_epi8((char)0x80);
+	const unsigned char *s = *src;
+	unsigned char *d = *dst;
+	__m512i in, v;
+
+	while (end - s >= 64) {
+		in = _mm512_loadu_si512(s);
+		v = _mm512_permutex2var_epi8(lut0, in, lut1);
+
+		/* Out of the alphabet, or not 7 bit to start with. */
+		if (_mm512_test_epi8_mask(_mm512_or_si512(v, in), high))
+			return -1;
+
+		v = _mm512_maddubs_epi16(v, _mm512_set1_epi32(0x01400140));
+		v = _mm512_madd_epi16(v, _mm512_set1_epi32(0x00011000));
+		v = _mm512_permutexvar_epi8(pack, v);
+
+		_mm512_mask_storeu_epi8(d, 0xffffffffffffULL, v);
+		s += 64;
+		d += 48;
+	}
+
+	*src = s;
+	*dst = d;
+
+	return 0;
+}
+#endif
+
+static b64uri_decoder_t b64uri_decode_kernel(void)
+{
+#ifdef JWT_B64_X86
+	if (__builtin_cpu_supports("avx512vbmi") &&
+	    __builtin_cpu_supports("avx512bw"))
+		return b64uri_decode_vbmi;
+	if (__builtin_cpu_supports("avx2"))
+		return b64uri_decode_avx2;
+	if (__builtin_cpu_supports("ssse3"))
+		return b64uri_decode_ssse3;
+#endif
+	return NULL;
+}
+
+/* Shortest input worth starting a kernel for. */
+#define B64URI_KERNEL_MIN	24
+
+/* Decode len characters of s into dst, which has room for them. Returns
+ * -1 if they are not canonical base64url. */
+static int b64uri_decode(unsigned char *d, const unsigned char *s, size_t len)
+{
+	const unsigned char *end = s + len;
+	b64uri_decoder_t kernel;
+	unsigned int a, b, c, e;
+
+	/* One character left over is less than a byte. */
+	if (len % 4 == 1)
+		return -1;
+
+	if (len >= B64URI_KERNEL_MIN && (kernel = b64uri_decode_kernel())) {
+		if (kernel(&d, &s, end))
+			return -1;
+	}
+
+	for (; end - s >= 4; s += 4) {
+		a = b64uri_values[s[0]];
+		b = b64uri_values[s[1]];
+		c = b64uri_values[s[2]];
+		e = b64uri_values[s[3]];
+		if ((a | b | c | e) & 0x80)
+			return -1;
+
+		*d++ = a << 2 | b >> 4;
+		*d++ = b << 4 | c >> 2;
+		*d++ = c << 6 | e;
+	}
+
+	if (s == end)
+		return 0;
+
+	a = b64uri_values[s[0]];
+	b = b64uri_values[s[1]];
+	c = end - s == 3 ? b64uri_values[s[2]] : 0;
+	if ((a | b | c) & 0x80)
+		return -1;
+
+	/* Leftover bits that are not zero mean the segment is not the
+	 * canonical encoding of anything. */
+	*d++ = a << 2 | b >> 4;
+	if (end - s == 3) {
+		if (c & 0x03)
+			return -1;
+		*d++ = b << 4 | c >> 2;
+	} else if (b & 0x0f) {
+		return -1;
+	}
+
+	return 0;
+}
+
+size_t jwt_b64url_decoded_len(size_t len)
+{
+	return len / 4 * 3 + (len % 4 > 1 ? len % 4 - 1 : 0);
+}
+
+int jwt_b64url_decode_into(void *dst, size_t dst_len, const char *src,
+			   size_t src_len, size_t *out_len)
+{
+	size_t len = jwt_b64url_decoded_len(src_len);
+
+	if ((!dst && dst_len) || (!src && src_len) || src_len % 4 == 1)
+		return EINVAL;
+
+	if (dst_len < len)
+		return ENOSPC;
+
+	if (b64uri_decode(dst, (const unsigned char *)src, src_len))
+		return EINVAL;
+
+	if (out_len)
+		*out_len = len;
+
+	return 0;
+}
+
+int jwt_b64uri_decode_buf(unsigned char *dst, int dst_len, const char *src)
+{
+	size_t len;
+
+	if (jwt_b64url_decode_into(dst, dst_len, src, strlen(src), &len))
+		return -1;
+
+	return (int)len;
+}
+
+/* Encoding kernels work like the decoding ones, the other way around.
+ * They load more than they encode, and stop while enough input is left
+ * for that. */
+typedef void (*b64uri_encoder_t)(char **dst, const unsigned char **src,
+				 const unsigned char *end);
+
+#ifdef JWT_B64_X86
+/* Each 3 bytes are spread over 4, and the 6 bit values shifted into
+ * place with multiplies. The offset to each character only depends on
+ * which range its value is in, which is found with a saturating
+ * subtract and a compare. */
+__attribute__((target("ssse3")))
+static void b64uri_encode_ssse3(char **dst, const unsigned char **src,
+				const unsigned char *end)
+{
+	const __m128i spread = _mm_setr_epi8(
+		1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10);
+	const __m128i lut_off = _mm_setr_epi8(
+		71, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -17, 32, 65, 0, 0);
+	const unsigned char *s = *src;
+	char *d = *dst;
+	__m128i in, t0, t1;
+
+	/* 16 bytes are loaded for every 12 encoded. */
+	while (end - s >= 16) {
+		in = _mm_loadu_si128((const __m128i *)s);
+		in = _mm_shuffle_epi8(in, spread);
+
+		t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+		t0 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+		t1 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+		t1 = _mm_mullo_epi16(t1, _mm_set1_epi32(0x01000010));
+		in = _mm_or_si128(t0, t1);
+
+		/* 0 for 26 to 51, 1 to 12 for 52 to 63, 13 below 26. */
+		t0 = _mm_subs_epu8(in, _mm_set1_epi8(51));
+		t1 = _mm_cmpgt_epi8(_mm_set1_epi8(26), in);
+		t0 = _mm_or_si128(t0, _mm_and_si128(t1, _mm_set1_epi8(13)));
+		in = _mm_add_epi8(in, _mm_shuffle_epi8(lut_off, t0));
+
+		_mm_storeu_si128((__m128i *)d, in);
+		s += 12;
+		d += 16;
+	}
+
+	*src = s;
+	*dst = d;
+}
+
+/* As above, with the input split between the two 128 bit lanes. */
+__attribute__((target("avx2")))
+static void b64uri_encode_avx2(char **dst, const unsigned char **src,
+			       const unsigned char *end)
+{
+	const __m256i spread = _mm256_setr_epi8(
+		1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10,
+		1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10);
+	const __m256i lut_off = _mm256_setr_epi8(
+		71, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -17, 32, 65, 0, 0,
+		71, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -17, 32, 65, 0, 0);
+	const unsigned char *s = *src;
+	char *d = *dst;
+	__m256i in, t0, t1;
+
+	/* 28 bytes are loaded for every 24 encoded. */
+	while (end - s >= 28) {
+		in = _mm256_inserti128_si256(_mm256_castsi128_si256(
+			_mm_loadu_si128((const __m128i *)s)),
+			_mm_loadu_si128((const __m128i *)(s + 12)), 1);
+		in = _mm256_shuffle_epi8(in, spread);
+
+		t0 = _mm256_and_si256(in, _mm256_set1_epi32(0x0fc0fc00));
+		t0 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+		t1 = _mm256_and_si256(in, _mm256_set1_epi32(0x003f03f0));
+		t1 = _mm256_mullo_epi16(t1, _mm256_set1_epi32(0x01000010));
+		in = _mm256_or_si256(t0, t1);
+
+		t0 = _mm256_subs_epu8(in, _mm256_set1_epi8(51));
+		t1 = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), in);
+		t0 = _mm256_or_si256(t0, _mm256_and_si256(t1,
+							  _mm256_set1_epi8(13)));
+		in = _mm256_add_epi8(in, _mm256_shuffle_epi8(lut_off, t0));
+
+		_mm256_storeu_si256((__m256i *)d, in);
+		s += 24;
+		d += 32;
+	}
+
+	*src = s;
+	*dst = d;
+}
+
+/* Where each byte of the 48 to encode goes, as b1 b0 b2 b1 for every
+ * 3, so that the four 6 bit values are at fixed bit offsets. */
+static const unsigned char b64uri_spread512[64] = {
+	 1,  0,  2,  1,  4,  3,  5,  4,  7,  6,  8,  7, 10,  9, 11, 10,
+	13, 12, 14, 13, 16, 15, 17, 16, 19, 18, 20, 19, 22, 21, 23, 22,
+	25, 24, 26, 25, 28, 27, 29, 28, 31, 30, 32, 31, 34, 33, 35, 34,
+	37, 36, 38, 37, 40, 39, 41, 40, 43, 42, 44, 43, 46, 45, 47, 46,
+};
+
+/* VBMI pulls each 6 bit value out with a multishift, and looks its
+ * character up in the alphabet directly. A masked load means nothing is
+ * read past the input. */
+__attribute__((target("avx512f,avx512bw,avx512vbmi")))
+static void b64uri_encode_vbmi(char **dst, const unsigned char **src,
+			       const unsigned char *end)
+{
+	const __m512i alphabet = _mm512_loadu_si512(b64uri_alphabet);
+	const __m512i spread = _mm512_loadu_si512(b64uri_spread512);
+	const __m512i shifts = _mm512_set1_epi64(0x3036242a1016040aLL);
+	const unsigned char *s = *src;
+	char *d = *dst;
+	__m512i in;
+
+	while (end - s >= 48) {
+		in = _mm512_maskz_loadu_epi8(0xffffffffffffULL, s);
+		in = _mm512_permutexvar_epi8(spread, in);
+		in = _mm512_multishift_epi64_epi8(shifts, in);
+		in = _mm512_permutexvar_epi8(in, alphabet);
+
+		_mm512_storeu_si512(d, in);
+		s += 48;
+		d += 64;
+	}
+
+	*src = s;
+	*dst = d;
+}
+#endif
+
+static b64uri_encoder_t b64uri_encode_kernel(void)
+{
+#ifdef JWT_B64_X86
+	if (__builtin_cpu_supports("avx512vbmi") &&
+	    __builtin_cpu_supports("avx512bw"))
+		return b64uri_encode_vbmi;
+	if (__builtin_cpu_supports("avx2"))
+		return b64uri_encode_avx2;
+	if (__builtin_cpu_supports("ssse3"))
+		return b64uri_encode_ssse3;
+#endif
+	return NULL;
+}
+
+static void b64uri_encode(char *d, const unsigned char *src, size_t len)
+{
+	const unsigned char *end = src + len;
+	b64uri_encoder_t kernel;
+
+	if (len >= B64URI_KERNEL_MIN && (kernel = b64uri_encode_kernel()))
+		kernel(&d, &src, end);
+
+	for (; end - src >= 3; src += 3) {
+		*d++ = b64uri_alphabet[src[0] >> 2];
+		*d++ = b64uri_alphabet[(src[0] & 0x03) << 4 | src[1] >> 4];
+		*d++ = b64uri_alphabet[(src[1] & 0x0f) << 2 | src[2] >> 6];
+		*d++ = b64uri_alphabet[src[2] & 0x3f];
+	}
+
+	if (end - src == 1) {
+		*d++ = b64uri_alphabet[src[0] >> 2];
+		*d++ = b64uri_alphabet[(src[0] & 0x03) << 4];
+	} else if (end - src == 2) {
+		*d++ = b64uri_alphabet[src[0] >> 2];
+		*d++ = b64uri_alphabet[(src[0] & 0x03) << 4 | src[1] >> 4];
+		*d++ = b64uri_alphabet[(src[1] & 0x0f) << 2];
+	}
+}
+
+size_t jwt_b64url_encoded_len(size_t len)
+{
+	return len / 3 * 4 + (len % 3 ? len % 3 + 1 : 0);
+}
+
+int jwt_b64url_encode_into(char *dst, size_t dst_len, const void *src,
+			   size_t src_len, size_t *out_len)
+{
+	size_t len = jwt_b64url_encoded_len(src_len);
+
+	/* The length would not fit in a size_t. */
+	if ((!dst && dst_len) || (!src && src_len) ||
+	    src_len > SIZE_MAX / 4 * 3)
+		return EINVAL;
+
+	if (dst_len < len)
+		return ENOSPC;
+
+	b64uri_encode(dst, src, src_len);
+	if (dst_len > len)
+		dst[len] = '\0';
+
+	if (out_len)
+		*out_len = len;
+
+	return 0;
+}
@@ -0,0 +1,243 @@
+/* Copyright (C) 2015-2018 Ben Collins <ben@cyphre.com>
+   This file is part of the JWT C Library
+
+   This Source Code Form is subject to the terms of the Mozilla Public
+   License, v. 2.0. If a copy of the MPL was not distributed with this
+   file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <jwt.h>
+
+#include "jwt-private.h"
+#include "config.h"
+
+/* Picks what signs and verifies each algorithm. By default that is the
+ * first backend that was built in, unless the application installed a
+ * provider of its own for the algorithm. */
+
+static const struct jwt_crypto_ops *crypto_backends[] = {
+#ifdef JWT_WITH_OPENSSL
+	&jwt_openssl_ops,
+#endif
+#ifdef JWT_WITH_GNUTLS
+	&jwt_gnutls_ops,
+#endif
+#ifdef JWT_WITH_WINCRYPT
+	&jwt_wincrypt_ops,
+#endif
+	NULL
+};
+
+static const struct jwt_crypto_ops *crypto_backend;
+static const jwt_crypto_provider_t *crypto_providers[JWT_ALG_TERM];
+
+static const struct jwt_crypto_ops *jwt_backend(void)
+{
+	return crypto_backend ? crypto_backend : crypto_backends[0];
+}
+
+/* Application providers are wrapped in ops of their own, which find the
+ * provider through the key. */
+static int provider_prepare_key(jwt_key_t *key)
+{
+	const jwt_crypto_provider_t *provider = key->provider;
+
+	if (provider->prepare == NULL)
+		return 0;
+
+	return provider->prepare(key->alg, key->data, key->len,
+				 &key->parsed);
+}
+
+static void provider_release_key(jwt_key_t *key)
+{
+	const jwt_crypto_provider_t *provider = key->provider;
+
+	if (provider->release && key->parsed)
+		provider->release(key->parsed);
+
+	key->parsed = NULL;
+}
+
+static int provider_sign(jwt_t *jwt, jwt_key_t *key, char **out,
+			 unsigned int *len, const char *str)
+{
+	*out = NULL;
+
+	return key->provider->sign(key->parsed, jwt->alg, key->data,
+				   key->len, str, (unsigned char **)out, len);
+}
+
+static int provider_verify(jwt_t *jwt, jwt_key_t *key, const char *head,
+			   const char *sig_b64)
+{
+	unsigned char *sig;
+	int sig_len, ret;
+
+	sig = jwt_b64_decode(sig_b64, &sig_len);
+	if (sig == NULL)
+		return errno;
+
+	ret = key->provider->verify(key->parsed, jwt->alg, key->data,
+				    key->len, head, sig, sig_len);
+
+	jwt_freemem(sig);
+
+	/* EINVAL for a mismatch, anything else is the provider failing. */
+	return ret;
+}
+
+static const struct jwt_crypto_ops provider_ops = {
+	.name = "provider",
+	.prepare_key = provider_prepare_key,
+	.release_key = provider_release_key,
+	.sign_sha_hmac = provider_sign,
+	.verify_sha_hmac = provider_verify,
+	.sign_sha_pem = provider_sign,
+	.verify_sha_pem = provider_verify,
+};
+
+static const struct jwt_crypto_ops *jwt_alg_ops(jwt_alg_t alg,
+					const jwt_crypto_provider_t **provider)
+{
+	*provider = NULL;
+
+	if (alg > JWT_ALG_NONE && alg < JWT_ALG_TERM)
+		*provider = crypto_providers[alg];
+
+	return *provider ? &provider_ops : jwt_backend();
+}
+
+/* Whether data is one DER encoded SEQUENCE, which PEM can't be. */
+static int jwt_is_der(const unsigned char *data, int len)
+{
+	long seq_len;
+	int i, n;
+
+	if (len < 2 || data[0] != 0x30)
+		return 0;
+
+	if (data[1] < 0x80)
+		return 2 + data[1] == len;
+
+	n = data[1] & 0x7f;
+	if (n == 0 || n > 4 || len < 2 + n)
+		return 0;
+
+	for (seq_len = 0, i = 0; i < n; i++)
+		seq_len = (seq_len << 8) | data[2 + i];
+
+	return 2 + n + seq_len == len;
+}
+
+int jwt_prepare_key(jwt_key_t *key)
+{
+	if (key->format == JWT_KEY_FORMAT_AUTO) {
+		key->format = jwt_is_der(key->data, key->len) ?
+			JWT_KEY_FORMAT_DER : JWT_KEY_FORMAT_PEM;
+	}
+
+	key->ops = jwt_alg_ops(key->alg, &key->provider);
+	if (key->ops == NULL)
+		return EINVAL;
+
+	return key->ops->prepare_key(key);
+}
+
+void jwt_release_key(jwt_key_t *key)
+{
+	if (key->ops)
+		key->ops->release_key(key);
+}
+
+int jwt_key_current(jwt_key_t *key, jwt_alg_t alg)
+{
+	const jwt_crypto_provider_t *provider;
+
+	return key->ops == jwt_alg_ops(alg, &provider) &&
+		key->provider == provider;
+}
+
+int jwt_crypto_provided(jwt_alg_t alg)
+{
+	const jwt_crypto_provider_t *provider;
+
+	jwt_alg_ops(alg, &provider);
+
+	return provider != NULL;
+}
+
+int jwt_crypto_init(void *libctx)
+{
+	int i, ret = libctx ? EINVAL : 0;
+
+	/* Only some backends have library contexts, the rest refuse one,
+	 * so it is enough for one of them to take it. */
+	for (i = 0; crypto_backends[i]; i++) {
+		if (crypto_backends[i]->init(libctx) == 0) {
+			if (libctx)
+				ret = 0;
+		} else if (!libctx) {
+			ret = EINVAL;
+		}
+	}
+
+	return ret;
+}
+
+void jwt_crypto_shutdown(void)
+{
+	int i;
+
+	for (i = 0; crypto_backends[i]; i++)
+		crypto_backends[i]->shutdown();
+}
+
+int jwt_set_crypto_backend(const char *name)
+{
+	int i;
+
+	if (name == NULL)
+		return EINVAL;
+
+	for (i = 0; crypto_backends[i]; i++) {
+		if (!strcmp(crypto_backends[i]->name, name))
+			break;
+	}
+
+	if (crypto_backends[i] == NULL)
+		return ENOENT;
+
+	crypto_backend = crypto_backends[i];
+
+	/* Don't hand out keys prepared by the old backend. */
+	jwt_key_cache_flush();
+
+	return 0;
+}
+
+const char *jwt_get_crypto_backend(void)
+{
+	const struct jwt_crypto_ops *ops = jwt_backend();
+
+	return ops ? ops->name : NULL;
+}
+
+int jwt_set_crypto_provider(jwt_alg_t alg,
+			    const jwt_crypto_provider_t *provider)
+{
+	if (alg <= JWT_ALG_NONE || alg >= JWT_ALG_TERM)
+		return EINVAL;
+
+	if (provider && (provider->sign == NULL || provider->verify == NULL))
+		return EINVAL;
+
+	crypto_providers[alg] = provider;
+
+	jwt_key_cache_flush();
+
+	return 0;
+}
@@ -17,59 +17,407 @@
 #include <jwt.h>
 
 #include "jwt-private.h"
-#include "base64.h"
 #include "config.h"
 
-/* Workaround to use GnuTLS 3.5 EC signature encode/decode functions that
- * are not public yet. */
-#if GNUTLS_VERSION_MAJOR == 3 && GNUTLS_VERSION_MINOR == 5
-extern int _gnutls_encode_ber_rs_raw(gnutls_datum_t *sig_value,
-				     const gnutls_datum_t *r,
-				     const gnutls_datum_t *s);
-extern int _gnutls_decode_ber_rs_raw(const gnutls_datum_t *sig_value,
-				     gnutls_datum_t *r, gnutls_datum_t *s);
-
-static int gnutls_encode_rs_value(gnutls_datum_t *sig_value,
-				  const gnutls_datum_t *r,
-				  const gnutls_datum_t * s)
+static int jwt_hmac_alg(jwt_alg_t alg)
 {
-	return _gnutls_encode_ber_rs_raw(sig_value, r, s);
+	switch (alg) {
+	case JWT_ALG_HS256:
+		return GNUTLS_MAC_SHA256;
+	case JWT_ALG_HS384:
+		return GNUTLS_MAC_SHA384;
+	case JWT_ALG_HS512:
+		return GNUTLS_MAC_SHA512;
+	default:
+		return GNUTLS_MAC_UNKNOWN;
+	}
 }
 
-static int gnutls_decode_rs_value(const gnutls_datum_t *sig_value,
-				  gnutls_datum_t *r, gnutls_datum_t *s)
+/* HMAC keys keep a handle that has already absorbed the ipad and opad
+ * blocks. Each operation works on a copy of it, so the key schedule is
+ * only paid for once per key. Copying handles needs GnuTLS 3.6.9. */
+#if GNUTLS_VERSION_NUMBER >= 0x030609
+static int jwt_prepare_hmac(jwt_key_t *key)
 {
-	return _gnutls_decode_ber_rs_raw(sig_value, r, s);
+	gnutls_hmac_hd_t hd;
+
+	if (gnutls_hmac_init(&hd, jwt_hmac_alg(key->alg), key->data,
+			     key->len))
+		return EINVAL;
+
+	key->parsed = hd;
+
+	return 0;
+}
+#else
+static int jwt_prepare_hmac(jwt_key_t *key)
+{
+	return 0;
 }
-#endif /* End of pre-3.6 work-arounds. */
+#endif
 
-/**
- * libjwt encryption/decryption function definitions
- */
-int jwt_sign_sha_hmac(jwt_t *jwt, char **out, unsigned int *len, const char *str)
+static int jwt_gnutls_init(void *libctx)
 {
-	int alg;
+	/* GnuTLS has no library contexts. */
+	return libctx ? EINVAL : 0;
+}
 
-	switch (jwt->alg) {
-	case JWT_ALG_HS256:
-		alg = GNUTLS_DIG_SHA256;
+static void jwt_gnutls_shutdown(void)
+{
+}
+
+/* EdDSA needs GnuTLS 3.6.0, and Ed448 3.6.12. Keys on either curve are
+ * accepted for EdDSA, and the curve picks the signature algorithm. */
+#if GNUTLS_VERSION_NUMBER >= 0x030600
+#define JWT_GNUTLS_EDDSA
+#endif
+
+static int jwt_eddsa_sign_alg(int pk_alg)
+{
+	switch (pk_alg) {
+#ifdef JWT_GNUTLS_EDDSA
+	case GNUTLS_PK_EDDSA_ED25519:
+		return GNUTLS_SIGN_EDDSA_ED25519;
+#endif
+#if GNUTLS_VERSION_NUMBER >= 0x03060c
+	case GNUTLS_PK_EDDSA_ED448:
+		return GNUTLS_SIGN_EDDSA_ED448;
+#endif
+	default:
+		return GNUTLS_SIGN_UNKNOWN;
+	}
+}
+
+static int jwt_pk_match(int type, int pk_alg)
+{
+#ifdef JWT_GNUTLS_EDDSA
+	if (type == GNUTLS_PK_EDDSA_ED25519)
+		return jwt_eddsa_sign_alg(pk_alg) != GNUTLS_SIGN_UNKNOWN;
+#endif
+
+	return type == pk_alg;
+}
+
+/* Parsed form of a PEM key. The public key is always available, the
+ * private key only when one was supplied. */
+struct jwt_gnutls_key {
+	gnutls_privkey_t privkey;
+	gnutls_pubkey_t pubkey;
+};
+
+static int jwt_import_privkey(struct jwt_gnutls_key *gkey,
+			      const gnutls_datum_t *key_dat,
+			      gnutls_x509_crt_fmt_t fmt)
+{
+	gnutls_x509_privkey_t key;
+
+	if (gnutls_x509_privkey_init(&key))
+		return ENOMEM;
+
+	if (gnutls_x509_privkey_import(key, key_dat, fmt)) {
+		gnutls_x509_privkey_deinit(key);
+		return EINVAL;
+	}
+
+	if (gnutls_privkey_init(&gkey->privkey)) {
+		gnutls_x509_privkey_deinit(key);
+		return ENOMEM;
+	}
+
+	/* The x509 key now belongs to privkey. */
+	if (gnutls_privkey_import_x509(gkey->privkey, key,
+				       GNUTLS_PRIVKEY_IMPORT_AUTO_RELEASE)) {
+		gnutls_x509_privkey_deinit(key);
+		return EINVAL;
+	}
+
+	/* Keep a public key around for verifying. */
+	if (gnutls_pubkey_import_privkey(gkey->pubkey, gkey->privkey, 0, 0))
+		return EINVAL;
+
+	return 0;
+}
+
+/* The curve of a raw key. The alg picks it for EC, the length of the
+ * key for EdDSA. */
+static gnutls_ecc_curve_t jwt_raw_curve(jwt_key_t *key, int *size)
+{
+	switch (key->alg) {
+	case JWT_ALG_ES256:
+		*size = 32;
+		return GNUTLS_ECC_CURVE_SECP256R1;
+	case JWT_ALG_ES384:
+		*size = 48;
+		return GNUTLS_ECC_CURVE_SECP384R1;
+	case JWT_ALG_ES512:
+		*size = 66;
+		return GNUTLS_ECC_CURVE_SECP521R1;
+#ifdef JWT_GNUTLS_EDDSA
+	case JWT_ALG_EDDSA:
+		*size = key->len;
+		if (key->len == 32)
+			return GNUTLS_ECC_CURVE_ED25519;
+#if GNUTLS_VERSION_NUMBER >= 0x03060c
+		if (key->len == 57)
+			return GNUTLS_ECC_CURVE_ED448;
+#endif
 		break;
+#endif
+	default:
+		break;
+	}
+
+	return GNUTLS_ECC_CURVE_INVALID;
+}
+
+static int jwt_import_raw_pubkey(struct jwt_gnutls_key *gkey,
+				 jwt_key_t *key)
+{
+	gnutls_datum_t x, y;
+	gnutls_ecc_curve_t curve;
+	int size;
+
+	curve = jwt_raw_curve(key, &size);
+	if (curve == GNUTLS_ECC_CURVE_INVALID)
+		return EINVAL;
+
+	if (key->alg == JWT_ALG_EDDSA) {
+		x.data = key->data;
+		x.size = key->len;
+
+		if (gnutls_pubkey_import_ecc_raw(gkey->pubkey, curve, &x, NULL))
+			return EINVAL;
+
+		return 0;
+	}
+
+	/* Only uncompressed points. */
+	if (key->len != 1 + 2 * size || key->data[0] != 0x04)
+		return EINVAL;
+
+	x.data = key->data + 1;
+	x.size = size;
+	y.data = key->data + 1 + size;
+	y.size = size;
+
+	if (gnutls_pubkey_import_ecc_raw(gkey->pubkey, curve, &x, &y))
+		return EINVAL;
+
+	return 0;
+}
+
+/* GnuTLS needs the public key along with a raw private key, and can't
+ * work it out. Only PKCS#8 EdDSA keys, from RFC 8410, come without it,
+ * so raw EdDSA keys are wrapped in that and raw EC keys are refused. */
+static int jwt_import_raw_privkey(struct jwt_gnutls_key *gkey,
+				  jwt_key_t *key)
+{
+	static const unsigned char ed25519[] = {
+		0x30, 0x2e, 0x02, 0x01, 0x00, 0x30, 0x05, 0x06,
+		0x03, 0x2b, 0x65, 0x70, 0x04, 0x22, 0x04, 0x20,
+	};
+	static const unsigned char ed448[] = {
+		0x30, 0x47, 0x02, 0x01, 0x00, 0x30, 0x05, 0x06,
+		0x03, 0x2b, 0x65, 0x71, 0x04, 0x3b, 0x04, 0x39,
+	};
+	unsigned char der[sizeof(ed448) + 57];
+	gnutls_datum_t key_dat = { der, 0 };
+	const unsigned char *pkcs8;
+	int ret;
+
+	if (key->alg != JWT_ALG_EDDSA)
+		return EINVAL;
+
+	if (key->len == 32)
+		pkcs8 = ed25519;
+	else if (key->len == 57)
+		pkcs8 = ed448;
+	else
+		return EINVAL;
+
+	memcpy(der, pkcs8, sizeof(ed448));
+	memcpy(der + sizeof(ed448), key->data, key->len);
+	key_dat.size = sizeof(ed448) + key->len;
+
+	ret = jwt_import_privkey(gkey, &key_dat, GNUTLS_X509_FMT_DER);
+
+	jwt_wipe(der, sizeof(der));
+
+	return ret;
+}
+
+static void jwt_gnutls_release_key(jwt_key_t *key)
+{
+	struct jwt_gnutls_key *gkey = key->parsed;
+
+	if (gkey == NULL)
+		return;
+
+	switch (key->alg) {
+	case JWT_ALG_HS256:
 	case JWT_ALG_HS384:
-		alg = GNUTLS_DIG_SHA384;
+	case JWT_ALG_HS512:
+		gnutls_hmac_deinit(key->parsed, NULL);
+		key->parsed = NULL;
+		return;
+	default:
 		break;
+	}
+
+	if (gkey->privkey)
+		gnutls_privkey_deinit(gkey->privkey);
+	if (gkey->pubkey)
+		gnutls_pubkey_deinit(gkey->pubkey);
+
+	jwt_freemem(gkey);
+	key->parsed = NULL;
+}
+
+static int jwt_gnutls_prepare_key(jwt_key_t *key)
+{
+	struct jwt_gnutls_key *gkey;
+	gnutls_datum_t key_dat = {
+		key->data,
+		key->len
+	};
+	gnutls_x509_crt_fmt_t fmt = GNUTLS_X509_FMT_PEM;
+	unsigned int bits;
+	int ret, pk_alg;
+
+	switch (key->alg) {
+	case JWT_ALG_HS256:
+	case JWT_ALG_HS384:
 	case JWT_ALG_HS512:
-		alg = GNUTLS_DIG_SHA512;
+		return jwt_prepare_hmac(key);
+
+	case JWT_ALG_RS256:
+	case JWT_ALG_RS384:
+	case JWT_ALG_RS512:
+		pk_alg = GNUTLS_PK_RSA;
+		break;
+
+	case JWT_ALG_ES256:
+	case JWT_ALG_ES384:
+	case JWT_ALG_ES512:
+		pk_alg = GNUTLS_PK_EC;
+		break;
+
+#ifdef JWT_GNUTLS_EDDSA
+	case JWT_ALG_EDDSA:
+		pk_alg = GNUTLS_PK_EDDSA_ED25519;
 		break;
+#endif
+
 	default:
 		return EINVAL;
 	}
 
+	gkey = jwt_malloc(sizeof(*gkey));
+	if (gkey == NULL)
+		return ENOMEM;
+	memset(gkey, 0, sizeof(*gkey));
+	key->parsed = gkey;
+
+	if (gnutls_pubkey_init(&gkey->pubkey)) {
+		ret = ENOMEM;
+		goto prepare_fail;
+	}
+
+	switch (key->format) {
+	case JWT_KEY_FORMAT_RAW_PUB:
+		ret = jwt_import_raw_pubkey(gkey, key);
+		break;
+
+	case JWT_KEY_FORMAT_RAW_PRIV:
+		ret = jwt_import_raw_privkey(gkey, key);
+		key->priv = 1;
+		break;
+
+	default:
+		if (key->format == JWT_KEY_FORMAT_DER)
+			fmt = GNUTLS_X509_FMT_DER;
+
+		ret = 0;
+		if (gnutls_pubkey_import(gkey->pubkey, &key_dat, fmt)) {
+			ret = jwt_import_privkey(gkey, &key_dat, fmt);
+			key->priv = 1;
+		}
+		break;
+	}
+
+	if (ret)
+		goto prepare_fail;
+
+	if (!jwt_pk_match(pk_alg,
+			  gnutls_pubkey_get_pk_algorithm(gkey->pubkey, &bits))) {
+		ret = EINVAL;
+		goto prepare_fail;
+	}
+
+	if (pk_alg == GNUTLS_PK_EC) {
+		key->ec_len = (bits + 7) / 8;
+		if (key->ec_len > JWT_EC_MAX_LEN) {
+			ret = EINVAL;
+			goto prepare_fail;
+		}
+	}
+
+	return 0;
+
+prepare_fail:
+	jwt_gnutls_release_key(key);
+
+	return ret;
+}
+
+/**
+ * libjwt encryption/decryption function definitions
+ */
+static int jwt_hmac(jwt_t *jwt, jwt_key_t *key, int alg, const char *str,
+		    unsigned char *out)
+{
+	gnutls_hmac_hd_t hd = NULL;
+
+#if GNUTLS_VERSION_NUMBER >= 0x030609
+	/* The prepared handle is bound to the algorithm the key was created
+	 * for, other HS algorithms take the one-shot path. Not every
+	 * backend can copy a handle either. */
+	if (key->parsed != NULL && key->alg == jwt->alg)
+		hd = gnutls_hmac_copy(key->parsed);
+#endif
+
+	if (hd != NULL) {
+		if (gnutls_hmac(hd, str, strlen(str))) {
+			gnutls_hmac_deinit(hd, NULL);
+			return EINVAL;
+		}
+
+		gnutls_hmac_deinit(hd, out);
+
+		return 0;
+	}
+
+	if (gnutls_hmac_fast(alg, key->data, key->len, str, strlen(str), out))
+		return EINVAL;
+
+	return 0;
+}
+
+static int jwt_sign_sha_hmac(jwt_t *jwt, jwt_key_t *key, char **out,
+			     unsigned int *len, const char *str)
+{
+	int alg;
+
+	alg = jwt_hmac_alg(jwt->alg);
+	if (alg == GNUTLS_MAC_UNKNOWN)
+		return EINVAL;
+
 	*len = gnutls_hmac_get_len(alg);
 	*out = jwt_malloc(*len);
 	if (*out == NULL)
 		return ENOMEM;
 
-	if (gnutls_hmac_fast(alg, jwt->key, jwt->key_len, str, strlen(str), *out)) {
+	if (jwt_hmac(jwt, key, alg, str, (unsigned char *)*out)) {
 		jwt_freemem(*out);
 		*out = NULL;
 		return EINVAL;
@@ -78,46 +426,77 @@ int jwt_sign_sha_hmac(jwt_t *jwt, char **out, unsigned int *len, const char *str
 	return 0;
 }
 
-int jwt_verify_sha_hmac(jwt_t *jwt, const char *head, const char *sig)
+static int jwt_sign_sha_hmac_stream(jwt_t *jwt, jwt_key_t *key,
+				    jwt_input_next_t next, void *arg,
+				    unsigned char *out, unsigned int *len)
 {
-	char *sig_check, *buf = NULL;
-	unsigned int len;
-	int ret = EINVAL;
+	gnutls_hmac_hd_t hd = NULL;
+	const char *piece;
+	size_t n;
+	int alg;
 
-	if (!jwt_sign_sha_hmac(jwt, &sig_check, &len, head)) {
-		buf = alloca(len * 2);
-		jwt_Base64encode(buf, sig_check, len);
-		jwt_base64uri_encode(buf);
+	alg = jwt_hmac_alg(jwt->alg);
+	if (alg == GNUTLS_MAC_UNKNOWN)
+		return EINVAL;
+
+#if GNUTLS_VERSION_NUMBER >= 0x030609
+	if (key->parsed != NULL && key->alg == jwt->alg)
+		hd = gnutls_hmac_copy(key->parsed);
+#endif
 
-		if (!strcmp(sig, buf))
-			ret = 0;
+	if (hd == NULL && gnutls_hmac_init(&hd, alg, key->data, key->len))
+		return EINVAL;
 
-		jwt_freemem(sig_check);
+	while ((n = next(arg, &piece)) != 0) {
+		if (gnutls_hmac(hd, piece, n)) {
+			gnutls_hmac_deinit(hd, NULL);
+			return EINVAL;
+		}
 	}
 
-	return ret;
+	gnutls_hmac_deinit(hd, out);
+	*len = gnutls_hmac_get_len(alg);
+
+	return 0;
 }
 
-int jwt_sign_sha_pem(jwt_t *jwt, char **out, unsigned int *len, const char *str)
+static int jwt_verify_sha_hmac(jwt_t *jwt, jwt_key_t *key, const char *head,
+			       const char *sig)
 {
-	/* For EC handling. */
-	int r_padding = 0, s_padding = 0, r_out_padding = 0,
-		s_out_padding = 0;
-	size_t out_size;
+	unsigned char res[JWT_HMAC_MAX_LEN];
+	unsigned char sig_raw[JWT_HMAC_MAX_LEN];
+	int alg, sig_len;
 
-	gnutls_x509_privkey_t key;
-	gnutls_privkey_t privkey;
-	gnutls_datum_t key_dat = {
-		jwt->key,
-		jwt->key_len
-	};
+	alg = jwt_hmac_alg(jwt->alg);
+	if (alg == GNUTLS_MAC_UNKNOWN)
+		return EINVAL;
+
+	/* Anything too long for the buffer can't match anyway. */
+	sig_len = jwt_b64uri_decode_buf(sig_raw, sizeof(sig_raw), sig);
+	if (sig_len < 0)
+		return EINVAL;
+
+	if (jwt_hmac(jwt, key, alg, head, res))
+		return ENOMEM;
+
+	if ((unsigned int)sig_len != gnutls_hmac_get_len(alg) ||
+	    gnutls_memcmp(res, sig_raw, sig_len))
+		return EINVAL;
+
+	return 0;
+}
+
+static int jwt_sign_sha_pem(jwt_t *jwt, jwt_key_t *key, char **out,
+			    unsigned int *len, const char *str)
+{
+	struct jwt_gnutls_key *gkey = key->parsed;
 	gnutls_datum_t body_dat = {
 		(unsigned char *)str,
 		strlen(str)
 	};
-	gnutls_datum_t sig_dat, r, s;
-	int ret = 0, pk_alg;
-	int alg, adj;
+	gnutls_datum_t sig_dat;
+	int ret = 0, pk_alg, key_alg;
+	int alg;
 
 	/* Initialiaze for checking later. */
 	*out = NULL;
@@ -147,46 +526,44 @@ int jwt_sign_sha_pem(jwt_t *jwt, char **out, unsigned int *len, const char *str)
 		alg = GNUTLS_DIG_SHA512;
 		pk_alg = GNUTLS_PK_EC;
 		break;
+#ifdef JWT_GNUTLS_EDDSA
+	case JWT_ALG_EDDSA:
+		alg = GNUTLS_DIG_UNKNOWN;
+		pk_alg = GNUTLS_PK_EDDSA_ED25519;
+		break;
+#endif
 	default:
 		return EINVAL;
 	}
 
-	/* Initialize signature process data */
-	if (gnutls_x509_privkey_init(&key))
-		return ENOMEM;
-
-	if (gnutls_x509_privkey_import(key, &key_dat, GNUTLS_X509_FMT_PEM)) {
-		ret = EINVAL;
-		goto sign_clean_key;
-	}
-
-	if (gnutls_privkey_init(&privkey)) {
-		ret = ENOMEM;
-		goto sign_clean_key;
-	}
-
-	if (gnutls_privkey_import_x509(privkey, key, 0)) {
-		ret = EINVAL;
-		goto sign_clean_privkey;
-	}
+	/* Signing needs the private half. */
+	if (!key->priv)
+		return EINVAL;
 
-	if (pk_alg != gnutls_privkey_get_pk_algorithm(privkey, NULL)) {
-		ret = EINVAL;
-		goto sign_clean_privkey;
-	}
+	key_alg = gnutls_privkey_get_pk_algorithm(gkey->privkey, NULL);
+	if (!jwt_pk_match(pk_alg, key_alg))
+		return EINVAL;
 
-	/* Sign data */
-	if (gnutls_privkey_sign_data(privkey, alg, 0, &body_dat, &sig_dat)) {
-		ret = EINVAL;
-		goto sign_clean_privkey;
-	}
+	/* Sign data. EdDSA hashes the message itself, so it is asked for by
+	 * signature algorithm rather than by digest. */
+#ifdef JWT_GNUTLS_EDDSA
+	if (alg == GNUTLS_DIG_UNKNOWN)
+		ret = gnutls_privkey_sign_data2(gkey->privkey,
+						jwt_eddsa_sign_alg(key_alg), 0,
+						&body_dat, &sig_dat);
+	else
+#endif
+		ret = gnutls_privkey_sign_data(gkey->privkey, alg, 0,
+					       &body_dat, &sig_dat);
+	if (ret)
+		return EINVAL;
 
-	/* RSA is very short. */
-	if (pk_alg == GNUTLS_PK_RSA) {
+	/* RSA is very short, and EdDSA is already in its final form. */
+	if (pk_alg != GNUTLS_PK_EC) {
 		*out = jwt_malloc(sig_dat.size);
 		if (*out == NULL) {
 			ret = ENOMEM;
-			goto sign_clean_privkey;
+			goto sign_clean_and_exit;
 		}
 
 		/* Copy signature to out */
@@ -196,58 +573,26 @@ int jwt_sign_sha_pem(jwt_t *jwt, char **out, unsigned int *len, const char *str)
 		goto sign_clean_and_exit;
 	}
 
-	/* Start EC handling. */
-	if ((ret = gnutls_decode_rs_value(&sig_dat, &r, &s))) {
-		ret = EINVAL;
-		goto sign_clean_privkey;
-	}
-
-	/* Check r and s size */
-	if (JWT_ALG_ES256)
-		adj = 32;
-	if (JWT_ALG_ES384)
-		adj = 48;
-	if (JWT_ALG_ES512)
-		adj = 66;
-
-	if (r.size > adj)
-		r_padding = r.size - adj;
-	else if (r.size < adj)
-		r_out_padding = adj - r.size;
-
-	if (s.size > adj)
-		s_padding = s.size - adj;
-	else if (s.size < adj)
-		s_out_padding = adj - s.size;
-
-	out_size = adj << 1;
-
-	*out = jwt_malloc(out_size);
+	/* EC signatures come out in DER, and are unpacked straight into
+	 * r||s, each padded to the size of the curve. */
+	*out = jwt_malloc(2 * key->ec_len);
 	if (*out == NULL) {
 		ret = ENOMEM;
-		goto sign_clean_privkey;
+		goto sign_clean_and_exit;
 	}
-	memset(*out, 0, out_size);
 
-	memcpy(*out + r_out_padding, r.data + r_padding, r.size - r_padding);
-	memcpy(*out + (r.size - r_padding + r_out_padding) + s_out_padding,
-	       s.data + s_padding, (s.size - s_padding));
+	if (jwt_ec_sig_der_to_raw((unsigned char *)*out, sig_dat.data,
+				  sig_dat.size, key->ec_len)) {
+		ret = EINVAL;
+		goto sign_clean_and_exit;
+	}
 
-	*len = (r.size - r_padding + r_out_padding) +
-		(s.size - s_padding + s_out_padding);
-	gnutls_free(r.data);
-	gnutls_free(s.data);
+	*len = 2 * key->ec_len;
 
 sign_clean_and_exit:
 	/* Clean and exit */
 	gnutls_free(sig_dat.data);
 
-sign_clean_privkey:
-	gnutls_privkey_deinit(privkey);
-
-sign_clean_key:
-	gnutls_x509_privkey_deinit(key);
-
 	if (ret && *out) {
 		jwt_freemem(*out);
 		*out = NULL;
@@ -256,19 +601,16 @@ sign_clean_key:
 	return ret;
 }
 
-int jwt_verify_sha_pem(jwt_t *jwt, const char *head, const char *sig_b64)
+static int jwt_verify_sha_pem(jwt_t *jwt, jwt_key_t *key, const char *head,
+			      const char *sig_b64)
 {
-	gnutls_datum_t r, s;
-	gnutls_datum_t cert_dat = {
-		jwt->key,
-		jwt->key_len
-	};
+	struct jwt_gnutls_key *gkey = key->parsed;
+	unsigned char der[JWT_EC_DER_MAX_LEN];
 	gnutls_datum_t data = {
 		(unsigned char *)head,
 		strlen(head)
 	};
 	gnutls_datum_t sig_dat = { NULL, 0 };
-	gnutls_pubkey_t pubkey;
 	int alg, ret = 0, sig_len;
 	unsigned char *sig = NULL;
 
@@ -291,6 +633,12 @@ int jwt_verify_sha_pem(jwt_t *jwt, const char *head, const char *sig_b64)
 	case JWT_ALG_ES512:
 		alg = GNUTLS_SIGN_ECDSA_SHA512;
 		break;
+	case JWT_ALG_EDDSA:
+		alg = jwt_eddsa_sign_alg(
+			gnutls_pubkey_get_pk_algorithm(gkey->pubkey, NULL));
+		if (alg == GNUTLS_SIGN_UNKNOWN)
+			return EINVAL;
+		break;
 	default:
 		return EINVAL;
 	}
@@ -298,68 +646,57 @@ int jwt_verify_sha_pem(jwt_t *jwt, const char *head, const char *sig_b64)
 	sig = (unsigned char *)jwt_b64_decode(sig_b64, &sig_len);
 
 	if (sig == NULL)
-		return EINVAL;
-
-	if (gnutls_pubkey_init(&pubkey)) {
-		ret = EINVAL;
-		goto verify_clean_sig;
-	}
+		return errno;
 
-	if (gnutls_pubkey_import(pubkey, &cert_dat, GNUTLS_X509_FMT_PEM)) {
-		ret = EINVAL;
-		goto verify_clean_pubkey;
-	}
+	sig_dat.size = sig_len;
+	sig_dat.data = sig;
 
-	/* Rebuild signature using r and s extracted from sig when jwt->alg
-	 * is ESxxx. */
+	/* Rebuild the DER signature from r and s when jwt->alg is ESxxx. */
 	switch (jwt->alg) {
 	case JWT_ALG_ES256:
 	case JWT_ALG_ES384:
 	case JWT_ALG_ES512:
-		/* XXX Gotta be a better way. */
-		if (sig_len == 64) {
-			r.size = 32;
-			r.data = sig;
-			s.size = 32;
-			s.data = sig + 32;
-		} else if (sig_len == 96) {
-			r.size = 48;
-			r.data = sig;
-			s.size = 48;
-			s.data = sig + 48;
-		} else if (sig_len == 132) {
-			r.size = 66;
-			r.data = sig;
-			s.size = 66;
-			s.data = sig + 66;
-		} else {
+		if (!key->ec_len || sig_len != 2 * key->ec_len) {
 			ret = EINVAL;
-			goto verify_clean_pubkey;
+			goto verify_clean_sig;
 		}
 
-		if (gnutls_encode_rs_value(&sig_dat, &r, &s) ||
-		    gnutls_pubkey_verify_data2(pubkey, alg, 0, &data, &sig_dat))
-			ret = EINVAL;
-
-		if (sig_dat.data != NULL)
-			gnutls_free(sig_dat.data);
-
+		sig_dat.size = jwt_ec_sig_raw_to_der(der, sig, key->ec_len);
+		sig_dat.data = der;
 		break;
 
 	default:
 		/* Use good old RSA signature verification. */
-		sig_dat.size = sig_len;
-		sig_dat.data = sig;
-
-		if (gnutls_pubkey_verify_data2(pubkey, alg, 0, &data, &sig_dat))
-			ret = EINVAL;
+		break;
 	}
 
-verify_clean_pubkey:
-	gnutls_pubkey_deinit(pubkey);
+	switch (gnutls_pubkey_verify_data2(gkey->pubkey, alg, 0, &data,
+					   &sig_dat)) {
+	case 0:
+		break;
+	case GNUTLS_E_MEMORY_ERROR:
+		ret = ENOMEM;
+		break;
+	default:
+		ret = EINVAL;
+		break;
+	}
 
 verify_clean_sig:
 	jwt_freemem(sig);
 
 	return ret;
 }
+
+const struct jwt_crypto_ops jwt_gnutls_ops = {
+	.name = "gnutls",
+	.init = jwt_gnutls_init,
+	.shutdown = jwt_gnutls_shutdown,
+	.prepare_key = jwt_gnutls_prepare_key,
+	.release_key = jwt_gnutls_release_key,
+	.sign_sha_hmac = jwt_sign_sha_hmac,
+	.verify_sha_hmac = jwt_verify_sha_hmac,
+	.sign_sha_hmac_stream = jwt_sign_sha_hmac_stream,
+	.sign_sha_pem = jwt_sign_sha_pem,
+	.verify_sha_pem = jwt_verify_sha_pem,
+};
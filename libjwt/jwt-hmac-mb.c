@@ -0,0 +1,748 @@
+/* Copyright (C) 2015-2018 Ben Collins <ben@cyphre.com>
+   This file is part of the JWT C Library
+
+   This Source Code Form is subject to the terms of the Mozilla Public
+   License, v. 2.0. If a copy of the MPL was not distributed with this
+   file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <jwt.h>
+
+#include "jwt-private.h"
+#include "config.h"
+
+/* Built in HMAC-SHA2 for batches of HS256, HS384 and HS512 tokens. One
+ * token is only a few blocks, which leaves most of a vector unit idle,
+ * so instead the same block of several tokens is hashed at once, one
+ * token per lane: 8 or 16 SHA-256 streams and 4 or 8 SHA-512 streams
+ * with AVX2 and AVX-512. Tokens left over go one at a time, through
+ * SHA-NI when the CPU has it. The kernels are picked at run time, and
+ * other CPUs and compilers get the portable code. */
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define JWT_HMAC_MB_X86
+#include <immintrin.h>
+#endif
+
+#define MB_MAX_LANES	16
+
+static const uint32_t K256[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+	0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+	0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+	0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+	0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+	0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+	0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+	0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+	0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static const uint64_t K512[80] = {
+	0x428a2f98d728ae22ULL, 0x7137449123ef65cdULL,
+	0xb5c0fbcfec4d3b2fULL, 0xe9b5dba58189dbbcULL,
+	0x3956c25bf348b538ULL, 0x59f111f1b605d019ULL,
+	0x923f82a4af194f9bULL, 0xab1c5ed5da6d8118ULL,
+	0xd807aa98a3030242ULL, 0x12835b0145706fbeULL,
+	0x243185be4ee4b28cULL, 0x550c7dc3d5ffb4e2ULL,
+	0x72be5d74f27b896fULL, 0x80deb1fe3b1696b1ULL,
+	0x9bdc06a725c71235ULL, 0xc19bf174cf692694ULL,
+	0xe49b69c19ef14ad2ULL, 0xefbe4786384f25e3ULL,
+	0x0fc19dc68b8cd5b5ULL, 0x240ca1cc77ac9c65ULL,
+	0x2de92c6f592b0275ULL, 0x4a7484aa6ea6e483ULL,
+	0x5cb0a9dcbd41fbd4ULL, 0x76f988da831153b5ULL,
+	0x983e5152ee66dfabULL, 0xa831c66d2db43210ULL,
+	0xb00327c898fb213fULL, 0xbf597fc7beef0ee4ULL,
+	0xc6e00bf33da88fc2ULL, 0xd5a79147930aa725ULL,
+	0x06ca6351e003826fULL, 0x142929670a0e6e70ULL,
+	0x27b70a8546d22ffcULL, 0x2e1b21385c26c926ULL,
+	0x4d2c6dfc5ac42aedULL, 0x53380d139d95b3dfULL,
+	0x650a73548baf63deULL, 0x766a0abb3c77b2a8ULL,
+	0x81c2c92e47edaee6ULL, 0x92722c851482353bULL,
+	0xa2bfe8a14cf10364ULL, 0xa81a664bbc423001ULL,
+	0xc24b8b70d0f89791ULL, 0xc76c51a30654be30ULL,
+	0xd192e819d6ef5218ULL, 0xd69906245565a910ULL,
+	0xf40e35855771202aULL, 0x106aa07032bbd1b8ULL,
+	0x19a4c116b8d2d0c8ULL, 0x1e376c085141ab53ULL,
+	0x2748774cdf8eeb99ULL, 0x34b0bcb5e19b48a8ULL,
+	0x391c0cb3c5c95a63ULL, 0x4ed8aa4ae3418acbULL,
+	0x5b9cca4f7763e373ULL, 0x682e6ff3d6b2b8a3ULL,
+	0x748f82ee5defb2fcULL, 0x78a5636f43172f60ULL,
+	0x84c87814a1f0ab72ULL, 0x8cc702081a6439ecULL,
+	0x90befffa23631e28ULL, 0xa4506cebde82bde9ULL,
+	0xbef9a3f7b2c67915ULL, 0xc67178f2e372532bULL,
+	0xca273eceea26619cULL, 0xd186b8c721c0c207ULL,
+	0xeada7dd6cde0eb1eULL, 0xf57d4f7fee6ed178ULL,
+	0x06f067aa72176fbaULL, 0x0a637dc5a2c898a6ULL,
+	0x113f9804bef90daeULL, 0x1b710b35131c471bULL,
+	0x28db77f523047d84ULL, 0x32caab7b40c72493ULL,
+	0x3c9ebe0a15c9bebcULL, 0x431d67c49c100d4cULL,
+	0x4cc5d4becb3e42b6ULL, 0x597f299cfc657e2aULL,
+	0x5fcb6fab3ad6faecULL, 0x6c44198c4a475817ULL,
+};
+
+static const uint32_t IV256[8] = {
+	0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+	0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+};
+
+static const uint64_t IV384[8] = {
+	0xcbbb9d5dc1059ed8ULL, 0x629a292a367cd507ULL,
+	0x9159015a3070dd17ULL, 0x152fecd8f70e5939ULL,
+	0x67332667ffc00b31ULL, 0x8eb44a8768581511ULL,
+	0xdb0c2e0d64f98fa7ULL, 0x47b5481dbefa4fa4ULL,
+};
+
+static const uint64_t IV512[8] = {
+	0x6a09e667f3bcc908ULL, 0xbb67ae8584caa73bULL,
+	0x3c6ef372fe94f82bULL, 0xa54ff53a5f1d36f1ULL,
+	0x510e527fade682d1ULL, 0x9b05688c2b3e6c1fULL,
+	0x1f83d9abfb41bd6bULL, 0x5be0cd19137e2179ULL,
+};
+
+/* These work the same on plain words and on GCC vectors of them. */
+#define ROR32(x, n)	(((x) >> (n)) | ((x) << (32 - (n))))
+#define ROR64(x, n)	(((x) >> (n)) | ((x) << (64 - (n))))
+
+#define SHA_CH(x, y, z)		(((x) & (y)) ^ (~(x) & (z)))
+#define SHA_MAJ(x, y, z)	(((x) & (y)) ^ ((x) & (z)) ^ ((y) & (z)))
+
+#define SHA256_S0(x)	(ROR32(x, 2) ^ ROR32(x, 13) ^ ROR32(x, 22))
+#define SHA256_S1(x)	(ROR32(x, 6) ^ ROR32(x, 11) ^ ROR32(x, 25))
+#define SHA256_s0(x)	(ROR32(x, 7) ^ ROR32(x, 18) ^ ((x) >> 3))
+#define SHA256_s1(x)	(ROR32(x, 17) ^ ROR32(x, 19) ^ ((x) >> 10))
+
+#define SHA512_S0(x)	(ROR64(x, 28) ^ ROR64(x, 34) ^ ROR64(x, 39))
+#define SHA512_S1(x)	(ROR64(x, 14) ^ ROR64(x, 18) ^ ROR64(x, 41))
+#define SHA512_s0(x)	(ROR64(x, 1) ^ ROR64(x, 8) ^ ((x) >> 7))
+#define SHA512_s1(x)	(ROR64(x, 19) ^ ROR64(x, 61) ^ ((x) >> 6))
+
+/* One round, with the message schedule worked out in w[] as it goes. */
+#define SHA_ROUND(SZ, a, b, c, d, e, f, g, h, i) do {			\
+	if ((i) >= 16)							\
+		w[(i) & 15] += SHA##SZ##_s1(w[((i) - 2) & 15]) +	\
+			w[((i) - 7) & 15] +				\
+			SHA##SZ##_s0(w[((i) - 15) & 15]);		\
+	t = h + SHA##SZ##_S1(e) + SHA_CH(e, f, g) + K##SZ[i] +		\
+		w[(i) & 15];						\
+	d += t;								\
+	h = t + SHA##SZ##_S0(a) + SHA_MAJ(a, b, c);			\
+} while (0)
+
+#define SHA_ROUNDS8(SZ, i) do {						\
+	SHA_ROUND(SZ, a, b, c, d, e, f, g, h, (i) + 0);			\
+	SHA_ROUND(SZ, h, a, b, c, d, e, f, g, (i) + 1);			\
+	SHA_ROUND(SZ, g, h, a, b, c, d, e, f, (i) + 2);			\
+	SHA_ROUND(SZ, f, g, h, a, b, c, d, e, (i) + 3);			\
+	SHA_ROUND(SZ, e, f, g, h, a, b, c, d, (i) + 4);			\
+	SHA_ROUND(SZ, d, e, f, g, h, a, b, c, (i) + 5);			\
+	SHA_ROUND(SZ, c, d, e, f, g, h, a, b, (i) + 6);			\
+	SHA_ROUND(SZ, b, c, d, e, f, g, h, a, (i) + 7);			\
+} while (0)
+
+/* Defines fn(state, in), which runs one block through each lane of type
+ * T, where T is a word or a vector of words. Both arguments are laid
+ * out word by word, each word holding one value per lane: state[8][L]
+ * and in[16][L]. */
+#define SHA_COMPRESS(SZ, ROUNDS, W, T, fn, attr)			\
+static attr void fn(W *state, const W *in)				\
+{									\
+	const int L = sizeof(T) / sizeof(W);				\
+	T a, b, c, d, e, f, g, h, t, w[16];				\
+	int i;								\
+									\
+	memcpy(&a, state + 0 * L, sizeof(T));				\
+	memcpy(&b, state + 1 * L, sizeof(T));				\
+	memcpy(&c, state + 2 * L, sizeof(T));				\
+	memcpy(&d, state + 3 * L, sizeof(T));				\
+	memcpy(&e, state + 4 * L, sizeof(T));				\
+	memcpy(&f, state + 5 * L, sizeof(T));				\
+	memcpy(&g, state + 6 * L, sizeof(T));				\
+	memcpy(&h, state + 7 * L, sizeof(T));				\
+	for (i = 0; i < 16; i++)					\
+		memcpy(&w[i], in + i * L, sizeof(T));			\
+									\
+	for (i = 0; i < ROUNDS; i += 16) {				\
+		SHA_ROUNDS8(SZ, i);					\
+		SHA_ROUNDS8(SZ, i + 8);					\
+	}								\
+									\
+	SHA_ADD(W, T, 0, a); SHA_ADD(W, T, 1, b);			\
+	SHA_ADD(W, T, 2, c); SHA_ADD(W, T, 3, d);			\
+	SHA_ADD(W, T, 4, e); SHA_ADD(W, T, 5, f);			\
+	SHA_ADD(W, T, 6, g); SHA_ADD(W, T, 7, h);			\
+}
+
+#define SHA_ADD(W, T, n, x) do {					\
+	T s;								\
+	memcpy(&s, state + (n) * L, sizeof(T));				\
+	s += x;								\
+	memcpy(state + (n) * L, &s, sizeof(T));				\
+} while (0)
+
+SHA_COMPRESS(256, 64, uint32_t, uint32_t, sha256_compress, )
+SHA_COMPRESS(512, 80, uint64_t, uint64_t, sha512_compress, )
+
+#ifdef JWT_HMAC_MB_X86
+typedef uint32_t v8u32 __attribute__((vector_size(32)));
+typedef uint32_t v16u32 __attribute__((vector_size(64)));
+typedef uint64_t v4u64 __attribute__((vector_size(32)));
+typedef uint64_t v8u64 __attribute__((vector_size(64)));
+
+SHA_COMPRESS(256, 64, uint32_t, v8u32, sha256_compress_avx2,
+	     __attribute__((target("avx2"))))
+SHA_COMPRESS(512, 80, uint64_t, v4u64, sha512_compress_avx2,
+	     __attribute__((target("avx2"))))
+SHA_COMPRESS(256, 64, uint32_t, v16u32, sha256_compress_avx512,
+	     __attribute__((target("avx512f"))))
+SHA_COMPRESS(512, 80, uint64_t, v8u64, sha512_compress_avx512,
+	     __attribute__((target("avx512f"))))
+#endif
+
+static inline uint32_t load_be32(const unsigned char *p)
+{
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+		((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+static inline uint64_t load_be64(const unsigned char *p)
+{
+	return ((uint64_t)load_be32(p) << 32) | load_be32(p + 4);
+}
+
+static inline void store_be32(unsigned char *p, uint32_t v)
+{
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+static inline void store_be64(unsigned char *p, uint64_t v)
+{
+	store_be32(p, v >> 32);
+	store_be32(p + 4, v);
+}
+
+static void sha256_blocks(uint32_t *state, const unsigned char *data,
+			  size_t blocks)
+{
+	uint32_t w[16];
+	int i;
+
+	for (; blocks; blocks--, data += 64) {
+		for (i = 0; i < 16; i++)
+			w[i] = load_be32(data + i * 4);
+		sha256_compress(state, w);
+	}
+}
+
+static void sha512_blocks(uint64_t *state, const unsigned char *data,
+			  size_t blocks)
+{
+	uint64_t w[16];
+	int i;
+
+	for (; blocks; blocks--, data += 128) {
+		for (i = 0; i < 16; i++)
+			w[i] = load_be64(data + i * 8);
+		sha512_compress(state, w);
+	}
+}
+
+#ifdef JWT_HMAC_MB_X86
+/* SHA-256 of one stream with the SHA extensions. */
+__attribute__((target("sha,sse4.1")))
+static void sha256_blocks_ni(uint32_t *state, const unsigned char *data,
+			     size_t blocks)
+{
+	const __m128i bswap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL,
+					     0x0405060700010203ULL);
+	__m128i st0, st1, abef, cdgh, msg, tmp, m[4];
+	int i;
+
+	/* The instructions want the state as ABEF and CDGH. */
+	tmp = _mm_shuffle_epi32(_mm_loadu_si128((__m128i *)&state[0]), 0xb1);
+	st1 = _mm_shuffle_epi32(_mm_loadu_si128((__m128i *)&state[4]), 0x1b);
+	st0 = _mm_alignr_epi8(tmp, st1, 8);
+	st1 = _mm_blend_epi16(st1, tmp, 0xf0);
+
+	for (; blocks; blocks--, data += 64) {
+		abef = st0;
+		cdgh = st1;
+
+		/* Four rounds at a time, with the schedule for later rounds
+		 * worked out alongside. */
+		for (i = 0; i < 16; i++) {
+			if (i < 4)
+				m[i] = _mm_shuffle_epi8(_mm_loadu_si128(
+					(__m128i *)(data + i * 16)), bswap);
+
+			msg = _mm_add_epi32(m[i & 3],
+				_mm_loadu_si128((__m128i *)&K256[i * 4]));
+			st1 = _mm_sha256rnds2_epu32(st1, st0, msg);
+
+			if (i >= 3 && i < 15) {
+				tmp = _mm_alignr_epi8(m[i & 3], m[(i - 1) & 3],
+						      4);
+				m[(i + 1) & 3] = _mm_add_epi32(m[(i + 1) & 3],
+							       tmp);
+				m[(i + 1) & 3] = _mm_sha256msg2_epu32(
+					m[(i + 1) & 3], m[i & 3]);
+			}
+
+			msg = _mm_shuffle_epi32(msg, 0x0e);
+			st0 = _mm_sha256rnds2_epu32(st0, st1, msg);
+
+			if (i >= 1 && i < 13)
+				m[(i - 1) & 3] = _mm_sha256msg1_epu32(
+					m[(i - 1) & 3], m[i & 3]);
+		}
+
+		st0 = _mm_add_epi32(st0, abef);
+		st1 = _mm_add_epi32(st1, cdgh);
+	}
+
+	tmp = _mm_shuffle_epi32(st0, 0x1b);
+	st1 = _mm_shuffle_epi32(st1, 0xb1);
+	st0 = _mm_blend_epi16(tmp, st1, 0xf0);
+	st1 = _mm_alignr_epi8(st1, tmp, 8);
+
+	_mm_storeu_si128((__m128i *)&state[0], st0);
+	_mm_storeu_si128((__m128i *)&state[4], st1);
+}
+#endif
+
+struct hmac_mb_kernels {
+	/* Lanes of the multi-buffer kernels. */
+	unsigned int lanes256, lanes512;
+	void (*mb256)(uint32_t *state, const uint32_t *in);
+	void (*mb512)(uint64_t *state, const uint64_t *in);
+
+	/* Fewer streams than this are hashed one at a time. */
+	unsigned int min256, min512;
+	void (*blocks256)(uint32_t *state, const unsigned char *data,
+			  size_t blocks);
+};
+
+static void hmac_mb_kernels(struct hmac_mb_kernels *k)
+{
+	k->lanes256 = k->lanes512 = 1;
+	k->mb256 = sha256_compress;
+	k->mb512 = sha512_compress;
+	k->min256 = k->min512 = 1;
+	k->blocks256 = sha256_blocks;
+
+#ifdef JWT_HMAC_MB_X86
+	if (__builtin_cpu_supports("avx512f")) {
+		k->lanes256 = 16;
+		k->lanes512 = 8;
+		k->mb256 = sha256_compress_avx512;
+		k->mb512 = sha512_compress_avx512;
+	} else if (__builtin_cpu_supports("avx2")) {
+		k->lanes256 = 8;
+		k->lanes512 = 4;
+		k->mb256 = sha256_compress_avx2;
+		k->mb512 = sha512_compress_avx2;
+	}
+
+	k->min256 = k->min512 = 2;
+
+	/* SHA-NI beats a vector that is less than half full. */
+	if (__builtin_cpu_supports("sha")) {
+		k->blocks256 = sha256_blocks_ni;
+		if (k->lanes256 > 2)
+			k->min256 = k->lanes256 / 2;
+	}
+#endif
+}
+
+/* Number of blocks a len byte message pads out to. */
+static size_t sha_nblocks(size_t len, size_t bs)
+{
+	return (len + 1 + bs / 8 + bs - 1) / bs;
+}
+
+/* Block b of a message as padded for SHA-2, where the message follows
+ * prefix bytes that were already hashed. Only the last one or two blocks
+ * need copying, the rest are returned in place. */
+static const unsigned char *sha_block(unsigned char *tmp, const char *msg,
+				      size_t len, size_t prefix, size_t b,
+				      size_t bs)
+{
+	size_t off = b * bs;
+
+	if (off + bs <= len)
+		return (const unsigned char *)msg + off;
+
+	memset(tmp, 0, bs);
+
+	if (off <= len) {
+		memcpy(tmp, msg + off, len - off);
+		tmp[len - off] = 0x80;
+	}
+
+	if (b + 1 == sha_nblocks(len, bs))
+		store_be64(tmp + bs - 8, (uint64_t)(prefix + len) * 8);
+
+	return tmp;
+}
+
+/* HMAC-SHA256 */
+
+static void hmac256_key(const struct hmac_mb_kernels *k,
+			const unsigned char *key, int key_len,
+			uint32_t *ikey, uint32_t *okey)
+{
+	unsigned char pad[64], tmp[64];
+	size_t i, nb;
+
+	memset(pad, 0, sizeof(pad));
+
+	if (key_len > 64) {
+		uint32_t st[8];
+
+		memcpy(st, IV256, sizeof(st));
+		nb = sha_nblocks(key_len, 64);
+		for (i = 0; i < nb; i++)
+			k->blocks256(st, sha_block(tmp, (const char *)key,
+						   key_len, 0, i, 64), 1);
+		for (i = 0; i < 8; i++)
+			store_be32(pad + i * 4, st[i]);
+		jwt_wipe(st, sizeof(st));
+	} else {
+		memcpy(pad, key, key_len);
+	}
+
+	for (i = 0; i < 64; i++)
+		tmp[i] = pad[i] ^ 0x36;
+	memcpy(ikey, IV256, sizeof(IV256));
+	k->blocks256(ikey, tmp, 1);
+
+	for (i = 0; i < 64; i++)
+		tmp[i] = pad[i] ^ 0x5c;
+	memcpy(okey, IV256, sizeof(IV256));
+	k->blocks256(okey, tmp, 1);
+
+	jwt_wipe(pad, sizeof(pad));
+	jwt_wipe(tmp, sizeof(tmp));
+}
+
+static void hmac256_one(const struct hmac_mb_kernels *k,
+			const uint32_t *ikey, const uint32_t *okey,
+			const char *msg, size_t len, unsigned char *out)
+{
+	size_t b, nb = sha_nblocks(len, 64);
+	unsigned char tmp[64], dig[32];
+	uint32_t st[8];
+	int i;
+
+	memcpy(st, ikey, sizeof(st));
+
+	/* Whole blocks straight from the message, then the padding. */
+	k->blocks256(st, (const unsigned char *)msg, len / 64);
+	for (b = len / 64; b < nb; b++)
+		k->blocks256(st, sha_block(tmp, msg, len, 64, b, 64), 1);
+
+	for (i = 0; i < 8; i++)
+		store_be32(dig + i * 4, st[i]);
+
+	memcpy(st, okey, sizeof(st));
+	k->blocks256(st, sha_block(tmp, (const char *)dig, 32, 64, 0, 64), 1);
+
+	for (i = 0; i < 8; i++)
+		store_be32(out + i * 4, st[i]);
+
+	jwt_wipe(st, sizeof(st));
+	jwt_wipe(dig, sizeof(dig));
+	jwt_wipe(tmp, sizeof(tmp));
+}
+
+static void hmac256_lanes(const struct hmac_mb_kernels *k,
+			  const uint32_t *ikey, const uint32_t *okey,
+			  const char * const *msgs, const size_t *lens,
+			  unsigned int n, unsigned char *out)
+{
+	const unsigned int L = k->lanes256;
+	uint32_t st[8 * MB_MAX_LANES], dig[8 * MB_MAX_LANES];
+	uint32_t w[16 * MB_MAX_LANES];
+	size_t len[MB_MAX_LANES], nb[MB_MAX_LANES], b, max = 0;
+	const unsigned char *p;
+	unsigned char tmp[64];
+	unsigned int l, i;
+
+	memset(w, 0, sizeof(w));
+	memset(dig, 0, sizeof(dig));
+
+	for (l = 0; l < n; l++) {
+		len[l] = lens[l];
+		nb[l] = sha_nblocks(len[l], 64);
+		if (nb[l] > max)
+			max = nb[l];
+	}
+
+	for (l = 0; l < L; l++) {
+		for (i = 0; i < 8; i++)
+			st[i * L + l] = ikey[i];
+	}
+
+	/* Lanes that run out of blocks early keep going on the same words,
+	 * their digest was saved when they finished. */
+	for (b = 0; b < max; b++) {
+		for (l = 0; l < n; l++) {
+			if (b >= nb[l])
+				continue;
+			p = sha_block(tmp, msgs[l], len[l], 64, b, 64);
+			for (i = 0; i < 16; i++)
+				w[i * L + l] = load_be32(p + i * 4);
+		}
+
+		k->mb256(st, w);
+
+		for (l = 0; l < n; l++) {
+			if (nb[l] != b + 1)
+				continue;
+			for (i = 0; i < 8; i++)
+				dig[i * L + l] = st[i * L + l];
+		}
+	}
+
+	/* The outer hash is always the one block, digest and padding. */
+	for (l = 0; l < L; l++) {
+		for (i = 0; i < 8; i++) {
+			st[i * L + l] = okey[i];
+			w[i * L + l] = dig[i * L + l];
+		}
+		w[8 * L + l] = 0x80000000;
+		for (i = 9; i < 15; i++)
+			w[i * L + l] = 0;
+		w[15 * L + l] = (64 + 32) * 8;
+	}
+
+	k->mb256(st, w);
+
+	for (l = 0; l < n; l++) {
+		for (i = 0; i < 8; i++)
+			store_be32(out + l * JWT_HMAC_MAX_LEN + i * 4,
+				   st[i * L + l]);
+	}
+
+	/* Every lane was started from the key's midstates. */
+	jwt_wipe(st, sizeof(st));
+	jwt_wipe(dig, sizeof(dig));
+	jwt_wipe(w, sizeof(w));
+	jwt_wipe(tmp, sizeof(tmp));
+}
+
+static void hmac256(const struct hmac_mb_kernels *k, const unsigned char *key,
+		    int key_len, const char * const *msgs, const size_t *lens,
+		    unsigned int count, unsigned char *out)
+{
+	uint32_t ikey[8], okey[8];
+	unsigned int i, n;
+
+	hmac256_key(k, key, key_len, ikey, okey);
+
+	for (i = 0; i < count; i += n) {
+		n = count - i < k->lanes256 ? count - i : k->lanes256;
+
+		if (n >= k->min256) {
+			hmac256_lanes(k, ikey, okey, msgs + i, lens + i, n,
+				      out + i * JWT_HMAC_MAX_LEN);
+		} else {
+			for (; n; n--, i++)
+				hmac256_one(k, ikey, okey, msgs[i], lens[i],
+					    out + i * JWT_HMAC_MAX_LEN);
+		}
+	}
+
+	/* As good as the key itself. */
+	jwt_wipe(ikey, sizeof(ikey));
+	jwt_wipe(okey, sizeof(okey));
+}
+
+/* HMAC-SHA384 and HMAC-SHA512, which differ in the IV and how much of
+ * the digest is kept. */
+
+static void hmac512_key(const uint64_t *iv, const unsigned char *key,
+			int key_len, uint64_t *ikey, uint64_t *okey)
+{
+	unsigned char pad[128], tmp[128];
+	size_t i, nb;
+
+	memset(pad, 0, sizeof(pad));
+
+	if (key_len > 128) {
+		uint64_t st[8];
+
+		/* Keys are hashed with the same function as the MAC. */
+		memcpy(st, iv, sizeof(st));
+		nb = sha_nblocks(key_len, 128);
+		for (i = 0; i < nb; i++)
+			sha512_blocks(st, sha_block(tmp, (const char *)key,
+						    key_len, 0, i, 128), 1);
+		for (i = 0; i < 8; i++)
+			store_be64(pad + i * 8, st[i]);
+		if (iv == IV384)
+			memset(pad + 48, 0, 16);
+		jwt_wipe(st, sizeof(st));
+	} else {
+		memcpy(pad, key, key_len);
+	}
+
+	for (i = 0; i < 128; i++)
+		tmp[i] = pad[i] ^ 0x36;
+	memcpy(ikey, iv, 8 * sizeof(*iv));
+	sha512_blocks(ikey, tmp, 1);
+
+	for (i = 0; i < 128; i++)
+		tmp[i] = pad[i] ^ 0x5c;
+	memcpy(okey, iv, 8 * sizeof(*iv));
+	sha512_blocks(okey, tmp, 1);
+
+	jwt_wipe(pad, sizeof(pad));
+	jwt_wipe(tmp, sizeof(tmp));
+}
+
+static void hmac512_lanes(const struct hmac_mb_kernels *k,
+			  const uint64_t *ikey, const uint64_t *okey,
+			  unsigned int L, unsigned int words,
+			  const char * const *msgs, const size_t *lens,
+			  unsigned int n, unsigned char *out)
+{
+	void (*compress)(uint64_t *, const uint64_t *) =
+		L == 1 ? sha512_compress : k->mb512;
+	uint64_t st[8 * MB_MAX_LANES], dig[8 * MB_MAX_LANES];
+	uint64_t w[16 * MB_MAX_LANES];
+	size_t len[MB_MAX_LANES], nb[MB_MAX_LANES], b, max = 0;
+	const unsigned char *p;
+	unsigned char tmp[128];
+	unsigned int l, i;
+
+	memset(w, 0, sizeof(w));
+	memset(dig, 0, sizeof(dig));
+
+	for (l = 0; l < n; l++) {
+		len[l] = lens[l];
+		nb[l] = sha_nblocks(len[l], 128);
+		if (nb[l] > max)
+			max = nb[l];
+	}
+
+	for (l = 0; l < L; l++) {
+		for (i = 0; i < 8; i++)
+			st[i * L + l] = ikey[i];
+	}
+
+	for (b = 0; b < max; b++) {
+		for (l = 0; l < n; l++) {
+			if (b >= nb[l])
+				continue;
+			p = sha_block(tmp, msgs[l], len[l], 128, b, 128);
+			for (i = 0; i < 16; i++)
+				w[i * L + l] = load_be64(p + i * 8);
+		}
+
+		compress(st, w);
+
+		for (l = 0; l < n; l++) {
+			if (nb[l] != b + 1)
+				continue;
+			for (i = 0; i < 8; i++)
+				dig[i * L + l] = st[i * L + l];
+		}
+	}
+
+	for (l = 0; l < L; l++) {
+		for (i = 0; i < 8; i++)
+			st[i * L + l] = okey[i];
+		for (i = 0; i < 16; i++)
+			w[i * L + l] = i < words ? dig[i * L + l] : 0;
+		w[words * L + l] = 0x8000000000000000ULL;
+		w[15 * L + l] = (128 + words * 8) * 8;
+	}
+
+	compress(st, w);
+
+	for (l = 0; l < n; l++) {
+		for (i = 0; i < words; i++)
+			store_be64(out + l * JWT_HMAC_MAX_LEN + i * 8,
+				   st[i * L + l]);
+	}
+
+	/* Every lane was started from the key's midstates. */
+	jwt_wipe(st, sizeof(st));
+	jwt_wipe(dig, sizeof(dig));
+	jwt_wipe(w, sizeof(w));
+	jwt_wipe(tmp, sizeof(tmp));
+}
+
+static void hmac512(const struct hmac_mb_kernels *k, const uint64_t *iv,
+		    unsigned int words, const unsigned char *key, int key_len,
+		    const char * const *msgs, const size_t *lens,
+		    unsigned int count, unsigned char *out)
+{
+	uint64_t ikey[8], okey[8];
+	unsigned int i, n;
+
+	hmac512_key(iv, key, key_len, ikey, okey);
+
+	for (i = 0; i < count; i += n) {
+		n = count - i < k->lanes512 ? count - i : k->lanes512;
+
+		if (n >= k->min512) {
+			hmac512_lanes(k, ikey, okey, k->lanes512, words,
+				      msgs + i, lens + i, n,
+				      out + i * JWT_HMAC_MAX_LEN);
+		} else {
+			for (; n; n--, i++)
+				hmac512_lanes(k, ikey, okey, 1, words,
+					      msgs + i, lens + i, 1,
+					      out + i * JWT_HMAC_MAX_LEN);
+		}
+	}
+
+	/* As good as the key itself. */
+	jwt_wipe(ikey, sizeof(ikey));
+	jwt_wipe(okey, sizeof(okey));
+}
+
+unsigned int jwt_hmac_mb(jwt_alg_t alg, const unsigned char *key,
+			 int key_len, const char * const *msgs,
+			 const size_t *lens, unsigned int count,
+			 unsigned char *out)
+{
+	struct hmac_mb_kernels k;
+
+	if (key == NULL || key_len < 0)
+		return 0;
+
+	hmac_mb_kernels(&k);
+
+	switch (alg) {
+	case JWT_ALG_HS256:
+		hmac256(&k, key, key_len, msgs, lens, count, out);
+		return 32;
+
+	case JWT_ALG_HS384:
+		hmac512(&k, IV384, 6, key, key_len, msgs, lens, count, out);
+		return 48;
+
+	case JWT_ALG_HS512:
+		hmac512(&k, IV512, 8, key, key_len, msgs, lens, count, out);
+		return 64;
+
+	default:
+		return 0;
+	}
+}
@@ -0,0 +1,745 @@
+/* Copyright (C) 2015-2018 Ben Collins <ben@cyphre.com>
+   This file is part of the JWT C Library
+
+   This Source Code Form is subject to the terms of the Mozilla Public
+   License, v. 2.0. If a copy of the MPL was not distributed with this
+   file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+
+#include <jwt.h>
+
+#include "jwt-private.h"
+#include "config.h"
+
+/* Key sets, filled from JSON Web Key Sets (RFC 7517) and indexed by kid.
+ *
+ * Each JWK is written out as the DER structure a PEM file of the key
+ * would hold, and prepared from that as any other key. That only happens
+ * when the set is loaded. */
+
+#define KEYSET_MIN_BUCKETS	16
+
+struct keyset_entry {
+	char *kid;
+	uint32_t hash;
+	jwt_key_t *key;
+	/* The JWK named its alg, so no other is accepted with it. */
+	int strict;
+	struct keyset_entry *next;
+};
+
+struct jwt_keyset {
+	struct keyset_entry **buckets;
+	unsigned int size;
+	unsigned int count;
+};
+
+/* DER is written back to front, so that the length of each value is
+ * known by the time its header goes in front of it. */
+struct der {
+	unsigned char *start, *p;
+	int err;
+};
+
+static void der_put(struct der *d, const void *data, size_t len)
+{
+	if (d->err || (size_t)(d->p - d->start) < len) {
+		d->err = EINVAL;
+		return;
+	}
+
+	d->p -= len;
+	if (len)
+		memcpy(d->p, data, len);
+}
+
+/* Put the header of a value that starts at d->p and ends at end. */
+static void der_close(struct der *d, unsigned char tag, unsigned char *end)
+{
+	unsigned char hdr[2 + sizeof(size_t)];
+	size_t len = end - d->p;
+	int n = 0, i;
+
+	hdr[0] = tag;
+
+	if (len < 0x80) {
+		hdr[1] = (unsigned char)len;
+		der_put(d, hdr, 2);
+		return;
+	}
+
+	while (n < (int)sizeof(size_t) && len >> (8 * n))
+		n++;
+
+	hdr[1] = 0x80 | n;
+	for (i = 0; i < n; i++)
+		hdr[2 + i] = (unsigned char)(len >> (8 * (n - 1 - i)));
+
+	der_put(d, hdr, 2 + n);
+}
+
+static void der_bytes(struct der *d, unsigned char tag,
+		      const unsigned char *data, size_t len)
+{
+	unsigned char *end = d->p;
+
+	der_put(d, data, len);
+	der_close(d, tag, end);
+}
+
+/* An unsigned big endian integer. */
+static void der_int(struct der *d, const unsigned char *data, size_t len)
+{
+	unsigned char *end = d->p;
+
+	while (len > 1 && data[0] == 0) {
+		data++;
+		len--;
+	}
+
+	der_put(d, data, len);
+	if (len == 0 || data[0] & 0x80)
+		der_put(d, "", 1);
+
+	der_close(d, 0x02, end);
+}
+
+static const unsigned char oid_rsa[] = {
+	0x06, 0x09, 0x2a, 0x86, 0x48, 0x86, 0xf7, 0x0d, 0x01, 0x01, 0x01,
+};
+static const unsigned char oid_ec[] = {
+	0x06, 0x07, 0x2a, 0x86, 0x48, 0xce, 0x3d, 0x02, 0x01,
+};
+static const unsigned char oid_p256[] = {
+	0x06, 0x08, 0x2a, 0x86, 0x48, 0xce, 0x3d, 0x03, 0x01, 0x07,
+};
+static const unsigned char oid_p384[] = {
+	0x06, 0x05, 0x2b, 0x81, 0x04, 0x00, 0x22,
+};
+static const unsigned char oid_p521[] = {
+	0x06, 0x05, 0x2b, 0x81, 0x04, 0x00, 0x23,
+};
+static const unsigned char oid_ed25519[] = {
+	0x06, 0x03, 0x2b, 0x65, 0x70,
+};
+static const unsigned char oid_ed448[] = {
+	0x06, 0x03, 0x2b, 0x65, 0x71,
+};
+
+static void der_alg(struct der *d, const unsigned char *oid, size_t oid_len,
+		    const unsigned char *param, size_t param_len)
+{
+	unsigned char *end = d->p;
+
+	der_put(d, param, param_len);
+	der_put(d, oid, oid_len);
+	der_close(d, 0x30, end);
+}
+
+/* The base64url members of a JWK, decoded. */
+#define JWK_MAX_PARTS	8
+
+struct jwk_parts {
+	unsigned char *v[JWK_MAX_PARTS];
+	size_t len[JWK_MAX_PARTS];
+	/* As allocated, so a part that failed to decode is wiped too. */
+	size_t size[JWK_MAX_PARTS];
+	size_t total;
+};
+
+static int jwk_parts_get(struct jwk_parts *parts, json_t *jwk,
+			 const char * const *names, int required)
+{
+	const char *val;
+	int i, len, size;
+
+	memset(parts, 0, sizeof(*parts));
+
+	for (i = 0; names[i]; i++) {
+		val = json_string_value(json_object_get(jwk, names[i]));
+		if (val == NULL) {
+			if (i < required)
+				return EINVAL;
+			continue;
+		}
+
+		size = (int)strlen(val) / 4 * 3 + 3;
+		parts->v[i] = jwt_malloc(size);
+		if (parts->v[i] == NULL)
+			return ENOMEM;
+		parts->size[i] = size;
+
+		len = jwt_b64uri_decode_buf(parts->v[i], size, val);
+		if (len <= 0)
+			return EINVAL;
+
+		parts->len[i] = len;
+		parts->total += len;
+	}
+
+	return 0;
+}
+
+static void jwk_parts_free(struct jwk_parts *parts)
+{
+	int i;
+
+	for (i = 0; i < JWK_MAX_PARTS; i++) {
+		if (parts->v[i] == NULL)
+			continue;
+
+		/* Private keys come through here. */
+		jwt_wipe(parts->v[i], parts->size[i]);
+		jwt_freemem(parts->v[i]);
+	}
+}
+
+/* Prepare the DER at d->p. */
+static int jwk_prepare(jwt_key_t **key, jwt_alg_t alg, struct der *d,
+		       unsigned char *end)
+{
+	if (d->err)
+		return d->err;
+
+	return jwt_key_new_format(key, alg, JWT_KEY_FORMAT_DER, d->p,
+				  (int)(end - d->p));
+}
+
+static int jwk_oct(json_t *jwk, jwt_alg_t alg, jwt_key_t **key)
+{
+	static const char * const names[] = { "k", NULL };
+	struct jwk_parts parts;
+	int ret;
+
+	ret = jwk_parts_get(&parts, jwk, names, 1);
+	if (ret == 0)
+		ret = jwt_key_new(key, alg == JWT_ALG_INVAL ? JWT_ALG_HS256 :
+				  alg, parts.v[0], (int)parts.len[0]);
+
+	jwk_parts_free(&parts);
+
+	return ret;
+}
+
+static int jwk_rsa(json_t *jwk, jwt_alg_t alg, jwt_key_t **key)
+{
+	static const char * const names[] = {
+		"n", "e", "d", "p", "q", "dp", "dq", "qi", NULL,
+	};
+	struct jwk_parts parts;
+	unsigned char *end, *bits, *oct;
+	struct der d = { NULL, NULL, 0 };
+	size_t size;
+	int ret, i;
+
+	if (alg == JWT_ALG_INVAL)
+		alg = JWT_ALG_RS256;
+
+	ret = jwk_parts_get(&parts, jwk, names, 2);
+	if (ret)
+		goto rsa_done;
+
+	/* Only private keys with all of their CRT parameters. */
+	for (i = 3; parts.v[2] && names[i]; i++) {
+		if (parts.v[i] == NULL) {
+			ret = EINVAL;
+			goto rsa_done;
+		}
+	}
+
+	size = parts.total + 128;
+	d.start = jwt_malloc(size);
+	if (d.start == NULL) {
+		ret = ENOMEM;
+		goto rsa_done;
+	}
+	d.p = end = d.start + size;
+
+	if (parts.v[2] == NULL) {
+		/* SubjectPublicKeyInfo around an RSAPublicKey. */
+		bits = d.p;
+		der_int(&d, parts.v[1], parts.len[1]);
+		der_int(&d, parts.v[0], parts.len[0]);
+		der_close(&d, 0x30, bits);
+		der_put(&d, "", 1);
+		der_close(&d, 0x03, bits);
+		der_alg(&d, oid_rsa, sizeof(oid_rsa),
+			(unsigned char *)"\x05\x00", 2);
+		der_close(&d, 0x30, end);
+
+		ret = jwk_prepare(key, alg, &d, end);
+	} else {
+		/* PKCS#8 around an RSAPrivateKey. */
+		oct = d.p;
+		for (i = JWK_MAX_PARTS - 1; i >= 0; i--)
+			der_int(&d, parts.v[i], parts.len[i]);
+		der_int(&d, (unsigned char *)"", 1);
+		der_close(&d, 0x30, oct);
+		der_close(&d, 0x04, oct);
+		der_alg(&d, oid_rsa, sizeof(oid_rsa),
+			(unsigned char *)"\x05\x00", 2);
+		der_int(&d, (unsigned char *)"", 1);
+		der_close(&d, 0x30, end);
+
+		ret = jwk_prepare(key, alg, &d, end);
+	}
+
+	jwt_wipe(d.start, size);
+	jwt_freemem(d.start);
+
+rsa_done:
+	jwk_parts_free(&parts);
+
+	return ret;
+}
+
+static int jwk_ec(json_t *jwk, jwt_alg_t alg, jwt_key_t **key)
+{
+	static const char * const names[] = { "x", "y", "d", NULL };
+	const char *crv = json_string_value(json_object_get(jwk, "crv"));
+	const unsigned char *oid;
+	struct jwk_parts parts;
+	struct der d = { NULL, NULL, 0 };
+	unsigned char *end, *bits, *ctx;
+	size_t oid_len, size;
+	jwt_alg_t def;
+	int ret;
+
+	if (crv == NULL)
+		return EINVAL;
+
+	if (!strcmp(crv, "P-256")) {
+		oid = oid_p256;
+		oid_len = sizeof(oid_p256);
+		def = JWT_ALG_ES256;
+	} else if (!strcmp(crv, "P-384")) {
+		oid = oid_p384;
+		oid_len = sizeof(oid_p384);
+		def = JWT_ALG_ES384;
+	} else if (!strcmp(crv, "P-521")) {
+		oid = oid_p521;
+		oid_len = sizeof(oid_p521);
+		def = JWT_ALG_ES512;
+	} else {
+		/* Not a curve we can sign with, skip it. */
+		*key = NULL;
+		return 0;
+	}
+
+	if (alg == JWT_ALG_INVAL)
+		alg = def;
+
+	ret = jwk_parts_get(&parts, jwk, names, 2);
+	if (ret)
+		goto ec_done;
+
+	size = parts.total + 128;
+	d.start = jwt_malloc(size);
+	if (d.start == NULL) {
+		ret = ENOMEM;
+		goto ec_done;
+	}
+	d.p = end = d.start + size;
+
+	if (parts.v[2] == NULL) {
+		/* SubjectPublicKeyInfo */
+		bits = d.p;
+		der_put(&d, parts.v[1], parts.len[1]);
+		der_put(&d, parts.v[0], parts.len[0]);
+		der_put(&d, "\x00\x04", 2);
+		der_close(&d, 0x03, bits);
+		der_alg(&d, oid_ec, sizeof(oid_ec), oid, oid_len);
+		der_close(&d, 0x30, end);
+
+		ret = jwk_prepare(key, alg, &d, end);
+	} else {
+		/* ECPrivateKey, from SEC 1. */
+		ctx = bits = d.p;
+		der_put(&d, parts.v[1], parts.len[1]);
+		der_put(&d, parts.v[0], parts.len[0]);
+		der_put(&d, "\x00\x04", 2);
+		der_close(&d, 0x03, bits);
+		der_close(&d, 0xa1, ctx);
+		ctx = d.p;
+		der_put(&d, oid, oid_len);
+		der_close(&d, 0xa0, ctx);
+		der_bytes(&d, 0x04, parts.v[2], parts.len[2]);
+		der_int(&d, (unsigned char *)"\x01", 1);
+		der_close(&d, 0x30, end);
+
+		ret = jwk_prepare(key, alg, &d, end);
+	}
+
+	jwt_wipe(d.start, size);
+	jwt_freemem(d.start);
+
+ec_done:
+	jwk_parts_free(&parts);
+
+	return ret;
+}
+
+static int jwk_okp(json_t *jwk, jwt_alg_t alg, jwt_key_t **key)
+{
+	static const char * const names[] = { "x", "d", NULL };
+	const char *crv = json_string_value(json_object_get(jwk, "crv"));
+	const unsigned char *oid;
+	struct jwk_parts parts;
+	struct der d = { NULL, NULL, 0 };
+	unsigned char *end, *bits, *oct;
+	size_t oid_len, size;
+	int ret;
+
+	if (crv == NULL)
+		return EINVAL;
+
+	if (!strcmp(crv, "Ed25519")) {
+		oid = oid_ed25519;
+		oid_len = sizeof(oid_ed25519);
+	} else if (!strcmp(crv, "Ed448")) {
+		oid = oid_ed448;
+		oid_len = sizeof(oid_ed448);
+	} else {
+		/* X25519 and X448 are for key agreement. */
+		*key = NULL;
+		return 0;
+	}
+
+	if (alg == JWT_ALG_INVAL)
+		alg = JWT_ALG_EDDSA;
+
+	ret = jwk_parts_get(&parts, jwk, names, 1);
+	if (ret)
+		goto okp_done;
+
+	size = parts.total + 64;
+	d.start = jwt_malloc(size);
+	if (d.start == NULL) {
+		ret = ENOMEM;
+		goto okp_done;
+	}
+	d.p = end = d.start + size;
+
+	if (parts.v[1] == NULL) {
+		/* SubjectPublicKeyInfo, from RFC 8410. */
+		bits = d.p;
+		der_put(&d, parts.v[0], parts.len[0]);
+		der_put(&d, "", 1);
+		der_close(&d, 0x03, bits);
+		der_alg(&d, oid, oid_len, NULL, 0);
+		der_close(&d, 0x30, end);
+
+		ret = jwk_prepare(key, alg, &d, end);
+	} else {
+		/* OneAsymmetricKey, with the private key alone. */
+		oct = d.p;
+		der_bytes(&d, 0x04, parts.v[1], parts.len[1]);
+		der_close(&d, 0x04, oct);
+		der_alg(&d, oid, oid_len, NULL, 0);
+		der_int(&d, (unsigned char *)"", 1);
+		der_close(&d, 0x30, end);
+
+		ret = jwk_prepare(key, alg, &d, end);
+	}
+
+	jwt_wipe(d.start, size);
+	jwt_freemem(d.start);
+
+okp_done:
+	jwk_parts_free(&parts);
+
+	return ret;
+}
+
+/* Prepare the key of one JWK. Keys that can't be used for signatures
+ * are skipped, by setting *key to NULL. */
+static int jwk_load(json_t *jwk, jwt_key_t **key, int *strict)
+{
+	const char *kty, *use, *alg_str;
+	jwt_alg_t alg = JWT_ALG_INVAL;
+
+	*key = NULL;
+	*strict = 0;
+
+	if (!json_is_object(jwk))
+		return EINVAL;
+
+	use = json_string_value(json_object_get(jwk, "use"));
+	if (use && strcmp(use, "sig"))
+		return 0;
+
+	alg_str = json_string_value(json_object_get(jwk, "alg"));
+	if (alg_str) {
+		alg = jwt_str_alg(alg_str);
+		if (alg == JWT_ALG_INVAL || alg == JWT_ALG_NONE)
+			return 0;
+		*strict = 1;
+	}
+
+	kty = json_string_value(json_object_get(jwk, "kty"));
+	if (kty == NULL)
+		return EINVAL;
+
+	if (!strcmp(kty, "oct"))
+		return jwk_oct(jwk, alg, key);
+	if (!strcmp(kty, "RSA"))
+		return jwk_rsa(jwk, alg, key);
+	if (!strcmp(kty, "EC"))
+		return jwk_ec(jwk, alg, key);
+	if (!strcmp(kty, "OKP"))
+		return jwk_okp(jwk, alg, key);
+
+	return 0;
+}
+
+/* FNV-1a */
+static uint32_t keyset_hash(const char *kid)
+{
+	uint32_t h = 2166136261U;
+
+	for (; *kid; kid++)
+		h = (h ^ (unsigned char)*kid) * 16777619U;
+
+	return h;
+}
+
+static struct keyset_entry *keyset_entry_new(const char *kid, jwt_key_t *key,
+					     int strict)
+{
+	struct keyset_entry *e;
+
+	if (kid == NULL)
+		kid = "";
+
+	e = jwt_malloc(sizeof(*e));
+	if (e == NULL)
+		return NULL;
+
+	memset(e, 0, sizeof(*e));
+
+	e->kid = jwt_strdup(kid);
+	if (e->kid == NULL) {
+		jwt_freemem(e);
+		return NULL;
+	}
+
+	e->hash = keyset_hash(kid);
+	e->key = key;
+	e->strict = strict;
+
+	return e;
+}
+
+static void keyset_entry_free(struct keyset_entry *e)
+{
+	jwt_key_free(e->key);
+	jwt_freemem(e->kid);
+	jwt_freemem(e);
+}
+
+static void keyset_insert(jwt_keyset_t *set, struct keyset_entry *e)
+{
+	struct keyset_entry **buckets, *next;
+	unsigned int size = set->size * 2, i;
+
+	/* Keep the chains short. A failed grow only makes them longer. */
+	if (set->count >= set->size) {
+		buckets = jwt_calloc(size, sizeof(*buckets));
+		if (buckets) {
+			for (i = 0; i < set->size; i++) {
+				for (; set->buckets[i]; set->buckets[i] = next) {
+					next = set->buckets[i]->next;
+					set->buckets[i]->next =
+						buckets[set->buckets[i]->hash &
+							(size - 1)];
+					buckets[set->buckets[i]->hash &
+						(size - 1)] = set->buckets[i];
+				}
+			}
+			jwt_freemem(set->buckets);
+			set->buckets = buckets;
+			set->size = size;
+		}
+	}
+
+	/* Keys added later are found first for the same kid. */
+	e->next = set->buckets[e->hash & (set->size - 1)];
+	set->buckets[e->hash & (set->size - 1)] = e;
+	set->count++;
+}
+
+int jwt_keyset_new(jwt_keyset_t **set)
+{
+	jwt_keyset_t *new;
+
+	if (!set)
+		return EINVAL;
+
+	*set = NULL;
+
+	new = jwt_malloc(sizeof(*new));
+	if (!new)
+		return ENOMEM;
+
+	new->buckets = jwt_calloc(KEYSET_MIN_BUCKETS, sizeof(*new->buckets));
+	if (!new->buckets) {
+		jwt_freemem(new);
+		return ENOMEM;
+	}
+
+	new->size = KEYSET_MIN_BUCKETS;
+	new->count = 0;
+
+	*set = new;
+
+	return 0;
+}
+
+void jwt_keyset_free(jwt_keyset_t *set)
+{
+	struct keyset_entry *e, *next;
+	unsigned int i;
+
+	if (!set)
+		return;
+
+	for (i = 0; i < set->size; i++) {
+		for (e = set->buckets[i]; e; e = next) {
+			next = e->next;
+			keyset_entry_free(e);
+		}
+	}
+
+	jwt_freemem(set->buckets);
+	jwt_freemem(set);
+}
+
+int jwt_keyset_add(jwt_keyset_t *set, const char *kid, jwt_key_t *key)
+{
+	struct keyset_entry *e;
+
+	if (!set || !key)
+		return EINVAL;
+
+	e = keyset_entry_new(kid, jwt_key_ref(key), 0);
+	if (!e) {
+		jwt_key_free(key);
+		return ENOMEM;
+	}
+
+	keyset_insert(set, e);
+
+	return 0;
+}
+
+int jwt_keyset_load_jwks(jwt_keyset_t *set, const char *jwks)
+{
+	struct keyset_entry *loaded = NULL, **tail = &loaded, *e;
+	json_t *js, *keys, *jwk;
+	jwt_key_t *key;
+	size_t i;
+	int strict, ret = 0;
+
+	if (!set || !jwks)
+		return EINVAL;
+
+	js = json_loads(jwks, JSON_REJECT_DUPLICATES, NULL);
+	if (!js)
+		return EINVAL;
+
+	/* A set of keys, or a lone JWK. */
+	keys = json_object_get(js, "keys");
+	if (!keys && json_object_get(js, "kty")) {
+		keys = json_array();
+		if (keys)
+			json_array_append_new(keys, json_incref(js));
+	} else {
+		json_incref(keys);
+	}
+
+	if (!json_is_array(keys)) {
+		ret = EINVAL;
+		goto load_done;
+	}
+
+	/* Nothing is added unless every key loads. */
+	json_array_foreach(keys, i, jwk) {
+		ret = jwk_load(jwk, &key, &strict);
+		if (ret)
+			goto load_done;
+		if (!key)
+			continue;
+
+		e = keyset_entry_new(json_string_value(
+				     json_object_get(jwk, "kid")), key, strict);
+		if (!e) {
+			jwt_key_free(key);
+			ret = ENOMEM;
+			goto load_done;
+		}
+
+		*tail = e;
+		tail = &e->next;
+	}
+
+	/* In document order, so the last of a duplicate kid wins. */
+	while (loaded) {
+		e = loaded;
+		loaded = e->next;
+		keyset_insert(set, e);
+	}
+
+load_done:
+	while (loaded) {
+		e = loaded;
+		loaded = e->next;
+		keyset_entry_free(e);
+	}
+
+	json_decref(keys);
+	json_decref(js);
+
+	return ret;
+}
+
+unsigned int jwt_keyset_count(jwt_keyset_t *set)
+{
+	return set ? set->count : 0;
+}
+
+jwt_key_t *jwt_keyset_lookup(jwt_keyset_t *set, const char *kid,
+			     jwt_alg_t alg)
+{
+	struct keyset_entry *e;
+	uint32_t hash;
+
+	if (!set)
+		return NULL;
+
+	if (kid == NULL)
+		kid = "";
+
+	hash = keyset_hash(kid);
+
+	for (e = set->buckets[hash & (set->size - 1)]; e; e = e->next) {
+		if (e->hash != hash || strcmp(e->kid, kid))
+			continue;
+
+		if (alg == JWT_ALG_INVAL)
+			return jwt_key_ref(e->key);
+
+		if (e->strict ? e->key->alg == alg : jwt_key_compat(e->key, alg))
+			return jwt_key_ref(e->key);
+	}
+
+	return NULL;
+}
+
+jwt_key_t *jwt_keyset_find(jwt_keyset_t *set, const char *kid)
+{
+	return jwt_keyset_lookup(set, kid, JWT_ALG_INVAL);
+}
@@ -0,0 +1,259 @@
+/* Copyright (C) 2015-2018 Ben Collins <ben@cyphre.com>
+   This file is part of the JWT C Library
+
+   This Source Code Form is subject to the terms of the Mozilla Public
+   License, v. 2.0. If a copy of the MPL was not distributed with this
+   file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+
+#include <jwt.h>
+
+#include "jwt-private.h"
+#include "config.h"
+
+/* Process wide cache of prepared keys, so callers that keep passing the
+ * same key bytes to jwt_set_alg() and jwt_decode() only pay for parsing
+ * them once. Entries are found through a small hash table and evicted in
+ * least recently used order. */
+
+#define KEY_CACHE_BUCKETS	64
+#define KEY_CACHE_DEFAULT_SIZE	16
+
+struct key_cache_entry {
+	uint64_t hash;
+	jwt_key_t *key;
+	struct key_cache_entry *hnext;
+	struct key_cache_entry *prev, *next;
+};
+
+static struct {
+	jwt_mutex_t lock;
+	struct key_cache_entry *buckets[KEY_CACHE_BUCKETS];
+	/* Most recently used at head. */
+	struct key_cache_entry *head, *tail;
+	unsigned int size;
+	unsigned int entries;
+	unsigned long hits, misses, evictions;
+} key_cache = {
+	JWT_MUTEX_INITIALIZER,
+	{ NULL },
+	NULL, NULL,
+	KEY_CACHE_DEFAULT_SIZE,
+	0,
+	0, 0, 0,
+};
+
+/* Not cryptographic, the key bytes are always compared on a match. */
+static uint64_t key_cache_hash(jwt_alg_t alg, const unsigned char *data,
+			       int len)
+{
+	const uint64_t mul = 0x9e3779b97f4a7c15ULL;
+	uint64_t h = ((uint64_t)alg << 32) ^ (uint64_t)len;
+	uint64_t w;
+	int i;
+
+	for (i = 0; i + 8 <= len; i += 8) {
+		memcpy(&w, data + i, 8);
+		h = (h ^ w) * mul;
+		h ^= h >> 29;
+	}
+
+	for (w = 0; i < len; i++)
+		w = (w << 8) | data[i];
+
+	h = (h ^ w) * mul;
+	h ^= h >> 32;
+
+	return h;
+}
+
+static struct key_cache_entry *key_cache_find(uint64_t hash, jwt_alg_t alg,
+					      const unsigned char *data,
+					      int len)
+{
+	struct key_cache_entry *e;
+
+	for (e = key_cache.buckets[hash % KEY_CACHE_BUCKETS]; e; e = e->hnext) {
+		if (e->hash == hash && e->key->alg == alg &&
+		    e->key->len == len && !memcmp(e->key->data, data, len))
+			return e;
+	}
+
+	return NULL;
+}
+
+static void key_cache_unlink(struct key_cache_entry *e)
+{
+	if (e->prev)
+		e->prev->next = e->next;
+	else
+		key_cache.head = e->next;
+
+	if (e->next)
+		e->next->prev = e->prev;
+	else
+		key_cache.tail = e->prev;
+
+	e->prev = e->next = NULL;
+}
+
+static void key_cache_push(struct key_cache_entry *e)
+{
+	e->prev = NULL;
+	e->next = key_cache.head;
+
+	if (key_cache.head)
+		key_cache.head->prev = e;
+	else
+		key_cache.tail = e;
+
+	key_cache.head = e;
+}
+
+/* Called with the lock held. Keys still in use elsewhere stay alive
+ * until their last reference is dropped. */
+static void key_cache_remove(struct key_cache_entry *e)
+{
+	struct key_cache_entry **p;
+
+	for (p = &key_cache.buckets[e->hash % KEY_CACHE_BUCKETS]; *p;
+	     p = &(*p)->hnext) {
+		if (*p == e) {
+			*p = e->hnext;
+			break;
+		}
+	}
+
+	key_cache_unlink(e);
+	key_cache.entries--;
+
+	jwt_key_free(e->key);
+	jwt_freemem(e);
+}
+
+static void key_cache_trim(unsigned int size)
+{
+	while (key_cache.entries > size) {
+		key_cache_remove(key_cache.tail);
+		key_cache.evictions++;
+	}
+}
+
+int jwt_key_cache_get(jwt_key_t **key, jwt_alg_t alg,
+		      const unsigned char *data, int len)
+{
+	struct key_cache_entry *e;
+	jwt_key_t *new;
+	uint64_t hash;
+	int ret;
+
+	*key = NULL;
+
+	if (data == NULL || len <= 0)
+		return 0;
+
+	hash = key_cache_hash(alg, data, len);
+
+	jwt_mutex_lock(&key_cache.lock);
+
+	if (!key_cache.size) {
+		jwt_mutex_unlock(&key_cache.lock);
+		return 0;
+	}
+
+	e = key_cache_find(hash, alg, data, len);
+	if (e) {
+		key_cache.hits++;
+		key_cache_unlink(e);
+		key_cache_push(e);
+		*key = jwt_key_ref(e->key);
+		jwt_mutex_unlock(&key_cache.lock);
+		return 0;
+	}
+
+	key_cache.misses++;
+
+	jwt_mutex_unlock(&key_cache.lock);
+
+	/* Parsing can be slow, so don't hold the lock for it. */
+	ret = jwt_key_new(&new, alg, data, len);
+	if (ret)
+		return ret;
+
+	e = jwt_malloc(sizeof(*e));
+	if (e == NULL) {
+		/* Still usable, just not cached. */
+		*key = new;
+		return 0;
+	}
+
+	memset(e, 0, sizeof(*e));
+	e->hash = hash;
+	e->key = new;
+
+	jwt_mutex_lock(&key_cache.lock);
+
+	/* Another thread may have added the same key meanwhile, or the
+	 * cache may have been turned off. */
+	if (!key_cache.size || key_cache_find(hash, alg, data, len)) {
+		jwt_mutex_unlock(&key_cache.lock);
+		jwt_freemem(e);
+		*key = new;
+		return 0;
+	}
+
+	e->hnext = key_cache.buckets[hash % KEY_CACHE_BUCKETS];
+	key_cache.buckets[hash % KEY_CACHE_BUCKETS] = e;
+	key_cache_push(e);
+	key_cache.entries++;
+
+	*key = jwt_key_ref(new);
+
+	key_cache_trim(key_cache.size);
+
+	jwt_mutex_unlock(&key_cache.lock);
+
+	return 0;
+}
+
+int jwt_key_cache_set_size(unsigned int size)
+{
+	jwt_mutex_lock(&key_cache.lock);
+
+	key_cache.size = size;
+	key_cache_trim(size);
+
+	jwt_mutex_unlock(&key_cache.lock);
+
+	return 0;
+}
+
+void jwt_key_cache_flush(void)
+{
+	jwt_mutex_lock(&key_cache.lock);
+
+	while (key_cache.head)
+		key_cache_remove(key_cache.head);
+
+	jwt_mutex_unlock(&key_cache.lock);
+}
+
+void jwt_key_cache_get_stats(jwt_cache_stats_t *stats)
+{
+	if (!stats)
+		return;
+
+	jwt_mutex_lock(&key_cache.lock);
+
+	stats->size = key_cache.size;
+	stats->entries = key_cache.entries;
+	stats->hits = key_cache.hits;
+	stats->misses = key_cache.misses;
+	stats->evictions = key_cache.evictions;
+
+	jwt_mutex_unlock(&key_cache.lock);
+}
@@ -0,0 +1,130 @@
+/* Copyright (C) 2015-2018 Ben Collins <ben@cyphre.com>
+   This file is part of the JWT C Library
+
+   This Source Code Form is subject to the terms of the Mozilla Public
+   License, v. 2.0. If a copy of the MPL was not distributed with this
+   file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <jwt.h>
+
+#include "jwt-private.h"
+#include "config.h"
+
+/* A keyring holds the current generation of a key, which is swapped for
+ * a new one without ever blocking readers, in the manner of RCU.
+ *
+ * Readers take their own reference to the key, so the only danger is a
+ * key being freed between loading the pointer and taking the reference.
+ * Readers announce themselves in one of two counters for that short
+ * window, picked by the parity of the epoch. Rotation publishes the new
+ * key, moves the epoch on, and waits for the counter of the old epoch to
+ * drain before dropping the keyring's reference to the old key. Readers
+ * already using it keep it alive until they are done. */
+
+struct jwt_keyring {
+	jwt_key_t *key;
+	volatile long generation;
+	volatile long epoch;
+	volatile long readers[2];
+};
+
+/* Rotation is rare, so one lock for all keyrings will do. */
+static jwt_mutex_t keyring_lock = JWT_MUTEX_INITIALIZER;
+
+int jwt_keyring_new(jwt_keyring_t **ring, jwt_key_t *key)
+{
+	jwt_keyring_t *new;
+
+	if (!ring)
+		return EINVAL;
+
+	*ring = NULL;
+
+	new = jwt_malloc(sizeof(*new));
+	if (!new)
+		return ENOMEM;
+
+	memset(new, 0, sizeof(*new));
+
+	if (key) {
+		new->key = jwt_key_ref(key);
+		new->generation = 1;
+	}
+
+	*ring = new;
+
+	return 0;
+}
+
+void jwt_keyring_free(jwt_keyring_t *ring)
+{
+	if (!ring)
+		return;
+
+	jwt_key_free(ring->key);
+	jwt_freemem(ring);
+}
+
+int jwt_keyring_set(jwt_keyring_t *ring, jwt_key_t *key)
+{
+	jwt_key_t *old;
+	long epoch;
+
+	if (!ring)
+		return EINVAL;
+
+	jwt_mutex_lock(&keyring_lock);
+
+	old = jwt_atomic_xchg_ptr(&ring->key, jwt_key_ref(key));
+	jwt_atomic_inc(&ring->generation);
+
+	/* Readers that come after this see the new key. Wait out those
+	 * that may still be picking up the old one. */
+	epoch = jwt_atomic_inc(&ring->epoch) - 1;
+	jwt_atomic_fence();
+
+	while (jwt_atomic_get(&ring->readers[epoch & 1]))
+		jwt_yield();
+
+	jwt_mutex_unlock(&keyring_lock);
+
+	jwt_key_free(old);
+
+	return 0;
+}
+
+jwt_key_t *jwt_keyring_get(jwt_keyring_t *ring)
+{
+	jwt_key_t *key;
+	long epoch;
+
+	if (!ring)
+		return NULL;
+
+	for (;;) {
+		epoch = jwt_atomic_get(&ring->epoch);
+		jwt_atomic_inc(&ring->readers[epoch & 1]);
+		jwt_atomic_fence();
+
+		/* Only counted if the epoch did not move on meanwhile. */
+		if (jwt_atomic_get(&ring->epoch) == epoch)
+			break;
+
+		jwt_atomic_dec(&ring->readers[epoch & 1]);
+	}
+
+	key = jwt_key_ref(jwt_atomic_get_ptr(&ring->key));
+
+	jwt_atomic_dec(&ring->readers[epoch & 1]);
+
+	return key;
+}
+
+unsigned long jwt_keyring_generation(jwt_keyring_t *ring)
+{
+	return ring ? (unsigned long)jwt_atomic_get(&ring->generation) : 0;
+}
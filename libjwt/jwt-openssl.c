@@ -14,221 +14,1956 @@
 #include <openssl/hmac.h>
 #include <openssl/buffer.h>
 #include <openssl/pem.h>
+#include <openssl/x509.h>
+#include <openssl/ec.h>
+#include <openssl/err.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/core_names.h>
+#include <openssl/param_build.h>
+#endif
+
+#include <jwt.h>
+
+#include "jwt-private.h"
+#include "config.h"
+
+/* Routines to support crypto in LibJWT using OpenSSL. */
+
+/* Functions to make libjwt backward compatible with OpenSSL version < 1.1.0
+ * See https://wiki.openssl.org/index.php/1.1_API_Changes
+ */
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+
+static HMAC_CTX *HMAC_CTX_new(void)
+{
+	HMAC_CTX *ctx = OPENSSL_malloc(sizeof(*ctx));
+
+	if (ctx != NULL)
+		HMAC_CTX_init(ctx);
+
+	return ctx;
+}
+
+static void HMAC_CTX_free(HMAC_CTX *ctx)
+{
+	if (ctx == NULL)
+		return;
+
+	HMAC_CTX_cleanup(ctx);
+	OPENSSL_free(ctx);
+}
+
+#endif
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+
+/* Every EVP_sha256() style lookup goes through the provider machinery,
+ * which takes global locks. The algorithms LibJWT uses are fetched once
+ * and kept here instead. */
+static struct {
+	jwt_mutex_t lock;
+	volatile long ready;
+	OSSL_LIB_CTX *libctx;
+	EVP_MD *sha256;
+	EVP_MD *sha384;
+	EVP_MD *sha512;
+	EVP_MAC *hmac;
+} fetch_cache = {
+	JWT_MUTEX_INITIALIZER,
+	0,
+	NULL,
+	NULL, NULL, NULL,
+	NULL,
+};
+
+/* Called with the lock held. */
+static void fetch_cache_free(void)
+{
+	jwt_atomic_set(&fetch_cache.ready, 0);
+
+	EVP_MD_free(fetch_cache.sha256);
+	EVP_MD_free(fetch_cache.sha384);
+	EVP_MD_free(fetch_cache.sha512);
+	EVP_MAC_free(fetch_cache.hmac);
+
+	fetch_cache.sha256 = fetch_cache.sha384 = fetch_cache.sha512 = NULL;
+	fetch_cache.hmac = NULL;
+}
+
+/* Called with the lock held. The context stays bound even if fetching
+ * from it fails, so a restricted context such as FIPS is never quietly
+ * swapped for the default one. */
+static int fetch_cache_load(OSSL_LIB_CTX *libctx)
+{
+	fetch_cache_free();
+
+	fetch_cache.libctx = libctx;
+	fetch_cache.sha256 = EVP_MD_fetch(libctx, "SHA256", NULL);
+	fetch_cache.sha384 = EVP_MD_fetch(libctx, "SHA384", NULL);
+	fetch_cache.sha512 = EVP_MD_fetch(libctx, "SHA512", NULL);
+	fetch_cache.hmac = EVP_MAC_fetch(libctx, "HMAC", NULL);
+
+	if (fetch_cache.sha256 == NULL || fetch_cache.sha384 == NULL ||
+	    fetch_cache.sha512 == NULL || fetch_cache.hmac == NULL) {
+		fetch_cache_free();
+		return EINVAL;
+	}
+
+	jwt_atomic_set(&fetch_cache.ready, 1);
+
+	return 0;
+}
+
+static int fetch_cache_ready(void)
+{
+	int ret = 0;
+
+	if (jwt_atomic_get(&fetch_cache.ready))
+		return 0;
+
+	jwt_mutex_lock(&fetch_cache.lock);
+	if (!fetch_cache.ready)
+		ret = fetch_cache_load(fetch_cache.libctx);
+	jwt_mutex_unlock(&fetch_cache.lock);
+
+	return ret;
+}
+
+static const EVP_MD *jwt_md(jwt_alg_t alg)
+{
+	if (fetch_cache_ready())
+		return NULL;
+
+	switch (alg) {
+	case JWT_ALG_HS256:
+	case JWT_ALG_RS256:
+	case JWT_ALG_ES256:
+		return fetch_cache.sha256;
+	case JWT_ALG_HS384:
+	case JWT_ALG_RS384:
+	case JWT_ALG_ES384:
+		return fetch_cache.sha384;
+	case JWT_ALG_HS512:
+	case JWT_ALG_RS512:
+	case JWT_ALG_ES512:
+		return fetch_cache.sha512;
+	default:
+		return NULL;
+	}
+}
+
+#else
+
+static int fetch_cache_ready(void)
+{
+	return 0;
+}
+
+static const EVP_MD *jwt_md(jwt_alg_t alg)
+{
+	switch (alg) {
+	case JWT_ALG_HS256:
+	case JWT_ALG_RS256:
+	case JWT_ALG_ES256:
+		return EVP_sha256();
+	case JWT_ALG_HS384:
+	case JWT_ALG_RS384:
+	case JWT_ALG_ES384:
+		return EVP_sha384();
+	case JWT_ALG_HS512:
+	case JWT_ALG_RS512:
+	case JWT_ALG_ES512:
+		return EVP_sha512();
+	default:
+		return NULL;
+	}
+}
+
+#endif
+
+/* HMAC keys keep a context that has already absorbed the ipad and opad
+ * blocks. Contexts are copied from it, and once finished can be set back
+ * to that state and reused without going through the key again. */
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+
+typedef EVP_MAC_CTX jwt_mac_ctx_t;
+
+static jwt_mac_ctx_t *jwt_mac_new(jwt_key_t *key, const EVP_MD *md)
+{
+	OSSL_PARAM params[2];
+	EVP_MAC_CTX *ctx;
+
+	ctx = EVP_MAC_CTX_new(fetch_cache.hmac);
+	if (ctx == NULL)
+		return NULL;
+
+	params[0] = OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST,
+						     (char *)EVP_MD_get0_name(md), 0);
+	params[1] = OSSL_PARAM_construct_end();
+
+	if (!EVP_MAC_init(ctx, key->data, key->len, params)) {
+		EVP_MAC_CTX_free(ctx);
+		return NULL;
+	}
+
+	return ctx;
+}
+
+static jwt_mac_ctx_t *jwt_mac_dup(jwt_mac_ctx_t *ctx)
+{
+	return EVP_MAC_CTX_dup(ctx);
+}
+
+static void jwt_mac_free(jwt_mac_ctx_t *ctx)
+{
+	EVP_MAC_CTX_free(ctx);
+}
+
+static int jwt_mac_run(jwt_mac_ctx_t *ctx, const char *str,
+		       unsigned char *out, unsigned int *len)
+{
+	size_t out_len;
+
+	/* Passing no key starts over with the one already set. */
+	if (!EVP_MAC_init(ctx, NULL, 0, NULL) ||
+	    !EVP_MAC_update(ctx, (const unsigned char *)str, strlen(str)) ||
+	    !EVP_MAC_final(ctx, out, &out_len, EVP_MAX_MD_SIZE))
+		return EINVAL;
+
+	*len = out_len;
+
+	return 0;
+}
+
+static int jwt_mac_stream(jwt_mac_ctx_t *ctx, jwt_input_next_t next,
+			  void *arg, unsigned char *out, unsigned int *len)
+{
+	const char *piece;
+	size_t n, out_len;
+
+	if (!EVP_MAC_init(ctx, NULL, 0, NULL))
+		return EINVAL;
+
+	while ((n = next(arg, &piece)) != 0) {
+		if (!EVP_MAC_update(ctx, (const unsigned char *)piece, n))
+			return EINVAL;
+	}
+
+	if (!EVP_MAC_final(ctx, out, &out_len, JWT_HMAC_MAX_LEN))
+		return EINVAL;
+
+	*len = out_len;
+
+	return 0;
+}
+
+#else
+
+typedef HMAC_CTX jwt_mac_ctx_t;
+
+static jwt_mac_ctx_t *jwt_mac_new(jwt_key_t *key, const EVP_MD *md)
+{
+	HMAC_CTX *ctx;
+
+	ctx = HMAC_CTX_new();
+	if (ctx == NULL)
+		return NULL;
+
+	if (!HMAC_Init_ex(ctx, key->data, key->len, md, NULL)) {
+		HMAC_CTX_free(ctx);
+		return NULL;
+	}
+
+	return ctx;
+}
+
+static jwt_mac_ctx_t *jwt_mac_dup(jwt_mac_ctx_t *ctx)
+{
+	HMAC_CTX *new;
+
+	new = HMAC_CTX_new();
+	if (new == NULL)
+		return NULL;
+
+	if (!HMAC_CTX_copy(new, ctx)) {
+		HMAC_CTX_free(new);
+		return NULL;
+	}
+
+	return new;
+}
+
+static void jwt_mac_free(jwt_mac_ctx_t *ctx)
+{
+	HMAC_CTX_free(ctx);
+}
+
+static int jwt_mac_run(jwt_mac_ctx_t *ctx, const char *str,
+		       unsigned char *out, unsigned int *len)
+{
+	/* Passing no key starts over with the one already set. */
+	if (!HMAC_Init_ex(ctx, NULL, 0, NULL, NULL) ||
+	    !HMAC_Update(ctx, (const unsigned char *)str, strlen(str)) ||
+	    !HMAC_Final(ctx, out, len))
+		return EINVAL;
+
+	return 0;
+}
+
+static int jwt_mac_stream(jwt_mac_ctx_t *ctx, jwt_input_next_t next,
+			  void *arg, unsigned char *out, unsigned int *len)
+{
+	const char *piece;
+	size_t n;
+
+	if (!HMAC_Init_ex(ctx, NULL, 0, NULL, NULL))
+		return EINVAL;
+
+	while ((n = next(arg, &piece)) != 0) {
+		if (!HMAC_Update(ctx, (const unsigned char *)piece, n))
+			return EINVAL;
+	}
+
+	if (!HMAC_Final(ctx, out, len))
+		return EINVAL;
+
+	return 0;
+}
+
+#endif
+
+static int jwt_prepare_hmac(jwt_key_t *key, const EVP_MD *md)
+{
+	if (md == NULL)
+		return EINVAL;
+
+	key->parsed = jwt_mac_new(key, md);
+	if (key->parsed == NULL)
+		return EINVAL;
+
+	return 0;
+}
+
+static void jwt_release_hmac(jwt_key_t *key)
+{
+	jwt_mac_free(key->parsed);
+}
+
+/* Keys and operations are bound to the library context in use. */
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+
+static EVP_PKEY *jwt_read_pubkey(BIO *bio)
+{
+	return PEM_read_bio_PUBKEY_ex(bio, NULL, NULL, NULL,
+				      fetch_cache.libctx, NULL);
+}
+
+static EVP_PKEY *jwt_read_privkey(BIO *bio)
+{
+	return PEM_read_bio_PrivateKey_ex(bio, NULL, NULL, NULL,
+					  fetch_cache.libctx, NULL);
+}
+
+static EVP_PKEY *jwt_d2i_pubkey(const unsigned char **der, long len)
+{
+	return d2i_PUBKEY_ex(NULL, der, len, fetch_cache.libctx, NULL);
+}
+
+static EVP_PKEY *jwt_d2i_privkey(const unsigned char **der, long len)
+{
+	return d2i_AutoPrivateKey_ex(NULL, der, len, fetch_cache.libctx, NULL);
+}
+
+static EVP_PKEY *jwt_raw_eddsa(jwt_key_t *key, int priv)
+{
+	const char *name;
+
+	if (key->len == 32)
+		name = "ED25519";
+	else if (key->len == 57)
+		name = "ED448";
+	else
+		return NULL;
+
+	if (priv)
+		return EVP_PKEY_new_raw_private_key_ex(fetch_cache.libctx, name,
+						       NULL, key->data,
+						       key->len);
+
+	return EVP_PKEY_new_raw_public_key_ex(fetch_cache.libctx, name, NULL,
+					      key->data, key->len);
+}
+
+/* The public key is worked out from a private one, so that it can verify
+ * as well. */
+static EVP_PKEY *jwt_raw_ec(jwt_key_t *key, int nid, int priv)
+{
+	unsigned char pub[1 + 2 * JWT_EC_MAX_LEN];
+	const unsigned char *point = key->data;
+	size_t point_len = key->len;
+	OSSL_PARAM_BLD *bld = NULL;
+	OSSL_PARAM *params = NULL;
+	EVP_PKEY_CTX *ctx = NULL;
+	EVP_PKEY *pkey = NULL;
+	EC_GROUP *group;
+	EC_POINT *pt = NULL;
+	BIGNUM *d = NULL;
+
+	group = EC_GROUP_new_by_curve_name_ex(fetch_cache.libctx, NULL, nid);
+	if (group == NULL)
+		return NULL;
+
+	if (priv) {
+		d = BN_secure_new();
+		pt = EC_POINT_new(group);
+		if (d == NULL || pt == NULL ||
+		    !BN_bin2bn(key->data, key->len, d) || BN_is_zero(d) ||
+		    BN_cmp(d, EC_GROUP_get0_order(group)) >= 0 ||
+		    !EC_POINT_mul(group, pt, d, NULL, NULL, NULL))
+			goto raw_ec_done;
+
+		point_len = EC_POINT_point2oct(group, pt,
+					       POINT_CONVERSION_UNCOMPRESSED,
+					       pub, sizeof(pub), NULL);
+		if (point_len == 0)
+			goto raw_ec_done;
+		point = pub;
+	}
+
+	bld = OSSL_PARAM_BLD_new();
+	if (bld == NULL ||
+	    !OSSL_PARAM_BLD_push_utf8_string(bld, OSSL_PKEY_PARAM_GROUP_NAME,
+					     OBJ_nid2sn(nid), 0) ||
+	    !OSSL_PARAM_BLD_push_octet_string(bld, OSSL_PKEY_PARAM_PUB_KEY,
+					      point, point_len) ||
+	    (d && !OSSL_PARAM_BLD_push_BN(bld, OSSL_PKEY_PARAM_PRIV_KEY, d)))
+		goto raw_ec_done;
+
+	params = OSSL_PARAM_BLD_to_param(bld);
+	ctx = EVP_PKEY_CTX_new_from_name(fetch_cache.libctx, "EC", NULL);
+	if (params == NULL || ctx == NULL || EVP_PKEY_fromdata_init(ctx) <= 0)
+		goto raw_ec_done;
+
+	/* This checks that the point is on the curve. */
+	if (EVP_PKEY_fromdata(ctx, &pkey, d ? EVP_PKEY_KEYPAIR :
+			      EVP_PKEY_PUBLIC_KEY, params) <= 0)
+		pkey = NULL;
+
+raw_ec_done:
+	EVP_PKEY_CTX_free(ctx);
+	OSSL_PARAM_free(params);
+	OSSL_PARAM_BLD_free(bld);
+	EC_POINT_free(pt);
+	BN_clear_free(d);
+	EC_GROUP_free(group);
+
+	return pkey;
+}
+
+static EVP_PKEY_CTX *jwt_pkey_ctx_new(EVP_PKEY *pkey)
+{
+	return EVP_PKEY_CTX_new_from_pkey(fetch_cache.libctx, pkey, NULL);
+}
+
+#else
+
+static EVP_PKEY *jwt_read_pubkey(BIO *bio)
+{
+	return PEM_read_bio_PUBKEY(bio, NULL, NULL, NULL);
+}
+
+static EVP_PKEY *jwt_read_privkey(BIO *bio)
+{
+	return PEM_read_bio_PrivateKey(bio, NULL, NULL, NULL);
+}
+
+static EVP_PKEY *jwt_d2i_pubkey(const unsigned char **der, long len)
+{
+	return d2i_PUBKEY(NULL, der, len);
+}
+
+static EVP_PKEY *jwt_d2i_privkey(const unsigned char **der, long len)
+{
+	return d2i_AutoPrivateKey(NULL, der, len);
+}
+
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+static EVP_PKEY *jwt_raw_eddsa(jwt_key_t *key, int priv)
+{
+	int type;
+
+	if (key->len == 32)
+		type = EVP_PKEY_ED25519;
+	else if (key->len == 57)
+		type = EVP_PKEY_ED448;
+	else
+		return NULL;
+
+	if (priv)
+		return EVP_PKEY_new_raw_private_key(type, NULL, key->data,
+						    key->len);
+
+	return EVP_PKEY_new_raw_public_key(type, NULL, key->data, key->len);
+}
+#endif
+
+/* The public key is worked out from a private one, so that it can verify
+ * as well. */
+static EVP_PKEY *jwt_raw_ec(jwt_key_t *key, int nid, int priv)
+{
+	EC_KEY *ec = EC_KEY_new_by_curve_name(nid);
+	const EC_GROUP *group;
+	BIGNUM *d = NULL, *order = NULL;
+	EVP_PKEY *pkey = NULL;
+	EC_POINT *pt = NULL;
+
+	if (ec == NULL)
+		return NULL;
+
+	group = EC_KEY_get0_group(ec);
+	pt = EC_POINT_new(group);
+	if (pt == NULL)
+		goto raw_ec_done;
+
+	if (priv) {
+		d = BN_bin2bn(key->data, key->len, NULL);
+		order = BN_new();
+		if (d == NULL || order == NULL ||
+		    !EC_GROUP_get_order(group, order, NULL) ||
+		    BN_is_zero(d) || BN_cmp(d, order) >= 0 ||
+		    !EC_KEY_set_private_key(ec, d) ||
+		    !EC_POINT_mul(group, pt, d, NULL, NULL, NULL))
+			goto raw_ec_done;
+	} else if (!EC_POINT_oct2point(group, pt, key->data, key->len, NULL)) {
+		goto raw_ec_done;
+	}
+
+	if (!EC_KEY_set_public_key(ec, pt) || !EC_KEY_check_key(ec))
+		goto raw_ec_done;
+
+	pkey = EVP_PKEY_new();
+	if (pkey == NULL || !EVP_PKEY_assign_EC_KEY(pkey, ec)) {
+		EVP_PKEY_free(pkey);
+		pkey = NULL;
+		goto raw_ec_done;
+	}
+
+	/* Now owned by pkey. */
+	ec = NULL;
+
+raw_ec_done:
+	EC_KEY_free(ec);
+	EC_POINT_free(pt);
+	BN_clear_free(d);
+	BN_free(order);
+
+	return pkey;
+}
+
+static EVP_PKEY_CTX *jwt_pkey_ctx_new(EVP_PKEY *pkey)
+{
+	return EVP_PKEY_CTX_new(pkey, NULL);
+}
+
+#endif
+
+static EVP_PKEY *jwt_read_pem(jwt_key_t *key)
+{
+	EVP_PKEY *pkey;
+	BIO *bufkey;
+
+	bufkey = BIO_new_mem_buf(key->data, key->len);
+	if (bufkey == NULL)
+		return NULL;
+
+	/* Try a public key first, since only reading a private key can end
+	 * up asking for a passphrase. */
+	pkey = jwt_read_pubkey(bufkey);
+	if (pkey == NULL) {
+		ERR_clear_error();
+		(void)BIO_reset(bufkey);
+
+		/* This uses OpenSSL's default passphrase callback if needed.
+		 * The library caller can override this in many ways, all of
+		 * which are outside of the scope of LibJWT and this is
+		 * documented in jwt.h. */
+		pkey = jwt_read_privkey(bufkey);
+		key->priv = 1;
+	}
+
+	BIO_free(bufkey);
+
+	return pkey;
+}
+
+static EVP_PKEY *jwt_read_der(jwt_key_t *key)
+{
+	const unsigned char *p = key->data;
+	EVP_PKEY *pkey;
+
+	pkey = jwt_d2i_pubkey(&p, key->len);
+	if (pkey == NULL) {
+		ERR_clear_error();
+		p = key->data;
+		pkey = jwt_d2i_privkey(&p, key->len);
+		key->priv = 1;
+	}
+
+	/* Nothing may follow the key. */
+	if (pkey != NULL && p != key->data + key->len) {
+		EVP_PKEY_free(pkey);
+		return NULL;
+	}
+
+	return pkey;
+}
+
+/* Raw keys carry no type, the alg says what they are. For EC it also
+ * picks the curve. */
+static EVP_PKEY *jwt_read_raw(jwt_key_t *key)
+{
+	int priv = key->format == JWT_KEY_FORMAT_RAW_PRIV;
+
+	key->priv = priv;
+
+	switch (key->alg) {
+	case JWT_ALG_ES256:
+		return jwt_raw_ec(key, NID_X9_62_prime256v1, priv);
+	case JWT_ALG_ES384:
+		return jwt_raw_ec(key, NID_secp384r1, priv);
+	case JWT_ALG_ES512:
+		return jwt_raw_ec(key, NID_secp521r1, priv);
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+	case JWT_ALG_EDDSA:
+		return jwt_raw_eddsa(key, priv);
+#endif
+	default:
+		return NULL;
+	}
+}
+
+/* EdDSA keys can be on either curve, other algorithms take one type. */
+static int jwt_pkey_match(EVP_PKEY *pkey, int type)
+{
+	int id = EVP_PKEY_id(pkey);
+
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+	if (type == EVP_PKEY_ED25519 && id == EVP_PKEY_ED448)
+		return 1;
+#endif
+
+	return id == type;
+}
+
+/* The kinds of context an operation can ask for. */
+enum {
+	JWT_CTX_MAC,
+	JWT_CTX_SIGN,
+	JWT_CTX_VERIFY,
+};
+
+static void *jwt_ctx_new(jwt_key_t *key, jwt_alg_t alg, const EVP_MD *md,
+			 int op)
+{
+	EVP_PKEY_CTX *pctx;
+	int ret;
+
+	if (op == JWT_CTX_MAC) {
+		/* The prepared context is bound to the digest the key was
+		 * created for. Keys are also accepted for the other HS
+		 * algorithms, which start from the raw key instead. */
+		if (key->parsed != NULL && key->alg == alg)
+			return jwt_mac_dup(key->parsed);
+
+		return jwt_mac_new(key, md);
+	}
+
+	pctx = jwt_pkey_ctx_new(key->parsed);
+	if (pctx == NULL)
+		return NULL;
+
+	if (op == JWT_CTX_SIGN)
+		ret = EVP_PKEY_sign_init(pctx);
+	else
+		ret = EVP_PKEY_verify_init(pctx);
+
+	if (ret != 1 || EVP_PKEY_CTX_set_signature_md(pctx, md) != 1) {
+		EVP_PKEY_CTX_free(pctx);
+		return NULL;
+	}
+
+	return pctx;
+}
+
+static void jwt_ctx_free(int op, void *ctx)
+{
+	if (op == JWT_CTX_MAC)
+		jwt_mac_free(ctx);
+	else
+		EVP_PKEY_CTX_free(ctx);
+}
+
+/* Setting up contexts allocates, and under load the allocations add up.
+ * Each thread keeps the contexts for the last few keys it used, and a
+ * digest context, and reuses them. Slots are tagged with the key id,
+ * and ids are never reused, so a slot for a released key just stops
+ * matching. jwt_ctx_get() takes over the least recently used slot, which
+ * is where those end up. The thread that releases a key drops its own
+ * slots for it right away, and logs the id so the rest drop theirs the
+ * next time they ask for a context, rather than holding on to the key
+ * material until the slot is needed.
+ * Needs the thread local storage from OpenSSL 1.1. */
+#define THREAD_CTX_SLOTS	8
+
+struct thread_ctx_slot {
+	uint64_t key_id;
+	jwt_alg_t alg;
+	int op;
+	void *ctx;
+	unsigned long used;
+};
+
+struct thread_ctx {
+	long epoch;
+	long release_seq;
+	EVP_MD_CTX *mdctx;
+	unsigned long tick;
+	struct thread_ctx_slot slots[THREAD_CTX_SLOTS];
+};
+
+/* Bumped when the library context changes, so every thread drops the
+ * contexts it made from the old one the next time it asks for one. */
+static volatile long thread_ctx_epoch;
+
+static void thread_ctx_flush(struct thread_ctx *tc)
+{
+	struct thread_ctx_slot *slot;
+	int i;
+
+	for (i = 0; i < THREAD_CTX_SLOTS; i++) {
+		slot = &tc->slots[i];
+		if (slot->ctx)
+			jwt_ctx_free(slot->op, slot->ctx);
+		slot->ctx = NULL;
+	}
+}
+
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+
+static CRYPTO_ONCE thread_ctx_once = CRYPTO_ONCE_STATIC_INIT;
+static CRYPTO_THREAD_LOCAL thread_ctx_local;
+static int thread_ctx_local_ok;
+
+/* The last few key ids released, by release sequence. A thread that
+ * fell further behind than this drops all of its slots instead. */
+#define THREAD_CTX_RELEASED	64
+
+static struct {
+	jwt_mutex_t lock;
+	volatile long seq;
+	uint64_t ids[THREAD_CTX_RELEASED];
+} thread_ctx_released = {
+	.lock = JWT_MUTEX_INITIALIZER,
+};
+
+static void thread_ctx_free(void *arg)
+{
+	struct thread_ctx *tc = arg;
+
+	if (tc == NULL)
+		return;
+
+	thread_ctx_flush(tc);
+	EVP_MD_CTX_free(tc->mdctx);
+	jwt_freemem(tc);
+}
+
+static void thread_ctx_init(void)
+{
+	thread_ctx_local_ok = CRYPTO_THREAD_init_local(&thread_ctx_local,
+						       thread_ctx_free);
+}
+
+/* The calling thread's contexts, or NULL if it has none yet. */
+static struct thread_ctx *thread_ctx_peek(void)
+{
+	if (!CRYPTO_THREAD_run_once(&thread_ctx_once, thread_ctx_init) ||
+	    !thread_ctx_local_ok)
+		return NULL;
+
+	return CRYPTO_THREAD_get_local(&thread_ctx_local);
+}
+
+static struct thread_ctx *thread_ctx(void)
+{
+	struct thread_ctx *tc;
+
+	tc = thread_ctx_peek();
+	if (tc != NULL || !thread_ctx_local_ok)
+		return tc;
+
+	tc = jwt_malloc(sizeof(*tc));
+	if (tc == NULL)
+		return NULL;
+
+	memset(tc, 0, sizeof(*tc));
+	tc->epoch = jwt_atomic_get(&thread_ctx_epoch);
+	tc->release_seq = jwt_atomic_get(&thread_ctx_released.seq);
+
+	tc->mdctx = EVP_MD_CTX_new();
+	if (tc->mdctx == NULL ||
+	    !CRYPTO_THREAD_set_local(&thread_ctx_local, tc)) {
+		thread_ctx_free(tc);
+		return NULL;
+	}
+
+	return tc;
+}
+
+/* Drops the calling thread's contexts now, the rest of the threads do
+ * so the next time they ask jwt_ctx_get() for one. */
+static void thread_ctx_reset(void)
+{
+	struct thread_ctx *tc;
+
+	jwt_atomic_inc(&thread_ctx_epoch);
+
+	tc = thread_ctx_peek();
+	if (tc != NULL)
+		thread_ctx_flush(tc);
+}
+
+static void thread_ctx_drop_id(struct thread_ctx *tc, uint64_t key_id)
+{
+	struct thread_ctx_slot *slot;
+	int i;
+
+	for (i = 0; i < THREAD_CTX_SLOTS; i++) {
+		slot = &tc->slots[i];
+		if (slot->ctx && slot->key_id == key_id) {
+			jwt_ctx_free(slot->op, slot->ctx);
+			slot->ctx = NULL;
+		}
+	}
+}
+
+/* Drops the calling thread's contexts for a key that is going away, and
+ * tells the rest of the threads to drop theirs. */
+static void thread_ctx_drop(uint64_t key_id)
+{
+	struct thread_ctx *tc;
+	long seq;
+
+	jwt_mutex_lock(&thread_ctx_released.lock);
+	seq = thread_ctx_released.seq;
+	thread_ctx_released.ids[seq % THREAD_CTX_RELEASED] = key_id;
+	jwt_atomic_set(&thread_ctx_released.seq, seq + 1);
+	jwt_mutex_unlock(&thread_ctx_released.lock);
+
+	tc = thread_ctx_peek();
+	if (tc != NULL)
+		thread_ctx_drop_id(tc, key_id);
+}
+
+/* Drops the contexts for keys released since the thread last looked. */
+static void thread_ctx_sync(struct thread_ctx *tc)
+{
+	long seq;
+
+	if (tc->release_seq == jwt_atomic_get(&thread_ctx_released.seq))
+		return;
+
+	jwt_mutex_lock(&thread_ctx_released.lock);
+	seq = thread_ctx_released.seq;
+	if (seq - tc->release_seq > THREAD_CTX_RELEASED) {
+		thread_ctx_flush(tc);
+	} else {
+		for (; tc->release_seq != seq; tc->release_seq++)
+			thread_ctx_drop_id(tc, thread_ctx_released.ids[
+				tc->release_seq % THREAD_CTX_RELEASED]);
+	}
+	tc->release_seq = seq;
+	jwt_mutex_unlock(&thread_ctx_released.lock);
+}
+
+#else
+
+static struct thread_ctx *thread_ctx_peek(void)
+{
+	return NULL;
+}
+
+static struct thread_ctx *thread_ctx(void)
+{
+	return NULL;
+}
+
+static void thread_ctx_reset(void)
+{
+}
+
+static void thread_ctx_drop(uint64_t key_id)
+{
+}
+
+static void thread_ctx_sync(struct thread_ctx *tc)
+{
+}
+
+#endif
+
+/* Returns a context for key, set up for alg and op. Must be handed back
+ * with jwt_ctx_put(). */
+static void *jwt_ctx_get(jwt_key_t *key, jwt_alg_t alg, const EVP_MD *md,
+			 int op)
+{
+	struct thread_ctx_slot *slot, *oldest;
+	struct thread_ctx *tc;
+	void *ctx;
+	long epoch;
+	int i;
+
+	tc = key->id ? thread_ctx() : NULL;
+	if (tc == NULL)
+		return jwt_ctx_new(key, alg, md, op);
+
+	/* Only here, where the thread holds none of its contexts. */
+	epoch = jwt_atomic_get(&thread_ctx_epoch);
+	if (tc->epoch != epoch) {
+		thread_ctx_flush(tc);
+		tc->epoch = epoch;
+	}
+
+	thread_ctx_sync(tc);
+
+	oldest = &tc->slots[0];
+	for (i = 0; i < THREAD_CTX_SLOTS; i++) {
+		slot = &tc->slots[i];
+		if (slot->ctx && slot->key_id == key->id &&
+		    slot->alg == alg && slot->op == op) {
+			slot->used = ++tc->tick;
+			return slot->ctx;
+		}
+
+		/* Empty slots count as the oldest of all. */
+		if (oldest->ctx && (slot->ctx == NULL ||
+				    slot->used < oldest->used))
+			oldest = slot;
+	}
+
+	ctx = jwt_ctx_new(key, alg, md, op);
+	if (ctx == NULL)
+		return NULL;
+
+	slot = oldest;
+	if (slot->ctx)
+		jwt_ctx_free(slot->op, slot->ctx);
+
+	slot->key_id = key->id;
+	slot->alg = alg;
+	slot->op = op;
+	slot->ctx = ctx;
+	slot->used = ++tc->tick;
+
+	return ctx;
+}
+
+static void jwt_ctx_put(jwt_key_t *key, int op, void *ctx, int failed)
+{
+	struct thread_ctx_slot *slot;
+	struct thread_ctx *tc;
+	int i;
+
+	/* The slots are exactly as jwt_ctx_get() left them. */
+	tc = key->id ? thread_ctx_peek() : NULL;
+
+	for (i = 0; tc != NULL && i < THREAD_CTX_SLOTS; i++) {
+		slot = &tc->slots[i];
+		if (slot->ctx != ctx)
+			continue;
+
+		/* Don't trust a context that an operation failed on. */
+		if (failed) {
+			jwt_ctx_free(op, ctx);
+			slot->ctx = NULL;
+		}
+
+		return;
+	}
+
+	jwt_ctx_free(op, ctx);
+}
+
+static int jwt_digest(const EVP_MD *md, const char *str, unsigned char *out,
+		      unsigned int *len)
+{
+	struct thread_ctx *tc = thread_ctx();
+
+	if (tc == NULL) {
+		if (EVP_Digest(str, strlen(str), out, len, md, NULL) != 1)
+			return EINVAL;
+		return 0;
+	}
+
+	if (EVP_DigestInit_ex(tc->mdctx, md, NULL) != 1 ||
+	    EVP_DigestUpdate(tc->mdctx, str, strlen(str)) != 1 ||
+	    EVP_DigestFinal_ex(tc->mdctx, out, len) != 1)
+		return EINVAL;
+
+	return 0;
+}
+
+static int jwt_hmac(jwt_t *jwt, jwt_key_t *key, const EVP_MD *md,
+		    const char *str, unsigned char *out, unsigned int *len)
+{
+	jwt_mac_ctx_t *ctx;
+	int ret;
+
+	ctx = jwt_ctx_get(key, jwt->alg, md, JWT_CTX_MAC);
+	if (ctx == NULL)
+		return ENOMEM;
+
+	ret = jwt_mac_run(ctx, str, out, len);
+
+	jwt_ctx_put(key, JWT_CTX_MAC, ctx, ret);
+
+	return ret;
+}
+
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+
+/* EdDSA hashes the message itself as part of signing, so it can't go
+ * through jwt_digest() and a pkey context. It only has one-shot digest
+ * sign and verify, which borrow the thread's digest context. */
+static int jwt_eddsa_init(EVP_MD_CTX *mdctx, EVP_PKEY *pkey, int sign)
+{
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+	if (sign)
+		return EVP_DigestSignInit_ex(mdctx, NULL, NULL,
+					     fetch_cache.libctx, NULL, pkey,
+					     NULL);
+
+	return EVP_DigestVerifyInit_ex(mdctx, NULL, NULL, fetch_cache.libctx,
+				       NULL, pkey, NULL);
+#else
+	if (sign)
+		return EVP_DigestSignInit(mdctx, NULL, NULL, NULL, pkey);
+
+	return EVP_DigestVerifyInit(mdctx, NULL, NULL, NULL, pkey);
+#endif
+}
+
+static int jwt_eddsa(jwt_key_t *key, int sign, unsigned char *sig,
+		     size_t *slen, const char *str)
+{
+	struct thread_ctx *tc = thread_ctx();
+	EVP_MD_CTX *mdctx;
+	int ret = 0;
+
+	mdctx = tc ? tc->mdctx : EVP_MD_CTX_new();
+	if (mdctx == NULL)
+		return ENOMEM;
+
+	/* Failing to set up is not the signature's fault. */
+	if (jwt_eddsa_init(mdctx, key->parsed, sign) != 1)
+		ret = ENOMEM;
+	else if (sign)
+		ret = EVP_DigestSign(mdctx, sig, slen,
+				     (const unsigned char *)str,
+				     strlen(str)) == 1 ? 0 : EINVAL;
+	else
+		ret = EVP_DigestVerify(mdctx, sig, *slen,
+				       (const unsigned char *)str,
+				       strlen(str)) == 1 ? 0 : EINVAL;
+
+	/* Drop the signing state so the context is fit for digests again. */
+	if (tc)
+		EVP_MD_CTX_reset(mdctx);
+	else
+		EVP_MD_CTX_free(mdctx);
+
+	return ret;
+}
+
+static int jwt_sign_eddsa(jwt_key_t *key, char **out, unsigned int *len,
+			  const char *str)
+{
+	size_t slen;
+	int ret;
+
+	if (!key->priv || !jwt_pkey_match(key->parsed, EVP_PKEY_ED25519))
+		return EINVAL;
+
+	slen = EVP_PKEY_size(key->parsed);
+
+	*out = jwt_malloc(slen);
+	if (*out == NULL)
+		return ENOMEM;
+
+	ret = jwt_eddsa(key, 1, (unsigned char *)*out, &slen, str);
+	if (ret) {
+		jwt_freemem(*out);
+		*out = NULL;
+		return ret;
+	}
+
+	*len = slen;
+
+	return 0;
+}
+
+static int jwt_verify_eddsa(jwt_key_t *key, const char *head,
+			    const char *sig_b64)
+{
+	unsigned char sig[JWT_EDDSA_MAX_LEN];
+	size_t slen;
+	int ret;
+
+	if (!jwt_pkey_match(key->parsed, EVP_PKEY_ED25519))
+		return EINVAL;
+
+	ret = jwt_b64uri_decode_buf(sig, sizeof(sig), sig_b64);
+	if (ret < 0)
+		return EINVAL;
+	slen = ret;
+
+	return jwt_eddsa(key, 0, sig, &slen, head);
+}
+
+#endif
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+
+static int jwt_openssl_init(void *libctx)
+{
+	int ret = 0;
+
+	jwt_mutex_lock(&fetch_cache.lock);
+	if (libctx != NULL || !fetch_cache.ready) {
+		ret = fetch_cache_load(libctx ? libctx : fetch_cache.libctx);
+		thread_ctx_reset();
+	}
+	jwt_mutex_unlock(&fetch_cache.lock);
+
+	return ret;
+}
+
+static void jwt_openssl_shutdown(void)
+{
+	jwt_mutex_lock(&fetch_cache.lock);
+	fetch_cache_free();
+	fetch_cache.libctx = NULL;
+	thread_ctx_reset();
+	jwt_mutex_unlock(&fetch_cache.lock);
+}
+
+#else
+
+static int jwt_openssl_init(void *libctx)
+{
+	/* Library contexts only exist since OpenSSL 3. */
+	return libctx ? EINVAL : 0;
+}
+
+static void jwt_openssl_shutdown(void)
+{
+	thread_ctx_reset();
+}
+
+#endif
+
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+
+/* Precomputed ECDSA nonces, see jwt_key_precompute(). All of an ECDSA
+ * signature that does not depend on the message, r = (k*G).x and the
+ * inverse of k, is worked out ahead of time by a thread of the key's own
+ * and kept in a ring. Signing takes one off the ring, wipes its slot and
+ * only has s = k^-1 * (e + r * d) left to do.
+ *
+ * BN_mod_mul() takes time that depends on its operands, so that last
+ * step never sees d itself. Each nonce comes with a random blind b, and
+ * s = (k * b)^-1 * (b * e + (b * d) * r), as OpenSSL's own ECDSA does. */
+
+struct ec_nonce {
+	/* (k * b)^-1 */
+	unsigned char kinv[JWT_EC_MAX_LEN];
+	unsigned char r[JWT_EC_MAX_LEN];
+	unsigned char blind[JWT_EC_MAX_LEN];
+	/* b * d */
+	unsigned char bpriv[JWT_EC_MAX_LEN];
+};
+
+struct ec_precomp {
+	jwt_mutex_t lock;
+	/* Signalled when the ring has room or the thread should stop. */
+	jwt_cond_t cond;
+	jwt_thread_t thread;
+	int running;
+	int stop;
+
+	EC_GROUP *group;
+	const BIGNUM *order;
+	BIGNUM *priv;
+	int bits;
+	int len;
+
+	struct ec_nonce *ring;
+	unsigned int depth;
+	unsigned int head;
+	unsigned int count;
+
+	/* On precomp_list, for fork(). */
+	struct ec_precomp *next;
+};
+
+/* Serializes jwt_key_precompute() calls and guards precomp_list. */
+static jwt_mutex_t precomp_lock = JWT_MUTEX_INITIALIZER;
+static struct ec_precomp *precomp_list;
+
+#ifndef _WIN32
+
+/* A child of fork() gets a copy of every ring, but not the threads that
+ * fill them. Were it to sign with those nonces while the parent does the
+ * same, two signatures would share a k and give away the key. So every
+ * ring is held still across fork() and wiped in the child, which goes on
+ * signing the normal way until jwt_key_precompute() is called again. */
+static int precomp_atfork_done;
+
+static void precomp_prepare(void)
+{
+	struct ec_precomp *p;
+
+	jwt_mutex_lock(&precomp_lock);
+	for (p = precomp_list; p; p = p->next)
+		jwt_mutex_lock(&p->lock);
+}
+
+static void precomp_parent(void)
+{
+	struct ec_precomp *p;
+
+	for (p = precomp_list; p; p = p->next)
+		jwt_mutex_unlock(&p->lock);
+	jwt_mutex_unlock(&precomp_lock);
+}
+
+static void precomp_child(void)
+{
+	struct ec_precomp *p;
+
+	for (p = precomp_list; p; p = p->next) {
+		if (p->ring)
+			OPENSSL_cleanse(p->ring, p->depth * sizeof(*p->ring));
+		p->head = 0;
+		p->count = 0;
+
+		/* The thread did not come along, and may have been waiting. */
+		p->running = 0;
+		p->stop = 0;
+		jwt_cond_init(&p->cond);
+
+		jwt_mutex_unlock(&p->lock);
+	}
+	jwt_mutex_unlock(&precomp_lock);
+}
+
+/* Called with precomp_lock held. */
+static int precomp_atfork(void)
+{
+	if (precomp_atfork_done)
+		return 0;
+
+	if (pthread_atfork(precomp_prepare, precomp_parent, precomp_child))
+		return ENOMEM;
+
+	precomp_atfork_done = 1;
+
+	return 0;
+}
+
+#else
+
+static int precomp_atfork(void)
+{
+	return 0;
+}
+
+#endif
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+
+static int jwt_ec_secret(EVP_PKEY *pkey, EC_GROUP **group, BIGNUM **priv)
+{
+	char name[64];
+	int nid;
+
+	if (!EVP_PKEY_get_group_name(pkey, name, sizeof(name), NULL))
+		return EINVAL;
+
+	nid = OBJ_txt2nid(name);
+	if (nid == NID_undef)
+		return EINVAL;
+
+	*group = EC_GROUP_new_by_curve_name_ex(fetch_cache.libctx, NULL, nid);
+	if (*group == NULL)
+		return ENOMEM;
+
+	*priv = NULL;
+	if (!EVP_PKEY_get_bn_param(pkey, OSSL_PKEY_PARAM_PRIV_KEY, priv)) {
+		EC_GROUP_free(*group);
+		*group = NULL;
+		return EINVAL;
+	}
+
+	return 0;
+}
+
+#else
+
+static int jwt_ec_secret(EVP_PKEY *pkey, EC_GROUP **group, BIGNUM **priv)
+{
+	const EC_KEY *ec = EVP_PKEY_get0_EC_KEY(pkey);
+
+	if (ec == NULL || EC_KEY_get0_private_key(ec) == NULL)
+		return EINVAL;
+
+	*group = EC_GROUP_dup(EC_KEY_get0_group(ec));
+	*priv = BN_dup(EC_KEY_get0_private_key(ec));
+	if (*group == NULL || *priv == NULL) {
+		EC_GROUP_free(*group);
+		BN_clear_free(*priv);
+		*group = NULL;
+		*priv = NULL;
+		return ENOMEM;
+	}
+
+	return 0;
+}
+
+#endif
+
+static void ec_precomp_free(struct ec_precomp *p)
+{
+	if (p->ring) {
+		OPENSSL_cleanse(p->ring, p->depth * sizeof(*p->ring));
+		jwt_freemem(p->ring);
+	}
+
+	BN_clear_free(p->priv);
+	EC_GROUP_free(p->group);
+	jwt_cond_destroy(&p->cond);
+	jwt_mutex_destroy(&p->lock);
+
+	jwt_freemem(p);
+}
+
+static int ec_precomp_new(jwt_key_t *key, struct ec_precomp **out)
+{
+	struct ec_precomp *p;
+	int ret;
 
-#include <jwt.h>
+	p = jwt_malloc(sizeof(*p));
+	if (p == NULL)
+		return ENOMEM;
 
-#include "jwt-private.h"
-#include "config.h"
+	memset(p, 0, sizeof(*p));
+	jwt_mutex_init(&p->lock);
+	jwt_cond_init(&p->cond);
 
-/* Routines to support crypto in LibJWT using OpenSSL. */
+	ret = jwt_ec_secret(key->parsed, &p->group, &p->priv);
+	if (ret) {
+		ec_precomp_free(p);
+		return ret;
+	}
 
-/* Functions to make libjwt backward compatible with OpenSSL version < 1.1.0
- * See https://wiki.openssl.org/index.php/1.1_API_Changes
- */
-#if OPENSSL_VERSION_NUMBER < 0x10100000L
+	BN_set_flags(p->priv, BN_FLG_CONSTTIME);
+
+	p->order = EC_GROUP_get0_order(p->group);
+	p->bits = BN_num_bits(p->order);
+	p->len = BN_num_bytes(p->order);
+
+	/* Signatures are encoded at key->ec_len, which is the size of the
+	 * field. For every named curve in use they are one and the same. */
+	if (p->len != key->ec_len) {
+		ec_precomp_free(p);
+		return ENOTSUP;
+	}
+
+	*out = p;
+
+	return 0;
+}
 
-static void ECDSA_SIG_get0(const ECDSA_SIG *sig, const BIGNUM **pr, const BIGNUM **ps)
+/* Make one nonce. Runs on the key's thread, without the lock held. */
+static int ec_nonce_make(struct ec_precomp *p, BN_CTX *ctx,
+			 struct ec_nonce *nonce)
 {
-	if (pr != NULL)
-		*pr = sig->r;
-	if (ps != NULL)
-		*ps = sig->s;
+	BIGNUM *k, *x, *b, *bd, *exp;
+	EC_POINT *point;
+	int ret = EINVAL;
+
+	BN_CTX_start(ctx);
+	k = BN_CTX_get(ctx);
+	x = BN_CTX_get(ctx);
+	b = BN_CTX_get(ctx);
+	bd = BN_CTX_get(ctx);
+	exp = BN_CTX_get(ctx);
+	point = EC_POINT_new(p->group);
+	if (exp == NULL || point == NULL)
+		goto ec_nonce_make_done;
+
+	BN_set_flags(k, BN_FLG_CONSTTIME);
+	BN_set_flags(b, BN_FLG_CONSTTIME);
+	BN_set_flags(bd, BN_FLG_CONSTTIME);
+
+	do {
+		do {
+			if (!BN_priv_rand_range(k, p->order))
+				goto ec_nonce_make_done;
+		} while (BN_is_zero(k));
+
+		if (!EC_POINT_mul(p->group, point, k, NULL, NULL, ctx) ||
+		    !EC_POINT_get_affine_coordinates(p->group, point, x, NULL,
+						     ctx) ||
+		    !BN_nnmod(x, x, p->order, ctx))
+			goto ec_nonce_make_done;
+	} while (BN_is_zero(x));
+
+	do {
+		if (!BN_priv_rand_range(b, p->order))
+			goto ec_nonce_make_done;
+	} while (BN_is_zero(b));
+
+	if (!BN_mod_mul(bd, b, p->priv, p->order, ctx) ||
+	    !BN_mod_mul(k, k, b, p->order, ctx))
+		goto ec_nonce_make_done;
+
+	/* The order is prime, so (k * b)^-1 = (k * b)^(n - 2) mod n, which
+	 * unlike BN_mod_inverse() does not leak k through its timing. */
+	if (!BN_copy(exp, p->order) || !BN_sub_word(exp, 2) ||
+	    !BN_mod_exp_mont_consttime(k, k, exp, p->order, ctx, NULL))
+		goto ec_nonce_make_done;
+
+	if (BN_bn2binpad(k, nonce->kinv, p->len) != p->len ||
+	    BN_bn2binpad(x, nonce->r, p->len) != p->len ||
+	    BN_bn2binpad(b, nonce->blind, p->len) != p->len ||
+	    BN_bn2binpad(bd, nonce->bpriv, p->len) != p->len)
+		goto ec_nonce_make_done;
+
+	ret = 0;
+
+ec_nonce_make_done:
+	BN_clear(k);
+	BN_clear(b);
+	BN_clear(bd);
+	EC_POINT_clear_free(point);
+	BN_CTX_end(ctx);
+
+	return ret;
 }
 
-static int ECDSA_SIG_set0(ECDSA_SIG *sig, BIGNUM *r, BIGNUM *s)
+static void ec_precomp_main(void *arg)
 {
-	if (r == NULL || s == NULL)
-		return 0;
+	struct ec_precomp *p = arg;
+	struct ec_nonce nonce;
+	unsigned int tail;
+	BN_CTX *ctx;
+	int ret;
+
+	ctx = BN_CTX_secure_new();
+	if (ctx == NULL)
+		return;
+
+	jwt_mutex_lock(&p->lock);
+	while (!p->stop) {
+		if (p->count == p->depth) {
+			jwt_cond_wait(&p->cond, &p->lock);
+			continue;
+		}
+
+		jwt_mutex_unlock(&p->lock);
+		ret = ec_nonce_make(p, ctx, &nonce);
+		jwt_mutex_lock(&p->lock);
+
+		/* Signing just falls back to the normal path if we give up. */
+		if (ret)
+			break;
+
+		if (p->count < p->depth) {
+			tail = (p->head + p->count) % p->depth;
+			memcpy(&p->ring[tail], &nonce, sizeof(nonce));
+			p->count++;
+		}
+		OPENSSL_cleanse(&nonce, sizeof(nonce));
+	}
+	jwt_mutex_unlock(&p->lock);
+
+	BN_CTX_free(ctx);
+}
+
+static void ec_precomp_stop(struct ec_precomp *p)
+{
+	if (!p->running)
+		return;
+
+	jwt_mutex_lock(&p->lock);
+	p->stop = 1;
+	jwt_cond_broadcast(&p->cond);
+	jwt_mutex_unlock(&p->lock);
+
+	jwt_thread_join(p->thread);
+	p->running = 0;
+	p->stop = 0;
+}
+
+/* Called with the thread stopped. Throws away every nonce not yet used. */
+static int ec_precomp_resize(struct ec_precomp *p, unsigned int depth)
+{
+	struct ec_nonce *ring = NULL;
+
+	if (depth) {
+		ring = jwt_calloc(depth, sizeof(*ring));
+		if (ring == NULL)
+			return ENOMEM;
+	}
+
+	jwt_mutex_lock(&p->lock);
+	if (p->ring) {
+		OPENSSL_cleanse(p->ring, p->depth * sizeof(*p->ring));
+		jwt_freemem(p->ring);
+	}
+	p->ring = ring;
+	p->depth = depth;
+	p->head = 0;
+	p->count = 0;
+	jwt_mutex_unlock(&p->lock);
+
+	return 0;
+}
+
+static int jwt_openssl_precompute(jwt_key_t *key, unsigned int depth)
+{
+	struct ec_precomp *p;
+	int ret = 0;
+
+	jwt_mutex_lock(&precomp_lock);
+
+	p = key->precomp;
+	if (p == NULL) {
+		if (depth == 0)
+			goto jwt_openssl_precompute_done;
+
+		ret = precomp_atfork();
+		if (ret)
+			goto jwt_openssl_precompute_done;
+
+		ret = ec_precomp_new(key, &p);
+		if (ret)
+			goto jwt_openssl_precompute_done;
+
+		p->next = precomp_list;
+		precomp_list = p;
+		jwt_atomic_set_ptr(&key->precomp, p);
+	}
+
+	ec_precomp_stop(p);
+
+	ret = ec_precomp_resize(p, depth);
+	if (ret || depth == 0)
+		goto jwt_openssl_precompute_done;
+
+	ret = jwt_thread_start(&p->thread, ec_precomp_main, p);
+	if (ret == 0)
+		p->running = 1;
+
+jwt_openssl_precompute_done:
+	jwt_mutex_unlock(&precomp_lock);
+
+	return ret;
+}
+
+/* Only from the last reference to the key, so nothing signs with it. */
+static void jwt_release_precomp(jwt_key_t *key)
+{
+	struct ec_precomp *p = key->precomp, **pp;
+
+	if (p == NULL)
+		return;
+
+	ec_precomp_stop(p);
+
+	jwt_mutex_lock(&precomp_lock);
+	for (pp = &precomp_list; *pp != p; pp = &(*pp)->next)
+		;
+	*pp = p->next;
+	jwt_mutex_unlock(&precomp_lock);
+
+	ec_precomp_free(p);
+	key->precomp = NULL;
+}
+
+/* Take a nonce off the ring, leaving nothing of it behind there. */
+static int ec_nonce_take(struct ec_precomp *p, struct ec_nonce *nonce)
+{
+	struct ec_nonce *slot;
+
+	jwt_mutex_lock(&p->lock);
+	if (p->count == 0) {
+		jwt_mutex_unlock(&p->lock);
+		return EAGAIN;
+	}
 
-	BN_clear_free(sig->r);
-	BN_clear_free(sig->s);
-	sig->r = r;
-	sig->s = s;
+	slot = &p->ring[p->head];
+	memcpy(nonce, slot, sizeof(*nonce));
+	OPENSSL_cleanse(slot, sizeof(*slot));
 
-	return 1;
+	if (p->count-- == p->depth)
+		jwt_cond_signal(&p->cond);
+	p->head = (p->head + 1) % p->depth;
+	jwt_mutex_unlock(&p->lock);
+
+	return 0;
+}
+
+/* Sign dgst with a precomputed nonce into a raw r||s signature. Returns
+ * EAGAIN when there is none to be had, for the caller to sign the usual
+ * way instead. */
+static int jwt_sign_precomp(jwt_key_t *key, const unsigned char *dgst,
+			    unsigned int dlen, char **out, unsigned int *len)
+{
+	struct ec_precomp *p = jwt_atomic_get_ptr(&key->precomp);
+	BIGNUM *kinv, *r, *b, *bd, *e, *s;
+	struct ec_nonce nonce;
+	BN_CTX *ctx;
+	int ret = EINVAL;
+
+	if (p == NULL || ec_nonce_take(p, &nonce))
+		return EAGAIN;
+
+	ctx = BN_CTX_secure_new();
+	if (ctx == NULL) {
+		OPENSSL_cleanse(&nonce, sizeof(nonce));
+		return ENOMEM;
+	}
+
+	BN_CTX_start(ctx);
+	kinv = BN_CTX_get(ctx);
+	r = BN_CTX_get(ctx);
+	b = BN_CTX_get(ctx);
+	bd = BN_CTX_get(ctx);
+	e = BN_CTX_get(ctx);
+	s = BN_CTX_get(ctx);
+	if (s == NULL)
+		goto jwt_sign_precomp_done;
+
+	BN_set_flags(kinv, BN_FLG_CONSTTIME);
+	BN_set_flags(b, BN_FLG_CONSTTIME);
+	BN_set_flags(bd, BN_FLG_CONSTTIME);
+	BN_set_flags(e, BN_FLG_CONSTTIME);
+	BN_set_flags(s, BN_FLG_CONSTTIME);
+
+	/* e is the leftmost bits of the digest, as many as the order has. */
+	if (dlen * 8 > (unsigned int)p->bits) {
+		if (!BN_bin2bn(dgst, p->len, e) ||
+		    (p->bits % 8 && !BN_rshift(e, e, 8 - p->bits % 8)))
+			goto jwt_sign_precomp_done;
+	} else if (!BN_bin2bn(dgst, dlen, e)) {
+		goto jwt_sign_precomp_done;
+	}
+
+	/* s = (k * b)^-1 * (b * e + (b * d) * r) */
+	if (!BN_bin2bn(nonce.kinv, p->len, kinv) ||
+	    !BN_bin2bn(nonce.r, p->len, r) ||
+	    !BN_bin2bn(nonce.blind, p->len, b) ||
+	    !BN_bin2bn(nonce.bpriv, p->len, bd) ||
+	    !BN_mod_mul(s, bd, r, p->order, ctx) ||
+	    !BN_mod_mul(e, e, b, p->order, ctx) ||
+	    !BN_mod_add_quick(s, s, e, p->order) ||
+	    !BN_mod_mul(s, s, kinv, p->order, ctx))
+		goto jwt_sign_precomp_done;
+
+	/* As unlikely as guessing the key, but not a valid signature. */
+	if (BN_is_zero(s)) {
+		ret = EAGAIN;
+		goto jwt_sign_precomp_done;
+	}
+
+	*out = jwt_malloc(2 * p->len);
+	if (*out == NULL) {
+		ret = ENOMEM;
+		goto jwt_sign_precomp_done;
+	}
+
+	BN_bn2binpad(r, (unsigned char *)*out, p->len);
+	BN_bn2binpad(s, (unsigned char *)*out + p->len, p->len);
+	*len = 2 * p->len;
+	ret = 0;
+
+jwt_sign_precomp_done:
+	OPENSSL_cleanse(&nonce, sizeof(nonce));
+	BN_clear(kinv);
+	BN_clear(b);
+	BN_clear(bd);
+	BN_clear(e);
+	BN_CTX_end(ctx);
+	BN_CTX_free(ctx);
+
+	return ret;
+}
+
+#else
+
+static void jwt_release_precomp(jwt_key_t *key)
+{
+}
+
+static int jwt_sign_precomp(jwt_key_t *key, const unsigned char *dgst,
+			    unsigned int dlen, char **out, unsigned int *len)
+{
+	return EAGAIN;
 }
 
 #endif
 
-int jwt_sign_sha_hmac(jwt_t *jwt, char **out, unsigned int *len,
-		      const char *str)
+static int jwt_openssl_prepare_key(jwt_key_t *key)
 {
-	const EVP_MD *alg;
+	EVP_PKEY *pkey;
+	int type;
 
-	switch (jwt->alg) {
-        /* HMAC */
+	switch (key->alg) {
 	case JWT_ALG_HS256:
-		alg = EVP_sha256();
-		break;
 	case JWT_ALG_HS384:
-		alg = EVP_sha384();
-		break;
 	case JWT_ALG_HS512:
-		alg = EVP_sha512();
+		return jwt_prepare_hmac(key, jwt_md(key->alg));
+
+	case JWT_ALG_RS256:
+	case JWT_ALG_RS384:
+	case JWT_ALG_RS512:
+		type = EVP_PKEY_RSA;
+		break;
+
+	case JWT_ALG_ES256:
+	case JWT_ALG_ES384:
+	case JWT_ALG_ES512:
+		type = EVP_PKEY_EC;
+		break;
+
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+	case JWT_ALG_EDDSA:
+		type = EVP_PKEY_ED25519;
 		break;
+#endif
+
 	default:
 		return EINVAL;
 	}
 
-	*out = jwt_malloc(EVP_MAX_MD_SIZE);
-	if (*out == NULL)
-		return ENOMEM;
+	/* Make sure the library context is set up. */
+	if (fetch_cache_ready())
+		return EINVAL;
+
+	switch (key->format) {
+	case JWT_KEY_FORMAT_DER:
+		pkey = jwt_read_der(key);
+		break;
+
+	case JWT_KEY_FORMAT_RAW_PUB:
+	case JWT_KEY_FORMAT_RAW_PRIV:
+		pkey = jwt_read_raw(key);
+		break;
+
+	default:
+		pkey = jwt_read_pem(key);
+		break;
+	}
+
+	if (pkey == NULL)
+		return EINVAL;
+
+	if (!jwt_pkey_match(pkey, type)) {
+		EVP_PKEY_free(pkey);
+		return EINVAL;
+	}
 
-	HMAC(alg, jwt->key, jwt->key_len,
-	     (const unsigned char *)str, strlen(str), (unsigned char *)*out,
-	     len);
+	if (type == EVP_PKEY_EC) {
+		key->ec_len = (EVP_PKEY_bits(pkey) + 7) / 8;
+		if (key->ec_len > JWT_EC_MAX_LEN) {
+			EVP_PKEY_free(pkey);
+			return EINVAL;
+		}
+	}
+
+	key->parsed = pkey;
 
 	return 0;
 }
 
-int jwt_verify_sha_hmac(jwt_t *jwt, const char *head, const char *sig)
+static void jwt_openssl_release_key(jwt_key_t *key)
 {
-	unsigned char res[EVP_MAX_MD_SIZE];
-	BIO *bmem = NULL, *b64 = NULL;
-	unsigned int res_len;
-	const EVP_MD *alg;
-	char *buf;
-	int len, ret = EINVAL;
+	if (key->parsed == NULL)
+		return;
 
-	switch (jwt->alg) {
+	/* Only keys with an id get contexts kept for them. */
+	if (key->id)
+		thread_ctx_drop(key->id);
+
+	jwt_release_precomp(key);
+
+	switch (key->alg) {
 	case JWT_ALG_HS256:
-		alg = EVP_sha256();
-		break;
 	case JWT_ALG_HS384:
-		alg = EVP_sha384();
-		break;
 	case JWT_ALG_HS512:
-		alg = EVP_sha512();
+		jwt_release_hmac(key);
 		break;
 	default:
-		return EINVAL;
+		EVP_PKEY_free(key->parsed);
+		break;
 	}
 
-	b64 = BIO_new(BIO_f_base64());
-	if (b64 == NULL)
-		return ENOMEM;
+	key->parsed = NULL;
+}
+
+static int jwt_sign_sha_hmac(jwt_t *jwt, jwt_key_t *key, char **out,
+			     unsigned int *len, const char *str)
+{
+	const EVP_MD *alg;
+	int ret;
+
+	alg = jwt_md(jwt->alg);
+	if (alg == NULL)
+		return EINVAL;
 
-	bmem = BIO_new(BIO_s_mem());
-	if (bmem == NULL) {
-		BIO_free(b64);
+	*out = jwt_malloc(EVP_MAX_MD_SIZE);
+	if (*out == NULL)
 		return ENOMEM;
+
+	ret = jwt_hmac(jwt, key, alg, str, (unsigned char *)*out, len);
+	if (ret) {
+		jwt_freemem(*out);
+		*out = NULL;
 	}
 
-	BIO_push(b64, bmem);
-	BIO_set_flags(b64, BIO_FLAGS_BASE64_NO_NL);
+	return ret;
+}
+
+static int jwt_sign_sha_hmac_stream(jwt_t *jwt, jwt_key_t *key,
+				    jwt_input_next_t next, void *arg,
+				    unsigned char *out, unsigned int *len)
+{
+	jwt_mac_ctx_t *ctx;
+	const EVP_MD *alg;
+	int ret;
 
-	HMAC(alg, jwt->key, jwt->key_len,
-	     (const unsigned char *)head, strlen(head), res, &res_len);
+	alg = jwt_md(jwt->alg);
+	if (alg == NULL)
+		return EINVAL;
 
-	BIO_write(b64, res, res_len);
+	ctx = jwt_ctx_get(key, jwt->alg, alg, JWT_CTX_MAC);
+	if (ctx == NULL)
+		return ENOMEM;
 
-	(void)BIO_flush(b64);
+	ret = jwt_mac_stream(ctx, next, arg, out, len);
 
-	len = BIO_pending(bmem);
-	if (len < 0)
-		goto jwt_verify_hmac_done;
+	jwt_ctx_put(key, JWT_CTX_MAC, ctx, ret);
 
-	buf = alloca(len + 1);
-	if (!buf) {
-		ret = ENOMEM;
-		goto jwt_verify_hmac_done;
-	}
+	return ret;
+}
+
+static int jwt_verify_sha_hmac(jwt_t *jwt, jwt_key_t *key, const char *head,
+			       const char *sig)
+{
+	unsigned char res[EVP_MAX_MD_SIZE];
+	unsigned char sig_raw[JWT_HMAC_MAX_LEN];
+	unsigned int res_len;
+	const EVP_MD *alg;
+	int sig_len;
 
-	len = BIO_read(bmem, buf, len);
-	buf[len] = '\0';
+	alg = jwt_md(jwt->alg);
+	if (alg == NULL)
+		return ENOMEM;
 
-	jwt_base64uri_encode(buf);
+	/* Anything too long for the buffer can't match anyway. */
+	sig_len = jwt_b64uri_decode_buf(sig_raw, sizeof(sig_raw), sig);
+	if (sig_len < 0)
+		return EINVAL;
 
-	/* And now... */
-	ret = strcmp(buf, sig) ? EINVAL : 0;
+	if (jwt_hmac(jwt, key, alg, head, res, &res_len))
+		return ENOMEM;
 
-jwt_verify_hmac_done:
-	BIO_free_all(b64);
+	if ((unsigned int)sig_len != res_len ||
+	    CRYPTO_memcmp(res, sig_raw, res_len))
+		return EINVAL;
 
-	return ret;
+	return 0;
 }
 
 #define SIGN_ERROR(__err) { ret = __err; goto jwt_sign_sha_pem_done; }
 
-int jwt_sign_sha_pem(jwt_t *jwt, char **out, unsigned int *len,
-		     const char *str)
+static int jwt_sign_sha_pem(jwt_t *jwt, jwt_key_t *key, char **out,
+			    unsigned int *len, const char *str)
 {
-	EVP_MD_CTX *mdctx = NULL;
-	ECDSA_SIG *ec_sig = NULL;
-	const BIGNUM *ec_sig_r = NULL;
-	const BIGNUM *ec_sig_s = NULL;
-	BIO *bufkey = NULL;
+	unsigned char dgst[EVP_MAX_MD_SIZE];
+	EVP_PKEY_CTX *pctx = NULL;
 	const EVP_MD *alg;
-	int type;
-	EVP_PKEY *pkey = NULL;
-	int pkey_type;
 	unsigned char *sig;
+	unsigned int dlen;
+	int type;
 	int ret = 0;
 	size_t slen;
 
 	switch (jwt->alg) {
 	/* RSA */
 	case JWT_ALG_RS256:
-		alg = EVP_sha256();
-		type = EVP_PKEY_RSA;
-		break;
 	case JWT_ALG_RS384:
-		alg = EVP_sha384();
-		type = EVP_PKEY_RSA;
-		break;
 	case JWT_ALG_RS512:
-		alg = EVP_sha512();
 		type = EVP_PKEY_RSA;
 		break;
 
 	/* ECC */
 	case JWT_ALG_ES256:
-		alg = EVP_sha256();
-		type = EVP_PKEY_EC;
-		break;
 	case JWT_ALG_ES384:
-		alg = EVP_sha384();
-		type = EVP_PKEY_EC;
-		break;
 	case JWT_ALG_ES512:
-		alg = EVP_sha512();
 		type = EVP_PKEY_EC;
 		break;
 
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+	/* EdDSA */
+	case JWT_ALG_EDDSA:
+		return jwt_sign_eddsa(key, out, len, str);
+#endif
+
 	default:
 		return EINVAL;
 	}
 
-	bufkey = BIO_new_mem_buf(jwt->key, jwt->key_len);
-	if (bufkey == NULL)
-		SIGN_ERROR(ENOMEM);
+	alg = jwt_md(jwt->alg);
+	if (alg == NULL)
+		return EINVAL;
 
-	/* This uses OpenSSL's default passphrase callback if needed. The
-	 * library caller can override this in many ways, all of which are
-	 * outside of the scope of LibJWT and this is documented in jwt.h. */
-	pkey = PEM_read_bio_PrivateKey(bufkey, NULL, NULL, NULL);
-	if (pkey == NULL)
-		SIGN_ERROR(EINVAL);
+	/* Signing needs the private half. */
+	if (!key->priv)
+		return EINVAL;
 
-	pkey_type = EVP_PKEY_id(pkey);
-	if (pkey_type != type)
-		SIGN_ERROR(EINVAL);
+	if (!jwt_pkey_match(key->parsed, type))
+		return EINVAL;
 
-	mdctx = EVP_MD_CTX_create();
-	if (mdctx == NULL)
-		SIGN_ERROR(ENOMEM);
+	if (jwt_digest(alg, str, dgst, &dlen))
+		return EINVAL;
 
-	/* Initialize the DigestSign operation using alg */
-	if (EVP_DigestSignInit(mdctx, NULL, alg, NULL, pkey) != 1)
-		SIGN_ERROR(EINVAL);
+	if (type == EVP_PKEY_EC) {
+		ret = jwt_sign_precomp(key, dgst, dlen, out, len);
+		if (ret != EAGAIN)
+			return ret;
+		ret = 0;
+	}
 
-	/* Call update with the message */
-	if (EVP_DigestSignUpdate(mdctx, str, strlen(str)) != 1)
-		SIGN_ERROR(EINVAL);
+	pctx = jwt_ctx_get(key, jwt->alg, alg, JWT_CTX_SIGN);
+	if (pctx == NULL)
+		return ENOMEM;
 
-	/* First, call EVP_DigestSignFinal with a NULL sig parameter to get length
+	/* First, call EVP_PKEY_sign with a NULL sig parameter to get length
 	 * of sig. Length is returned in slen */
-	if (EVP_DigestSignFinal(mdctx, NULL, &slen) != 1)
+	if (EVP_PKEY_sign(pctx, NULL, &slen, dgst, dlen) != 1)
 		SIGN_ERROR(EINVAL);
 
 	/* Allocate memory for signature based on returned size */
@@ -237,212 +1972,132 @@ int jwt_sign_sha_pem(jwt_t *jwt, char **out, unsigned int *len,
 		SIGN_ERROR(ENOMEM);
 
 	/* Get the signature */
-	if (EVP_DigestSignFinal(mdctx, sig, &slen) != 1)
+	if (EVP_PKEY_sign(pctx, sig, &slen, dgst, dlen) != 1)
 		SIGN_ERROR(EINVAL);
 
-	if (pkey_type != EVP_PKEY_EC) {
+	if (type != EVP_PKEY_EC) {
 		*out = jwt_malloc(slen);
 		if (*out == NULL)
 			SIGN_ERROR(ENOMEM);
 		memcpy(*out, sig, slen);
 		*len = slen;
 	} else {
-		unsigned int degree, bn_len, r_len, s_len, buf_len;
-		unsigned char *raw_buf;
-		EC_KEY *ec_key;
-
 		/* For EC we need to convert to a raw format of R/S. */
-
-		/* Get the actual ec_key */
-		ec_key = EVP_PKEY_get1_EC_KEY(pkey);
-		if (ec_key == NULL)
-			SIGN_ERROR(ENOMEM);
-
-		degree = EC_GROUP_get_degree(EC_KEY_get0_group(ec_key));
-
-		EC_KEY_free(ec_key);
-
-		/* Get the sig from the DER encoded version. */
-		ec_sig = d2i_ECDSA_SIG(NULL, (const unsigned char **)&sig, slen);
-		if (ec_sig == NULL)
+		*out = jwt_malloc(2 * key->ec_len);
+		if (*out == NULL)
 			SIGN_ERROR(ENOMEM);
 
-		ECDSA_SIG_get0(ec_sig, &ec_sig_r, &ec_sig_s);
-		r_len = BN_num_bytes(ec_sig_r);
-		s_len = BN_num_bytes(ec_sig_s);
-		bn_len = (degree + 7) / 8;
-		if ((r_len > bn_len) || (s_len > bn_len))
+		if (jwt_ec_sig_der_to_raw((unsigned char *)*out, sig, slen,
+					  key->ec_len)) {
+			jwt_freemem(*out);
+			*out = NULL;
 			SIGN_ERROR(EINVAL);
+		}
 
-		buf_len = 2 * bn_len;
-		raw_buf = alloca(buf_len);
-		if (raw_buf == NULL)
-			SIGN_ERROR(ENOMEM);
-
-		/* Pad the bignums with leading zeroes. */
-		memset(raw_buf, 0, buf_len);
-		BN_bn2bin(ec_sig_r, raw_buf + bn_len - r_len);
-		BN_bn2bin(ec_sig_s, raw_buf + buf_len - s_len);
-
-		*out = jwt_malloc(buf_len);
-		if (*out == NULL)
-			SIGN_ERROR(ENOMEM);
-		memcpy(*out, raw_buf, buf_len);
-		*len = buf_len;
+		*len = 2 * key->ec_len;
 	}
 
 jwt_sign_sha_pem_done:
-	if (bufkey)
-		BIO_free(bufkey);
-	if (pkey)
-		EVP_PKEY_free(pkey);
-	if (mdctx)
-		EVP_MD_CTX_destroy(mdctx);
-	if (ec_sig)
-		ECDSA_SIG_free(ec_sig);
+	jwt_ctx_put(key, JWT_CTX_SIGN, pctx, ret);
 
 	return ret;
 }
 
 #define VERIFY_ERROR(__err) { ret = __err; goto jwt_verify_sha_pem_done; }
 
-int jwt_verify_sha_pem(jwt_t *jwt, const char *head, const char *sig_b64)
+static int jwt_verify_sha_pem(jwt_t *jwt, jwt_key_t *key, const char *head,
+			      const char *sig_b64)
 {
+	unsigned char der[JWT_EC_DER_MAX_LEN];
+	unsigned char dgst[EVP_MAX_MD_SIZE];
 	unsigned char *sig = NULL;
-	EVP_MD_CTX *mdctx = NULL;
-	ECDSA_SIG *ec_sig = NULL;
-	BIGNUM *ec_sig_r = NULL;
-	BIGNUM *ec_sig_s = NULL;
-	EVP_PKEY *pkey = NULL;
+	EVP_PKEY_CTX *pctx = NULL;
+	const unsigned char *check;
 	const EVP_MD *alg;
+	unsigned int dlen;
 	int type;
-	int pkey_type;
-	BIO *bufkey = NULL;
 	int ret = 0;
 	int slen;
 
 	switch (jwt->alg) {
 	/* RSA */
 	case JWT_ALG_RS256:
-		alg = EVP_sha256();
-		type = EVP_PKEY_RSA;
-		break;
 	case JWT_ALG_RS384:
-		alg = EVP_sha384();
-		type = EVP_PKEY_RSA;
-		break;
 	case JWT_ALG_RS512:
-		alg = EVP_sha512();
 		type = EVP_PKEY_RSA;
 		break;
 
 	/* ECC */
 	case JWT_ALG_ES256:
-		alg = EVP_sha256();
-		type = EVP_PKEY_EC;
-		break;
 	case JWT_ALG_ES384:
-		alg = EVP_sha384();
-		type = EVP_PKEY_EC;
-		break;
 	case JWT_ALG_ES512:
-		alg = EVP_sha512();
 		type = EVP_PKEY_EC;
 		break;
 
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+	/* EdDSA */
+	case JWT_ALG_EDDSA:
+		return jwt_verify_eddsa(key, head, sig_b64);
+#endif
+
 	default:
 		return EINVAL;
 	}
 
-	sig = jwt_b64_decode(sig_b64, &slen);
-	if (sig == NULL)
-		VERIFY_ERROR(EINVAL);
+	alg = jwt_md(jwt->alg);
+	if (alg == NULL)
+		return ENOMEM;
 
-	bufkey = BIO_new_mem_buf(jwt->key, jwt->key_len);
-	if (bufkey == NULL)
-		VERIFY_ERROR(ENOMEM);
+	if (!jwt_pkey_match(key->parsed, type))
+		return EINVAL;
 
-	/* This uses OpenSSL's default passphrase callback if needed. The
-	 * library caller can override this in many ways, all of which are
-	 * outside of the scope of LibJWT and this is documented in jwt.h. */
-	pkey = PEM_read_bio_PUBKEY(bufkey, NULL, NULL, NULL);
-	if (pkey == NULL)
-		VERIFY_ERROR(EINVAL);
+	sig = jwt_b64_decode(sig_b64, &slen);
+	if (sig == NULL)
+		VERIFY_ERROR(errno);
 
-	pkey_type = EVP_PKEY_id(pkey);
-	if (pkey_type != type)
-		VERIFY_ERROR(EINVAL);
+	check = sig;
 
 	/* Convert EC sigs back to ASN1. */
-	if (pkey_type == EVP_PKEY_EC) {
-		unsigned int degree, bn_len;
-		unsigned char *p;
-		EC_KEY *ec_key;
-
-		ec_sig = ECDSA_SIG_new();
-		if (ec_sig == NULL)
-			VERIFY_ERROR(ENOMEM);
-
-		/* Get the actual ec_key */
-		ec_key = EVP_PKEY_get1_EC_KEY(pkey);
-		if (ec_key == NULL)
-			VERIFY_ERROR(ENOMEM);
-
-		degree = EC_GROUP_get_degree(EC_KEY_get0_group(ec_key));
-
-		EC_KEY_free(ec_key);
-
-		bn_len = (degree + 7) / 8;
-		if ((bn_len * 2) != slen)
-			VERIFY_ERROR(EINVAL);
-
-		ec_sig_r = BN_bin2bn(sig, bn_len, NULL);
-		ec_sig_s = BN_bin2bn(sig + bn_len, bn_len, NULL);
-		if (ec_sig_r  == NULL || ec_sig_s == NULL)
+	if (type == EVP_PKEY_EC) {
+		if (slen != 2 * key->ec_len)
 			VERIFY_ERROR(EINVAL);
 
-		ECDSA_SIG_set0(ec_sig, ec_sig_r, ec_sig_s);
-		jwt_freemem(sig);
-
-		slen = i2d_ECDSA_SIG(ec_sig, NULL);
-		sig = jwt_malloc(slen);
-		if (sig == NULL)
-			VERIFY_ERROR(ENOMEM);
-
-		p = sig;
-		slen = i2d_ECDSA_SIG(ec_sig, &p);
-
-		if (slen == 0)
-			VERIFY_ERROR(EINVAL);
+		slen = jwt_ec_sig_raw_to_der(der, sig, key->ec_len);
+		check = der;
 	}
 
-	mdctx = EVP_MD_CTX_create();
-	if (mdctx == NULL)
+	if (jwt_digest(alg, head, dgst, &dlen))
 		VERIFY_ERROR(ENOMEM);
 
-	/* Initialize the DigestVerify operation using alg */
-	if (EVP_DigestVerifyInit(mdctx, NULL, alg, NULL, pkey) != 1)
-		VERIFY_ERROR(EINVAL);
-
-	/* Call update with the message */
-	if (EVP_DigestVerifyUpdate(mdctx, head, strlen(head)) != 1)
-		VERIFY_ERROR(EINVAL);
+	pctx = jwt_ctx_get(key, jwt->alg, alg, JWT_CTX_VERIFY);
+	if (pctx == NULL)
+		VERIFY_ERROR(ENOMEM);
 
 	/* Now check the sig for validity. */
-	if (EVP_DigestVerifyFinal(mdctx, sig, slen) != 1)
+	if (EVP_PKEY_verify(pctx, check, slen, dgst, dlen) != 1)
 		VERIFY_ERROR(EINVAL);
 
 jwt_verify_sha_pem_done:
-	if (bufkey)
-		BIO_free(bufkey);
-	if (pkey)
-		EVP_PKEY_free(pkey);
-	if (mdctx)
-		EVP_MD_CTX_destroy(mdctx);
+	if (pctx)
+		jwt_ctx_put(key, JWT_CTX_VERIFY, pctx, 0);
 	if (sig)
 		jwt_freemem(sig);
-	if (ec_sig)
-		ECDSA_SIG_free(ec_sig);
 
 	return ret;
 }
+
+const struct jwt_crypto_ops jwt_openssl_ops = {
+	.name = "openssl",
+	.init = jwt_openssl_init,
+	.shutdown = jwt_openssl_shutdown,
+	.prepare_key = jwt_openssl_prepare_key,
+	.release_key = jwt_openssl_release_key,
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+	.precompute = jwt_openssl_precompute,
+#endif
+	.sign_sha_hmac = jwt_sign_sha_hmac,
+	.verify_sha_hmac = jwt_verify_sha_hmac,
+	.sign_sha_hmac_stream = jwt_sign_sha_hmac_stream,
+	.sign_sha_pem = jwt_sign_sha_pem,
+	.verify_sha_pem = jwt_verify_sha_pem,
+};
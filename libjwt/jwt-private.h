@@ -8,16 +8,41 @@
 #ifndef JWT_PRIVATE_H
 #define JWT_PRIVATE_H
 
+#include <stdint.h>
 #include <jansson.h>
 
 struct jwt {
 	jwt_alg_t alg;
 	unsigned char *key;
 	int key_len;
+	jwt_key_t *jkey;
 	json_t *grants;
 	json_t *headers;
 };
 
+struct jwt_key {
+	volatile long refs;
+	jwt_alg_t alg;
+	unsigned char *data;
+	int len;
+	/* Never JWT_KEY_FORMAT_AUTO once the key is prepared. */
+	jwt_key_format_t format;
+	/* What the key was prepared with, see jwt_prepare_key(). */
+	const struct jwt_crypto_ops *ops;
+	const jwt_crypto_provider_t *provider;
+	/* Set by the crypto backend when the key is prepared. */
+	void *parsed;
+	int priv;
+	/* For EC keys, the size in bytes of each of r and s. */
+	int ec_len;
+	/* Unique for the life of the process, so backends can keep state
+	 * for a key without holding a reference. Zero for temporary keys. */
+	uint64_t id;
+	/* Backend state for jwt_key_precompute(), created on first use and
+	 * kept until the key is released. */
+	void *precomp;
+};
+
 struct jwt_valid {
 	jwt_alg_t alg;
 	time_t now;
@@ -33,19 +58,228 @@ char *jwt_strdup(const char *str);
 void *jwt_calloc(size_t nmemb, size_t size);
 void *jwt_realloc(void *ptr, size_t size);
 
+/* Clears secrets from memory, in a way the compiler can't drop as a dead
+ * store the way it may a memset() of a buffer about to go out of scope. */
+void jwt_wipe(void *ptr, size_t len);
+
+/* Reference counting for shared objects. */
+#ifdef _MSC_VER
+#include <intrin.h>
+#define jwt_atomic_inc(__p) _InterlockedIncrement(__p)
+#define jwt_atomic_dec(__p) _InterlockedDecrement(__p)
+#define jwt_atomic_get(__p) _InterlockedCompareExchange(__p, 0, 0)
+#define jwt_atomic_set(__p, __v) _InterlockedExchange(__p, __v)
+#define jwt_atomic_inc64(__p) _InterlockedIncrement64((volatile __int64 *)(__p))
+#define jwt_atomic_get_ptr(__p) \
+	_InterlockedCompareExchangePointer((void *volatile *)(__p), NULL, NULL)
+#define jwt_atomic_xchg_ptr(__p, __v) \
+	_InterlockedExchangePointer((void *volatile *)(__p), __v)
+#define jwt_atomic_set_ptr(__p, __v) \
+	(void)_InterlockedExchangePointer((void *volatile *)(__p), __v)
+/* A full fence, not just a compiler barrier, so the keyring's store then
+ * load handshake holds without relying on the interlocked calls next to
+ * it. */
+#include <windows.h>
+#define jwt_atomic_fence() MemoryBarrier()
+#else
+#define jwt_atomic_inc(__p) __atomic_add_fetch(__p, 1, __ATOMIC_ACQ_REL)
+#define jwt_atomic_dec(__p) __atomic_sub_fetch(__p, 1, __ATOMIC_ACQ_REL)
+#define jwt_atomic_get(__p) __atomic_load_n(__p, __ATOMIC_ACQUIRE)
+#define jwt_atomic_set(__p, __v) __atomic_store_n(__p, __v, __ATOMIC_RELEASE)
+#define jwt_atomic_inc64(__p) __atomic_add_fetch(__p, 1, __ATOMIC_ACQ_REL)
+#define jwt_atomic_get_ptr(__p) __atomic_load_n(__p, __ATOMIC_ACQUIRE)
+#define jwt_atomic_xchg_ptr(__p, __v) \
+	__atomic_exchange_n(__p, __v, __ATOMIC_ACQ_REL)
+#define jwt_atomic_set_ptr(__p, __v) \
+	__atomic_store_n(__p, __v, __ATOMIC_RELEASE)
+#define jwt_atomic_fence() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#endif
+
+/* Locking for process wide state. */
+#ifdef _WIN32
+#include <windows.h>
+typedef SRWLOCK jwt_mutex_t;
+#define JWT_MUTEX_INITIALIZER SRWLOCK_INIT
+#define jwt_mutex_init(__m) InitializeSRWLock(__m)
+#define jwt_mutex_destroy(__m) do { } while (0)
+#define jwt_mutex_lock(__m) AcquireSRWLockExclusive(__m)
+#define jwt_mutex_unlock(__m) ReleaseSRWLockExclusive(__m)
+#define jwt_yield() SwitchToThread()
+typedef CONDITION_VARIABLE jwt_cond_t;
+#define jwt_cond_init(__c) InitializeConditionVariable(__c)
+#define jwt_cond_destroy(__c) do { } while (0)
+#define jwt_cond_wait(__c, __m) SleepConditionVariableSRW(__c, __m, INFINITE, 0)
+#define jwt_cond_signal(__c) WakeConditionVariable(__c)
+#define jwt_cond_broadcast(__c) WakeAllConditionVariable(__c)
+typedef HANDLE jwt_thread_t;
+#else
+#include <pthread.h>
+#include <sched.h>
+typedef pthread_mutex_t jwt_mutex_t;
+#define JWT_MUTEX_INITIALIZER PTHREAD_MUTEX_INITIALIZER
+#define jwt_mutex_init(__m) pthread_mutex_init(__m, NULL)
+#define jwt_mutex_destroy(__m) pthread_mutex_destroy(__m)
+#define jwt_mutex_lock(__m) pthread_mutex_lock(__m)
+#define jwt_mutex_unlock(__m) pthread_mutex_unlock(__m)
+#define jwt_yield() sched_yield()
+typedef pthread_cond_t jwt_cond_t;
+#define jwt_cond_init(__c) pthread_cond_init(__c, NULL)
+#define jwt_cond_destroy(__c) pthread_cond_destroy(__c)
+#define jwt_cond_wait(__c, __m) pthread_cond_wait(__c, __m)
+#define jwt_cond_signal(__c) pthread_cond_signal(__c)
+#define jwt_cond_broadcast(__c) pthread_cond_broadcast(__c)
+typedef pthread_t jwt_thread_t;
+#endif
+
+/* Background threads, see jwt-thread.c. jwt_thread_start() runs fn(arg)
+ * on a new thread and returns 0, or an errno if it could not be started.
+ * Every started thread must be waited for with jwt_thread_join(). */
+int jwt_thread_start(jwt_thread_t *thread, void (*fn)(void *), void *arg);
+void jwt_thread_join(jwt_thread_t thread);
+
+/* Number of CPUs online, at least 1. */
+unsigned int jwt_thread_cpus(void);
+
+/* Returns a referenced key from the process wide key cache, or sets *key
+ * to NULL if the cache is turned off. */
+int jwt_key_cache_get(jwt_key_t **key, jwt_alg_t alg,
+		      const unsigned char *data, int len);
+
+/* The verified and rejected token caches, see jwt-tokencache.c. Tokens
+ * are known by an id made from the token and the key it is verified
+ * with, the raw key or the prepared jkey. jwt_token_cache_id() returns
+ * ENOENT when both caches are off or the token would not be verified at
+ * all. */
+#define JWT_TOKEN_ID_LEN	32
+
+int jwt_token_cache_id(unsigned char *id, const char *token,
+		       const unsigned char *key, int key_len, jwt_key_t *jkey);
+
+/* Fill in the alg, header and claims of a new jwt from the cache.
+ * Returns 0 on a hit. */
+int jwt_token_cache_get(const unsigned char *id, jwt_t *jwt);
+
+/* Save a jwt that was just verified. */
+void jwt_token_cache_put(const unsigned char *id, jwt_t *jwt);
+
+/* Whether the token failed its signature check recently, and save one
+ * that just did. */
+int jwt_reject_cache_check(const unsigned char *id);
+void jwt_reject_cache_put(const unsigned char *id);
+
+/* Whether key is of the same kind, HMAC, RSA and so on, as alg. */
+int jwt_key_compat(jwt_key_t *key, jwt_alg_t alg);
+
+/* Returns a referenced key of set for kid that can be used with alg,
+ * or any key for kid if alg is JWT_ALG_INVAL. */
+jwt_key_t *jwt_keyset_lookup(jwt_keyset_t *set, const char *kid,
+			     jwt_alg_t alg);
+
 /* Helper routines. */
 void jwt_base64uri_encode(char *str);
+/* Returns NULL with errno set to ENOMEM or, for bad input, EINVAL. */
 void *jwt_b64_decode(const char *src, int *ret_len);
 
-/* These routines are implemented by the crypto backend. */
-int jwt_sign_sha_hmac(jwt_t *jwt, char **out, unsigned int *len,
-		      const char *str);
+/* Decode an unpadded base64url string into dst, see
+ * jwt_b64url_decode_into(). Returns the decoded length, or -1 if src is
+ * not canonical base64url or does not fit in dst_len bytes. */
+int jwt_b64uri_decode_buf(unsigned char *dst, int dst_len, const char *src);
+
+/* Largest MAC produced by any supported algorithm (HS512). */
+#define JWT_HMAC_MAX_LEN	64
+
+/* The built in multi-buffer HMAC, see jwt-hmac-mb.c. Signs each of the
+ * count msgs, lens[i] bytes long, with the same key into out,
+ * JWT_HMAC_MAX_LEN bytes apart. Returns the MAC length, or 0 if alg is
+ * not HS*. */
+unsigned int jwt_hmac_mb(jwt_alg_t alg, const unsigned char *key,
+			 int key_len, const char * const *msgs,
+			 const size_t *lens, unsigned int count,
+			 unsigned char *out);
+
+/* Largest r or s of an ECDSA signature, for P-521. */
+#define JWT_EC_MAX_LEN		66
+#define JWT_EC_DER_MAX_LEN	(3 + 2 * (2 + JWT_EC_MAX_LEN + 1))
+
+/* Most nonces jwt_key_precompute() keeps ready for one key. */
+#define JWT_PRECOMPUTE_MAX	4096
+
+/* Largest EdDSA signature, for Ed448. Ed25519 ones are 64 bytes. */
+#define JWT_EDDSA_MAX_LEN	114
+
+/* Convert between the r||s form of an ECDSA signature used by JWS, where
+ * each half is len bytes, and DER. jwt_ec_sig_raw_to_der() returns the
+ * length written to der, which must hold JWT_EC_DER_MAX_LEN bytes.
+ * jwt_ec_sig_der_to_raw() returns 0 on success. */
+int jwt_ec_sig_raw_to_der(unsigned char *der, const unsigned char *sig,
+			  int len);
+int jwt_ec_sig_der_to_raw(unsigned char *out, const unsigned char *der,
+			  int der_len, int len);
+
+/* Hands over the next piece of a signing input as it is produced, and
+ * returns its length, or 0 once there is no more. */
+typedef size_t (*jwt_input_next_t)(void *arg, const char **piece);
+
+/* A crypto backend. Each one lives in its own jwt-<name>.c and any of
+ * them can be linked in together. A prepared key remembers the ops that
+ * made it, and is only ever handed back to those. */
+struct jwt_crypto_ops {
+	const char *name;
+
+	/* Set up and release the backend's process wide state. The backend
+	 * also sets itself up on first use, so these are optional. A NULL
+	 * libctx keeps whatever context is already in use, anything else
+	 * rebinds. */
+	int (*init)(void *libctx);
+	void (*shutdown)(void);
+
+	/* Parse key->data into a backend specific object stored in
+	 * key->parsed. Returns EINVAL if the key does not match key->alg. */
+	int (*prepare_key)(jwt_key_t *key);
+	void (*release_key)(jwt_key_t *key);
+
+	/* Optional, see jwt_key_precompute(). Called with the key already
+	 * checked to be a private EC key. */
+	int (*precompute)(jwt_key_t *key, unsigned int depth);
+
+	/* The key passed in has already been checked against jwt->alg.
+	 * Verifying returns EINVAL only for a signature that does not match
+	 * or is malformed, and ENOMEM when it could not be checked, so a
+	 * transient failure is never taken for a forgery. */
+	int (*sign_sha_hmac)(jwt_t *jwt, jwt_key_t *key, char **out,
+			     unsigned int *len, const char *str);
+	int (*verify_sha_hmac)(jwt_t *jwt, jwt_key_t *key, const char *head,
+			       const char *sig);
+	/* Optional. Like sign_sha_hmac, but the input is taken from next()
+	 * until it runs out, and the MAC written to out, which has room for
+	 * JWT_HMAC_MAX_LEN bytes. */
+	int (*sign_sha_hmac_stream)(jwt_t *jwt, jwt_key_t *key,
+				    jwt_input_next_t next, void *arg,
+				    unsigned char *out, unsigned int *len);
+	int (*sign_sha_pem)(jwt_t *jwt, jwt_key_t *key, char **out,
+			    unsigned int *len, const char *str);
+	int (*verify_sha_pem)(jwt_t *jwt, jwt_key_t *key, const char *head,
+			      const char *sig_b64);
+};
+
+extern const struct jwt_crypto_ops jwt_openssl_ops;
+extern const struct jwt_crypto_ops jwt_gnutls_ops;
+extern const struct jwt_crypto_ops jwt_wincrypt_ops;
+
+/* Set up and release every backend that was built in. */
+int jwt_crypto_init(void *libctx);
+
+void jwt_crypto_shutdown(void);
+
+/* Prepare key with whatever currently handles key->alg. */
+int jwt_prepare_key(jwt_key_t *key);
 
-int jwt_verify_sha_hmac(jwt_t *jwt, const char *head, const char *sig);
+void jwt_release_key(jwt_key_t *key);
 
-int jwt_sign_sha_pem(jwt_t *jwt, char **out, unsigned int *len,
-		     const char *str);
+/* Whether key was prepared by what currently handles alg. */
+int jwt_key_current(jwt_key_t *key, jwt_alg_t alg);
 
-int jwt_verify_sha_pem(jwt_t *jwt, const char *head, const char *sig_b64);
+/* Whether the application installed a provider of its own for alg. */
+int jwt_crypto_provided(jwt_alg_t alg);
 
 #endif /* JWT_PRIVATE_H */
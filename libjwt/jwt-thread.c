@@ -0,0 +1,118 @@
+/* Copyright (C) 2015-2018 Ben Collins <ben@cyphre.com>
+   This file is part of the JWT C Library
+
+   This Source Code Form is subject to the terms of the Mozilla Public
+   License, v. 2.0. If a copy of the MPL was not distributed with this
+   file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <stdlib.h>
+#include <errno.h>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#include <jwt.h>
+
+#include "jwt-private.h"
+#include "config.h"
+
+/* The smallest wrapper over native threads that the background work in
+ * LibJWT needs: start a function on a thread of its own and wait for it
+ * to return. */
+
+struct thread_start {
+	void (*fn)(void *);
+	void *arg;
+};
+
+#ifdef _WIN32
+
+static DWORD WINAPI thread_main(LPVOID data)
+{
+	struct thread_start start = *(struct thread_start *)data;
+
+	jwt_freemem(data);
+	start.fn(start.arg);
+
+	return 0;
+}
+
+int jwt_thread_start(jwt_thread_t *thread, void (*fn)(void *), void *arg)
+{
+	struct thread_start *start;
+
+	start = jwt_malloc(sizeof(*start));
+	if (start == NULL)
+		return ENOMEM;
+
+	start->fn = fn;
+	start->arg = arg;
+
+	*thread = CreateThread(NULL, 0, thread_main, start, 0, NULL);
+	if (*thread == NULL) {
+		jwt_freemem(start);
+		return EAGAIN;
+	}
+
+	return 0;
+}
+
+void jwt_thread_join(jwt_thread_t thread)
+{
+	WaitForSingleObject(thread, INFINITE);
+	CloseHandle(thread);
+}
+
+unsigned int jwt_thread_cpus(void)
+{
+	SYSTEM_INFO info;
+
+	GetSystemInfo(&info);
+
+	return info.dwNumberOfProcessors ? info.dwNumberOfProcessors : 1;
+}
+
+#else
+
+static void *thread_main(void *data)
+{
+	struct thread_start start = *(struct thread_start *)data;
+
+	jwt_freemem(data);
+	start.fn(start.arg);
+
+	return NULL;
+}
+
+int jwt_thread_start(jwt_thread_t *thread, void (*fn)(void *), void *arg)
+{
+	struct thread_start *start;
+	int ret;
+
+	start = jwt_malloc(sizeof(*start));
+	if (start == NULL)
+		return ENOMEM;
+
+	start->fn = fn;
+	start->arg = arg;
+
+	ret = pthread_create(thread, NULL, thread_main, start);
+	if (ret)
+		jwt_freemem(start);
+
+	return ret;
+}
+
+void jwt_thread_join(jwt_thread_t thread)
+{
+	pthread_join(thread, NULL);
+}
+
+unsigned int jwt_thread_cpus(void)
+{
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+	return n > 0 ? n : 1;
+}
+
+#endif
@@ -0,0 +1,674 @@
+/* Copyright (C) 2015-2018 Ben Collins <ben@cyphre.com>
+   This file is part of the JWT C Library
+
+   This Source Code Form is subject to the terms of the Mozilla Public
+   License, v. 2.0. If a copy of the MPL was not distributed with this
+   file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <jwt.h>
+
+#include "jwt-private.h"
+#include "config.h"
+
+/* Process wide cache of tokens that already passed jwt_decode(), so a
+ * client that keeps presenting the same bearer token only pays for the
+ * signature check and JSON parsing once. Entries are keyed by an
+ * HMAC-SHA256 of the exact token bytes under the identity of the key it
+ * was verified with, hold a copy of the decoded header and claims, and
+ * never outlive the token's exp.
+ *
+ * The cache is split into shards, picked by the id, each with its own
+ * lock, hash table and least recently used order, so threads decoding
+ * different tokens rarely wait for each other. */
+
+#define TOKEN_CACHE_SHARDS	16
+#define TOKEN_CACHE_DEFAULT_TTL	300
+
+struct token_cache_entry {
+	unsigned char id[JWT_TOKEN_ID_LEN];
+	time_t expires;
+	jwt_alg_t alg;
+	json_t *headers;
+	json_t *grants;
+	struct token_cache_entry *hnext;
+	struct token_cache_entry *prev, *next;
+};
+
+struct token_cache_shard {
+	jwt_mutex_t lock;
+	struct token_cache_entry **buckets;
+	unsigned int nbuckets;
+	/* Most recently used at head. */
+	struct token_cache_entry *head, *tail;
+	unsigned int size;
+	unsigned int entries;
+	unsigned long hits, misses, evictions;
+};
+
+static struct {
+	/* Checked without a lock, so a cache that is off costs nothing. */
+	volatile long enabled;
+	jwt_mutex_t lock;
+	unsigned int size;
+	volatile long ttl;
+	struct token_cache_shard shards[TOKEN_CACHE_SHARDS];
+} token_cache = {
+	.lock = JWT_MUTEX_INITIALIZER,
+	.ttl = TOKEN_CACHE_DEFAULT_TTL,
+};
+
+/* Tokens that failed their signature check are remembered too, by id
+ * alone, so a client retrying the same bad token is turned away without
+ * the crypto backend. Only a few seconds by default, since all this
+ * saves is work. Each shard is a fixed table of sets of a few ids, so a
+ * lookup compares at most REJECT_CACHE_WAYS ids and nothing is allocated
+ * after the size is set. */
+#define REJECT_CACHE_WAYS	4
+#define REJECT_CACHE_DEFAULT_TTL	10
+
+struct reject_cache_set {
+	unsigned char id[REJECT_CACHE_WAYS][JWT_TOKEN_ID_LEN];
+	/* Zero for a way that is free. */
+	time_t expires[REJECT_CACHE_WAYS];
+};
+
+struct reject_cache_shard {
+	jwt_mutex_t lock;
+	struct reject_cache_set *sets;
+	unsigned int nsets;
+	unsigned long hits, misses, evictions;
+};
+
+static struct {
+	volatile long enabled;
+	unsigned int size;
+	volatile long ttl;
+	struct reject_cache_shard shards[TOKEN_CACHE_SHARDS];
+} reject_cache = {
+	.ttl = REJECT_CACHE_DEFAULT_TTL,
+};
+
+/* Shard locks can't be set up statically in an array on every system.
+ * Called with token_cache.lock held, which guards both caches' sizes. */
+static void token_cache_init(void)
+{
+	static int done;
+	int i;
+
+	if (done)
+		return;
+
+	for (i = 0; i < TOKEN_CACHE_SHARDS; i++) {
+		jwt_mutex_init(&token_cache.shards[i].lock);
+		jwt_mutex_init(&reject_cache.shards[i].lock);
+	}
+
+	done = 1;
+}
+
+static uint64_t token_cache_word(const unsigned char *id)
+{
+	uint64_t w;
+
+	memcpy(&w, id, sizeof(w));
+
+	return w;
+}
+
+static struct token_cache_shard *token_cache_shard(const unsigned char *id)
+{
+	return &token_cache.shards[id[JWT_TOKEN_ID_LEN - 1] %
+				   TOKEN_CACHE_SHARDS];
+}
+
+int jwt_token_cache_id(unsigned char *id, const char *token,
+		       const unsigned char *key, int key_len, jwt_key_t *jkey)
+{
+	/* Prepared keys are known by their id, which is never reused. The
+	 * tag keeps them apart from raw keys of the same bytes. */
+	unsigned char ident[16] = "jwt\0key\0";
+	size_t len;
+
+	if (!jwt_atomic_get(&token_cache.enabled) &&
+	    !jwt_atomic_get(&reject_cache.enabled))
+		return ENOENT;
+
+	if (jkey) {
+		if (!jkey->id)
+			return ENOENT;
+		memcpy(ident + 8, &jkey->id, sizeof(jkey->id));
+		key = ident;
+		key_len = sizeof(ident);
+	} else if (key == NULL || key_len <= 0) {
+		/* Nothing was verified, so there is nothing to save. */
+		return ENOENT;
+	}
+
+	len = strlen(token);
+	if (!jwt_hmac_mb(JWT_ALG_HS256, key, key_len, &token, &len, 1, id))
+		return ENOENT;
+
+	return 0;
+}
+
+/* Called with the shard lock held. */
+static struct token_cache_entry *token_cache_find(
+	struct token_cache_shard *shard, const unsigned char *id)
+{
+	struct token_cache_entry *e;
+
+	if (!shard->nbuckets)
+		return NULL;
+
+	for (e = shard->buckets[token_cache_word(id) % shard->nbuckets]; e;
+	     e = e->hnext) {
+		if (!memcmp(e->id, id, JWT_TOKEN_ID_LEN))
+			return e;
+	}
+
+	return NULL;
+}
+
+static void token_cache_unlink(struct token_cache_shard *shard,
+			       struct token_cache_entry *e)
+{
+	if (e->prev)
+		e->prev->next = e->next;
+	else
+		shard->head = e->next;
+
+	if (e->next)
+		e->next->prev = e->prev;
+	else
+		shard->tail = e->prev;
+
+	e->prev = e->next = NULL;
+}
+
+static void token_cache_push(struct token_cache_shard *shard,
+			     struct token_cache_entry *e)
+{
+	e->prev = NULL;
+	e->next = shard->head;
+
+	if (shard->head)
+		shard->head->prev = e;
+	else
+		shard->tail = e;
+
+	shard->head = e;
+}
+
+/* Called with the shard lock held. */
+static void token_cache_remove(struct token_cache_shard *shard,
+			       struct token_cache_entry *e)
+{
+	struct token_cache_entry **p;
+
+	for (p = &shard->buckets[token_cache_word(e->id) % shard->nbuckets];
+	     *p; p = &(*p)->hnext) {
+		if (*p == e) {
+			*p = e->hnext;
+			break;
+		}
+	}
+
+	token_cache_unlink(shard, e);
+	shard->entries--;
+
+	json_decref(e->headers);
+	json_decref(e->grants);
+	jwt_freemem(e);
+}
+
+static void token_cache_trim(struct token_cache_shard *shard,
+			     unsigned int size)
+{
+	while (shard->entries > size) {
+		token_cache_remove(shard, shard->tail);
+		shard->evictions++;
+	}
+}
+
+int jwt_token_cache_get(const unsigned char *id, jwt_t *jwt)
+{
+	struct token_cache_shard *shard = token_cache_shard(id);
+	struct token_cache_entry *e;
+	json_t *headers = NULL, *grants = NULL;
+	int ret = ENOENT;
+
+	/* The id may have been made for the reject cache alone. */
+	if (!jwt_atomic_get(&token_cache.enabled))
+		return ENOENT;
+
+	jwt_mutex_lock(&shard->lock);
+
+	e = token_cache_find(shard, id);
+	if (e && e->expires <= time(NULL)) {
+		token_cache_remove(shard, e);
+		shard->evictions++;
+		e = NULL;
+	}
+
+	if (e) {
+		/* Copies, since the caller is free to change its JWT. */
+		headers = json_deep_copy(e->headers);
+		grants = json_deep_copy(e->grants);
+		if (headers && grants) {
+			token_cache_unlink(shard, e);
+			token_cache_push(shard, e);
+			jwt->alg = e->alg;
+			ret = 0;
+		}
+	}
+
+	if (ret)
+		shard->misses++;
+	else
+		shard->hits++;
+
+	jwt_mutex_unlock(&shard->lock);
+
+	if (ret) {
+		json_decref(headers);
+		json_decref(grants);
+		return ret;
+	}
+
+	json_decref(jwt->headers);
+	json_decref(jwt->grants);
+	jwt->headers = headers;
+	jwt->grants = grants;
+
+	return 0;
+}
+
+void jwt_token_cache_put(const unsigned char *id, jwt_t *jwt)
+{
+	struct token_cache_shard *shard = token_cache_shard(id);
+	struct token_cache_entry *e;
+	time_t now = time(NULL);
+	json_t *exp;
+
+	if (!jwt_atomic_get(&token_cache.enabled))
+		return;
+
+	e = jwt_malloc(sizeof(*e));
+	if (e == NULL)
+		return;
+
+	memset(e, 0, sizeof(*e));
+	memcpy(e->id, id, JWT_TOKEN_ID_LEN);
+	e->alg = jwt->alg;
+	e->expires = now + jwt_atomic_get(&token_cache.ttl);
+
+	/* A token that can't say when it expires is used as is, but not
+	 * kept. One that has expired already, likewise. */
+	exp = json_object_get(jwt->grants, "exp");
+	if (exp) {
+		if (!json_is_integer(exp) ||
+		    json_integer_value(exp) <= (json_int_t)now) {
+			jwt_freemem(e);
+			return;
+		}
+		if (json_integer_value(exp) < (json_int_t)e->expires)
+			e->expires = json_integer_value(exp);
+	}
+
+	/* Copying outside the lock keeps other threads moving. */
+	e->headers = json_deep_copy(jwt->headers);
+	e->grants = json_deep_copy(jwt->grants);
+	if (e->headers == NULL || e->grants == NULL)
+		goto put_fail;
+
+	jwt_mutex_lock(&shard->lock);
+
+	/* The cache may have been turned off meanwhile, or another thread
+	 * may have saved the same token. */
+	if (!shard->size || token_cache_find(shard, id)) {
+		jwt_mutex_unlock(&shard->lock);
+		goto put_fail;
+	}
+
+	e->hnext = shard->buckets[token_cache_word(id) % shard->nbuckets];
+	shard->buckets[token_cache_word(id) % shard->nbuckets] = e;
+	token_cache_push(shard, e);
+	shard->entries++;
+
+	token_cache_trim(shard, shard->size);
+
+	jwt_mutex_unlock(&shard->lock);
+
+	return;
+
+put_fail:
+	json_decref(e->headers);
+	json_decref(e->grants);
+	jwt_freemem(e);
+}
+
+int jwt_token_cache_set_size(unsigned int size)
+{
+	struct token_cache_entry **buckets[TOKEN_CACHE_SHARDS] = { NULL };
+	struct token_cache_shard *shard;
+	unsigned int per, nbuckets = 0;
+	int i;
+
+	/* Each shard takes an even part, and has a power of two buckets
+	 * for about as many entries. */
+	per = size / TOKEN_CACHE_SHARDS + (size % TOKEN_CACHE_SHARDS != 0);
+	if (per) {
+		for (nbuckets = 8; nbuckets < per; nbuckets *= 2)
+			;
+
+		for (i = 0; i < TOKEN_CACHE_SHARDS; i++) {
+			buckets[i] = jwt_calloc(nbuckets, sizeof(*buckets[i]));
+			if (buckets[i] == NULL)
+				goto set_size_fail;
+		}
+	}
+
+	jwt_mutex_lock(&token_cache.lock);
+	token_cache_init();
+
+	for (i = 0; i < TOKEN_CACHE_SHARDS; i++) {
+		shard = &token_cache.shards[i];
+
+		jwt_mutex_lock(&shard->lock);
+
+		while (shard->head)
+			token_cache_remove(shard, shard->head);
+
+		jwt_freemem(shard->buckets);
+		shard->buckets = buckets[i];
+		shard->nbuckets = nbuckets;
+		shard->size = per;
+
+		jwt_mutex_unlock(&shard->lock);
+	}
+
+	token_cache.size = size;
+	jwt_atomic_set(&token_cache.enabled, size != 0);
+
+	jwt_mutex_unlock(&token_cache.lock);
+
+	return 0;
+
+set_size_fail:
+	for (i = 0; i < TOKEN_CACHE_SHARDS; i++)
+		jwt_freemem(buckets[i]);
+
+	return ENOMEM;
+}
+
+int jwt_token_cache_set_ttl(unsigned int seconds)
+{
+	if (seconds == 0 || seconds > INT32_MAX)
+		return EINVAL;
+
+	jwt_atomic_set(&token_cache.ttl, (long)seconds);
+
+	return 0;
+}
+
+void jwt_token_cache_flush(void)
+{
+	struct token_cache_shard *shard;
+	int i;
+
+	jwt_mutex_lock(&token_cache.lock);
+	token_cache_init();
+
+	for (i = 0; i < TOKEN_CACHE_SHARDS; i++) {
+		shard = &token_cache.shards[i];
+
+		jwt_mutex_lock(&shard->lock);
+		while (shard->head)
+			token_cache_remove(shard, shard->head);
+		jwt_mutex_unlock(&shard->lock);
+	}
+
+	jwt_mutex_unlock(&token_cache.lock);
+}
+
+void jwt_token_cache_get_stats(jwt_cache_stats_t *stats)
+{
+	struct token_cache_shard *shard;
+	int i;
+
+	if (!stats)
+		return;
+
+	memset(stats, 0, sizeof(*stats));
+
+	jwt_mutex_lock(&token_cache.lock);
+	token_cache_init();
+
+	stats->size = token_cache.size;
+
+	for (i = 0; i < TOKEN_CACHE_SHARDS; i++) {
+		shard = &token_cache.shards[i];
+
+		jwt_mutex_lock(&shard->lock);
+		stats->entries += shard->entries;
+		stats->hits += shard->hits;
+		stats->misses += shard->misses;
+		stats->evictions += shard->evictions;
+		jwt_mutex_unlock(&shard->lock);
+	}
+
+	jwt_mutex_unlock(&token_cache.lock);
+}
+
+static struct reject_cache_shard *reject_cache_shard(const unsigned char *id)
+{
+	return &reject_cache.shards[id[JWT_TOKEN_ID_LEN - 1] %
+				    TOKEN_CACHE_SHARDS];
+}
+
+/* Called with the shard lock held. */
+static struct reject_cache_set *reject_cache_set(
+	struct reject_cache_shard *shard, const unsigned char *id)
+{
+	return &shard->sets[token_cache_word(id) % shard->nsets];
+}
+
+int jwt_reject_cache_check(const unsigned char *id)
+{
+	struct reject_cache_shard *shard = reject_cache_shard(id);
+	struct reject_cache_set *set;
+	time_t now = time(NULL);
+	int i, ret = 0;
+
+	if (!jwt_atomic_get(&reject_cache.enabled))
+		return 0;
+
+	jwt_mutex_lock(&shard->lock);
+
+	if (!shard->nsets) {
+		jwt_mutex_unlock(&shard->lock);
+		return 0;
+	}
+
+	set = reject_cache_set(shard, id);
+	for (i = 0; i < REJECT_CACHE_WAYS; i++) {
+		if (!set->expires[i] ||
+		    memcmp(set->id[i], id, JWT_TOKEN_ID_LEN))
+			continue;
+
+		if (set->expires[i] <= now) {
+			set->expires[i] = 0;
+			shard->evictions++;
+		} else {
+			ret = 1;
+		}
+		break;
+	}
+
+	if (ret)
+		shard->hits++;
+	else
+		shard->misses++;
+
+	jwt_mutex_unlock(&shard->lock);
+
+	return ret;
+}
+
+void jwt_reject_cache_put(const unsigned char *id)
+{
+	struct reject_cache_shard *shard = reject_cache_shard(id);
+	struct reject_cache_set *set;
+	time_t now = time(NULL);
+	int i, way = 0;
+
+	if (!jwt_atomic_get(&reject_cache.enabled))
+		return;
+
+	jwt_mutex_lock(&shard->lock);
+
+	if (!shard->nsets) {
+		jwt_mutex_unlock(&shard->lock);
+		return;
+	}
+
+	/* The same id again, else a free or expired way, else the one that
+	 * would expire first. */
+	set = reject_cache_set(shard, id);
+	for (i = 0; i < REJECT_CACHE_WAYS; i++) {
+		if (set->expires[i] &&
+		    !memcmp(set->id[i], id, JWT_TOKEN_ID_LEN)) {
+			way = i;
+			break;
+		}
+		if (set->expires[i] < set->expires[way])
+			way = i;
+	}
+
+	if (i == REJECT_CACHE_WAYS && set->expires[way])
+		shard->evictions++;
+
+	memcpy(set->id[way], id, JWT_TOKEN_ID_LEN);
+	set->expires[way] = now + jwt_atomic_get(&reject_cache.ttl);
+
+	jwt_mutex_unlock(&shard->lock);
+}
+
+int jwt_reject_cache_set_size(unsigned int size)
+{
+	struct reject_cache_set *sets[TOKEN_CACHE_SHARDS] = { NULL };
+	struct reject_cache_shard *shard;
+	unsigned int per, nsets;
+	int i;
+
+	/* Each shard takes an even part, rounded up to whole sets. */
+	per = size / TOKEN_CACHE_SHARDS + (size % TOKEN_CACHE_SHARDS != 0);
+	nsets = (per + REJECT_CACHE_WAYS - 1) / REJECT_CACHE_WAYS;
+	if (nsets) {
+		for (i = 0; i < TOKEN_CACHE_SHARDS; i++) {
+			sets[i] = jwt_calloc(nsets, sizeof(*sets[i]));
+			if (sets[i] == NULL)
+				goto set_size_fail;
+		}
+	}
+
+	jwt_mutex_lock(&token_cache.lock);
+	token_cache_init();
+
+	for (i = 0; i < TOKEN_CACHE_SHARDS; i++) {
+		shard = &reject_cache.shards[i];
+
+		jwt_mutex_lock(&shard->lock);
+		jwt_freemem(shard->sets);
+		shard->sets = sets[i];
+		shard->nsets = nsets;
+		jwt_mutex_unlock(&shard->lock);
+	}
+
+	reject_cache.size = size;
+	jwt_atomic_set(&reject_cache.enabled, size != 0);
+
+	jwt_mutex_unlock(&token_cache.lock);
+
+	return 0;
+
+set_size_fail:
+	for (i = 0; i < TOKEN_CACHE_SHARDS; i++)
+		jwt_freemem(sets[i]);
+
+	return ENOMEM;
+}
+
+int jwt_reject_cache_set_ttl(unsigned int seconds)
+{
+	if (seconds == 0 || seconds > INT32_MAX)
+		return EINVAL;
+
+	jwt_atomic_set(&reject_cache.ttl, (long)seconds);
+
+	return 0;
+}
+
+void jwt_reject_cache_flush(void)
+{
+	struct reject_cache_shard *shard;
+	int i;
+
+	jwt_mutex_lock(&token_cache.lock);
+	token_cache_init();
+
+	for (i = 0; i < TOKEN_CACHE_SHARDS; i++) {
+		shard = &reject_cache.shards[i];
+
+		jwt_mutex_lock(&shard->lock);
+		if (shard->nsets)
+			memset(shard->sets, 0,
+			       shard->nsets * sizeof(*shard->sets));
+		jwt_mutex_unlock(&shard->lock);
+	}
+
+	jwt_mutex_unlock(&token_cache.lock);
+}
+
+void jwt_reject_cache_get_stats(jwt_cache_stats_t *stats)
+{
+	struct reject_cache_shard *shard;
+	time_t now = time(NULL);
+	unsigned int n;
+	int i, w;
+
+	if (!stats)
+		return;
+
+	memset(stats, 0, sizeof(*stats));
+
+	jwt_mutex_lock(&token_cache.lock);
+	token_cache_init();
+
+	stats->size = reject_cache.size;
+
+	for (i = 0; i < TOKEN_CACHE_SHARDS; i++) {
+		shard = &reject_cache.shards[i];
+
+		jwt_mutex_lock(&shard->lock);
+		/* Expired ids linger until their way is reused. */
+		for (n = 0; n < shard->nsets; n++) {
+			for (w = 0; w < REJECT_CACHE_WAYS; w++) {
+				if (shard->sets[n].expires[w] > now)
+					stats->entries++;
+			}
+		}
+		stats->hits += shard->hits;
+		stats->misses += shard->misses;
+		stats->evictions += shard->evictions;
+		jwt_mutex_unlock(&shard->lock);
+	}
+
+	jwt_mutex_unlock(&token_cache.lock);
+}
@@ -471,10 +471,39 @@ static int is_public_key_pem(unsigned char* key, int key_len)
 	return !memcmp(key, PEM_PUBLIC_KEY_HEADER, strlen(PEM_PUBLIC_KEY_HEADER));
 }
 
+static int jwt_wincrypt_init(void *libctx)
+{
+	/* CryptoAPI has no library contexts. */
+	return libctx ? EINVAL : 0;
+}
+
+static void jwt_wincrypt_shutdown(void)
+{
+}
+
+static int jwt_wincrypt_prepare_key(jwt_key_t *key)
+{
+	/* Keys are looked up in the certificate store or imported on every
+	 * use, so there is nothing to prepare here. Only HMAC keys and PEM
+	 * are understood there. */
+	switch (key->alg) {
+	case JWT_ALG_HS256:
+	case JWT_ALG_HS384:
+	case JWT_ALG_HS512:
+		return 0;
+	default:
+		return key->format == JWT_KEY_FORMAT_PEM ? 0 : EINVAL;
+	}
+}
+
+static void jwt_wincrypt_release_key(jwt_key_t *key)
+{
+}
+
 #define SIGN_HMAC_ERROR(__err) { ret = __err; goto jwt_sign_sha_hmac_done; }
 
-int jwt_sign_sha_hmac(jwt_t *jwt, char **out, unsigned int *len,
-		      const char *str)
+static int jwt_sign_sha_hmac(jwt_t *jwt, jwt_key_t *key, char **out,
+			     unsigned int *len, const char *str)
 {
 	int ret = EINVAL;
 	LPCWSTR alg;
@@ -528,8 +557,8 @@ int jwt_sign_sha_hmac(jwt_t *jwt, char **out, unsigned int *len,
 		&hHash,
 		pbHashObject,
 		cbHashObject,
-		jwt->key,
-		jwt->key_len,
+		key->data,
+		key->len,
 		0) != ERROR_SUCCESS)
 		SIGN_HMAC_ERROR(EINVAL);
 
@@ -583,7 +612,8 @@ jwt_sign_sha_hmac_done:
 
 #define VERIFY_HMAC_ERROR(__err) { ret = __err; goto jwt_verify_hmac_done; }
 
-int jwt_verify_sha_hmac(jwt_t *jwt, const char *head, const char *sig)
+static int jwt_verify_sha_hmac(jwt_t *jwt, jwt_key_t *key, const char *head,
+			       const char *sig)
 {
 	int ret;
 	char* pbHash = NULL;
@@ -592,9 +622,9 @@ int jwt_verify_sha_hmac(jwt_t *jwt, const char *head, const char *sig)
 	DWORD cbB64;
 
 	/* Compute the HMAC on the "head" string. */
-	ret = jwt_sign_sha_hmac(jwt, &pbHash, &cbHash, head);
+	ret = jwt_sign_sha_hmac(jwt, key, &pbHash, &cbHash, head);
 	if (ret)
-		goto jwt_verify_hmac_done;
+		VERIFY_HMAC_ERROR(ENOMEM);
 
 	/* Encode as Base64. */
 	if (!CryptBinaryToStringA(
@@ -603,7 +633,7 @@ int jwt_verify_sha_hmac(jwt_t *jwt, const char *head, const char *sig)
 		CRYPT_STRING_BASE64 | CRYPT_STRING_NOCRLF,
 		NULL,
 		&cbB64))
-		VERIFY_HMAC_ERROR(EINVAL);
+		VERIFY_HMAC_ERROR(ENOMEM);
 
 	/* Null terminator is already included in base64Size. */
 	pbB64 = (char*)jwt_malloc(cbB64);
@@ -617,7 +647,7 @@ int jwt_verify_sha_hmac(jwt_t *jwt, const char *head, const char *sig)
 		CRYPT_STRING_BASE64 | CRYPT_STRING_NOCRLF,
 		pbB64,
 		&cbB64))
-		VERIFY_HMAC_ERROR(EINVAL);
+		VERIFY_HMAC_ERROR(ENOMEM);
 
 	/* URI encode. */
 	jwt_base64uri_encode(pbB64);
@@ -637,8 +667,8 @@ jwt_verify_hmac_done:
 
 #define SIGN_PEM_ERROR(__err) { ret = __err; goto jwt_sign_sha_pem_done; }
 
-int jwt_sign_sha_pem(jwt_t *jwt, char **out, unsigned int *len,
-		     const char *str)
+static int jwt_sign_sha_pem(jwt_t *jwt, jwt_key_t *key, char **out,
+			    unsigned int *len, const char *str)
 {
 	int ret = EINVAL;
 	LPCWSTR alg;
@@ -703,8 +733,8 @@ int jwt_sign_sha_pem(jwt_t *jwt, char **out, unsigned int *len,
 	 * in the certificate store.
 	 */
 	ret = open_private_key_from_store(
-		jwt->key,
-		jwt->key_len,
+		key->data,
+		key->len,
 		&hCertStore,
 		&pSignerCert,
 		&hStorageProv,
@@ -836,7 +866,8 @@ jwt_sign_sha_pem_done:
 
 #define VERIFY_PEM_ERROR(__err) { ret = __err; goto jwt_verify_sha_pem_done; }
 
-int jwt_verify_sha_pem(jwt_t *jwt, const char *head, const char *sig_b64)
+static int jwt_verify_sha_pem(jwt_t *jwt, jwt_key_t *key, const char *head,
+			      const char *sig_b64)
 {
 	int ret = EINVAL;
 	LPCWSTR alg;
@@ -891,21 +922,21 @@ int jwt_verify_sha_pem(jwt_t *jwt, const char *head, const char *sig_b64)
 
 	/* Decode signature. */
 	if (!(pbSignature = jwt_b64_decode(sig_b64, &cbSignature)))
-		VERIFY_PEM_ERROR(EINVAL);
+		VERIFY_PEM_ERROR(errno);
 
 	/* Open handle to public key. */
-	if (is_public_key_pem(jwt->key, jwt->key_len))
+	if (is_public_key_pem(key->data, key->len))
 	{
 		ret = open_public_key_from_pem(
-			jwt->key,
-			jwt->key_len,
+			key->data,
+			key->len,
 			&hKey);
 	}
 	else
 	{
 		ret = open_public_key_from_store(
-			jwt->key,
-			jwt->key_len,
+			key->data,
+			key->len,
 			&hCertStore,
 			&pSignerCert,
 			&hKey);
@@ -919,7 +950,7 @@ int jwt_verify_sha_pem(jwt_t *jwt, const char *head, const char *sig_b64)
 		alg,
 		NULL,
 		0) != ERROR_SUCCESS)
-		VERIFY_PEM_ERROR(EINVAL);
+		VERIFY_PEM_ERROR(ENOMEM);
 
 	if (BCryptGetProperty(
 		hHashAlg,
@@ -928,7 +959,7 @@ int jwt_verify_sha_pem(jwt_t *jwt, const char *head, const char *sig_b64)
 		sizeof(DWORD),
 		&cbDummy,
 		0) != ERROR_SUCCESS)
-		VERIFY_PEM_ERROR(EINVAL);
+		VERIFY_PEM_ERROR(ENOMEM);
 
 	if (!(pbHashObject = (BYTE*)jwt_malloc(cbHashObject)))
 		VERIFY_PEM_ERROR(ENOMEM);
@@ -941,7 +972,7 @@ int jwt_verify_sha_pem(jwt_t *jwt, const char *head, const char *sig_b64)
 		NULL,
 		0,
 		0) != ERROR_SUCCESS)
-		VERIFY_PEM_ERROR(EINVAL);
+		VERIFY_PEM_ERROR(ENOMEM);
 
 	if (BCryptGetProperty(
 		hHashAlg,
@@ -950,7 +981,7 @@ int jwt_verify_sha_pem(jwt_t *jwt, const char *head, const char *sig_b64)
 		sizeof(DWORD),
 		&cbDummy,
 		0) != ERROR_SUCCESS)
-		VERIFY_PEM_ERROR(EINVAL);
+		VERIFY_PEM_ERROR(ENOMEM);
 
 	if (!(pbHashValue = (BYTE*)jwt_malloc(cbHashValue)))
 		VERIFY_PEM_ERROR(ENOMEM);
@@ -960,14 +991,14 @@ int jwt_verify_sha_pem(jwt_t *jwt, const char *head, const char *sig_b64)
 		(PUCHAR)head,
 		(ULONG)strlen(head),
 		0) != ERROR_SUCCESS)
-		VERIFY_PEM_ERROR(EINVAL);
+		VERIFY_PEM_ERROR(ENOMEM);
 
 	if (BCryptFinishHash(
 		hHash,
 		pbHashValue,
 		cbHashValue,
 		0) != ERROR_SUCCESS)
-		VERIFY_PEM_ERROR(EINVAL);
+		VERIFY_PEM_ERROR(ENOMEM);
 
 	/* Verify hash against signature. */
 	paddingInfo.pszAlgId = alg;
@@ -1011,3 +1042,15 @@ jwt_verify_sha_pem_done:
 
 	return ret;
 }
+
+const struct jwt_crypto_ops jwt_wincrypt_ops = {
+	.name = "wincrypt",
+	.init = jwt_wincrypt_init,
+	.shutdown = jwt_wincrypt_shutdown,
+	.prepare_key = jwt_wincrypt_prepare_key,
+	.release_key = jwt_wincrypt_release_key,
+	.sign_sha_hmac = jwt_sign_sha_hmac,
+	.verify_sha_hmac = jwt_verify_sha_hmac,
+	.sign_sha_pem = jwt_sign_sha_pem,
+	.verify_sha_pem = jwt_verify_sha_pem,
+};
@@ -9,17 +9,20 @@
 #include <string.h>
 #include <errno.h>
 #include <stdio.h>
+#include <limits.h>
 
 #include <jwt.h>
 
 #include "jwt-private.h"
-#include "base64.h"
 #include "config.h"
 
 static jwt_malloc_t pfn_malloc = NULL;
 static jwt_realloc_t pfn_realloc = NULL;
 static jwt_free_t pfn_free = NULL;
 
+/* Source of jwt_key_t ids. */
+static volatile uint64_t jwt_key_ids = 0;
+
 void *jwt_malloc(size_t size)
 {
 	if (pfn_malloc)
@@ -44,6 +47,14 @@ void jwt_freemem(void *ptr)
 		free(ptr);
 }
 
+void jwt_wipe(void *ptr, size_t len)
+{
+	volatile unsigned char *p = ptr;
+
+	while (len--)
+		*p++ = 0;
+}
+
 char *jwt_strdup(const char *str)
 {
 	size_t len;
@@ -98,6 +109,8 @@ const char *jwt_alg_str(jwt_alg_t alg)
 		return "ES384";
 	case JWT_ALG_ES512:
 		return "ES512";
+	case JWT_ALG_EDDSA:
+		return "EdDSA";
 	default:
 		return NULL;
 	}
@@ -128,10 +141,199 @@ jwt_alg_t jwt_str_alg(const char *alg)
 		return JWT_ALG_ES384;
 	else if (!strcasecmp(alg, "ES512"))
 		return JWT_ALG_ES512;
+	else if (!strcasecmp(alg, "EdDSA"))
+		return JWT_ALG_EDDSA;
 
 	return JWT_ALG_INVAL;
 }
 
+/* Algorithms in the same family can share a key. */
+static jwt_alg_t jwt_alg_family(jwt_alg_t alg)
+{
+	switch (alg) {
+	case JWT_ALG_HS256:
+	case JWT_ALG_HS384:
+	case JWT_ALG_HS512:
+		return JWT_ALG_HS256;
+
+	case JWT_ALG_RS256:
+	case JWT_ALG_RS384:
+	case JWT_ALG_RS512:
+		return JWT_ALG_RS256;
+
+	case JWT_ALG_ES256:
+	case JWT_ALG_ES384:
+	case JWT_ALG_ES512:
+		return JWT_ALG_ES256;
+
+	case JWT_ALG_EDDSA:
+		return JWT_ALG_EDDSA;
+
+	default:
+		return JWT_ALG_INVAL;
+	}
+}
+
+int jwt_key_compat(jwt_key_t *key, jwt_alg_t alg)
+{
+	jwt_alg_t family = jwt_alg_family(alg);
+
+	return family != JWT_ALG_INVAL && family == jwt_alg_family(key->alg);
+}
+
+int jwt_key_new(jwt_key_t **key, jwt_alg_t alg, const unsigned char *data,
+		int len)
+{
+	return jwt_key_new_format(key, alg, JWT_KEY_FORMAT_AUTO, data, len);
+}
+
+int jwt_key_new_format(jwt_key_t **key, jwt_alg_t alg,
+		       jwt_key_format_t format, const unsigned char *data,
+		       int len)
+{
+	jwt_key_t *new;
+	int ret;
+
+	if (!key)
+		return EINVAL;
+
+	*key = NULL;
+
+	if (jwt_alg_family(alg) == JWT_ALG_INVAL || !data || len <= 0)
+		return EINVAL;
+
+	if (format < JWT_KEY_FORMAT_AUTO || format > JWT_KEY_FORMAT_RAW_PRIV)
+		return EINVAL;
+
+	new = jwt_malloc(sizeof(jwt_key_t));
+	if (!new)
+		return ENOMEM;
+
+	memset(new, 0, sizeof(jwt_key_t));
+
+	new->data = jwt_malloc(len);
+	if (!new->data) {
+		jwt_freemem(new);
+		return ENOMEM;
+	}
+
+	memcpy(new->data, data, len);
+	new->len = len;
+	new->alg = alg;
+	new->format = format;
+	new->refs = 1;
+
+	ret = jwt_prepare_key(new);
+	if (ret) {
+		memset(new->data, 0, new->len);
+		jwt_freemem(new->data);
+		jwt_freemem(new);
+		return ret;
+	}
+
+	new->id = jwt_atomic_inc64(&jwt_key_ids);
+
+	*key = new;
+
+	return 0;
+}
+
+jwt_key_t *jwt_key_ref(jwt_key_t *key)
+{
+	if (key)
+		jwt_atomic_inc(&key->refs);
+
+	return key;
+}
+
+void jwt_key_free(jwt_key_t *key)
+{
+	if (!key || jwt_atomic_dec(&key->refs) > 0)
+		return;
+
+	jwt_release_key(key);
+
+	/* Overwrite it so it's gone from memory. */
+	memset(key->data, 0, key->len);
+
+	jwt_freemem(key->data);
+	jwt_freemem(key);
+}
+
+jwt_alg_t jwt_key_get_alg(jwt_key_t *key)
+{
+	return key ? key->alg : JWT_ALG_INVAL;
+}
+
+int jwt_key_precompute(jwt_key_t *key, unsigned int depth)
+{
+	if (!key || depth > JWT_PRECOMPUTE_MAX)
+		return EINVAL;
+
+	if (jwt_alg_family(key->alg) != JWT_ALG_ES256 || !key->priv)
+		return EINVAL;
+
+	if (key->ops->precompute == NULL)
+		return ENOTSUP;
+
+	return key->ops->precompute(key, depth);
+}
+
+/* Wrap raw key data in a temporary key for the backend. The data is not
+ * copied, so it must only be released with jwt_release_key(). */
+static int jwt_load_key(jwt_key_t *key, jwt_alg_t alg,
+			const unsigned char *data, int len)
+{
+	memset(key, 0, sizeof(jwt_key_t));
+
+	key->refs = 1;
+	key->alg = alg;
+	key->data = (unsigned char *)data;
+	key->len = len;
+
+	return jwt_prepare_key(key);
+}
+
+/* Find a key for jwt->alg prepared by whatever handles that alg now: the
+ * one set on the JWT, a cached one, or failing those a temporary one in
+ * tmp. Callers release tmp if that is what they got, and drop *cached. */
+static int jwt_get_key(jwt_t *jwt, jwt_key_t *tmp, jwt_key_t **key,
+		       jwt_key_t **cached)
+{
+	const unsigned char *data = jwt->key;
+	int len = jwt->key_len;
+	int ret;
+
+	*cached = NULL;
+	*key = jwt->jkey;
+
+	if (*key == NULL) {
+		ret = jwt_key_cache_get(cached, jwt->alg, data, len);
+		if (ret)
+			return ret;
+		*key = *cached;
+	}
+
+	/* Prepared before another provider took over this alg. */
+	if (*key && !jwt_key_current(*key, jwt->alg)) {
+		data = (*key)->data;
+		len = (*key)->len;
+		*key = NULL;
+	}
+
+	if (*key == NULL) {
+		ret = jwt_load_key(tmp, jwt->alg, data, len);
+		if (ret) {
+			jwt_key_free(*cached);
+			*cached = NULL;
+			return ret;
+		}
+		*key = tmp;
+	}
+
+	return 0;
+}
+
 static void jwt_scrub_key(jwt_t *jwt)
 {
 	if (jwt->key) {
@@ -142,6 +344,9 @@ static void jwt_scrub_key(jwt_t *jwt)
 		jwt->key = NULL;
 	}
 
+	jwt_key_free(jwt->jkey);
+	jwt->jkey = NULL;
+
 	jwt->key_len = 0;
 	jwt->alg = JWT_ALG_NONE;
 }
@@ -177,6 +382,29 @@ int jwt_set_alg(jwt_t *jwt, jwt_alg_t alg, const unsigned char *key, int len)
 	return 0;
 }
 
+int jwt_set_alg_key(jwt_t *jwt, jwt_alg_t alg, jwt_key_t *key)
+{
+	/* No matter what happens here, we do this. */
+	jwt_scrub_key(jwt);
+
+	if (alg < JWT_ALG_NONE || alg >= JWT_ALG_INVAL)
+		return EINVAL;
+
+	if (alg == JWT_ALG_NONE) {
+		if (key)
+			return EINVAL;
+	} else {
+		if (!key || !jwt_key_compat(key, alg))
+			return EINVAL;
+
+		jwt->jkey = jwt_key_ref(key);
+	}
+
+	jwt->alg = alg;
+
+	return 0;
+}
+
 jwt_alg_t jwt_get_alg(jwt_t *jwt)
 {
 	return jwt->alg;
@@ -254,6 +482,11 @@ jwt_t *jwt_dup(jwt_t *jwt)
 		new->key_len = jwt->key_len;
 	}
 
+	if (jwt->jkey) {
+		new->alg = jwt->alg;
+		new->jkey = jwt_key_ref(jwt->jkey);
+	}
+
 	new->grants = json_deep_copy(jwt->grants);
 	if (!new->grants)
 		errno = ENOMEM;
@@ -317,63 +550,178 @@ static int get_js_bool(json_t *js, const char *key)
 
 void *jwt_b64_decode(const char *src, int *ret_len)
 {
+	size_t src_len = strlen(src), len;
 	void *buf;
-	char *new;
-	int len, i, z;
 
-	/* Decode based on RFC-4648 URI safe encoding. */
-	len = (int)strlen(src);
-	new = alloca(len + 4);
-	if (!new)
+	/* Never ask for nothing, which may come back as NULL. */
+	len = jwt_b64url_decoded_len(src_len);
+	buf = jwt_malloc(len ? len : 1);
+	if (buf == NULL) {
+		errno = ENOMEM;
 		return NULL;
-
-	for (i = 0; i < len; i++) {
-		switch (src[i]) {
-		case '-':
-			new[i] = '+';
-			break;
-		case '_':
-			new[i] = '/';
-			break;
-		default:
-			new[i] = src[i];
-		}
-	}
-	z = 4 - (i % 4);
-	if (z < 4) {
-		while (z--)
-			new[i++] = '=';
 	}
-	new[i] = '\0';
 
-	buf = jwt_malloc(i);
-	if (buf == NULL)
+	if (len > INT_MAX ||
+	    jwt_b64url_decode_into(buf, len, src, src_len, &len)) {
+		jwt_freemem(buf);
+		errno = EINVAL;
 		return NULL;
+	}
 
-	*ret_len = jwt_Base64decode(buf, new);
+	*ret_len = (int)len;
 
 	return buf;
 }
 
+/* JWS carries ECDSA signatures as r||s, each padded to the size of the
+ * curve, while the crypto libraries want the DER encoded
+ * ECDSA-Sig-Value:
+ *
+ *     SEQUENCE { INTEGER r, INTEGER s }
+ *
+ * Converting by hand saves the backends building bignums for every
+ * token. */
 
-static json_t *jwt_b64_decode_json(char *src)
+static unsigned char *der_put_int(unsigned char *p, const unsigned char *in,
+				  int len)
 {
-	json_t *js;
-	char *buf;
-	int len;
+	/* Shortest form, but always positive. */
+	while (len > 1 && !in[0]) {
+		in++;
+		len--;
+	}
 
-	buf = jwt_b64_decode(src, &len);
+	*p++ = 0x02;
+	*p++ = len + (in[0] >> 7);
+	if (in[0] & 0x80)
+		*p++ = 0x00;
+	memcpy(p, in, len);
 
-	if (buf == NULL)
+	return p + len;
+}
+
+int jwt_ec_sig_raw_to_der(unsigned char *der, const unsigned char *sig,
+			  int len)
+{
+	unsigned char body[JWT_EC_DER_MAX_LEN];
+	unsigned char *p;
+	int body_len;
+
+	p = der_put_int(body, sig, len);
+	p = der_put_int(p, sig + len, len);
+	body_len = p - body;
+
+	p = der;
+	*p++ = 0x30;
+	if (body_len >= 0x80)
+		*p++ = 0x81;
+	*p++ = body_len;
+	memcpy(p, body, body_len);
+
+	return (p - der) + body_len;
+}
+
+static const unsigned char *der_get_int(const unsigned char *p,
+					const unsigned char *end,
+					unsigned char *out, int len)
+{
+	int n;
+
+	if (end - p < 2 || p[0] != 0x02 || p[1] & 0x80)
 		return NULL;
 
-	buf[len] = '\0';
+	n = p[1];
+	p += 2;
 
-	js = json_loads(buf, 0, NULL);
+	if (n == 0 || end - p < n || p[0] & 0x80)
+		return NULL;
 
-	jwt_freemem(buf);
+	/* Only one leading zero, and only where it is needed. */
+	if (!p[0] && n > 1) {
+		if (!(p[1] & 0x80))
+			return NULL;
+		p++;
+		n--;
+	}
+
+	if (n > len)
+		return NULL;
+
+	memset(out, 0, len - n);
+	memcpy(out + len - n, p, n);
+
+	return p + n;
+}
+
+int jwt_ec_sig_der_to_raw(unsigned char *out, const unsigned char *der,
+			  int der_len, int len)
+{
+	const unsigned char *p = der, *end = der + der_len;
+	int body_len;
+
+	if (end - p < 2 || *p++ != 0x30)
+		return EINVAL;
+
+	body_len = *p++;
+	if (body_len == 0x81) {
+		if (p == end)
+			return EINVAL;
+		body_len = *p++;
+		if (body_len < 0x80)
+			return EINVAL;
+	} else if (body_len & 0x80) {
+		return EINVAL;
+	}
+
+	if (end - p != body_len)
+		return EINVAL;
+
+	p = der_get_int(p, end, out, len);
+	if (p != NULL)
+		p = der_get_int(p, end, out + len, len);
+	if (p != end)
+		return EINVAL;
+
+	return 0;
+}
+
+struct b64_json_src {
+	const char *s;
+	size_t len;
+};
+
+/* Feeds jansson's read buffer straight from the base64url text, in whole
+ * groups of four characters, so the decoded JSON is never held anywhere
+ * else and each byte is touched once on its way to the parser. */
+static size_t jwt_b64_json_read(void *buf, size_t buflen, void *data)
+{
+	struct b64_json_src *src = data;
+	size_t n, out;
 
-	return js;
+	if (src->len == 0)
+		return 0;
+
+	n = buflen / 3 * 4;
+	if (n == 0)
+		return (size_t)-1;
+	if (n > src->len)
+		n = src->len;
+
+	if (jwt_b64url_decode_into(buf, buflen, src->s, n, &out))
+		return (size_t)-1;
+
+	src->s += n;
+	src->len -= n;
+
+	return out;
+}
+
+static json_t *jwt_b64_decode_json(char *src)
+{
+	struct b64_json_src in = { src, strlen(src) };
+
+	/* Invalid base64url stops the parser like a read error would. */
+	return json_load_callback(jwt_b64_json_read, &in, 0, NULL);
 }
 
 void jwt_base64uri_encode(char *str)
@@ -401,12 +749,20 @@ void jwt_base64uri_encode(char *str)
 
 static int jwt_sign(jwt_t *jwt, char **out, unsigned int *len, const char *str)
 {
+	jwt_key_t tmp, *key, *cached;
+	int ret;
+
+	ret = jwt_get_key(jwt, &tmp, &key, &cached);
+	if (ret)
+		return ret;
+
 	switch (jwt->alg) {
 	/* HMAC */
 	case JWT_ALG_HS256:
 	case JWT_ALG_HS384:
 	case JWT_ALG_HS512:
-		return jwt_sign_sha_hmac(jwt, out, len, str);
+		ret = key->ops->sign_sha_hmac(jwt, key, out, len, str);
+		break;
 
 	/* RSA */
 	case JWT_ALG_RS256:
@@ -417,181 +773,601 @@ static int jwt_sign(jwt_t *jwt, char **out, unsigned int *len, const char *str)
 	case JWT_ALG_ES256:
 	case JWT_ALG_ES384:
 	case JWT_ALG_ES512:
-		return jwt_sign_sha_pem(jwt, out, len, str);
+
+	/* EdDSA */
+	case JWT_ALG_EDDSA:
+		ret = key->ops->sign_sha_pem(jwt, key, out, len, str);
+		break;
 
 	/* You wut, mate? */
 	default:
+		ret = EINVAL;
+	}
+
+	if (key == &tmp)
+		jwt_release_key(&tmp);
+	jwt_key_free(cached);
+
+	return ret;
+}
+
+/* If mismatch is given, it is set when the signature was checked and
+ * found not to match, as opposed to not being checked at all. */
+static int jwt_verify(jwt_t *jwt, const char *head, const char *sig,
+		      int *mismatch)
+{
+	jwt_key_t tmp, *key, *cached;
+	int ret;
+
+	if (mismatch)
+		*mismatch = 0;
+
+	ret = jwt_get_key(jwt, &tmp, &key, &cached);
+	if (ret)
+		return ret;
+
+	switch (jwt->alg) {
+	/* HMAC */
+	case JWT_ALG_HS256:
+	case JWT_ALG_HS384:
+	case JWT_ALG_HS512:
+		ret = key->ops->verify_sha_hmac(jwt, key, head, sig);
+		break;
+
+	/* RSA */
+	case JWT_ALG_RS256:
+	case JWT_ALG_RS384:
+	case JWT_ALG_RS512:
+
+	/* ECC */
+	case JWT_ALG_ES256:
+	case JWT_ALG_ES384:
+	case JWT_ALG_ES512:
+
+	/* EdDSA */
+	case JWT_ALG_EDDSA:
+		ret = key->ops->verify_sha_pem(jwt, key, head, sig);
+		break;
+
+	/* You wut, mate? */
+	default:
+		ret = EINVAL;
+	}
+
+	if (mismatch)
+		*mismatch = ret == EINVAL;
+
+	if (key == &tmp)
+		jwt_release_key(&tmp);
+	jwt_key_free(cached);
+
+	return ret;
+}
+
+static int jwt_parse_body(jwt_t *jwt, char *body)
+{
+	if (jwt->grants) {
+		json_decref(jwt->grants);
+		jwt->grants = NULL;
+	}
+
+	jwt->grants = jwt_b64_decode_json(body);
+	if (!jwt->grants)
+		return EINVAL;
+
+	return 0;
+}
+
+static int jwt_parse_head(jwt_t *jwt, char *head)
+{
+	if (jwt->headers) {
+		json_decref(jwt->headers);
+		jwt->headers = NULL;
+	}
+
+	jwt->headers = jwt_b64_decode_json(head);
+	if (!jwt->headers)
+		return EINVAL;
+
+	return 0;
+}
+
+static int jwt_verify_head(jwt_t *jwt, char *head, jwt_keyset_t *set)
+{
+	int ret = 0;
+	if ((ret = jwt_parse_head(jwt, head))) {
+		return ret;
+	}
+
+	const char *val;
+
+	val = get_js_string(jwt->headers, "alg");
+	jwt->alg = jwt_str_alg(val);
+	if (jwt->alg == JWT_ALG_INVAL) {
+		ret = EINVAL;
+		goto verify_head_done;
+	}
+
+	if (jwt->alg != JWT_ALG_NONE) {
+		/* If alg is not NONE, there may be a typ. */
+		val = get_js_string(jwt->headers, "typ");
+		if (val && strcasecmp(val, "JWT"))
+			ret = EINVAL;
+
+		if (set) {
+			/* The key the header names, if it suits the alg. */
+			val = get_js_string(jwt->headers, "kid");
+			jwt->jkey = jwt_keyset_lookup(set, val, jwt->alg);
+			if (!jwt->jkey)
+				ret = EINVAL;
+		} else if (jwt->jkey) {
+			/* Do not let the token pick a different kind of
+			 * algorithm than the key was made for. */
+			if (!jwt_key_compat(jwt->jkey, jwt->alg))
+				ret = EINVAL;
+		} else if (jwt->key) {
+			if (jwt->key_len <= 0)
+				ret = EINVAL;
+		} else {
+			jwt_scrub_key(jwt);
+		}
+	} else {
+		/* If alg is NONE, there should not be a key */
+		if (jwt->key || jwt->jkey || set) {
+			ret = EINVAL;
+		}
+	}
+
+verify_head_done:
+
+	return ret;
+}
+
+/* Split a token in place into its head, body and signature. */
+static int jwt_split_token(char *head, char **body, char **sig)
+{
+	char *p;
+
+	for (p = head; p[0] != '.'; p++) {
+		if (p[0] == '\0')
+			return EINVAL;
+	}
+
+	p[0] = '\0';
+	*body = ++p;
+
+	for (; p[0] != '.'; p++) {
+		if (p[0] == '\0')
+			return EINVAL;
+	}
+
+	p[0] = '\0';
+	*sig = ++p;
+
+	return 0;
+}
+
+/* A token part way through being decoded. */
+struct jwt_decode_state {
+	unsigned char id[JWT_TOKEN_ID_LEN];
+	int have_id;
+	/* Found in the token cache, so already complete. */
+	int cached;
+	char *head, *body, *sig;
+	jwt_t *jwt;
+};
+
+/* Split the token and check its header, and whether its alg suits the
+ * key. A token that could never verify goes no further. */
+static int jwt_decode_start(struct jwt_decode_state *ds, const char *token,
+			    const unsigned char *key, int key_len,
+			    jwt_key_t *jkey, jwt_keyset_t *set)
+{
+	int ret;
+
+	memset(ds, 0, sizeof(*ds));
+
+	ds->head = jwt_strdup(token);
+	if (!ds->head)
+		return ENOMEM;
+
+	/* Key sets pick their key from the header, so only tokens with the
+	 * key given up front are looked for in the cache. */
+	if (!set)
+		ds->have_id = !jwt_token_cache_id(ds->id, token, key, key_len,
+						  jkey);
+
+	/* Failed with this key not long ago, and would again. */
+	if (ds->have_id && jwt_reject_cache_check(ds->id))
 		return EINVAL;
+
+	/* Find the components. */
+	if (jwt_split_token(ds->head, &ds->body, &ds->sig))
+		return EINVAL;
+
+	/* Now that we have everything split up, let's check out the
+	 * header. */
+	ret = jwt_new(&ds->jwt);
+	if (ret)
+		return ret;
+
+	/* Copy the key over for verify_head. */
+	if (key_len) {
+		ds->jwt->key = jwt_malloc(key_len);
+		if (ds->jwt->key == NULL)
+			return ENOMEM;
+		memcpy(ds->jwt->key, key, key_len);
+		ds->jwt->key_len = key_len;
+	}
+
+	ds->jwt->jkey = jwt_key_ref(jkey);
+
+	/* Seen and verified with this key before. */
+	if (ds->have_id && !jwt_token_cache_get(ds->id, ds->jwt)) {
+		ds->cached = 1;
+		return 0;
+	}
+
+	return jwt_verify_head(ds->jwt, ds->head, set);
+}
+
+/* The signature covers the payload as it was sent, so it is checked
+ * before the payload is decoded at all. That way none of a forged
+ * token's claims ever reach jansson. */
+static int jwt_decode_verify(struct jwt_decode_state *ds)
+{
+	int mismatch, ret;
+
+	if (ds->cached || ds->jwt->alg == JWT_ALG_NONE)
+		return 0;
+
+	/* Re-add this since it's part of the verified data. */
+	ds->body[-1] = '.';
+	/* Only a signature that was checked and did not match is
+	 * remembered, never a failure to check it. */
+	ret = jwt_verify(ds->jwt, ds->head, ds->sig, &mismatch);
+	if (ds->have_id && mismatch)
+		jwt_reject_cache_put(ds->id);
+	ds->body[-1] = '\0';
+
+	return ret;
+}
+
+/* Only now the claims. Hands the JWT over if all went well, and frees
+ * what is left either way. */
+static int jwt_decode_finish(struct jwt_decode_state *ds, jwt_t **jwt,
+			     int ret)
+{
+	if (!ret && !ds->cached) {
+		ret = jwt_parse_body(ds->jwt, ds->body);
+		if (!ret && ds->have_id && ds->jwt->alg != JWT_ALG_NONE)
+			jwt_token_cache_put(ds->id, ds->jwt);
 	}
+
+	if (ret)
+		jwt_free(ds->jwt);
+	else
+		*jwt = ds->jwt;
+
+	jwt_freemem(ds->head);
+
+	return ret;
+}
+
+static int jwt_decode_internal(jwt_t **jwt, const char *token,
+			       const unsigned char *key, int key_len,
+			       jwt_key_t *jkey, jwt_keyset_t *set)
+{
+	struct jwt_decode_state ds;
+	int ret;
+
+	if (!jwt)
+		return EINVAL;
+
+	*jwt = NULL;
+
+	ret = jwt_decode_start(&ds, token, key, key_len, jkey, set);
+	if (!ret)
+		ret = jwt_decode_verify(&ds);
+
+	return jwt_decode_finish(&ds, jwt, ret);
+}
+
+int jwt_decode(jwt_t **jwt, const char *token, const unsigned char *key,
+	       int key_len)
+{
+	return jwt_decode_internal(jwt, token, key, key_len, NULL, NULL);
+}
+
+int jwt_decode_with_key(jwt_t **jwt, const char *token, jwt_key_t *key)
+{
+	return jwt_decode_internal(jwt, token, NULL, 0, key, NULL);
+}
+
+int jwt_decode_keyring(jwt_t **jwt, const char *token, jwt_keyring_t *ring)
+{
+	jwt_key_t *key;
+	int ret;
+
+	if (!jwt)
+		return EINVAL;
+
+	*jwt = NULL;
+
+	/* An empty keyring must not let unsigned tokens through. */
+	key = jwt_keyring_get(ring);
+	if (!key)
+		return EINVAL;
+
+	ret = jwt_decode_internal(jwt, token, NULL, 0, key, NULL);
+
+	jwt_key_free(key);
+
+	return ret;
+}
+
+int jwt_decode_keyset(jwt_t **jwt, const char *token, jwt_keyset_t *set)
+{
+	if (!jwt)
+		return EINVAL;
+
+	*jwt = NULL;
+
+	/* Without a set, unsigned tokens would get through. */
+	if (!set)
+		return EINVAL;
+
+	return jwt_decode_internal(jwt, token, NULL, 0, NULL, set);
+}
+
+/* Compare MACs in constant time. */
+static int jwt_memcmp_ct(const unsigned char *a, const unsigned char *b,
+			 unsigned int len)
+{
+	unsigned char diff = 0;
+	unsigned int i;
+
+	for (i = 0; i < len; i++)
+		diff |= a[i] ^ b[i];
+
+	return diff;
 }
 
-static int jwt_verify(jwt_t *jwt, const char *head, const char *sig)
+/* Batches of HMAC tokens go through the built in multi-buffer HMAC,
+ * unless the application has a provider of its own for them. */
+static int jwt_hmac_batched(jwt_alg_t alg, jwt_key_t *key)
 {
-	switch (jwt->alg) {
-	/* HMAC */
+	switch (alg) {
 	case JWT_ALG_HS256:
 	case JWT_ALG_HS384:
 	case JWT_ALG_HS512:
-		return jwt_verify_sha_hmac(jwt, head, sig);
-
-	/* RSA */
-	case JWT_ALG_RS256:
-	case JWT_ALG_RS384:
-	case JWT_ALG_RS512:
+		return key->len > 0 && !jwt_crypto_provided(alg);
 
-	/* ECC */
-	case JWT_ALG_ES256:
-	case JWT_ALG_ES384:
-	case JWT_ALG_ES512:
-		return jwt_verify_sha_pem(jwt, head, sig);
-
-	/* You wut, mate? */
 	default:
-		return EINVAL;
+		return 0;
 	}
 }
 
-static int jwt_parse_body(jwt_t *jwt, char *body)
+/* Check one token of a batch. The scratch buffer and JWT object are
+ * reused from token to token, and only the header is parsed. HMAC tokens
+ * are left for jwt_verify_hmacs() if hmac_len is set, which is given the
+ * length of the signing input. */
+static int jwt_verify_one(jwt_t *jwt, const char *token, char **buf,
+			  size_t *buf_len, size_t *hmac_len)
 {
-	if (jwt->grants) {
-		json_decref(jwt->grants);
-		jwt->grants = NULL;
+	size_t len = strlen(token) + 1;
+	char *head, *body, *sig;
+	int ret;
+
+	if (len > *buf_len) {
+		head = jwt_realloc(*buf, len);
+		if (head == NULL)
+			return ENOMEM;
+		*buf = head;
+		*buf_len = len;
 	}
 
-	jwt->grants = jwt_b64_decode_json(body);
-	if (!jwt->grants)
-		return EINVAL;
+	head = memcpy(*buf, token, len);
 
-	return 0;
-}
+	ret = jwt_split_token(head, &body, &sig);
+	if (ret)
+		return ret;
 
-static int jwt_parse_head(jwt_t *jwt, char *head)
-{
-	if (jwt->headers) {
-		json_decref(jwt->headers);
-		jwt->headers = NULL;
+	ret = jwt_verify_head(jwt, head, NULL);
+	if (ret)
+		return ret;
+
+	if (hmac_len && jwt_hmac_batched(jwt->alg, jwt->jkey)) {
+		*hmac_len = sig - head - 1;
+		return 0;
 	}
 
-	jwt->headers = jwt_b64_decode_json(head);
-	if (!jwt->headers)
-		return EINVAL;
+	/* Keys can't be made for none, so that was refused above. */
+	body[-1] = '.';
 
-	return 0;
+	return jwt_verify(jwt, head, sig, NULL);
 }
 
-static int jwt_verify_head(jwt_t *jwt, char *head)
+/* Finish the HMAC tokens jwt_verify_one() left, all of one alg at once.
+ * The signing input is at the start of each token, so it is hashed in
+ * place. */
+static void jwt_verify_hmacs(const char **tokens, int *results,
+			     unsigned int count, jwt_key_t *key,
+			     const size_t *hmac_lens, const jwt_alg_t *algs,
+			     jwt_alg_t alg, const char **msgs, size_t *lens,
+			     unsigned char *macs)
 {
-	int ret = 0;
-	if ((ret = jwt_parse_head(jwt, head))) {
-		return ret;
-	}
-
-	const char *val;
+	unsigned char sig[JWT_HMAC_MAX_LEN];
+	unsigned int i, n, mac_len;
+	int sig_len;
 
-	val = get_js_string(jwt->headers, "alg");
-	jwt->alg = jwt_str_alg(val);
-	if (jwt->alg == JWT_ALG_INVAL) {
-		ret = EINVAL;
-		goto verify_head_done;
+	for (i = n = 0; i < count; i++) {
+		if (hmac_lens[i] && algs[i] == alg) {
+			msgs[n] = tokens[i];
+			lens[n++] = hmac_lens[i];
+		}
 	}
 
-	if (jwt->alg != JWT_ALG_NONE) {
-		/* If alg is not NONE, there may be a typ. */
-		val = get_js_string(jwt->headers, "typ");
-		if (val && strcasecmp(val, "JWT"))
-			ret = EINVAL;
+	if (n == 0)
+		return;
 
-		if (jwt->key) {
-			if (jwt->key_len <= 0)
-				ret = EINVAL;
-		} else {
-			jwt_scrub_key(jwt);
-		}
-	} else {
-		/* If alg is NONE, there should not be a key */
-		if (jwt->key){
-			ret = EINVAL;
-		}
-	}
+	mac_len = jwt_hmac_mb(alg, key->data, key->len, msgs, lens, n, macs);
 
-verify_head_done:
+	for (i = n = 0; i < count; i++) {
+		if (!hmac_lens[i] || algs[i] != alg)
+			continue;
 
-	return ret;
+		sig_len = jwt_b64uri_decode_buf(sig, sizeof(sig),
+						tokens[i] + hmac_lens[i] + 1);
+		if (sig_len < 0 || (unsigned int)sig_len != mac_len ||
+		    jwt_memcmp_ct(sig, macs + n * JWT_HMAC_MAX_LEN, mac_len))
+			results[i] = EINVAL;
+
+		n++;
+	}
 }
 
-int jwt_decode(jwt_t **jwt, const char *token, const unsigned char *key,
-	       int key_len)
+int jwt_verify_batch(const char **tokens, int *results, unsigned int count,
+		     jwt_key_t *key)
 {
-	char *head = jwt_strdup(token);
-	jwt_t *new = NULL;
-	char *body, *sig;
-	int ret = EINVAL;
+	size_t buf_len = 0, *hmac_lens = NULL, *lens = NULL;
+	const char **msgs = NULL;
+	unsigned char *macs = NULL;
+	jwt_alg_t *algs = NULL;
+	char *buf = NULL;
+	jwt_t *jwt;
+	unsigned int i;
+	int ret;
 
-	if (!jwt)
+	if (!tokens || !results || !key)
 		return EINVAL;
 
-	*jwt = NULL;
+	ret = jwt_new(&jwt);
+	if (ret)
+		return ret;
 
-	if (!head)
-		return ENOMEM;
+	jwt->jkey = jwt_key_ref(key);
 
-	/* Find the components. */
-	for (body = head; body[0] != '.'; body++) {
-		if (body[0] == '\0')
-			goto decode_done;
+	if (count && key->alg >= JWT_ALG_HS256 && key->alg <= JWT_ALG_HS512) {
+		hmac_lens = jwt_calloc(count, sizeof(*hmac_lens));
+		algs = jwt_malloc(count * sizeof(*algs));
+		msgs = jwt_malloc(count * sizeof(*msgs));
+		lens = jwt_malloc(count * sizeof(*lens));
+		macs = jwt_malloc(count * JWT_HMAC_MAX_LEN);
+
+		/* Fall back to one at a time. */
+		if (!hmac_lens || !algs || !msgs || !lens || !macs) {
+			jwt_freemem(hmac_lens);
+			hmac_lens = NULL;
+		}
+	}
+
+	for (i = 0; i < count; i++) {
+		results[i] = jwt_verify_one(jwt, tokens[i], &buf, &buf_len,
+					    hmac_lens ? &hmac_lens[i] : NULL);
+		if (hmac_lens)
+			algs[i] = jwt->alg;
 	}
 
-	body[0] = '\0';
-	body++;
+	if (hmac_lens) {
+		for (i = JWT_ALG_HS256; i <= JWT_ALG_HS512; i++)
+			jwt_verify_hmacs(tokens, results, count, key, hmac_lens,
+					 algs, i, msgs, lens, macs);
+	}
 
-	for (sig = body; sig[0] != '.'; sig++) {
-		if (sig[0] == '\0')
-			goto decode_done;
+	for (i = 0; i < count; i++) {
+		if (results[i] && !ret)
+			ret = results[i];
 	}
 
-	sig[0] = '\0';
-	sig++;
+	jwt_freemem(hmac_lens);
+	jwt_freemem(algs);
+	jwt_freemem(msgs);
+	jwt_freemem(lens);
+	jwt_freemem(macs);
+	jwt_freemem(buf);
+	jwt_free(jwt);
 
-	/* Now that we have everything split up, let's check out the
-	 * header. */
-	ret = jwt_new(&new);
-	if (ret) {
-		goto decode_done;
+	return ret;
+}
+
+int jwt_decode_batch(jwt_t **jwts, const char **tokens, int *results,
+		     unsigned int count, jwt_key_t *key)
+{
+	size_t *hmac_lens = NULL, *lens = NULL;
+	struct jwt_decode_state *ds = NULL;
+	const char **msgs = NULL;
+	unsigned char *macs = NULL;
+	jwt_alg_t *algs = NULL;
+	unsigned int i;
+	int ret = 0;
+
+	if (!jwts || !tokens || !results || !key)
+		return EINVAL;
+
+	if (count && key->alg >= JWT_ALG_HS256 && key->alg <= JWT_ALG_HS512) {
+		ds = jwt_malloc(count * sizeof(*ds));
+		hmac_lens = jwt_calloc(count, sizeof(*hmac_lens));
+		algs = jwt_malloc(count * sizeof(*algs));
+		msgs = jwt_malloc(count * sizeof(*msgs));
+		lens = jwt_malloc(count * sizeof(*lens));
+		macs = jwt_malloc(count * JWT_HMAC_MAX_LEN);
+
+		if (!ds || !hmac_lens || !algs || !msgs || !lens || !macs) {
+			jwt_freemem(ds);
+			ds = NULL;
+		}
 	}
 
-	/* Copy the key over for verify_head. */
-	if (key_len) {
-		new->key = jwt_malloc(key_len);
-		if (new->key == NULL)
-			goto decode_done;
-		memcpy(new->key, key, key_len);
-		new->key_len = key_len;
+	/* Fall back to one at a time. */
+	if (!ds) {
+		for (i = 0; i < count; i++) {
+			results[i] = jwt_decode_internal(&jwts[i], tokens[i],
+							 NULL, 0, key, NULL);
+			if (results[i] && !ret)
+				ret = results[i];
+		}
+		goto batch_done;
 	}
 
-	ret = jwt_verify_head(new, head);
-	if (ret)
-		goto decode_done;
+	/* HMAC tokens are left for jwt_verify_hmacs(), the rest are checked
+	 * as they come. */
+	for (i = 0; i < count; i++) {
+		jwts[i] = NULL;
+		results[i] = jwt_decode_start(&ds[i], tokens[i], NULL, 0, key,
+					      NULL);
+		if (results[i] || ds[i].cached)
+			continue;
+
+		if (jwt_hmac_batched(ds[i].jwt->alg, key)) {
+			hmac_lens[i] = ds[i].sig - ds[i].head - 1;
+			algs[i] = ds[i].jwt->alg;
+		} else {
+			results[i] = jwt_decode_verify(&ds[i]);
+		}
+	}
 
-	ret = jwt_parse_body(new, body);
-	if (ret)
-		goto decode_done;
+	for (i = JWT_ALG_HS256; i <= JWT_ALG_HS512; i++)
+		jwt_verify_hmacs(tokens, results, count, key, hmac_lens, algs, i,
+				 msgs, lens, macs);
 
-	/* Check the signature, if needed. */
-	if (new->alg != JWT_ALG_NONE) {
-		/* Re-add this since it's part of the verified data. */
-		body[-1] = '.';
-		ret = jwt_verify(new, head, sig);
-	} else {
-		ret = 0;
-	}
+	for (i = 0; i < count; i++) {
+		/* Only a signature that was checked and did not match. */
+		if (hmac_lens[i] && results[i] && ds[i].have_id)
+			jwt_reject_cache_put(ds[i].id);
 
-decode_done:
-	if (ret)
-		jwt_free(new);
-	else
-		*jwt = new;
+		results[i] = jwt_decode_finish(&ds[i], &jwts[i], results[i]);
+		if (results[i] && !ret)
+			ret = results[i];
+	}
 
-	jwt_freemem(head);
+batch_done:
+	jwt_freemem(ds);
+	jwt_freemem(hmac_lens);
+	jwt_freemem(algs);
+	jwt_freemem(msgs);
+	jwt_freemem(lens);
+	jwt_freemem(macs);
 
 	return ret;
 }
@@ -1004,95 +1780,233 @@ char *jwt_dump_str(jwt_t *jwt, int pretty)
 	return out;
 }
 
-static int jwt_encode(jwt_t *jwt, char **out)
+/* Source bytes encoded at a time when the signing input is hashed as it
+ * is produced, so each piece is hashed while it is still in L1. Keeping
+ * it a multiple of 3 makes every piece whole base64url groups. */
+#define JWT_ENCODE_CHUNK	768
+
+/* A token being encoded into buf, a piece at a time. */
+struct encode_feed {
+	char *head, *body;
+	const char *src[2];
+	size_t len[2];
+	/* 0 and 2 are the header and claims, 1 the dot between them. */
+	unsigned int part;
+	char *buf;
+	size_t pos, size;
+};
+
+/* Encode the next piece of the signing input onto the end of buf. A
+ * jwt_input_next_t, so a backend can hash each piece right after it is
+ * written. */
+static size_t jwt_encode_next(void *arg, const char **piece)
 {
-	char *buf = NULL, *head, *body, *sig;
-	int ret, head_len, body_len;
-	unsigned int sig_len;
+	struct encode_feed *f = arg;
+	size_t n, out;
+	unsigned int i;
 
-	/* First the header. */
-	ret = jwt_write_head(jwt, &buf, 0);
-	if (ret) {
-		if (buf)
-			jwt_freemem(buf);
-		return ret;
-	}
+	for (; f->part < 3; f->part++) {
+		*piece = f->buf + f->pos;
 
-	head = alloca(strlen(buf) * 2);
-	if (head == NULL) {
-		jwt_freemem(buf);
-		return ENOMEM;
+		if (f->part == 1) {
+			f->buf[f->pos++] = '.';
+			f->part++;
+			return 1;
+		}
+
+		i = f->part / 2;
+		if (f->len[i] == 0)
+			continue;
+
+		n = f->len[i] < JWT_ENCODE_CHUNK ? f->len[i] : JWT_ENCODE_CHUNK;
+		jwt_b64url_encode_into(f->buf + f->pos, f->size - f->pos,
+				       f->src[i], n, &out);
+		f->src[i] += n;
+		f->len[i] -= n;
+		f->pos += out;
+
+		return out;
 	}
-	jwt_Base64encode(head, buf, (int)strlen(buf));
-	head_len = (int)strlen(head);
 
-	jwt_freemem(buf);
-	buf = NULL;
+	return 0;
+}
 
-	/* Now the body. */
-	ret = jwt_write_body(jwt, &buf, 0);
-	if (ret) {
-		if (buf)
-			jwt_freemem(buf);
+/* Write out the header and claims and make room for the token in buf,
+ * with extra bytes after the signing input and its nul. */
+static int jwt_encode_start(jwt_t *jwt, struct encode_feed *f, size_t extra)
+{
+	int ret;
+
+	memset(f, 0, sizeof(*f));
+
+	ret = jwt_write_head(jwt, &f->head, 0);
+	if (ret == 0)
+		ret = jwt_write_body(jwt, &f->body, 0);
+	if (ret)
 		return ret;
-	}
 
-	body = alloca(strlen(buf) * 2);
-	if (body == NULL) {
-		jwt_freemem(buf);
+	f->src[0] = f->head;
+	f->len[0] = strlen(f->head);
+	f->src[1] = f->body;
+	f->len[1] = strlen(f->body);
+
+	f->size = jwt_b64url_encoded_len(f->len[0]) +
+		  jwt_b64url_encoded_len(f->len[1]) + 2 + extra;
+	f->buf = jwt_malloc(f->size);
+	if (f->buf == NULL)
 		return ENOMEM;
+
+	return 0;
+}
+
+/* Frees all but buf, which is the caller's. */
+static void jwt_encode_end(struct encode_feed *f)
+{
+	if (f->head)
+		jwt_freemem(f->head);
+	if (f->body)
+		jwt_freemem(f->body);
+}
+
+/* The signing input of a token: its header and claims, encoded and
+ * joined by a dot. */
+static int jwt_encode_input(jwt_t *jwt, char **out)
+{
+	struct encode_feed f;
+	const char *piece;
+	int ret;
+
+	ret = jwt_encode_start(jwt, &f, 0);
+	if (ret == 0) {
+		while (jwt_encode_next(&f, &piece))
+			;
+		f.buf[f.pos] = '\0';
+		*out = f.buf;
 	}
-	jwt_Base64encode(body, buf, (int)strlen(buf));
-	body_len = (int)strlen(body);
 
-	jwt_freemem(buf);
-	buf = NULL;
+	jwt_encode_end(&f);
+
+	return ret;
+}
 
-	jwt_base64uri_encode(head);
-	jwt_base64uri_encode(body);
+/* Put a token together from its signing input and signature, which is
+ * empty for alg none. */
+static int jwt_encode_sig(char **out, const char *input, const char *sig,
+			  unsigned int sig_len)
+{
+	size_t len = strlen(input), size;
+	char *buf;
 
-	/* Allocate enough to reuse as b64 buffer. */
-	buf = jwt_malloc(head_len + body_len + 2);
+	size = len + 1 + jwt_b64url_encoded_len(sig_len) + 1;
+	buf = jwt_malloc(size);
 	if (buf == NULL)
 		return ENOMEM;
-	strcpy(buf, head);
-	strcat(buf, ".");
-	strcat(buf, body);
 
-	ret = __append_str(out, buf);
-	if (ret == 0)
-		ret = __append_str(out, ".");
-	if (ret) {
-		if (buf)
-			jwt_freemem(buf);
+	memcpy(buf, input, len);
+	buf[len++] = '.';
+	jwt_b64url_encode_into(buf + len, size - len, sig, sig_len, NULL);
+
+	*out = buf;
+
+	return 0;
+}
+
+/* HMAC the signing input as f encodes it, if the backend can take it a
+ * piece at a time, or else once it is all there. */
+static int jwt_sign_hmac(jwt_t *jwt, struct encode_feed *f,
+			 unsigned char *mac, unsigned int *mac_len)
+{
+	jwt_key_t tmp, *key, *cached;
+	const char *piece;
+	char *sig = NULL;
+	int ret;
+
+	ret = jwt_get_key(jwt, &tmp, &key, &cached);
+	if (ret)
 		return ret;
+
+	if (key->ops->sign_sha_hmac_stream) {
+		ret = key->ops->sign_sha_hmac_stream(jwt, key, jwt_encode_next,
+						     f, mac, mac_len);
+	} else {
+		while (jwt_encode_next(f, &piece))
+			;
+		f->buf[f->pos] = '\0';
+
+		ret = key->ops->sign_sha_hmac(jwt, key, &sig, mac_len, f->buf);
+		if (ret == 0 && *mac_len > JWT_HMAC_MAX_LEN)
+			ret = EINVAL;
+		if (ret == 0)
+			memcpy(mac, sig, *mac_len);
+		if (sig)
+			jwt_freemem(sig);
 	}
 
-	if (jwt->alg == JWT_ALG_NONE) {
-		jwt_freemem(buf);
-		return 0;
+	if (key == &tmp)
+		jwt_release_key(&tmp);
+	jwt_key_free(cached);
+
+	return ret;
+}
+
+/* HMAC tokens are put together in one buffer, the signature going in
+ * the room left after the signing input. */
+static int jwt_encode_hmac(jwt_t *jwt, char **out)
+{
+	unsigned char mac[JWT_HMAC_MAX_LEN];
+	unsigned int mac_len;
+	struct encode_feed f;
+	int ret;
+
+	ret = jwt_encode_start(jwt, &f,
+			       1 + jwt_b64url_encoded_len(JWT_HMAC_MAX_LEN));
+	if (ret == 0)
+		ret = jwt_sign_hmac(jwt, &f, mac, &mac_len);
+
+	if (ret == 0) {
+		f.buf[f.pos++] = '.';
+		jwt_b64url_encode_into(f.buf + f.pos, f.size - f.pos, mac,
+				       mac_len, NULL);
+		*out = f.buf;
+	} else if (f.buf) {
+		jwt_freemem(f.buf);
 	}
 
-	/* Now the signature. */
-	ret = jwt_sign(jwt, &sig, &sig_len, buf);
-	jwt_freemem(buf);
+	jwt_encode_end(&f);
 
-	if (ret)
-		return ret;
+	return ret;
+}
 
-	buf = jwt_malloc(sig_len * 2);
-	if (buf == NULL) {
-		jwt_freemem(sig);
-		return ENOMEM;
+static int jwt_encode(jwt_t *jwt, char **out)
+{
+	char *input, *sig = NULL;
+	unsigned int sig_len = 0;
+	int ret;
+
+	switch (jwt->alg) {
+	case JWT_ALG_HS256:
+	case JWT_ALG_HS384:
+	case JWT_ALG_HS512:
+		return jwt_encode_hmac(jwt, out);
+
+	default:
+		break;
 	}
 
-	jwt_Base64encode(buf, sig, sig_len);
+	ret = jwt_encode_input(jwt, &input);
+	if (ret)
+		return ret;
 
-	jwt_freemem(sig);
+	/* Now the signature. */
+	if (jwt->alg != JWT_ALG_NONE)
+		ret = jwt_sign(jwt, &sig, &sig_len, input);
 
-	jwt_base64uri_encode(buf);
-	ret = __append_str(out, buf);
-	jwt_freemem(buf);
+	if (ret == 0)
+		ret = jwt_encode_sig(out, input, sig, sig_len);
+
+	if (sig)
+		jwt_freemem(sig);
+	jwt_freemem(input);
 
 	return ret;
 }
@@ -1129,12 +2043,120 @@ char *jwt_encode_str(jwt_t *jwt)
 	return str;
 }
 
+int jwt_encode_batch(jwt_t **jwts, char **tokens, int *results,
+		     unsigned int count, jwt_key_t *key)
+{
+	char **inputs = NULL;
+	size_t *lens = NULL;
+	unsigned char *macs = NULL;
+	unsigned int i, n, mac_len;
+	int hmac, ret = 0;
+
+	if (!jwts || !tokens || !results || !key)
+		return EINVAL;
+
+	hmac = count && jwt_hmac_batched(key->alg, key);
+	if (hmac) {
+		inputs = jwt_malloc(count * sizeof(*inputs));
+		lens = jwt_malloc(count * sizeof(*lens));
+		macs = jwt_malloc(count * JWT_HMAC_MAX_LEN);
+
+		/* Fall back to one at a time. */
+		if (!inputs || !lens || !macs)
+			hmac = 0;
+	}
+
+	/* HMAC tokens only get as far as their signing input here, and are
+	 * then all signed at once. */
+	for (i = n = 0; i < count; i++) {
+		tokens[i] = NULL;
+
+		results[i] = jwt_set_alg_key(jwts[i], key->alg, key);
+		if (results[i])
+			continue;
+
+		if (!hmac) {
+			results[i] = jwt_encode(jwts[i], &tokens[i]);
+			continue;
+		}
+
+		results[i] = jwt_encode_input(jwts[i], &inputs[n]);
+		if (results[i] == 0) {
+			lens[n] = strlen(inputs[n]);
+			n++;
+		}
+	}
+
+	if (hmac && n) {
+		mac_len = jwt_hmac_mb(key->alg, key->data, key->len,
+				      (const char * const *)inputs, lens, n,
+				      macs);
+
+		for (i = n = 0; i < count; i++) {
+			if (results[i])
+				continue;
+
+			results[i] = jwt_encode_sig(&tokens[i], inputs[n],
+				(char *)macs + n * JWT_HMAC_MAX_LEN, mac_len);
+			jwt_freemem(inputs[n++]);
+		}
+	}
+
+	for (i = 0; i < count; i++) {
+		if (!results[i])
+			continue;
+
+		if (tokens[i]) {
+			jwt_freemem(tokens[i]);
+			tokens[i] = NULL;
+		}
+
+		if (!ret)
+			ret = results[i];
+	}
+
+	jwt_freemem(inputs);
+	jwt_freemem(lens);
+	jwt_freemem(macs);
+
+	return ret;
+}
+
 void jwt_free_str(char *str)
 {
 	if (str)
 		jwt_freemem(str);
 }
 
+int jwt_init(void)
+{
+	return jwt_crypto_init(NULL);
+}
+
+int jwt_init_libctx(void *libctx)
+{
+	int ret;
+
+	if (libctx == NULL)
+		return EINVAL;
+
+	ret = jwt_crypto_init(libctx);
+
+	/* Raw keys must not be served from the old context, which the
+	 * caller may free. */
+	jwt_key_cache_flush();
+
+	return ret;
+}
+
+void jwt_shutdown(void)
+{
+	/* Cached keys may hold objects from the backend's context. */
+	jwt_key_cache_flush();
+
+	jwt_crypto_shutdown();
+}
+
 int jwt_set_alloc(jwt_malloc_t pmalloc, jwt_realloc_t prealloc, jwt_free_t pfree)
 {
 	/* Set allocator functions for LibJWT. */
@@ -0,0 +1,394 @@
+/* Public domain, no copyright. Use at your own risk. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+
+#include <check.h>
+
+#include <jwt.h>
+
+/* Constant time to make tests consistent. */
+#define TS_CONST	1475980545L
+
+/* Macro to allocate a new JWT with checks. */
+#define ALLOC_JWT(__jwt) do {		\
+	int __ret = jwt_new(__jwt);	\
+	ck_assert_int_eq(__ret, 0);	\
+	ck_assert_ptr_ne(__jwt, NULL);	\
+} while(0)
+
+/* Older check doesn't have this. */
+#ifndef ck_assert_ptr_ne
+#define ck_assert_ptr_ne(X, Y) ck_assert(X != Y)
+#define ck_assert_ptr_eq(X, Y) ck_assert(X == Y)
+#endif
+
+#ifndef ck_assert_int_gt
+#define ck_assert_int_gt(X, Y) ck_assert(X > Y)
+#endif
+
+#define JOBS	32
+
+static unsigned char key[16384];
+static size_t key_len;
+
+static void read_key(const char *key_file)
+{
+	FILE *fp;
+	char *key_path;
+	int ret = 0;
+
+	ret = asprintf(&key_path, KEYDIR "/%s", key_file);
+	ck_assert_int_gt(ret, 0);
+
+	fp = fopen(key_path, "r");
+	ck_assert_ptr_ne(fp, NULL);
+
+	jwt_free_str(key_path);
+
+	key_len = fread(key, 1, sizeof(key), fp);
+	ck_assert_int_ne(key_len, 0);
+
+	ck_assert_int_eq(ferror(fp), 0);
+
+	fclose(fp);
+
+	key[key_len] = '\0';
+}
+
+static jwt_key_t *new_key(const char *key_file)
+{
+	jwt_key_t *k = NULL;
+	int ret;
+
+	read_key(key_file);
+	ret = jwt_key_new(&k, JWT_ALG_RS256, key, key_len);
+	ck_assert_int_eq(ret, 0);
+
+	return k;
+}
+
+static jwt_t *new_jwt(jwt_key_t *k, long iat)
+{
+	jwt_t *jwt = NULL;
+	int ret;
+
+	ALLOC_JWT(&jwt);
+
+	ret = jwt_add_grant(jwt, "iss", "files.cyphre.com");
+	ck_assert_int_eq(ret, 0);
+
+	ret = jwt_add_grant_int(jwt, "iat", iat);
+	ck_assert_int_eq(ret, 0);
+
+	ret = jwt_set_alg_key(jwt, JWT_ALG_RS256, k);
+	ck_assert_int_eq(ret, 0);
+
+	return jwt;
+}
+
+/* Collect count jobs the way an event loop would. */
+static void wait_jobs(jwt_async_t *pool, jwt_async_job_t **jobs, int count)
+{
+	struct pollfd pfd;
+	jwt_async_job_t *job;
+	int n = 0, ret;
+
+	pfd.fd = jwt_async_get_fd(pool);
+	pfd.events = POLLIN;
+	ck_assert_int_ne(pfd.fd, -1);
+
+	while (n < count) {
+		ret = poll(&pfd, 1, 10000);
+		ck_assert_int_eq(ret, 1);
+
+		while ((job = jwt_async_next(pool)) != NULL) {
+			ck_assert_int_lt(n, count);
+			jobs[n++] = job;
+		}
+	}
+
+	/* Nothing left, so nothing to wake up for. */
+	ck_assert_int_eq(poll(&pfd, 1, 0), 0);
+	ck_assert_ptr_eq(jwt_async_next(pool), NULL);
+}
+
+START_TEST(test_jwt_async_encode)
+{
+	jwt_async_job_t *jobs[JOBS];
+	jwt_key_t *priv, *pub;
+	jwt_async_t *pool;
+	long iat;
+	jwt_t *jwt;
+	char *token;
+	int i, ret;
+
+	priv = new_key("rsa_key_2048.pem");
+	pub = new_key("rsa_key_2048-pub.pem");
+
+	ret = jwt_async_new(&pool, 4);
+	ck_assert_int_eq(ret, 0);
+
+	for (i = 0; i < JOBS; i++) {
+		/* The pool signs a copy, so this one can go right away. */
+		jwt = new_jwt(priv, TS_CONST + i);
+		ret = jwt_async_encode(pool, jwt, NULL, (void *)(long)i);
+		ck_assert_int_eq(ret, 0);
+		jwt_free(jwt);
+	}
+
+	wait_jobs(pool, jobs, JOBS);
+
+	for (i = 0; i < JOBS; i++) {
+		ck_assert_int_eq(jwt_async_job_result(jobs[i]), 0);
+		ck_assert_ptr_eq(jwt_async_job_take_jwt(jobs[i]), NULL);
+
+		token = jwt_async_job_take_token(jobs[i]);
+		ck_assert_ptr_ne(token, NULL);
+		ck_assert_ptr_eq(jwt_async_job_take_token(jobs[i]), NULL);
+
+		/* Each token belongs with the data it was submitted with. */
+		ret = jwt_decode_with_key(&jwt, token, pub);
+		ck_assert_int_eq(ret, 0);
+		iat = (long)jwt_async_job_data(jobs[i]);
+		ck_assert_int_eq(jwt_get_grant_int(jwt, "iat"), TS_CONST + iat);
+
+		jwt_free(jwt);
+		jwt_free_str(token);
+		jwt_async_job_free(jobs[i]);
+	}
+
+	jwt_async_free(pool);
+	jwt_key_free(priv);
+	jwt_key_free(pub);
+}
+END_TEST
+
+START_TEST(test_jwt_async_decode)
+{
+	jwt_async_job_t *jobs[JOBS];
+	jwt_key_t *priv, *pub;
+	char *tokens[JOBS];
+	jwt_async_t *pool;
+	long i;
+	jwt_t *jwt;
+	int ret;
+
+	priv = new_key("rsa_key_2048.pem");
+	pub = new_key("rsa_key_2048-pub.pem");
+
+	for (i = 0; i < JOBS; i++) {
+		jwt = new_jwt(priv, TS_CONST + i);
+		tokens[i] = jwt_encode_str(jwt);
+		ck_assert_ptr_ne(tokens[i], NULL);
+		jwt_free(jwt);
+
+		/* Break every other signature. */
+		if (i % 2)
+			tokens[i][strlen(tokens[i]) - 5] ^= 1;
+	}
+
+	ret = jwt_async_new(&pool, 0);
+	ck_assert_int_eq(ret, 0);
+
+	for (i = 0; i < JOBS; i++) {
+		ret = jwt_async_decode(pool, tokens[i], pub, NULL, (void *)i);
+		ck_assert_int_eq(ret, 0);
+	}
+
+	/* The pool keeps its own copies and references. */
+	for (i = 0; i < JOBS; i++)
+		jwt_free_str(tokens[i]);
+	jwt_key_free(pub);
+
+	wait_jobs(pool, jobs, JOBS);
+
+	for (i = 0; i < JOBS; i++) {
+		long n = (long)jwt_async_job_data(jobs[i]);
+
+		ck_assert_ptr_eq(jwt_async_job_take_token(jobs[i]), NULL);
+
+		jwt = jwt_async_job_take_jwt(jobs[i]);
+		if (n % 2) {
+			ck_assert_int_eq(jwt_async_job_result(jobs[i]), EINVAL);
+			ck_assert_ptr_eq(jwt, NULL);
+		} else {
+			ck_assert_int_eq(jwt_async_job_result(jobs[i]), 0);
+			ck_assert_ptr_ne(jwt, NULL);
+			ck_assert_int_eq(jwt_get_grant_int(jwt, "iat"),
+					 TS_CONST + n);
+		}
+
+		jwt_free(jwt);
+		jwt_async_job_free(jobs[i]);
+	}
+
+	jwt_async_free(pool);
+	jwt_key_free(priv);
+}
+END_TEST
+
+static pthread_mutex_t cb_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cb_cond = PTHREAD_COND_INITIALIZER;
+static int cb_done, cb_ok;
+
+static void job_done(jwt_async_job_t *job, void *data)
+{
+	char *token = jwt_async_job_take_token(job);
+
+	pthread_mutex_lock(&cb_lock);
+	cb_done++;
+	if (jwt_async_job_result(job) == 0 && token != NULL &&
+	    data == &cb_done)
+		cb_ok++;
+	pthread_cond_signal(&cb_cond);
+	pthread_mutex_unlock(&cb_lock);
+
+	jwt_free_str(token);
+	jwt_async_job_free(job);
+}
+
+START_TEST(test_jwt_async_callback)
+{
+	jwt_async_t *pool;
+	jwt_key_t *priv;
+	jwt_t *jwt;
+	int i, ret;
+
+	priv = new_key("rsa_key_2048.pem");
+	jwt = new_jwt(priv, TS_CONST);
+
+	cb_done = cb_ok = 0;
+
+	ret = jwt_async_new(&pool, 2);
+	ck_assert_int_eq(ret, 0);
+
+	for (i = 0; i < JOBS; i++) {
+		ret = jwt_async_encode(pool, jwt, job_done, &cb_done);
+		ck_assert_int_eq(ret, 0);
+	}
+
+	pthread_mutex_lock(&cb_lock);
+	while (cb_done < JOBS)
+		pthread_cond_wait(&cb_cond, &cb_lock);
+	pthread_mutex_unlock(&cb_lock);
+
+	ck_assert_int_eq(cb_ok, JOBS);
+
+	/* Callback jobs never show up here. */
+	ck_assert_ptr_eq(jwt_async_next(pool), NULL);
+
+	/* Freeing the pool finishes what was submitted. */
+	cb_done = cb_ok = 0;
+	for (i = 0; i < JOBS; i++) {
+		ret = jwt_async_encode(pool, jwt, job_done, &cb_done);
+		ck_assert_int_eq(ret, 0);
+	}
+	jwt_async_free(pool);
+
+	ck_assert_int_eq(cb_done, JOBS);
+	ck_assert_int_eq(cb_ok, JOBS);
+
+	/* Along with finished jobs nobody picked up. */
+	ret = jwt_async_new(&pool, 1);
+	ck_assert_int_eq(ret, 0);
+	for (i = 0; i < 4; i++) {
+		ret = jwt_async_encode(pool, jwt, NULL, NULL);
+		ck_assert_int_eq(ret, 0);
+	}
+	jwt_async_free(pool);
+
+	jwt_free(jwt);
+	jwt_key_free(priv);
+}
+END_TEST
+
+START_TEST(test_jwt_async_invalid)
+{
+	jwt_async_job_t *job;
+	jwt_async_t *pool;
+	jwt_t *jwt;
+	int ret;
+
+	ck_assert_int_eq(jwt_async_new(NULL, 1), EINVAL);
+	ck_assert_int_eq(jwt_async_new(&pool, 257), EINVAL);
+	ck_assert_ptr_eq(pool, NULL);
+
+	ret = jwt_async_new(&pool, 1);
+	ck_assert_int_eq(ret, 0);
+
+	ck_assert_int_eq(jwt_async_encode(pool, NULL, NULL, NULL), EINVAL);
+	ck_assert_int_eq(jwt_async_decode(pool, NULL, NULL, NULL, NULL),
+			 EINVAL);
+	ck_assert_int_eq(jwt_async_encode(NULL, NULL, NULL, NULL), EINVAL);
+	ck_assert_int_eq(jwt_async_get_fd(NULL), -1);
+	ck_assert_ptr_eq(jwt_async_next(NULL), NULL);
+
+	/* Errors signing come back with the job. */
+	ALLOC_JWT(&jwt);
+	ret = jwt_set_alg(jwt, JWT_ALG_RS256, (const unsigned char *)"junk", 4);
+	ck_assert_int_eq(ret, 0);
+	ret = jwt_async_encode(pool, jwt, NULL, NULL);
+	ck_assert_int_eq(ret, 0);
+	jwt_free(jwt);
+
+	wait_jobs(pool, &job, 1);
+	ck_assert_int_eq(jwt_async_job_result(job), EINVAL);
+	ck_assert_ptr_eq(jwt_async_job_take_token(job), NULL);
+	jwt_async_job_free(job);
+
+	/* Not even a token. */
+	ret = jwt_async_decode(pool, "not.a.token", NULL, NULL, NULL);
+	ck_assert_int_eq(ret, 0);
+
+	wait_jobs(pool, &job, 1);
+	ck_assert_int_eq(jwt_async_job_result(job), EINVAL);
+	jwt_async_job_free(job);
+
+	jwt_async_free(pool);
+	jwt_async_free(NULL);
+	jwt_async_job_free(NULL);
+}
+END_TEST
+
+static Suite *libjwt_suite(void)
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s = suite_create("LibJWT Worker Pools");
+
+	tc_core = tcase_create("jwt_async");
+
+	tcase_add_test(tc_core, test_jwt_async_encode);
+	tcase_add_test(tc_core, test_jwt_async_decode);
+	tcase_add_test(tc_core, test_jwt_async_callback);
+	tcase_add_test(tc_core, test_jwt_async_invalid);
+
+	tcase_set_timeout(tc_core, 30);
+
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
+
+int main(int argc, char *argv[])
+{
+	int number_failed;
+	Suite *s;
+	SRunner *sr;
+
+	s = libjwt_suite();
+	sr = srunner_create(s);
+
+	srunner_run_all(sr, CK_VERBOSE);
+	number_failed = srunner_ntests_failed(sr);
+	srunner_free(sr);
+
+	return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
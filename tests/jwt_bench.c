@@ -0,0 +1,427 @@
+/* Public domain, no copyright. Use at your own risk. */
+
+/* Rough timings for the hot paths. This is not run as part of the test
+ * suite, build it with the tests and run it by hand:
+ *
+ *     ./jwt_bench [iterations]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include <jwt.h>
+
+/* Constant time to make results consistent. */
+#define TS_CONST	1475980545L
+
+#define DEFAULT_ITERATIONS	100000
+
+static const unsigned char key256[32] = "012345678901234567890123456789XY";
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void report(const char *name, long iterations, double secs)
+{
+	printf("%-24s %10ld ops %10.0f ops/s %8.2f us/op\n", name, iterations,
+	       iterations / secs, secs * 1e6 / iterations);
+}
+
+static jwt_t *new_jwt(jwt_alg_t alg, const unsigned char *key, int key_len)
+{
+	jwt_t *jwt = NULL;
+
+	if (jwt_new(&jwt) ||
+	    jwt_add_grant(jwt, "iss", "files.cyphre.com") ||
+	    jwt_add_grant(jwt, "sub", "user0") ||
+	    jwt_add_grant(jwt, "ref", "XXXX-YYYY-ZZZZ-AAAA-CCCC") ||
+	    jwt_add_grant_int(jwt, "iat", TS_CONST) ||
+	    jwt_set_alg(jwt, alg, key, key_len)) {
+		fprintf(stderr, "Failed to create JWT\n");
+		exit(1);
+	}
+
+	return jwt;
+}
+
+static void bench_encode(const char *name, jwt_alg_t alg, long iterations)
+{
+	jwt_t *jwt = new_jwt(alg, key256, sizeof(key256));
+	double start;
+	char *out;
+	long i;
+
+	start = now();
+	for (i = 0; i < iterations; i++) {
+		out = jwt_encode_str(jwt);
+		if (out == NULL) {
+			fprintf(stderr, "%s: encode failed\n", name);
+			exit(1);
+		}
+		jwt_free_str(out);
+	}
+	report(name, iterations, now() - start);
+
+	jwt_free(jwt);
+}
+
+static void bench_decode(const char *name, jwt_alg_t alg, long iterations)
+{
+	jwt_t *jwt = new_jwt(alg, key256, sizeof(key256));
+	double start;
+	char *token;
+	long i;
+
+	token = jwt_encode_str(jwt);
+	jwt_free(jwt);
+	if (token == NULL) {
+		fprintf(stderr, "%s: encode failed\n", name);
+		exit(1);
+	}
+
+	start = now();
+	for (i = 0; i < iterations; i++) {
+		if (jwt_decode(&jwt, token, key256, sizeof(key256))) {
+			fprintf(stderr, "%s: decode failed\n", name);
+			exit(1);
+		}
+		jwt_free(jwt);
+	}
+	report(name, iterations, now() - start);
+
+	jwt_free_str(token);
+}
+
+/* A token with a claim of about claim_len bytes, as with long lists of
+ * permissions. */
+static void bench_decode_large(const char *name, size_t claim_len,
+			       long iterations)
+{
+	jwt_t *jwt = new_jwt(JWT_ALG_HS256, key256, sizeof(key256));
+	double start;
+	char *perms, *token;
+	size_t i;
+	long n;
+
+	perms = malloc(claim_len + 1);
+	if (perms == NULL) {
+		fprintf(stderr, "%s: out of memory\n", name);
+		exit(1);
+	}
+	for (i = 0; i < claim_len; i++)
+		perms[i] = i % 16 == 15 ? ',' : 'a' + i % 16;
+	perms[claim_len] = '\0';
+
+	if (jwt_add_grant(jwt, "perms", perms) ||
+	    (token = jwt_encode_str(jwt)) == NULL) {
+		fprintf(stderr, "%s: encode failed\n", name);
+		exit(1);
+	}
+	jwt_free(jwt);
+	free(perms);
+
+	start = now();
+	for (n = 0; n < iterations; n++) {
+		if (jwt_decode(&jwt, token, key256, sizeof(key256))) {
+			fprintf(stderr, "%s: decode failed\n", name);
+			exit(1);
+		}
+		jwt_free(jwt);
+	}
+	report(name, iterations, now() - start);
+
+	jwt_free_str(token);
+}
+
+#define BATCH	64
+
+/* Same as above, BATCH tokens per call and one prepared key. */
+static void bench_batch(const char *name, jwt_alg_t alg, long iterations)
+{
+	const char *ctokens[BATCH];
+	char *tokens[BATCH];
+	int results[BATCH];
+	jwt_t *jwts[BATCH];
+	jwt_key_t *key;
+	char label[32];
+	double start;
+	long i;
+	int j;
+
+	if (jwt_key_new(&key, alg, key256, sizeof(key256))) {
+		fprintf(stderr, "%s: key failed\n", name);
+		exit(1);
+	}
+
+	for (j = 0; j < BATCH; j++)
+		jwts[j] = new_jwt(alg, key256, sizeof(key256));
+
+	start = now();
+	for (i = 0; i < iterations; i += BATCH) {
+		if (jwt_encode_batch(jwts, tokens, results, BATCH, key)) {
+			fprintf(stderr, "%s: encode failed\n", name);
+			exit(1);
+		}
+		if (i + BATCH < iterations) {
+			for (j = 0; j < BATCH; j++)
+				jwt_free_str(tokens[j]);
+		}
+	}
+	snprintf(label, sizeof(label), "encode batch %s", name);
+	report(label, i, now() - start);
+
+	for (j = 0; j < BATCH; j++)
+		ctokens[j] = tokens[j];
+
+	start = now();
+	for (i = 0; i < iterations; i += BATCH) {
+		if (jwt_verify_batch(ctokens, results, BATCH, key)) {
+			fprintf(stderr, "%s: verify failed\n", name);
+			exit(1);
+		}
+	}
+	snprintf(label, sizeof(label), "verify batch %s", name);
+	report(label, i, now() - start);
+
+	for (j = 0; j < BATCH; j++) {
+		jwt_free_str(tokens[j]);
+		jwt_free(jwts[j]);
+	}
+	jwt_key_free(key);
+}
+
+static jwt_key_t *read_key(const char *name, jwt_alg_t alg)
+{
+	unsigned char pem[16384];
+	jwt_key_t *key = NULL;
+	char path[256];
+	size_t len;
+	FILE *fp;
+
+	snprintf(path, sizeof(path), KEYDIR "/%s", name);
+	fp = fopen(path, "r");
+	if (fp == NULL) {
+		fprintf(stderr, "%s: no key\n", name);
+		exit(1);
+	}
+	len = fread(pem, 1, sizeof(pem), fp);
+	fclose(fp);
+
+	if (jwt_key_new(&key, alg, pem, len)) {
+		fprintf(stderr, "%s: key failed\n", name);
+		exit(1);
+	}
+
+	return key;
+}
+
+/* The same RS256 token over and over, as a client would present it, with
+ * the verified token cache off and on. */
+static void bench_decode_cached(const char *name, unsigned int size,
+				long iterations)
+{
+	jwt_key_t *priv = read_key("rsa_key_2048.pem", JWT_ALG_RS256);
+	jwt_key_t *pub = read_key("rsa_key_2048-pub.pem", JWT_ALG_RS256);
+	jwt_cache_stats_t stats;
+	jwt_t *jwt = new_jwt(JWT_ALG_NONE, NULL, 0);
+	double start;
+	char *token;
+	long i;
+
+	if (jwt_set_alg_key(jwt, JWT_ALG_RS256, priv) ||
+	    (token = jwt_encode_str(jwt)) == NULL) {
+		fprintf(stderr, "%s: encode failed\n", name);
+		exit(1);
+	}
+	jwt_free(jwt);
+
+	jwt_token_cache_set_size(size);
+
+	start = now();
+	for (i = 0; i < iterations; i++) {
+		if (jwt_decode_with_key(&jwt, token, pub)) {
+			fprintf(stderr, "%s: decode failed\n", name);
+			exit(1);
+		}
+		jwt_free(jwt);
+	}
+	report(name, iterations, now() - start);
+
+	jwt_token_cache_get_stats(&stats);
+	if (size)
+		printf("%-24s %10lu hits %10lu misses\n", "", stats.hits,
+		       stats.misses);
+
+	jwt_token_cache_set_size(0);
+	jwt_free_str(token);
+	jwt_key_free(priv);
+	jwt_key_free(pub);
+}
+
+/* The same forged token over and over, as a misbehaving client would. */
+static void bench_decode_rejected(const char *name, unsigned int size,
+				  long iterations)
+{
+	jwt_key_t *priv = read_key("rsa_key_2048.pem", JWT_ALG_RS256);
+	jwt_key_t *pub = read_key("rsa_key_2048-pub.pem", JWT_ALG_RS256);
+	jwt_cache_stats_t stats;
+	jwt_t *jwt = new_jwt(JWT_ALG_NONE, NULL, 0);
+	double start;
+	char *token, *c;
+	long i;
+
+	if (jwt_set_alg_key(jwt, JWT_ALG_RS256, priv) ||
+	    (token = jwt_encode_str(jwt)) == NULL) {
+		fprintf(stderr, "%s: encode failed\n", name);
+		exit(1);
+	}
+	jwt_free(jwt);
+
+	/* Well formed, so the signature really is checked. */
+	c = token + strlen(token) - 8;
+	*c = *c == 'A' ? 'B' : 'A';
+
+	jwt_reject_cache_set_size(size);
+
+	start = now();
+	for (i = 0; i < iterations; i++) {
+		if (jwt_decode_with_key(&jwt, token, pub) != EINVAL) {
+			fprintf(stderr, "%s: decode did not fail\n", name);
+			exit(1);
+		}
+	}
+	report(name, iterations, now() - start);
+
+	jwt_reject_cache_get_stats(&stats);
+	if (size)
+		printf("%-24s %10lu hits %10lu misses\n", "", stats.hits,
+		       stats.misses);
+
+	jwt_reject_cache_set_size(0);
+	jwt_free_str(token);
+	jwt_key_free(priv);
+	jwt_key_free(pub);
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+#define BURST		32
+#define PRECOMP_DEPTH	64
+
+/* ES256 signing latency, with and without jwt_key_precompute(). Tokens
+ * are signed in bursts with a pause in between, which is when the nonce
+ * thread catches up, so this is the latency seen by a server that is not
+ * signing flat out. */
+static void bench_es_latency(const char *name, unsigned int depth,
+			     long iterations)
+{
+	struct timespec pause = { 0, 2000000 };
+	unsigned char pem[4096];
+	jwt_key_t *key = NULL;
+	double start, *lat;
+	size_t pem_len;
+	jwt_t *jwt;
+	char *out;
+	FILE *fp;
+	long i;
+
+	fp = fopen(KEYDIR "/ec_key_prime256v1.pem", "r");
+	if (fp == NULL) {
+		fprintf(stderr, "%s: no key\n", name);
+		exit(1);
+	}
+	pem_len = fread(pem, 1, sizeof(pem), fp);
+	fclose(fp);
+
+	if (jwt_key_new(&key, JWT_ALG_ES256, pem, pem_len)) {
+		fprintf(stderr, "%s: key failed\n", name);
+		exit(1);
+	}
+
+	if (depth && jwt_key_precompute(key, depth)) {
+		printf("%-24s not supported by %s\n", name,
+		       jwt_get_crypto_backend());
+		jwt_key_free(key);
+		return;
+	}
+
+	jwt = new_jwt(JWT_ALG_NONE, NULL, 0);
+	if (jwt_set_alg_key(jwt, JWT_ALG_ES256, key)) {
+		fprintf(stderr, "%s: set key failed\n", name);
+		exit(1);
+	}
+
+	lat = malloc(iterations * sizeof(*lat));
+	if (lat == NULL)
+		exit(1);
+
+	for (i = 0; i < iterations; i++) {
+		if (i % BURST == 0)
+			nanosleep(&pause, NULL);
+
+		start = now();
+		out = jwt_encode_str(jwt);
+		lat[i] = now() - start;
+		if (out == NULL) {
+			fprintf(stderr, "%s: encode failed\n", name);
+			exit(1);
+		}
+		jwt_free_str(out);
+	}
+
+	qsort(lat, iterations, sizeof(*lat), cmp_double);
+	printf("%-24s %10ld ops %8.2f us p50 %8.2f us p99\n", name,
+	       iterations, lat[iterations / 2] * 1e6,
+	       lat[iterations * 99 / 100] * 1e6);
+
+	free(lat);
+	jwt_free(jwt);
+	jwt_key_free(key);
+}
+
+int main(int argc, char *argv[])
+{
+	long iterations = DEFAULT_ITERATIONS;
+
+	if (argc > 1) {
+		iterations = strtol(argv[1], NULL, 10);
+		if (iterations <= 0) {
+			fprintf(stderr, "usage: %s [iterations]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	bench_encode("encode HS256", JWT_ALG_HS256, iterations);
+	bench_decode("decode HS256", JWT_ALG_HS256, iterations);
+	bench_batch("HS256", JWT_ALG_HS256, iterations);
+	bench_encode("encode HS512", JWT_ALG_HS512, iterations);
+	bench_decode("decode HS512", JWT_ALG_HS512, iterations);
+	bench_batch("HS512", JWT_ALG_HS512, iterations);
+	bench_decode_large("decode HS256 2K", 2048, iterations / 10);
+	bench_decode_large("decode HS256 16K", 16384, iterations / 10);
+
+	/* Public key signatures are slow, don't take all day over them. */
+	bench_decode_cached("decode RS256", 0, iterations / 10);
+	bench_decode_cached("decode RS256 cached", 1024, iterations / 10);
+	bench_decode_rejected("reject RS256", 0, iterations / 10);
+	bench_decode_rejected("reject RS256 cached", 1024, iterations / 10);
+	bench_es_latency("sign ES256", 0, iterations / 10);
+	bench_es_latency("sign ES256 precomputed", PRECOMP_DEPTH,
+			 iterations / 10);
+
+	return 0;
+}
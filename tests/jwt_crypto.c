@@ -0,0 +1,428 @@
+/* Public domain, no copyright. Use at your own risk. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <check.h>
+
+#include <jwt.h>
+
+/* Constant time to make tests consistent. */
+#define TS_CONST	1475980545L
+
+/* Macro to allocate a new JWT with checks. */
+#define ALLOC_JWT(__jwt) do {		\
+	int __ret = jwt_new(__jwt);	\
+	ck_assert_int_eq(__ret, 0);	\
+	ck_assert_ptr_ne(__jwt, NULL);	\
+} while(0)
+
+/* Older check doesn't have this. */
+#ifndef ck_assert_ptr_ne
+#define ck_assert_ptr_ne(X, Y) ck_assert(X != Y)
+#define ck_assert_ptr_eq(X, Y) ck_assert(X == Y)
+#endif
+
+#ifndef ck_assert_int_gt
+#define ck_assert_int_gt(X, Y) ck_assert(X > Y)
+#endif
+
+static unsigned char key[16384];
+static size_t key_len;
+
+static const char jwt_rs256_2048[] = "eyJhbGciOiJSUzI1NiIsInR5cCI6IkpXVCJ9.ey"
+	"JpYXQiOjE0NzU5ODA1NDUsImlzcyI6ImZpbGVzLmN5cGhyZS5jb20iLCJyZWYiOiJYWF"
+	"hYLVlZWVktWlpaWi1BQUFBLUNDQ0MiLCJzdWIiOiJ1c2VyMCJ9.cl9YHrbydUPb8dbij"
+	"SZzpTa-r-Z2bFz8r1DEQeqGB2ncHlNvYRLa3wa-IbOSQGPVok9xMutxc2ngm0cvquOOW"
+	"WVZIpYz3IdZQaCZ4G2PtTwnmhblSnqB-1ZvbUljBHjIoeXDTq2Msph2sjED9YKHKcjIm"
+	"kwil1cp75bnZMoKW3kDuNdq1vUwZDLdE_YRMpA53sTsoXHNSBzQwrIFEdCA8OA2rS-9R"
+	"IYtbLnKUZH4GXe2wb5y7pB21qqIdSl9k7yuD90k7LaCQDNLvrI1_cQB9wQcqqFA0qFc2"
+	"UxbiRRsC65eRZ1PfdZ8I_scukh5Vts5PNaRdE-_y_bpZKPaUu-WwA";
+
+static const char jwt_hs256[] = "eyJhbGciOiJIUzI1NiIsInR5cCI6IkpXVCJ9.eyJpYXQ"
+	"iOjE0NzU5ODA1NDUsImlzcyI6ImZpbGVzLmN5cGhyZS5jb20iLCJyZWYiOiJYWFhYLVl"
+	"ZWVktWlpaWi1BQUFBLUNDQ0MiLCJzdWIiOiJ1c2VyMCJ9.B0a9gqWgPuuIx-EFXXSHQBy"
+	"CMHCzs0gjvY3-60oV4TY";
+
+static const unsigned char key256[32] = "012345678901234567890123456789XY";
+
+static void read_key(const char *key_file)
+{
+	FILE *fp;
+	char *key_path;
+	int ret = 0;
+
+	ret = asprintf(&key_path, KEYDIR "/%s", key_file);
+	ck_assert_int_gt(ret, 0);
+
+	fp = fopen(key_path, "r");
+	ck_assert_ptr_ne(fp, NULL);
+
+	jwt_free_str(key_path);
+
+	key_len = fread(key, 1, sizeof(key), fp);
+	ck_assert_int_ne(key_len, 0);
+
+	ck_assert_int_eq(ferror(fp), 0);
+
+	fclose(fp);
+
+	key[key_len] = '\0';
+}
+
+static void add_grants(jwt_t *jwt)
+{
+	int ret;
+
+	ret = jwt_add_grant(jwt, "iss", "files.cyphre.com");
+	ck_assert_int_eq(ret, 0);
+
+	ret = jwt_add_grant(jwt, "sub", "user0");
+	ck_assert_int_eq(ret, 0);
+
+	ret = jwt_add_grant(jwt, "ref", "XXXX-YYYY-ZZZZ-AAAA-CCCC");
+	ck_assert_int_eq(ret, 0);
+
+	ret = jwt_add_grant_int(jwt, "iat", TS_CONST);
+	ck_assert_int_eq(ret, 0);
+}
+
+static char *encode(jwt_alg_t alg, const unsigned char *k, int len)
+{
+	jwt_t *jwt = NULL;
+	char *out;
+	int ret;
+
+	ALLOC_JWT(&jwt);
+	add_grants(jwt);
+
+	ret = jwt_set_alg(jwt, alg, k, len);
+	ck_assert_int_eq(ret, 0);
+
+	out = jwt_encode_str(jwt);
+	ck_assert_ptr_ne(out, NULL);
+
+	jwt_free(jwt);
+
+	return out;
+}
+
+static void decode(const char *token, const unsigned char *k, int len,
+		   int expect)
+{
+	jwt_t *jwt = NULL;
+	int ret;
+
+	ret = jwt_decode(&jwt, token, k, len);
+	ck_assert_int_eq(ret, expect);
+	if (expect)
+		ck_assert_ptr_eq(jwt, NULL);
+	else
+		ck_assert_ptr_ne(jwt, NULL);
+
+	jwt_free(jwt);
+}
+
+/* A made up provider, which "signs" by copying the key. */
+static int fake_prepared, fake_released, fake_signed, fake_verified;
+static int fake_state, fake_verify_err;
+
+static int fake_prepare(jwt_alg_t alg, const unsigned char *k, int len,
+			void **state)
+{
+	fake_prepared++;
+	*state = &fake_state;
+
+	return 0;
+}
+
+static void fake_release(void *state)
+{
+	ck_assert_ptr_eq(state, &fake_state);
+	fake_released++;
+}
+
+static int fake_sign(void *state, jwt_alg_t alg, const unsigned char *k,
+		     int len, const char *data, unsigned char **sig,
+		     unsigned int *sig_len)
+{
+	ck_assert_ptr_eq(state, &fake_state);
+	ck_assert_int_eq(alg, JWT_ALG_HS256);
+
+	*sig = malloc(len);
+	if (*sig == NULL)
+		return ENOMEM;
+
+	memcpy(*sig, k, len);
+	*sig_len = len;
+	fake_signed++;
+
+	return 0;
+}
+
+static int fake_verify(void *state, jwt_alg_t alg, const unsigned char *k,
+		       int len, const char *data, const unsigned char *sig,
+		       unsigned int sig_len)
+{
+	ck_assert_ptr_eq(state, &fake_state);
+	fake_verified++;
+
+	if (fake_verify_err)
+		return fake_verify_err;
+
+	return sig_len == (unsigned int)len && !memcmp(sig, k, len) ? 0 :
+		EINVAL;
+}
+
+static const jwt_crypto_provider_t fake_provider = {
+	"fake",
+	fake_prepare,
+	fake_release,
+	fake_sign,
+	fake_verify,
+};
+
+START_TEST(test_jwt_crypto_backend)
+{
+	const char *name;
+	int ret;
+
+	name = jwt_get_crypto_backend();
+	ck_assert_ptr_ne(name, NULL);
+
+	ret = jwt_set_crypto_backend(name);
+	ck_assert_int_eq(ret, 0);
+	ck_assert_str_eq(jwt_get_crypto_backend(), name);
+
+	ret = jwt_set_crypto_backend("no-such-backend");
+	ck_assert_int_eq(ret, ENOENT);
+	ck_assert_str_eq(jwt_get_crypto_backend(), name);
+
+	ret = jwt_set_crypto_backend(NULL);
+	ck_assert_int_eq(ret, EINVAL);
+}
+END_TEST
+
+START_TEST(test_jwt_crypto_backends_compare)
+{
+	const char *names[] = { "openssl", "gnutls" };
+	const char *orig = jwt_get_crypto_backend();
+	char *es384 = NULL, *out;
+	unsigned int i, found = 0;
+	int ret;
+
+	/* Every backend that was built in must give the same answers, and
+	 * accept what the others signed. */
+	for (i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+		if (jwt_set_crypto_backend(names[i]))
+			continue;
+		found++;
+
+		out = encode(JWT_ALG_HS256, key256, sizeof(key256));
+		ck_assert_str_eq(out, jwt_hs256);
+		jwt_free_str(out);
+
+		read_key("rsa_key_2048.pem");
+		out = encode(JWT_ALG_RS256, key, key_len);
+		ck_assert_str_eq(out, jwt_rs256_2048);
+		jwt_free_str(out);
+
+		read_key("ec_key_secp384r1-pub.pem");
+		if (es384)
+			decode(es384, key, key_len, 0);
+		jwt_free_str(es384);
+
+		read_key("ec_key_secp384r1.pem");
+		es384 = encode(JWT_ALG_ES384, key, key_len);
+
+		read_key("ec_key_secp384r1-pub.pem");
+		decode(es384, key, key_len, 0);
+	}
+
+	ck_assert_int_gt(found, 0);
+
+	ret = jwt_set_crypto_backend(orig);
+	ck_assert_int_eq(ret, 0);
+
+	jwt_free_str(es384);
+}
+END_TEST
+
+START_TEST(test_jwt_crypto_provider)
+{
+	jwt_key_t *jkey = NULL;
+	jwt_t *jwt = NULL;
+	char *builtin, *out, *batch;
+	int ret, result;
+
+	builtin = encode(JWT_ALG_HS256, key256, sizeof(key256));
+
+	/* Made before the provider went in. */
+	ret = jwt_key_new(&jkey, JWT_ALG_HS256, key256, sizeof(key256));
+	ck_assert_int_eq(ret, 0);
+
+	ret = jwt_set_crypto_provider(JWT_ALG_HS256, &fake_provider);
+	ck_assert_int_eq(ret, 0);
+
+	out = encode(JWT_ALG_HS256, key256, sizeof(key256));
+	ck_assert_str_ne(out, builtin);
+	ck_assert_int_eq(fake_signed, 1);
+
+	decode(out, key256, sizeof(key256), 0);
+	ck_assert_int_eq(fake_verified, 1);
+
+	/* Batches are left to the provider too. */
+	ALLOC_JWT(&jwt);
+	ret = jwt_encode_batch(&jwt, &batch, &result, 1, jkey);
+	ck_assert_int_eq(ret, 0);
+	ck_assert_int_eq(fake_signed, 2);
+	jwt_free(jwt);
+	jwt = NULL;
+
+	ret = jwt_verify_batch((const char **)&batch, &result, 1, jkey);
+	ck_assert_int_eq(ret, 0);
+	ck_assert_int_eq(fake_verified, 2);
+	jwt_free_str(batch);
+
+	decode(builtin, key256, sizeof(key256), EINVAL);
+	ck_assert_int_eq(fake_verified, 3);
+
+	/* The old key is handed to the provider too. */
+	ret = jwt_decode_with_key(&jwt, out, jkey);
+	ck_assert_int_eq(ret, 0);
+	ck_assert_int_eq(fake_verified, 4);
+	jwt_free(jwt);
+
+	/* Other algorithms stay where they were. */
+	jwt_free_str(out);
+	out = encode(JWT_ALG_HS384, key256, sizeof(key256));
+	decode(out, key256, sizeof(key256), 0);
+	ck_assert_int_eq(fake_signed, 2);
+	ck_assert_int_eq(fake_verified, 4);
+	jwt_free_str(out);
+
+	ret = jwt_set_crypto_provider(JWT_ALG_HS256, NULL);
+	ck_assert_int_eq(ret, 0);
+
+	out = encode(JWT_ALG_HS256, key256, sizeof(key256));
+	ck_assert_str_eq(out, builtin);
+	ck_assert_int_eq(fake_signed, 2);
+	jwt_free_str(out);
+
+	ret = jwt_decode_with_key(&jwt, builtin, jkey);
+	ck_assert_int_eq(ret, 0);
+	jwt_free(jwt);
+
+	/* Everything the provider prepared was released. */
+	jwt_key_cache_flush();
+	ck_assert_int_gt(fake_prepared, 0);
+	ck_assert_int_eq(fake_released, fake_prepared);
+
+	jwt_free_str(builtin);
+	jwt_key_free(jkey);
+}
+END_TEST
+
+START_TEST(test_jwt_crypto_provider_transient)
+{
+	jwt_cache_stats_t stats;
+	char *builtin, *out;
+	int ret;
+
+	ret = jwt_reject_cache_set_size(64);
+	ck_assert_int_eq(ret, 0);
+	jwt_reject_cache_flush();
+
+	builtin = encode(JWT_ALG_HS256, key256, sizeof(key256));
+
+	ret = jwt_set_crypto_provider(JWT_ALG_HS256, &fake_provider);
+	ck_assert_int_eq(ret, 0);
+
+	out = encode(JWT_ALG_HS256, key256, sizeof(key256));
+
+	/* A provider that could not check is not a forgery. */
+	fake_verify_err = ENOMEM;
+	decode(out, key256, sizeof(key256), ENOMEM);
+	fake_verify_err = 0;
+
+	jwt_reject_cache_get_stats(&stats);
+	ck_assert_int_eq(stats.entries, 0);
+
+	decode(out, key256, sizeof(key256), 0);
+
+	/* A mismatch still is. */
+	decode(builtin, key256, sizeof(key256), EINVAL);
+
+	jwt_reject_cache_get_stats(&stats);
+	ck_assert_int_eq(stats.entries, 1);
+
+	ret = jwt_set_crypto_provider(JWT_ALG_HS256, NULL);
+	ck_assert_int_eq(ret, 0);
+
+	jwt_key_cache_flush();
+	jwt_free_str(builtin);
+	jwt_free_str(out);
+
+	ret = jwt_reject_cache_set_size(0);
+	ck_assert_int_eq(ret, 0);
+}
+END_TEST
+
+START_TEST(test_jwt_crypto_provider_invalid)
+{
+	jwt_crypto_provider_t bad = fake_provider;
+	int ret;
+
+	ret = jwt_set_crypto_provider(JWT_ALG_NONE, &fake_provider);
+	ck_assert_int_eq(ret, EINVAL);
+
+	ret = jwt_set_crypto_provider(JWT_ALG_INVAL, &fake_provider);
+	ck_assert_int_eq(ret, EINVAL);
+
+	bad.verify = NULL;
+	ret = jwt_set_crypto_provider(JWT_ALG_HS256, &bad);
+	ck_assert_int_eq(ret, EINVAL);
+}
+END_TEST
+
+static Suite *libjwt_suite(void)
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s = suite_create("LibJWT Crypto Providers");
+
+	tc_core = tcase_create("jwt_crypto");
+
+	tcase_add_test(tc_core, test_jwt_crypto_backend);
+	tcase_add_test(tc_core, test_jwt_crypto_backends_compare);
+	tcase_add_test(tc_core, test_jwt_crypto_provider);
+	tcase_add_test(tc_core, test_jwt_crypto_provider_transient);
+	tcase_add_test(tc_core, test_jwt_crypto_provider_invalid);
+
+	tcase_set_timeout(tc_core, 30);
+
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
+
+int main(int argc, char *argv[])
+{
+	int number_failed;
+	Suite *s;
+	SRunner *sr;
+
+	s = libjwt_suite();
+	sr = srunner_create(s);
+
+	srunner_run_all(sr, CK_VERBOSE);
+	number_failed = srunner_ntests_failed(sr);
+	srunner_free(sr);
+
+	return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -5,6 +5,8 @@
 #include <string.h>
 #include <errno.h>
 #include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
 
 #include <check.h>
 
@@ -201,6 +203,268 @@ START_TEST(test_jwt_encode_ec_with_rsa)
 }
 END_TEST
 
+static void __test_sign_verify_loop(const char *priv, const char *pub,
+				    const jwt_alg_t alg, size_t sig_len,
+				    unsigned int depth)
+{
+	jwt_key_t *sign_key = NULL, *verify_key = NULL;
+	struct timespec ts = { 0, 50000000 };
+	jwt_t *jwt = NULL;
+	int i, ret;
+	char *out;
+
+	/* Signatures are random, so enough rounds will hit r and s with
+	 * leading zeroes and with the high bit set. */
+	read_key(priv);
+	ret = jwt_key_new(&sign_key, alg, key, key_len);
+	ck_assert_int_eq(ret, 0);
+
+	if (depth) {
+		ret = jwt_key_precompute(sign_key, depth);
+		if (ret == ENOTSUP)
+			ck_assert_str_eq(jwt_get_crypto_backend(), "gnutls");
+		else
+			ck_assert_int_eq(ret, 0);
+
+		/* Give the thread a head start so both paths get used. */
+		nanosleep(&ts, NULL);
+	}
+
+	read_key(pub);
+	ret = jwt_key_new(&verify_key, alg, key, key_len);
+	ck_assert_int_eq(ret, 0);
+
+	for (i = 0; i < 256; i++) {
+		ALLOC_JWT(&jwt);
+
+		ret = jwt_add_grant_int(jwt, "iat", TS_CONST + i);
+		ck_assert_int_eq(ret, 0);
+
+		ret = jwt_set_alg_key(jwt, alg, sign_key);
+		ck_assert_int_eq(ret, 0);
+
+		out = jwt_encode_str(jwt);
+		ck_assert_ptr_ne(out, NULL);
+		jwt_free(jwt);
+
+		/* r||s is sized by the curve. */
+		ck_assert_int_eq(strlen(strrchr(out, '.') + 1), sig_len);
+
+		ret = jwt_decode_with_key(&jwt, out, verify_key);
+		ck_assert_int_eq(ret, 0);
+		ck_assert_ptr_ne(jwt, NULL);
+		jwt_free(jwt);
+
+		jwt_free_str(out);
+	}
+
+	jwt_key_free(sign_key);
+	jwt_key_free(verify_key);
+}
+
+START_TEST(test_jwt_sign_verify_loop)
+{
+	__test_sign_verify_loop("ec_key_secp384r1.pem",
+				"ec_key_secp384r1-pub.pem", JWT_ALG_ES384, 128, 0);
+	__test_sign_verify_loop("ec_key_secp521r1.pem",
+				"ec_key_secp521r1-pub.pem", JWT_ALG_ES512, 176, 0);
+}
+END_TEST
+
+START_TEST(test_jwt_sign_verify_precompute)
+{
+	__test_sign_verify_loop("ec_key_prime256v1.pem",
+				"ec_key_prime256v1-pub.pem", JWT_ALG_ES256, 86,
+				64);
+	__test_sign_verify_loop("ec_key_secp384r1.pem",
+				"ec_key_secp384r1-pub.pem", JWT_ALG_ES384, 128,
+				64);
+	__test_sign_verify_loop("ec_key_secp521r1.pem",
+				"ec_key_secp521r1-pub.pem", JWT_ALG_ES512, 176,
+				64);
+
+	/* Digest longer than the order. */
+	__test_sign_verify_loop("ec_key_prime256v1.pem",
+				"ec_key_prime256v1-pub.pem", JWT_ALG_ES512, 86,
+				64);
+}
+END_TEST
+
+START_TEST(test_jwt_precompute_depth)
+{
+	static const unsigned int depths[] = { 1, 8, 0, 2, 4096, 0, 0, 3 };
+	jwt_key_t *sign_key = NULL, *pub_key = NULL;
+	jwt_t *jwt = NULL;
+	int i, ret;
+	char *out;
+
+	read_key("ec_key_prime256v1.pem");
+	ret = jwt_key_new(&sign_key, JWT_ALG_ES256, key, key_len);
+	ck_assert_int_eq(ret, 0);
+
+	read_key("ec_key_prime256v1-pub.pem");
+	ret = jwt_key_new(&pub_key, JWT_ALG_ES256, key, key_len);
+	ck_assert_int_eq(ret, 0);
+
+	/* Only for private keys, and only so deep. */
+	ret = jwt_key_precompute(pub_key, 8);
+	ck_assert_int_eq(ret, EINVAL);
+
+	ret = jwt_key_precompute(sign_key, 4097);
+	ck_assert_int_eq(ret, EINVAL);
+
+	ret = jwt_key_precompute(NULL, 8);
+	ck_assert_int_eq(ret, EINVAL);
+
+	/* Stopping what never started is fine. */
+	ret = jwt_key_precompute(sign_key, 0);
+	if (ret == ENOTSUP) {
+		ck_assert_str_eq(jwt_get_crypto_backend(), "gnutls");
+		goto done;
+	}
+	ck_assert_int_eq(ret, 0);
+
+	/* Shrink, grow, stop and start again, signing all along. */
+	for (i = 0; i < sizeof(depths) / sizeof(depths[0]); i++) {
+		ret = jwt_key_precompute(sign_key, depths[i]);
+		ck_assert_int_eq(ret, 0);
+
+		ALLOC_JWT(&jwt);
+		ret = jwt_set_alg_key(jwt, JWT_ALG_ES256, sign_key);
+		ck_assert_int_eq(ret, 0);
+		out = jwt_encode_str(jwt);
+		ck_assert_ptr_ne(out, NULL);
+		jwt_free(jwt);
+
+		ret = jwt_decode_with_key(&jwt, out, pub_key);
+		ck_assert_int_eq(ret, 0);
+		jwt_free(jwt);
+		jwt_free_str(out);
+	}
+
+done:
+	/* Freed with the thread still running. */
+	jwt_key_free(sign_key);
+	jwt_key_free(pub_key);
+}
+END_TEST
+
+/* Base64 of the first 30 bytes of an ES256 signature, which are all r. */
+#define R_PREFIX	40
+#define FORK_SIGNS	32
+
+static void sign_r_prefixes(jwt_key_t *sign_key, char *r)
+{
+	jwt_t *jwt = NULL;
+	char *out;
+	int i;
+
+	for (i = 0; i < FORK_SIGNS; i++) {
+		if (jwt_new(&jwt) || jwt_set_alg_key(jwt, JWT_ALG_ES256, sign_key))
+			_exit(1);
+
+		out = jwt_encode_str(jwt);
+		jwt_free(jwt);
+		if (out == NULL)
+			_exit(1);
+
+		memcpy(r + i * R_PREFIX, strrchr(out, '.') + 1, R_PREFIX);
+		jwt_free_str(out);
+	}
+}
+
+START_TEST(test_jwt_precompute_fork)
+{
+	static char parent_r[FORK_SIGNS * R_PREFIX];
+	static char child_r[FORK_SIGNS * R_PREFIX];
+	struct timespec ts = { 0, 50000000 };
+	jwt_key_t *sign_key = NULL;
+	int fds[2], status, i, j, ret;
+	size_t got = 0;
+	ssize_t n;
+	pid_t pid;
+
+	read_key("ec_key_prime256v1.pem");
+	ret = jwt_key_new(&sign_key, JWT_ALG_ES256, key, key_len);
+	ck_assert_int_eq(ret, 0);
+
+	ret = jwt_key_precompute(sign_key, 2 * FORK_SIGNS);
+	if (ret == ENOTSUP) {
+		ck_assert_str_eq(jwt_get_crypto_backend(), "gnutls");
+		jwt_key_free(sign_key);
+		return;
+	}
+	ck_assert_int_eq(ret, 0);
+
+	/* Fill the ring, so the child would have all of it to reuse. */
+	nanosleep(&ts, NULL);
+
+	ret = pipe(fds);
+	ck_assert_int_eq(ret, 0);
+
+	pid = fork();
+	ck_assert_int_ne(pid, -1);
+
+	if (pid == 0) {
+		close(fds[0]);
+		sign_r_prefixes(sign_key, child_r);
+		if (write(fds[1], child_r, sizeof(child_r)) != sizeof(child_r))
+			_exit(1);
+		_exit(0);
+	}
+
+	close(fds[1]);
+	sign_r_prefixes(sign_key, parent_r);
+
+	while (got < sizeof(child_r)) {
+		n = read(fds[0], child_r + got, sizeof(child_r) - got);
+		if (n <= 0)
+			break;
+		got += n;
+	}
+	close(fds[0]);
+
+	ck_assert_int_eq(waitpid(pid, &status, 0), pid);
+	ck_assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+	ck_assert_int_eq(got, sizeof(child_r));
+
+	/* No nonce may be used on both sides of the fork. */
+	for (i = 0; i < FORK_SIGNS; i++) {
+		for (j = 0; j < FORK_SIGNS; j++)
+			ck_assert(memcmp(parent_r + i * R_PREFIX,
+					 child_r + j * R_PREFIX, R_PREFIX));
+	}
+
+	jwt_key_free(sign_key);
+}
+END_TEST
+
+START_TEST(test_jwt_verify_invalid_sig)
+{
+	char token[sizeof(jwt_es384)];
+	jwt_t *jwt = NULL;
+	int ret = 0;
+
+	read_key("ec_key_secp384r1-pub.pem");
+
+	/* Too short. */
+	strcpy(token, jwt_es384);
+	token[strlen(token) - 2] = '\0';
+
+	ret = jwt_decode(&jwt, token, key, key_len);
+	ck_assert_int_eq(ret, EINVAL);
+	ck_assert_ptr_eq(jwt, NULL);
+
+	/* Right length, wrong value. */
+	strcpy(token, jwt_es384);
+	token[strlen(token) - 10] ^= 1;
+
+	ret = jwt_decode(&jwt, token, key, key_len);
+	ck_assert_int_eq(ret, EINVAL);
+	ck_assert_ptr_eq(jwt, NULL);
+}
+END_TEST
+
 START_TEST(test_jwt_verify_invalid_token)
 {
 	jwt_t *jwt = NULL;
@@ -301,6 +565,11 @@ static Suite *libjwt_suite(void)
 	tcase_add_test(tc_core, test_jwt_encode_es512);
 	tcase_add_test(tc_core, test_jwt_verify_es512);
 	tcase_add_test(tc_core, test_jwt_encode_ec_with_rsa);
+	tcase_add_test(tc_core, test_jwt_sign_verify_loop);
+	tcase_add_test(tc_core, test_jwt_sign_verify_precompute);
+	tcase_add_test(tc_core, test_jwt_precompute_depth);
+	tcase_add_test(tc_core, test_jwt_precompute_fork);
+	tcase_add_test(tc_core, test_jwt_verify_invalid_sig);
 	tcase_add_test(tc_core, test_jwt_verify_invalid_token);
 	tcase_add_test(tc_core, test_jwt_verify_invalid_alg);
 	tcase_add_test(tc_core, test_jwt_verify_invalid_cert);
@@ -0,0 +1,268 @@
+/* Public domain, no copyright. Use at your own risk. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include <check.h>
+
+#include <jwt.h>
+
+/* Constant time to make tests consistent. */
+#define TS_CONST	1475980545L
+
+/* Macro to allocate a new JWT with checks. */
+#define ALLOC_JWT(__jwt) do {		\
+	int __ret = jwt_new(__jwt);	\
+	ck_assert_int_eq(__ret, 0);	\
+	ck_assert_ptr_ne(__jwt, NULL);	\
+} while(0)
+
+/* Older check doesn't have this. */
+#ifndef ck_assert_ptr_ne
+#define ck_assert_ptr_ne(X, Y) ck_assert(X != Y)
+#define ck_assert_ptr_eq(X, Y) ck_assert(X == Y)
+#endif
+
+#ifndef ck_assert_int_gt
+#define ck_assert_int_gt(X, Y) ck_assert(X > Y)
+#endif
+
+static unsigned char key[16384];
+static size_t key_len;
+
+/* EdDSA signatures are deterministic, so these can be compared as is. */
+
+static const char jwt_eddsa_ed25519[] = "eyJhbGciOiJFZERTQSIsInR5cCI6IkpXVCJ9."
+	"eyJpYXQiOjE0NzU5ODA1NDUsImlzcyI6ImZpbGVzLmN5cGhyZS5jb20iLCJyZWYiOiJYWF"
+	"hYLVlZWVktWlpaWi1BQUFBLUNDQ0MiLCJzdWIiOiJ1c2VyMCJ9.6E0f0Lm1eSYLt7kuzyT"
+	"twNAvDbNMAm1JiGeh4aMbxIXLfA6KLAT_0LHl7-c3RK8sR1JrJ0PKAAdT45q1_kegDA";
+
+static const char jwt_eddsa_ed448[] = "eyJhbGciOiJFZERTQSIsInR5cCI6IkpXVCJ9.e"
+	"yJpYXQiOjE0NzU5ODA1NDUsImlzcyI6ImZpbGVzLmN5cGhyZS5jb20iLCJyZWYiOiJYWF"
+	"hYLVlZWVktWlpaWi1BQUFBLUNDQ0MiLCJzdWIiOiJ1c2VyMCJ9.Gvmy-XbRuv3B9B2QRx"
+	"a319d0Dwm3SsCZ2Q3fMgVns70MEUYIb479NAAm7xXIaKDONpVX3I-nmumA_gzAXK6qkoX"
+	"BZXAkxP0ffH3BPYTa9XRNrz6m44-_l5Me0oW269pYNc03VniVGaGg8IURZUP71AUA";
+
+static void read_key(const char *key_file)
+{
+	FILE *fp = fopen(key_file, "r");
+	char *key_path;
+	int ret = 0;
+
+	ret = asprintf(&key_path, KEYDIR "/%s", key_file);
+	ck_assert_int_gt(ret, 0);
+
+	fp = fopen(key_path, "r");
+	ck_assert_ptr_ne(fp, NULL);
+
+	jwt_free_str(key_path);
+
+	key_len = fread(key, 1, sizeof(key), fp);
+	ck_assert_int_ne(key_len, 0);
+
+	ck_assert_int_eq(ferror(fp), 0);
+
+	fclose(fp);
+
+	key[key_len] = '\0';
+}
+
+static void __test_alg_key(const char *key_file, const char *jwt_str,
+			   const jwt_alg_t alg)
+{
+	jwt_t *jwt = NULL;
+	int ret = 0;
+	char *out;
+
+	ALLOC_JWT(&jwt);
+
+	read_key(key_file);
+
+	ret = jwt_add_grant(jwt, "iss", "files.cyphre.com");
+	ck_assert_int_eq(ret, 0);
+
+	ret = jwt_add_grant(jwt, "sub", "user0");
+	ck_assert_int_eq(ret, 0);
+
+	ret = jwt_add_grant(jwt, "ref", "XXXX-YYYY-ZZZZ-AAAA-CCCC");
+	ck_assert_int_eq(ret, 0);
+
+	ret = jwt_add_grant_int(jwt, "iat", TS_CONST);
+	ck_assert_int_eq(ret, 0);
+
+	ret = jwt_set_alg(jwt, alg, key, key_len);
+	ck_assert_int_eq(ret, 0);
+
+	out = jwt_encode_str(jwt);
+	ck_assert_ptr_ne(out, NULL);
+
+	ck_assert_str_eq(out, jwt_str);
+
+	jwt_free_str(out);
+	jwt_free(jwt);
+}
+
+static void __verify_alg_key(const char *key_file, const char *jwt_str,
+			     const jwt_alg_t alg)
+{
+	jwt_t *jwt = NULL;
+	int ret = 0;
+
+	read_key(key_file);
+
+	ret = jwt_decode(&jwt, jwt_str, key, key_len);
+	ck_assert_int_eq(ret, 0);
+	ck_assert_ptr_ne(jwt, NULL);
+
+	ck_assert(jwt_get_alg(jwt) == alg);
+
+	jwt_free(jwt);
+}
+
+START_TEST(test_jwt_alg_str_eddsa)
+{
+	ck_assert_str_eq(jwt_alg_str(JWT_ALG_EDDSA), "EdDSA");
+	ck_assert(jwt_str_alg("EdDSA") == JWT_ALG_EDDSA);
+}
+END_TEST
+
+START_TEST(test_jwt_encode_ed25519)
+{
+	__test_alg_key("eddsa_key_ed25519.pem", jwt_eddsa_ed25519,
+		       JWT_ALG_EDDSA);
+}
+END_TEST
+
+START_TEST(test_jwt_verify_ed25519)
+{
+	__verify_alg_key("eddsa_key_ed25519-pub.pem", jwt_eddsa_ed25519,
+			 JWT_ALG_EDDSA);
+}
+END_TEST
+
+START_TEST(test_jwt_encode_ed448)
+{
+	__test_alg_key("eddsa_key_ed448.pem", jwt_eddsa_ed448, JWT_ALG_EDDSA);
+}
+END_TEST
+
+START_TEST(test_jwt_verify_ed448)
+{
+	__verify_alg_key("eddsa_key_ed448-pub.pem", jwt_eddsa_ed448,
+			 JWT_ALG_EDDSA);
+}
+END_TEST
+
+START_TEST(test_jwt_encode_eddsa_with_ec)
+{
+	jwt_t *jwt = NULL;
+	int ret = 0;
+	char *out;
+
+	ALLOC_JWT(&jwt);
+
+	read_key("ec_key_secp384r1.pem");
+
+	ret = jwt_add_grant(jwt, "iss", "files.cyphre.com");
+	ck_assert_int_eq(ret, 0);
+
+	ret = jwt_set_alg(jwt, JWT_ALG_EDDSA, key, key_len);
+	ck_assert_int_eq(ret, 0);
+
+	out = jwt_encode_str(jwt);
+	ck_assert_ptr_eq(out, NULL);
+	ck_assert_int_eq(errno, EINVAL);
+
+	jwt_free(jwt);
+}
+END_TEST
+
+START_TEST(test_jwt_verify_invalid_sig)
+{
+	char token[sizeof(jwt_eddsa_ed25519)];
+	jwt_t *jwt = NULL;
+	int ret = 0;
+
+	read_key("eddsa_key_ed25519-pub.pem");
+
+	/* Too short. */
+	strcpy(token, jwt_eddsa_ed25519);
+	token[strlen(token) - 2] = '\0';
+
+	ret = jwt_decode(&jwt, token, key, key_len);
+	ck_assert_int_eq(ret, EINVAL);
+	ck_assert_ptr_eq(jwt, NULL);
+
+	/* Right length, wrong value. */
+	strcpy(token, jwt_eddsa_ed25519);
+	token[strlen(token) - 10] ^= 1;
+
+	ret = jwt_decode(&jwt, token, key, key_len);
+	ck_assert_int_eq(ret, EINVAL);
+	ck_assert_ptr_eq(jwt, NULL);
+}
+END_TEST
+
+START_TEST(test_jwt_verify_invalid_cert)
+{
+	jwt_t *jwt = NULL;
+	int ret = 0;
+
+	/* Right algorithm, wrong curve. */
+	read_key("eddsa_key_ed448-pub.pem");
+
+	ret = jwt_decode(&jwt, jwt_eddsa_ed25519, key, key_len);
+	ck_assert_int_ne(ret, 0);
+	ck_assert_ptr_eq(jwt, NULL);
+
+	read_key("ec_key_secp384r1-pub.pem");
+
+	ret = jwt_decode(&jwt, jwt_eddsa_ed25519, key, key_len);
+	ck_assert_int_ne(ret, 0);
+	ck_assert_ptr_eq(jwt, NULL);
+}
+END_TEST
+
+static Suite *libjwt_suite(void)
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s = suite_create("LibJWT EdDSA Sign/Verify");
+
+	tc_core = tcase_create("jwt_eddsa");
+
+	tcase_add_test(tc_core, test_jwt_alg_str_eddsa);
+	tcase_add_test(tc_core, test_jwt_encode_ed25519);
+	tcase_add_test(tc_core, test_jwt_verify_ed25519);
+	tcase_add_test(tc_core, test_jwt_encode_ed448);
+	tcase_add_test(tc_core, test_jwt_verify_ed448);
+	tcase_add_test(tc_core, test_jwt_encode_eddsa_with_ec);
+	tcase_add_test(tc_core, test_jwt_verify_invalid_sig);
+	tcase_add_test(tc_core, test_jwt_verify_invalid_cert);
+
+	tcase_set_timeout(tc_core, 30);
+
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
+
+int main(int argc, char *argv[])
+{
+	int number_failed;
+	Suite *s;
+	SRunner *sr;
+
+	s = libjwt_suite();
+	sr = srunner_create(s);
+
+	srunner_run_all(sr, CK_VERBOSE);
+	number_failed = srunner_ntests_failed(sr);
+	srunner_free(sr);
+
+	return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -292,6 +292,203 @@ START_TEST(test_jwt_encode_change_alg)
 }
 END_TEST
 
+/* Plain, bit at a time base64url to check the encoder against. */
+static void b64url(char *dst, const char *src, size_t len)
+{
+	static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+				       "abcdefghijklmnopqrstuvwxyz0123456789-_";
+	unsigned int acc = 0, bits = 0;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		acc = acc << 8 | (unsigned char)src[i];
+		for (bits += 8; bits >= 6; bits -= 6)
+			*dst++ = alphabet[(acc >> (bits - 6)) & 0x3f];
+	}
+	if (bits)
+		*dst++ = alphabet[(acc << (6 - bits)) & 0x3f];
+	*dst = '\0';
+}
+
+/* Claims of many lengths, so every way through the encoder is taken. */
+START_TEST(test_jwt_encode_b64url)
+{
+	unsigned char key256[32] = "012345678901234567890123456789XY";
+	char *claim, *token, *dump, *body, *want;
+	size_t len, i;
+	jwt_t *jwt;
+	int ret;
+
+	for (len = 0; len < 600; len += len < 100 ? 1 : 37) {
+		claim = malloc(len + 1);
+		ck_assert_ptr_ne(claim, NULL);
+		for (i = 0; i < len; i++)
+			claim[i] = 'A' + (i * 13) % 58;
+		claim[len] = '\0';
+
+		ALLOC_JWT(&jwt);
+		ret = jwt_add_grant(jwt, "claim", claim);
+		ck_assert_int_eq(ret, 0);
+		ret = jwt_set_alg(jwt, JWT_ALG_HS256, key256, sizeof(key256));
+		ck_assert_int_eq(ret, 0);
+
+		token = jwt_encode_str(jwt);
+		ck_assert_ptr_ne(token, NULL);
+
+		/* The header has no dot in it. */
+		dump = jwt_dump_str(jwt, 0);
+		ck_assert_ptr_ne(dump, NULL);
+		body = strchr(dump, '.');
+		ck_assert_ptr_ne(body, NULL);
+		*body++ = '\0';
+
+		want = malloc(strlen(dump) * 2 + strlen(body) * 2 + 2);
+		ck_assert_ptr_ne(want, NULL);
+		b64url(want, dump, strlen(dump));
+		strcat(want, ".");
+		b64url(want + strlen(want), body, strlen(body));
+		strcat(want, ".");
+
+		ck_assert_int_eq(strncmp(token, want, strlen(want)), 0);
+		ck_assert_int_eq(strlen(token) - strlen(want), 43);
+
+		free(want);
+		jwt_free_str(dump);
+		jwt_free_str(token);
+		jwt_free(jwt);
+		free(claim);
+	}
+}
+END_TEST
+
+/* The public buffer functions, checked against the plain encoder. */
+START_TEST(test_jwt_b64url_into)
+{
+	char src[300], enc[410], want[410], dec[300];
+	size_t len, i, out;
+	int ret;
+
+	for (i = 0; i < sizeof(src); i++)
+		src[i] = (char)(i * 151 + 7);
+
+	for (len = 0; len <= sizeof(src); len++) {
+		b64url(want, src, len);
+		ck_assert_int_eq(jwt_b64url_encoded_len(len), strlen(want));
+
+		ret = jwt_b64url_encode_into(enc, sizeof(enc), src, len, &out);
+		ck_assert_int_eq(ret, 0);
+		ck_assert_int_eq(out, strlen(want));
+		ck_assert_str_eq(enc, want);
+
+		/* Exactly enough room leaves out the nul. */
+		memset(enc, '#', sizeof(enc));
+		ret = jwt_b64url_encode_into(enc, out, src, len, NULL);
+		ck_assert_int_eq(ret, 0);
+		ck_assert_int_eq(memcmp(enc, want, out), 0);
+		ck_assert_int_eq(enc[out], '#');
+
+		if (out) {
+			ret = jwt_b64url_encode_into(enc, out - 1, src, len,
+						     NULL);
+			ck_assert_int_eq(ret, ENOSPC);
+		}
+
+		/* Decode from the '#' filled copy, which has no nul. */
+		ck_assert_int_eq(jwt_b64url_decoded_len(out), len);
+		ret = jwt_b64url_decode_into(dec, len, enc, out, &i);
+		ck_assert_int_eq(ret, 0);
+		ck_assert_int_eq(i, len);
+		ck_assert_int_eq(memcmp(dec, src, len), 0);
+
+		if (len) {
+			ret = jwt_b64url_decode_into(dec, len - 1, enc, out,
+						     NULL);
+			ck_assert_int_eq(ret, ENOSPC);
+		}
+	}
+
+	/* Padding, the other alphabet, a stray character and bits left
+	 * over are all refused. */
+	ret = jwt_b64url_decode_into(dec, sizeof(dec), "QQ==", 4, NULL);
+	ck_assert_int_eq(ret, EINVAL);
+	ret = jwt_b64url_decode_into(dec, sizeof(dec), "+/8", 3, NULL);
+	ck_assert_int_eq(ret, EINVAL);
+	ret = jwt_b64url_decode_into(dec, sizeof(dec), "QUJDR", 5, NULL);
+	ck_assert_int_eq(ret, EINVAL);
+	ret = jwt_b64url_decode_into(dec, sizeof(dec), "QR", 2, NULL);
+	ck_assert_int_eq(ret, EINVAL);
+	ret = jwt_b64url_decode_into(dec, sizeof(dec), "QQ", 2, &out);
+	ck_assert_int_eq(ret, 0);
+	ck_assert_int_eq(out, 1);
+	ck_assert_int_eq(dec[0], 'A');
+
+	ret = jwt_b64url_decode_into(NULL, 0, "", 0, &out);
+	ck_assert_int_eq(ret, 0);
+	ck_assert_int_eq(out, 0);
+	ret = jwt_b64url_decode_into(dec, sizeof(dec), NULL, 4, NULL);
+	ck_assert_int_eq(ret, EINVAL);
+	ret = jwt_b64url_encode_into(enc, sizeof(enc), NULL, 4, NULL);
+	ck_assert_int_eq(ret, EINVAL);
+}
+END_TEST
+
+/* Encode claims of many lengths with one HMAC alg and key, and check
+ * each token with the backend. */
+static void encode_hmac_lengths(jwt_alg_t alg, const unsigned char *key,
+				int key_len, char *claim, size_t max)
+{
+	char *token;
+	jwt_t *jwt, *out;
+	size_t len;
+	int ret;
+
+	for (len = 0; len < max;
+	     len += len < 300 || (len > 730 && len < 800) ? 1 : 97) {
+		ALLOC_JWT(&jwt);
+		claim[len] = '\0';
+		ret = jwt_add_grant(jwt, "claim", claim);
+		claim[len] = 'a' + len % 26;
+		ck_assert_int_eq(ret, 0);
+		ret = jwt_set_alg(jwt, alg, key, key_len);
+		ck_assert_int_eq(ret, 0);
+
+		token = jwt_encode_str(jwt);
+		ck_assert_ptr_ne(token, NULL);
+
+		ret = jwt_decode(&out, token, key, key_len);
+		ck_assert_int_eq(ret, 0);
+
+		jwt_free(out);
+		jwt_free_str(token);
+		jwt_free(jwt);
+	}
+}
+
+/* HMAC tokens are signed as they are encoded, so check them at every
+ * length around the block and chunk sizes, and with keys both shorter
+ * and longer than a block. */
+START_TEST(test_jwt_encode_hmac_stream)
+{
+	static const jwt_alg_t algs[] = { JWT_ALG_HS256, JWT_ALG_HS384,
+					  JWT_ALG_HS512 };
+	static const int key_lens[] = { 1, 32, 129, 300 };
+	unsigned char key[300];
+	char claim[2000];
+	size_t i, a, k;
+
+	for (i = 0; i < sizeof(key); i++)
+		key[i] = (unsigned char)(i * 29 + 3);
+	for (i = 0; i < sizeof(claim); i++)
+		claim[i] = 'a' + i % 26;
+
+	for (a = 0; a < sizeof(algs) / sizeof(algs[0]); a++) {
+		for (k = 0; k < sizeof(key_lens) / sizeof(key_lens[0]); k++)
+			encode_hmac_lengths(algs[a], key, key_lens[k], claim,
+					    sizeof(claim));
+	}
+}
+END_TEST
+
 START_TEST(test_jwt_encode_invalid)
 {
 	unsigned char key512[64] = "012345678901234567890123456789XY"
@@ -355,6 +552,9 @@ static Suite *libjwt_suite(void)
 	tcase_add_test(tc_core, test_jwt_encode_hs384);
 	tcase_add_test(tc_core, test_jwt_encode_hs512);
 	tcase_add_test(tc_core, test_jwt_encode_change_alg);
+	tcase_add_test(tc_core, test_jwt_encode_b64url);
+	tcase_add_test(tc_core, test_jwt_b64url_into);
+	tcase_add_test(tc_core, test_jwt_encode_hmac_stream);
 	tcase_add_test(tc_core, test_jwt_encode_invalid);
 
 	tcase_set_timeout(tc_core, 30);
@@ -0,0 +1,493 @@
+/* Public domain, no copyright. Use at your own risk. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include <check.h>
+
+#include <jwt.h>
+
+/* Constant time to make tests consistent. */
+#define TS_CONST	1475980545L
+
+/* Macro to allocate a new JWT with checks. */
+#define ALLOC_JWT(__jwt) do {		\
+	int __ret = jwt_new(__jwt);	\
+	ck_assert_int_eq(__ret, 0);	\
+	ck_assert_ptr_ne(__jwt, NULL);	\
+} while(0)
+
+/* Older check doesn't have this. */
+#ifndef ck_assert_ptr_ne
+#define ck_assert_ptr_ne(X, Y) ck_assert(X != Y)
+#define ck_assert_ptr_eq(X, Y) ck_assert(X == Y)
+#endif
+
+#ifndef ck_assert_int_gt
+#define ck_assert_int_gt(X, Y) ck_assert(X > Y)
+#endif
+
+static unsigned char key[16384];
+static size_t key_len;
+
+static const unsigned char key256[32] = "012345678901234567890123456789XY";
+
+/* The test keys, as JWKs. The set has one key for encryption and one
+ * for key agreement, which are skipped. */
+static const char jwks_pub[] = "{\"keys\":[{\"kty\":\"RSA\",\"n\":\"wtpMAM4l1H995oqlqd"
+	"MhuqNuffp4-4aUCwuFE9B5s9MJr63gyf8jW0oDr7Mb1Xb8y9iGkWfhouZqNJbMFry-"
+	"iBs-z2TtJF06vbHQZzajDsdux3XVfXv9v6dDIImyU24MsGNkpNt0GISaaiqv51NMZQ"
+	"X0miOXXWdkQvWTZFXhmsFCmJLE67oQFSar4hzfAaCulaMD-b3Mcsjlh0yvSq7g6swi"
+	"IasEU3qNLKaJAZEzfywroVYr3BwM1IiVbQeKgIkyPS_85M4Y6Ss_T-OWi1OeK49NdY"
+	"BvFP-hNVEoeZzJz5K_nd6C35IX0t2bN5CVXchUFmaUMYk2iPdhXdsC720tBw\",\"e"
+	"\":\"AQAB\",\"kid\":\"rsa\"},{\"kty\":\"EC\",\"crv\":\"P-384\",\"x"
+	"\":\"omxC9ycc8AkXSwWQpu1kN5Fmgy_sD_KJqN3tlSZmUEZ3w3c6KYJfK97PMOSZQ"
+	"aUd\",\"y\":\"eydBoq_IOglQQOj8zLqubq5IpaaUiDQ50eJg79PvXuLiVUH98cBL"
+	"_o8sDVB_sGzz\",\"kid\":\"ec\",\"alg\":\"ES384\"},{\"kty\":\"OKP\","
+	"\"crv\":\"Ed25519\",\"x\":\"4pNKdiYe2AdIW1PoV2Dpn1xpdwGxsH2jUlttZS"
+	"xIMHA\",\"kid\":\"ed\"},{\"kty\":\"oct\",\"kid\":\"hs\",\"alg\":\""
+	"HS256\",\"k\":\"MDEyMzQ1Njc4OTAxMjM0NTY3ODkwMTIzNDU2Nzg5WFk\"},{\""
+	"kty\":\"RSA\",\"n\":\"wtpMAM4l1H995oqlqdMhuqNuffp4-4aUCwuFE9B5s9MJ"
+	"r63gyf8jW0oDr7Mb1Xb8y9iGkWfhouZqNJbMFry-iBs-z2TtJF06vbHQZzajDsdux3"
+	"XVfXv9v6dDIImyU24MsGNkpNt0GISaaiqv51NMZQX0miOXXWdkQvWTZFXhmsFCmJLE"
+	"67oQFSar4hzfAaCulaMD-b3Mcsjlh0yvSq7g6swiIasEU3qNLKaJAZEzfywroVYr3B"
+	"wM1IiVbQeKgIkyPS_85M4Y6Ss_T-OWi1OeK49NdYBvFP-hNVEoeZzJz5K_nd6C35IX"
+	"0t2bN5CVXchUFmaUMYk2iPdhXdsC720tBw\",\"e\":\"AQAB\",\"kid\":\"enc\""
+	",\"use\":\"enc\"},{\"kty\":\"OKP\",\"crv\":\"X25519\",\"kid\":\"x\""
+	",\"x\":\"hSDwCYkwp1R0i33ctD73Wg2_Og0mOBr066SpjqqbTmo\"}]}";
+
+static const char jwk_rsa_priv[] = "{\"kty\":\"RSA\",\"n\":\"wtpMAM4l1H995oqlqdMhuqNuffp4-"
+	"4aUCwuFE9B5s9MJr63gyf8jW0oDr7Mb1Xb8y9iGkWfhouZqNJbMFry-iBs-z2TtJF0"
+	"6vbHQZzajDsdux3XVfXv9v6dDIImyU24MsGNkpNt0GISaaiqv51NMZQX0miOXXWdkQ"
+	"vWTZFXhmsFCmJLE67oQFSar4hzfAaCulaMD-b3Mcsjlh0yvSq7g6swiIasEU3qNLKa"
+	"JAZEzfywroVYr3BwM1IiVbQeKgIkyPS_85M4Y6Ss_T-OWi1OeK49NdYBvFP-hNVEoe"
+	"ZzJz5K_nd6C35IX0t2bN5CVXchUFmaUMYk2iPdhXdsC720tBw\",\"e\":\"AQAB\""
+	",\"d\":\"D8dTnkETSSjlzhRuI9loAtAXM3Zj86JLPLW7GgaoxEoTn7lJ2bGicFMHB"
+	"2ROnbOb9vnas82gtOtJsGaBslmoaCckp_C5T1eJWTEb-i-vdpPpwZcmKZovyyRFSE4"
+	"-NYlU17fEv6DRvuaGBpDcW7QgHJIl45F8QWEM-msee2KE-V4Gz_9vAQ-sOlvsb4mJP"
+	"1tJIBx9Lb5loVREwCRy2Ha9tnWdDNar8EYkOn8si4snPT-E3ZCy8mlcZyUkZeiS_Hd"
+	"tydxZfoiwrSRYamd1diQpPhWCeRteQ802a7ds0Y2YzgfFUaYjNuRQm7zA__hwbXS7E"
+	"LPyNMU15N00bajlG0tUOQ\",\"p\":\"5y8tNZdtDp3lugNnCAyA8mIcuTu7rpbGhL"
+	"SUXlJXIxAzJIp_G--u6tlWR2__92R_oqZ0WAclFMmFIXTrNg2ERhngHm5x_MKU0-BQ"
+	"mMVLCFKQ3we0cH3QTjYGinsEyc_xT7MMtWHtG-R9nOr1YpthWd9x0HKGd8LxRashlZ"
+	"zM6Ts\",\"q\":\"18S_ecqMVBimvLzM3BNwp9NbM4dHRatLKnBaTPh1i1a_OAiLbh"
+	"vR-i9CmkrRBCDoibMTlaXF3xRYbCbzhoTAOA0E8B-Frl5l6dT6FTA5VeuT2Kr4c8C-"
+	"PkIb2Ttm7KxLpyE1zplOwiOpIpZwDdy7j-B26mYKF_ZajyN9VWMy7qU\",\"dp\":\""
+	"YRhyT3DSz_HHG1H0gu_ldGd6kt2gnNocdH33VooUqNhT8oPskMog1-gCEazbf4cJCE"
+	"IK2THfBBUDQiL96szQgjS56W4Pl84NfdNXZmJuegdbayCsSxa8VyzfoGe8ghpAym1z"
+	"5_ZCBJX5n98awphp0bpD7f07tq78cHtIdrLNaSM\",\"dq\":\"yC0XOyWn1Old32I"
+	"FaPN8I6cZSI_rln4ZaRD9JcWoP5JGKvT6bjfPMZ2g28Ynbf4d3opN1BsMnS6h7gyhB"
+	"56nOhkSCLgl7KRVRn-5V-j6eHTrICtV_wXFObtZXMsYbOBX-4D7C2X9xG0TICyTXrj"
+	"3Jb8oc8Qg_yQl1gAl6g7zFKU\",\"qi\":\"ERMrkFR7KGYZG1eFNRdVmJMq-Ibxyw"
+	"8ks_CbiI-n3yUyk1U8962ol2Q0T4qjBmb26L5rrhNQhneM4e8mo9FXLlQapYkPvkdr"
+	"qW0Bp72A_UNAvcGTmN7z5OCJGMUutx2hmEAlrYmpLKS8pM_p9zpKtEOtzsP5GMDYVl"
+	"Ep1jYSjzQ\"}";
+
+static const char jwk_ec384_priv[] = "{\"kty\":\"EC\",\"crv\":\"P-384\",\"x\":\"omxC9ycc8AkX"
+	"SwWQpu1kN5Fmgy_sD_KJqN3tlSZmUEZ3w3c6KYJfK97PMOSZQaUd\",\"y\":\"eyd"
+	"Boq_IOglQQOj8zLqubq5IpaaUiDQ50eJg79PvXuLiVUH98cBL_o8sDVB_sGzz\",\""
+	"d\":\"XiwoGqY2Zr02rTB2mF9wNNvtGLN06_JHWvhPQxZ5gkogjhIoOdfX09d3nXlP"
+	"GHQ7\"}";
+
+static const char jwk_ed25519_priv[] = "{\"kty\":\"OKP\",\"crv\":\"Ed25519\",\"x\":\"4pNKdiYe2"
+	"AdIW1PoV2Dpn1xpdwGxsH2jUlttZSxIMHA\",\"d\":\"zGJGDz1Zp44ji9naklL1s"
+	"g9ih6dL6V0wcW8qurQpQr4\"}";
+
+static const char jwk_ec521_pub[] = "{\"kty\":\"EC\",\"crv\":\"P-521\",\"x\":\"AP2sRNuqV1l3"
+	"rAI3Ez_9k33uBHBeANy7qoKSBc637Ys7VYqtPuXXlL33MbjyBZPgDVYp5QDs4GVqRU"
+	"tJIXiOyiQG\",\"y\":\"AN3zh5-WU1NPAAI2rtAqGXvRkj1AuHJ0stZ6nrYigVtGK"
+	"Qb4WmORV554L3x1B3ZpBUlSwkujfi16Iv3ZtBW6OrJx\"}";
+
+static void read_key(const char *key_file)
+{
+	FILE *fp;
+	char *key_path;
+	int ret = 0;
+
+	ret = asprintf(&key_path, KEYDIR "/%s", key_file);
+	ck_assert_int_gt(ret, 0);
+
+	fp = fopen(key_path, "r");
+	ck_assert_ptr_ne(fp, NULL);
+
+	jwt_free_str(key_path);
+
+	key_len = fread(key, 1, sizeof(key), fp);
+	ck_assert_int_ne(key_len, 0);
+
+	ck_assert_int_eq(ferror(fp), 0);
+
+	fclose(fp);
+
+	key[key_len] = '\0';
+}
+
+static jwt_keyset_t *new_keyset(const char *jwks)
+{
+	jwt_keyset_t *set = NULL;
+	int ret;
+
+	ret = jwt_keyset_new(&set);
+	ck_assert_int_eq(ret, 0);
+	ck_assert_ptr_ne(set, NULL);
+
+	if (jwks) {
+		ret = jwt_keyset_load_jwks(set, jwks);
+		ck_assert_int_eq(ret, 0);
+	}
+
+	return set;
+}
+
+/* Sign a token with a PEM key from a file, or else with key256. */
+static char *sign_token(jwt_alg_t alg, const char *key_file, const char *kid)
+{
+	jwt_t *jwt = NULL;
+	char *out;
+	int ret;
+
+	ALLOC_JWT(&jwt);
+
+	ret = jwt_add_grant(jwt, "iss", "files.cyphre.com");
+	ck_assert_int_eq(ret, 0);
+
+	ret = jwt_add_grant_int(jwt, "iat", TS_CONST);
+	ck_assert_int_eq(ret, 0);
+
+	if (kid) {
+		ret = jwt_add_header(jwt, "kid", kid);
+		ck_assert_int_eq(ret, 0);
+	}
+
+	if (key_file) {
+		read_key(key_file);
+		ret = jwt_set_alg(jwt, alg, key, key_len);
+	} else if (alg == JWT_ALG_NONE) {
+		ret = jwt_set_alg(jwt, alg, NULL, 0);
+	} else {
+		ret = jwt_set_alg(jwt, alg, key256, sizeof(key256));
+	}
+	ck_assert_int_eq(ret, 0);
+
+	out = jwt_encode_str(jwt);
+	ck_assert_ptr_ne(out, NULL);
+
+	jwt_free(jwt);
+
+	return out;
+}
+
+static int decode_keyset(jwt_keyset_t *set, const char *token)
+{
+	jwt_t *jwt = NULL;
+	int ret;
+
+	ret = jwt_decode_keyset(&jwt, token, set);
+	if (ret == 0) {
+		ck_assert_ptr_ne(jwt, NULL);
+		ck_assert_str_eq(jwt_get_grant(jwt, "iss"),
+				 "files.cyphre.com");
+	} else {
+		ck_assert_ptr_eq(jwt, NULL);
+	}
+
+	jwt_free(jwt);
+
+	return ret;
+}
+
+START_TEST(test_jwt_keyset_load)
+{
+	jwt_keyset_t *set;
+	jwt_key_t *jkey;
+
+	set = new_keyset(jwks_pub);
+	ck_assert_int_eq(jwt_keyset_count(set), 4);
+
+	jkey = jwt_keyset_find(set, "rsa");
+	ck_assert_ptr_ne(jkey, NULL);
+	ck_assert_int_eq(jwt_key_get_alg(jkey), JWT_ALG_RS256);
+	jwt_key_free(jkey);
+
+	jkey = jwt_keyset_find(set, "ec");
+	ck_assert_ptr_ne(jkey, NULL);
+	ck_assert_int_eq(jwt_key_get_alg(jkey), JWT_ALG_ES384);
+	jwt_key_free(jkey);
+
+	jkey = jwt_keyset_find(set, "ed");
+	ck_assert_ptr_ne(jkey, NULL);
+	ck_assert_int_eq(jwt_key_get_alg(jkey), JWT_ALG_EDDSA);
+	jwt_key_free(jkey);
+
+	jkey = jwt_keyset_find(set, "hs");
+	ck_assert_ptr_ne(jkey, NULL);
+	ck_assert_int_eq(jwt_key_get_alg(jkey), JWT_ALG_HS256);
+	jwt_key_free(jkey);
+
+	/* Skipped, or never there. */
+	ck_assert_ptr_eq(jwt_keyset_find(set, "enc"), NULL);
+	ck_assert_ptr_eq(jwt_keyset_find(set, "x"), NULL);
+	ck_assert_ptr_eq(jwt_keyset_find(set, "nope"), NULL);
+	ck_assert_ptr_eq(jwt_keyset_find(set, NULL), NULL);
+
+	/* A lone JWK. */
+	ck_assert_int_eq(jwt_keyset_load_jwks(set, jwk_ec521_pub), 0);
+	ck_assert_int_eq(jwt_keyset_count(set), 5);
+
+	jkey = jwt_keyset_find(set, NULL);
+	ck_assert_ptr_ne(jkey, NULL);
+	ck_assert_int_eq(jwt_key_get_alg(jkey), JWT_ALG_ES512);
+	jwt_key_free(jkey);
+
+	jwt_keyset_free(set);
+	jwt_keyset_free(NULL);
+}
+END_TEST
+
+START_TEST(test_jwt_decode_keyset)
+{
+	jwt_keyset_t *set;
+	char *token;
+
+	set = new_keyset(jwks_pub);
+
+	token = sign_token(JWT_ALG_RS256, "rsa_key_2048.pem", "rsa");
+	ck_assert_int_eq(decode_keyset(set, token), 0);
+	jwt_free_str(token);
+
+	/* No alg in the JWK, so any RSA one will do. */
+	token = sign_token(JWT_ALG_RS384, "rsa_key_2048.pem", "rsa");
+	ck_assert_int_eq(decode_keyset(set, token), 0);
+	jwt_free_str(token);
+
+	token = sign_token(JWT_ALG_ES384, "ec_key_secp384r1.pem", "ec");
+	ck_assert_int_eq(decode_keyset(set, token), 0);
+	jwt_free_str(token);
+
+	token = sign_token(JWT_ALG_EDDSA, "eddsa_key_ed25519.pem", "ed");
+	ck_assert_int_eq(decode_keyset(set, token), 0);
+	jwt_free_str(token);
+
+	token = sign_token(JWT_ALG_HS256, NULL, "hs");
+	ck_assert_int_eq(decode_keyset(set, token), 0);
+	jwt_free_str(token);
+
+	/* The JWK named HS256, so the same secret can't be used with
+	 * another alg. */
+	token = sign_token(JWT_ALG_HS384, NULL, "hs");
+	ck_assert_int_eq(decode_keyset(set, token), EINVAL);
+	jwt_free_str(token);
+
+	/* The key of another kid. */
+	token = sign_token(JWT_ALG_RS256, "rsa_key_2048.pem", "ec");
+	ck_assert_int_eq(decode_keyset(set, token), EINVAL);
+	jwt_free_str(token);
+
+	/* A kid that isn't there, or none at all. */
+	token = sign_token(JWT_ALG_RS256, "rsa_key_2048.pem", "nope");
+	ck_assert_int_eq(decode_keyset(set, token), EINVAL);
+	jwt_free_str(token);
+
+	token = sign_token(JWT_ALG_RS256, "rsa_key_2048.pem", NULL);
+	ck_assert_int_eq(decode_keyset(set, token), EINVAL);
+	jwt_free_str(token);
+
+	/* Signed by someone else. */
+	token = sign_token(JWT_ALG_RS256, "rsa_key_4096.pem", "rsa");
+	ck_assert_int_eq(decode_keyset(set, token), EINVAL);
+	jwt_free_str(token);
+
+	/* Unsigned tokens never get through. */
+	token = sign_token(JWT_ALG_NONE, NULL, "rsa");
+	ck_assert_int_eq(decode_keyset(set, token), EINVAL);
+	ck_assert_int_eq(decode_keyset(NULL, token), EINVAL);
+	jwt_free_str(token);
+
+	jwt_keyset_free(set);
+}
+END_TEST
+
+START_TEST(test_jwt_keyset_private)
+{
+	static const struct {
+		const char *jwk;
+		jwt_alg_t alg;
+		const char *pub;
+	} keys[] = {
+		{ jwk_rsa_priv, JWT_ALG_RS256, "rsa_key_2048-pub.pem" },
+		{ jwk_ec384_priv, JWT_ALG_ES384, "ec_key_secp384r1-pub.pem" },
+		{ jwk_ed25519_priv, JWT_ALG_EDDSA,
+		  "eddsa_key_ed25519-pub.pem" },
+	};
+	jwt_keyset_t *set;
+	jwt_key_t *jkey;
+	jwt_t *jwt;
+	char *token;
+	int ret;
+	size_t i;
+
+	/* Sign with keys from JWKs and check against their PEMs. */
+	for (i = 0; i < sizeof(keys) / sizeof(keys[0]); i++) {
+		set = new_keyset(keys[i].jwk);
+		ck_assert_int_eq(jwt_keyset_count(set), 1);
+
+		jkey = jwt_keyset_find(set, NULL);
+		ck_assert_ptr_ne(jkey, NULL);
+
+		ALLOC_JWT(&jwt);
+		ret = jwt_add_grant(jwt, "iss", "files.cyphre.com");
+		ck_assert_int_eq(ret, 0);
+		ret = jwt_set_alg_key(jwt, keys[i].alg, jkey);
+		ck_assert_int_eq(ret, 0);
+		token = jwt_encode_str(jwt);
+		ck_assert_ptr_ne(token, NULL);
+		jwt_free(jwt);
+
+		read_key(keys[i].pub);
+		ret = jwt_decode(&jwt, token, key, key_len);
+		ck_assert_int_eq(ret, 0);
+		jwt_free(jwt);
+
+		jwt_free_str(token);
+		jwt_key_free(jkey);
+		jwt_keyset_free(set);
+	}
+}
+END_TEST
+
+START_TEST(test_jwt_keyset_add)
+{
+	jwt_keyset_t *set;
+	jwt_key_t *jkey, *found;
+	char kid[16], *token;
+	int ret, i;
+
+	set = new_keyset(NULL);
+
+	ret = jwt_key_new(&jkey, JWT_ALG_HS256, key256, sizeof(key256));
+	ck_assert_int_eq(ret, 0);
+
+	/* Enough to grow the table a few times. */
+	for (i = 0; i < 200; i++) {
+		sprintf(kid, "k%d", i);
+		ck_assert_int_eq(jwt_keyset_add(set, kid, jkey), 0);
+	}
+	ck_assert_int_eq(jwt_keyset_add(set, NULL, jkey), 0);
+	ck_assert_int_eq(jwt_keyset_count(set), 201);
+
+	for (i = 0; i < 200; i++) {
+		sprintf(kid, "k%d", i);
+		found = jwt_keyset_find(set, kid);
+		ck_assert_ptr_eq(found, jkey);
+		jwt_key_free(found);
+	}
+
+	/* Keys added by hand take any alg of their kind. */
+	token = sign_token(JWT_ALG_HS512, NULL, "k123");
+	ck_assert_int_eq(decode_keyset(set, token), 0);
+	jwt_free_str(token);
+
+	token = sign_token(JWT_ALG_HS256, NULL, NULL);
+	ck_assert_int_eq(decode_keyset(set, token), 0);
+	jwt_free_str(token);
+
+	token = sign_token(JWT_ALG_HS256, NULL, "k200");
+	ck_assert_int_eq(decode_keyset(set, token), EINVAL);
+	jwt_free_str(token);
+
+	ck_assert_int_eq(jwt_keyset_add(set, "k", NULL), EINVAL);
+	ck_assert_int_eq(jwt_keyset_add(NULL, "k", jkey), EINVAL);
+
+	jwt_key_free(jkey);
+	jwt_keyset_free(set);
+}
+END_TEST
+
+START_TEST(test_jwt_keyset_invalid)
+{
+	jwt_keyset_t *set;
+	int ret;
+
+	set = new_keyset(NULL);
+
+	ret = jwt_keyset_load_jwks(set, "not json");
+	ck_assert_int_eq(ret, EINVAL);
+
+	ret = jwt_keyset_load_jwks(set, "{\"keys\":{}}");
+	ck_assert_int_eq(ret, EINVAL);
+
+	ret = jwt_keyset_load_jwks(set, "{\"keys\":[{\"kid\":\"a\"}]}");
+	ck_assert_int_eq(ret, EINVAL);
+
+	/* Not base64url. */
+	ret = jwt_keyset_load_jwks(set, "{\"kty\":\"oct\",\"k\":\"a+b/\"}");
+	ck_assert_int_eq(ret, EINVAL);
+
+	/* An RSA key without its modulus, after one that is fine. Neither
+	 * is added. */
+	ret = jwt_keyset_load_jwks(set, "{\"keys\":[{\"kty\":\"oct\","
+				   "\"k\":\"c2VjcmV0\"},{\"kty\":\"RSA\","
+				   "\"e\":\"AQAB\"}]}");
+	ck_assert_int_eq(ret, EINVAL);
+	ck_assert_int_eq(jwt_keyset_count(set), 0);
+
+	/* Half a point. */
+	ret = jwt_keyset_load_jwks(set, "{\"kty\":\"EC\",\"crv\":\"P-256\","
+				   "\"x\":\"AAAA\"}");
+	ck_assert_int_eq(ret, EINVAL);
+
+	/* A JWK alg that doesn't fit the key. */
+	ret = jwt_keyset_load_jwks(set, "{\"kty\":\"oct\",\"alg\":\"RS256\","
+				   "\"k\":\"c2VjcmV0\"}");
+	ck_assert_int_eq(ret, EINVAL);
+
+	ck_assert_int_eq(jwt_keyset_count(set), 0);
+
+	ck_assert_int_eq(jwt_keyset_load_jwks(NULL, jwks_pub), EINVAL);
+	ck_assert_int_eq(jwt_keyset_load_jwks(set, NULL), EINVAL);
+	ck_assert_int_eq(jwt_keyset_new(NULL), EINVAL);
+
+	jwt_keyset_free(set);
+}
+END_TEST
+
+static Suite *libjwt_suite(void)
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s = suite_create("LibJWT Key Sets");
+
+	tc_core = tcase_create("jwt_jwks");
+
+	tcase_add_test(tc_core, test_jwt_keyset_load);
+	tcase_add_test(tc_core, test_jwt_decode_keyset);
+	tcase_add_test(tc_core, test_jwt_keyset_private);
+	tcase_add_test(tc_core, test_jwt_keyset_add);
+	tcase_add_test(tc_core, test_jwt_keyset_invalid);
+
+	tcase_set_timeout(tc_core, 30);
+
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
+
+int main(int argc, char *argv[])
+{
+	int number_failed;
+	Suite *s;
+	SRunner *sr;
+
+	s = libjwt_suite();
+	sr = srunner_create(s);
+
+	srunner_run_all(sr, CK_VERBOSE);
+	number_failed = srunner_ntests_failed(sr);
+	srunner_free(sr);
+
+	return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,1592 @@
+/* Public domain, no copyright. Use at your own risk. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <check.h>
+
+#include <jwt.h>
+
+/* Constant time to make tests consistent. */
+#define TS_CONST	1475980545L
+
+/* Macro to allocate a new JWT with checks. */
+#define ALLOC_JWT(__jwt) do {		\
+	int __ret = jwt_new(__jwt);	\
+	ck_assert_int_eq(__ret, 0);	\
+	ck_assert_ptr_ne(__jwt, NULL);	\
+} while(0)
+
+/* Older check doesn't have this. */
+#ifndef ck_assert_ptr_ne
+#define ck_assert_ptr_ne(X, Y) ck_assert(X != Y)
+#define ck_assert_ptr_eq(X, Y) ck_assert(X == Y)
+#endif
+
+#ifndef ck_assert_int_gt
+#define ck_assert_int_gt(X, Y) ck_assert(X > Y)
+#endif
+
+static unsigned char key[16384];
+static size_t key_len;
+
+static const char jwt_rs256_2048[] = "eyJhbGciOiJSUzI1NiIsInR5cCI6IkpXVCJ9.ey"
+	"JpYXQiOjE0NzU5ODA1NDUsImlzcyI6ImZpbGVzLmN5cGhyZS5jb20iLCJyZWYiOiJYWF"
+	"hYLVlZWVktWlpaWi1BQUFBLUNDQ0MiLCJzdWIiOiJ1c2VyMCJ9.cl9YHrbydUPb8dbij"
+	"SZzpTa-r-Z2bFz8r1DEQeqGB2ncHlNvYRLa3wa-IbOSQGPVok9xMutxc2ngm0cvquOOW"
+	"WVZIpYz3IdZQaCZ4G2PtTwnmhblSnqB-1ZvbUljBHjIoeXDTq2Msph2sjED9YKHKcjIm"
+	"kwil1cp75bnZMoKW3kDuNdq1vUwZDLdE_YRMpA53sTsoXHNSBzQwrIFEdCA8OA2rS-9R"
+	"IYtbLnKUZH4GXe2wb5y7pB21qqIdSl9k7yuD90k7LaCQDNLvrI1_cQB9wQcqqFA0qFc2"
+	"UxbiRRsC65eRZ1PfdZ8I_scukh5Vts5PNaRdE-_y_bpZKPaUu-WwA";
+
+static const char jwt_hs256[] = "eyJhbGciOiJIUzI1NiIsInR5cCI6IkpXVCJ9.eyJpYXQ"
+	"iOjE0NzU5ODA1NDUsImlzcyI6ImZpbGVzLmN5cGhyZS5jb20iLCJyZWYiOiJYWFhYLVl"
+	"ZWVktWlpaWi1BQUFBLUNDQ0MiLCJzdWIiOiJ1c2VyMCJ9.B0a9gqWgPuuIx-EFXXSHQBy"
+	"CMHCzs0gjvY3-60oV4TY";
+
+static const unsigned char key256[32] = "012345678901234567890123456789XY";
+
+/* The secp384r1 and Ed25519 test keys, raw. */
+static const unsigned char ec384_raw_priv[48] = {
+	0x5e, 0x2c, 0x28, 0x1a, 0xa6, 0x36, 0x66, 0xbd,
+	0x36, 0xad, 0x30, 0x76, 0x98, 0x5f, 0x70, 0x34,
+	0xdb, 0xed, 0x18, 0xb3, 0x74, 0xeb, 0xf2, 0x47,
+	0x5a, 0xf8, 0x4f, 0x43, 0x16, 0x79, 0x82, 0x4a,
+	0x20, 0x8e, 0x12, 0x28, 0x39, 0xd7, 0xd7, 0xd3,
+	0xd7, 0x77, 0x9d, 0x79, 0x4f, 0x18, 0x74, 0x3b,
+};
+
+static const unsigned char ec384_raw_pub[97] = {
+	0x04, 0xa2, 0x6c, 0x42, 0xf7, 0x27, 0x1c, 0xf0,
+	0x09, 0x17, 0x4b, 0x05, 0x90, 0xa6, 0xed, 0x64,
+	0x37, 0x91, 0x66, 0x83, 0x2f, 0xec, 0x0f, 0xf2,
+	0x89, 0xa8, 0xdd, 0xed, 0x95, 0x26, 0x66, 0x50,
+	0x46, 0x77, 0xc3, 0x77, 0x3a, 0x29, 0x82, 0x5f,
+	0x2b, 0xde, 0xcf, 0x30, 0xe4, 0x99, 0x41, 0xa5,
+	0x1d, 0x7b, 0x27, 0x41, 0xa2, 0xaf, 0xc8, 0x3a,
+	0x09, 0x50, 0x40, 0xe8, 0xfc, 0xcc, 0xba, 0xae,
+	0x6e, 0xae, 0x48, 0xa5, 0xa6, 0x94, 0x88, 0x34,
+	0x39, 0xd1, 0xe2, 0x60, 0xef, 0xd3, 0xef, 0x5e,
+	0xe2, 0xe2, 0x55, 0x41, 0xfd, 0xf1, 0xc0, 0x4b,
+	0xfe, 0x8f, 0x2c, 0x0d, 0x50, 0x7f, 0xb0, 0x6c,
+	0xf3,
+};
+
+static const unsigned char ed25519_raw_priv[32] = {
+	0xcc, 0x62, 0x46, 0x0f, 0x3d, 0x59, 0xa7, 0x8e,
+	0x23, 0x8b, 0xd9, 0xda, 0x92, 0x52, 0xf5, 0xb2,
+	0x0f, 0x62, 0x87, 0xa7, 0x4b, 0xe9, 0x5d, 0x30,
+	0x71, 0x6f, 0x2a, 0xba, 0xb4, 0x29, 0x42, 0xbe,
+};
+
+static const unsigned char ed25519_raw_pub[32] = {
+	0xe2, 0x93, 0x4a, 0x76, 0x26, 0x1e, 0xd8, 0x07,
+	0x48, 0x5b, 0x53, 0xe8, 0x57, 0x60, 0xe9, 0x9f,
+	0x5c, 0x69, 0x77, 0x01, 0xb1, 0xb0, 0x7d, 0xa3,
+	0x52, 0x5b, 0x6d, 0x65, 0x2c, 0x48, 0x30, 0x70,
+};
+
+static void read_key(const char *key_file)
+{
+	FILE *fp;
+	char *key_path;
+	int ret = 0;
+
+	ret = asprintf(&key_path, KEYDIR "/%s", key_file);
+	ck_assert_int_gt(ret, 0);
+
+	fp = fopen(key_path, "r");
+	ck_assert_ptr_ne(fp, NULL);
+
+	jwt_free_str(key_path);
+
+	key_len = fread(key, 1, sizeof(key), fp);
+	ck_assert_int_ne(key_len, 0);
+
+	ck_assert_int_eq(ferror(fp), 0);
+
+	fclose(fp);
+
+	key[key_len] = '\0';
+}
+
+static jwt_key_t *new_key(const char *key_file, jwt_alg_t alg)
+{
+	jwt_key_t *jkey = NULL;
+	int ret;
+
+	read_key(key_file);
+
+	ret = jwt_key_new(&jkey, alg, key, key_len);
+	ck_assert_int_eq(ret, 0);
+	ck_assert_ptr_ne(jkey, NULL);
+
+	return jkey;
+}
+
+static jwt_key_t *new_key_format(const char *key_file, jwt_alg_t alg,
+				 jwt_key_format_t format)
+{
+	jwt_key_t *jkey = NULL;
+	int ret;
+
+	read_key(key_file);
+
+	ret = jwt_key_new_format(&jkey, alg, format, key, key_len);
+	ck_assert_int_eq(ret, 0);
+	ck_assert_ptr_ne(jkey, NULL);
+
+	return jkey;
+}
+
+static void add_grants(jwt_t *jwt)
+{
+	int ret;
+
+	ret = jwt_add_grant(jwt, "iss", "files.cyphre.com");
+	ck_assert_int_eq(ret, 0);
+
+	ret = jwt_add_grant(jwt, "sub", "user0");
+	ck_assert_int_eq(ret, 0);
+
+	ret = jwt_add_grant(jwt, "ref", "XXXX-YYYY-ZZZZ-AAAA-CCCC");
+	ck_assert_int_eq(ret, 0);
+
+	ret = jwt_add_grant_int(jwt, "iat", TS_CONST);
+	ck_assert_int_eq(ret, 0);
+}
+
+START_TEST(test_jwt_key_new)
+{
+	jwt_key_t *jkey = NULL;
+	int ret;
+
+	ret = jwt_key_new(&jkey, JWT_ALG_HS256, key256, sizeof(key256));
+	ck_assert_int_eq(ret, 0);
+	ck_assert_ptr_ne(jkey, NULL);
+	ck_assert_int_eq(jwt_key_get_alg(jkey), JWT_ALG_HS256);
+
+	ck_assert_ptr_eq(jwt_key_ref(jkey), jkey);
+	jwt_key_free(jkey);
+	jwt_key_free(jkey);
+
+	ret = jwt_key_new(&jkey, JWT_ALG_NONE, key256, sizeof(key256));
+	ck_assert_int_eq(ret, EINVAL);
+	ck_assert_ptr_eq(jkey, NULL);
+
+	ret = jwt_key_new(&jkey, JWT_ALG_HS256, NULL, 0);
+	ck_assert_int_eq(ret, EINVAL);
+	ck_assert_ptr_eq(jkey, NULL);
+
+	ret = jwt_key_new(NULL, JWT_ALG_HS256, key256, sizeof(key256));
+	ck_assert_int_eq(ret, EINVAL);
+
+	jwt_key_free(NULL);
+}
+END_TEST
+
+START_TEST(test_jwt_key_new_invalid)
+{
+	jwt_key_t *jkey = NULL;
+	int ret;
+
+	/* Errors in the key show up when it is created. */
+	read_key("rsa_key_invalid.pem");
+	ret = jwt_key_new(&jkey, JWT_ALG_RS256, key, key_len);
+	ck_assert_int_ne(ret, 0);
+	ck_assert_ptr_eq(jkey, NULL);
+
+	/* So does a key of the wrong type. */
+	read_key("ec_key_secp384r1.pem");
+	ret = jwt_key_new(&jkey, JWT_ALG_RS256, key, key_len);
+	ck_assert_int_eq(ret, EINVAL);
+	ck_assert_ptr_eq(jkey, NULL);
+}
+END_TEST
+
+START_TEST(test_jwt_encode_hs256_key)
+{
+	jwt_key_t *jkey = NULL;
+	jwt_t *jwt = NULL;
+	int ret;
+	char *out;
+
+	ret = jwt_key_new(&jkey, JWT_ALG_HS256, key256, sizeof(key256));
+	ck_assert_int_eq(ret, 0);
+
+	ALLOC_JWT(&jwt);
+	add_grants(jwt);
+
+	ret = jwt_set_alg_key(jwt, JWT_ALG_HS256, jkey);
+	ck_assert_int_eq(ret, 0);
+	ck_assert_int_eq(jwt_get_alg(jwt), JWT_ALG_HS256);
+
+	/* The JWT holds its own reference. */
+	jwt_key_free(jkey);
+
+	out = jwt_encode_str(jwt);
+	ck_assert_ptr_ne(out, NULL);
+	ck_assert_str_eq(out, jwt_hs256);
+
+	jwt_free_str(out);
+	jwt_free(jwt);
+}
+END_TEST
+
+static char *encode_with_key(jwt_alg_t alg, jwt_key_t *jkey)
+{
+	jwt_t *jwt = NULL;
+	char *out;
+	int ret;
+
+	ALLOC_JWT(&jwt);
+	add_grants(jwt);
+
+	ret = jwt_set_alg_key(jwt, alg, jkey);
+	ck_assert_int_eq(ret, 0);
+
+	out = jwt_encode_str(jwt);
+	ck_assert_ptr_ne(out, NULL);
+
+	jwt_free(jwt);
+
+	return out;
+}
+
+START_TEST(test_jwt_hmac_key_reuse)
+{
+	jwt_alg_t algs[] = { JWT_ALG_HS384, JWT_ALG_HS512 };
+	jwt_key_t *jkey = NULL, *other = NULL;
+	jwt_t *jwt = NULL;
+	char *out, *out2;
+	unsigned int i;
+	int ret;
+
+	ret = jwt_key_new(&jkey, JWT_ALG_HS256, key256, sizeof(key256));
+	ck_assert_int_eq(ret, 0);
+
+	/* Every token starts from the same prepared state. */
+	for (i = 0; i < 3; i++) {
+		out = encode_with_key(JWT_ALG_HS256, jkey);
+		ck_assert_str_eq(out, jwt_hs256);
+
+		ret = jwt_decode_with_key(&jwt, out, jkey);
+		ck_assert_int_eq(ret, 0);
+		ck_assert_ptr_ne(jwt, NULL);
+		jwt_free(jwt);
+		jwt = NULL;
+
+		jwt_free_str(out);
+	}
+
+	/* A key prepared for HS256 still works for the rest of the family,
+	 * and gives the same result as a key prepared for that alg. */
+	for (i = 0; i < sizeof(algs) / sizeof(algs[0]); i++) {
+		ret = jwt_key_new(&other, algs[i], key256, sizeof(key256));
+		ck_assert_int_eq(ret, 0);
+
+		out = encode_with_key(algs[i], jkey);
+		out2 = encode_with_key(algs[i], other);
+		ck_assert_str_eq(out, out2);
+
+		ret = jwt_decode_with_key(&jwt, out, other);
+		ck_assert_int_eq(ret, 0);
+		ck_assert_ptr_ne(jwt, NULL);
+		jwt_free(jwt);
+		jwt = NULL;
+
+		ret = jwt_decode_with_key(&jwt, out2, jkey);
+		ck_assert_int_eq(ret, 0);
+		ck_assert_ptr_ne(jwt, NULL);
+		jwt_free(jwt);
+		jwt = NULL;
+
+		jwt_free_str(out);
+		jwt_free_str(out2);
+		jwt_key_free(other);
+	}
+
+	jwt_key_free(jkey);
+}
+END_TEST
+
+START_TEST(test_jwt_decode_hs256_key)
+{
+	jwt_key_t *jkey = NULL;
+	jwt_t *jwt = NULL;
+	int ret;
+
+	ret = jwt_key_new(&jkey, JWT_ALG_HS256, key256, sizeof(key256));
+	ck_assert_int_eq(ret, 0);
+
+	ret = jwt_decode_with_key(&jwt, jwt_hs256, jkey);
+	ck_assert_int_eq(ret, 0);
+	ck_assert_ptr_ne(jwt, NULL);
+	ck_assert_int_eq(jwt_get_alg(jwt), JWT_ALG_HS256);
+	ck_assert_str_eq(jwt_get_grant(jwt, "sub"), "user0");
+
+	jwt_free(jwt);
+	jwt_key_free(jkey);
+
+	ret = jwt_key_new(&jkey, JWT_ALG_HS256, (const unsigned char *)"bad",
+			  3);
+	ck_assert_int_eq(ret, 0);
+
+	ret = jwt_decode_with_key(&jwt, jwt_hs256, jkey);
+	ck_assert_int_ne(ret, 0);
+	ck_assert_ptr_eq(jwt, NULL);
+
+	jwt_key_free(jkey);
+}
+END_TEST
+
+START_TEST(test_jwt_decode_batch)
+{
+	char forged[sizeof(jwt_hs256)];
+	const char *tokens[5];
+	int results[5];
+	jwt_t *jwts[5];
+	jwt_key_t *jkey = NULL;
+	char *hs512;
+	unsigned int i;
+	int ret;
+
+	ret = jwt_key_new(&jkey, JWT_ALG_HS256, key256, sizeof(key256));
+	ck_assert_int_eq(ret, 0);
+
+	hs512 = encode_with_key(JWT_ALG_HS512, jkey);
+
+	strcpy(forged, jwt_hs256);
+	forged[strlen(forged) - 10] ^= 1;
+
+	tokens[0] = jwt_hs256;
+	tokens[1] = forged;
+	tokens[2] = "not-a-token";
+	tokens[3] = jwt_rs256_2048;
+	tokens[4] = hs512;
+
+	ret = jwt_verify_batch(tokens, results, 5, jkey);
+	ck_assert_int_eq(ret, EINVAL);
+	ck_assert_int_eq(results[0], 0);
+	ck_assert_int_eq(results[1], EINVAL);
+	ck_assert_int_eq(results[2], EINVAL);
+	ck_assert_int_eq(results[3], EINVAL);
+	ck_assert_int_eq(results[4], 0);
+
+	ret = jwt_decode_batch(jwts, tokens, results, 5, jkey);
+	ck_assert_int_eq(ret, EINVAL);
+	for (i = 0; i < 5; i++) {
+		if (i == 0 || i == 4) {
+			ck_assert_int_eq(results[i], 0);
+			ck_assert_ptr_ne(jwts[i], NULL);
+			ck_assert_str_eq(jwt_get_grant(jwts[i], "sub"),
+					 "user0");
+		} else {
+			ck_assert_int_ne(results[i], 0);
+			ck_assert_ptr_eq(jwts[i], NULL);
+		}
+		jwt_free(jwts[i]);
+	}
+
+	/* All good. */
+	tokens[1] = hs512;
+	ret = jwt_verify_batch(tokens, results, 2, jkey);
+	ck_assert_int_eq(ret, 0);
+
+	ret = jwt_verify_batch(NULL, results, 2, jkey);
+	ck_assert_int_eq(ret, EINVAL);
+
+	ret = jwt_verify_batch(tokens, results, 2, NULL);
+	ck_assert_int_eq(ret, EINVAL);
+
+	jwt_free_str(hs512);
+	jwt_key_free(jkey);
+}
+END_TEST
+
+/* Claims of different lengths, so the tokens of a batch span different
+ * numbers of hash blocks. */
+static jwt_t *batch_jwt(unsigned int i)
+{
+	char pad[400];
+	jwt_t *jwt = NULL;
+	int ret;
+
+	ALLOC_JWT(&jwt);
+	add_grants(jwt);
+
+	memset(pad, 'a' + i % 26, sizeof(pad));
+	pad[(i * 37) % sizeof(pad)] = '\0';
+
+	ret = jwt_add_grant(jwt, "pad", pad);
+	ck_assert_int_eq(ret, 0);
+
+	return jwt;
+}
+
+START_TEST(test_jwt_encode_batch)
+{
+	static const unsigned int counts[] = { 1, 3, 8, 17, 33 };
+	static const jwt_alg_t algs[] = {
+		JWT_ALG_HS256, JWT_ALG_HS384, JWT_ALG_HS512,
+	};
+	unsigned char long_key[200];
+	const char *ctokens[33];
+	char *tokens[33], *out;
+	int results[33];
+	jwt_t *jwts[33];
+	jwt_key_t *jkey;
+	unsigned int a, c, i;
+	int ret;
+
+	memset(long_key, 0x5a, sizeof(long_key));
+
+	for (a = 0; a < 6; a++) {
+		/* Keys longer than a hash block get hashed first. */
+		ret = jwt_key_new(&jkey, algs[a % 3], a < 3 ? key256 : long_key,
+				  a < 3 ? sizeof(key256) : sizeof(long_key));
+		ck_assert_int_eq(ret, 0);
+
+		for (c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+			for (i = 0; i < counts[c]; i++)
+				jwts[i] = batch_jwt(i);
+
+			ret = jwt_encode_batch(jwts, tokens, results,
+					       counts[c], jkey);
+			ck_assert_int_eq(ret, 0);
+
+			/* Same as signing them one by one. */
+			for (i = 0; i < counts[c]; i++) {
+				ck_assert_int_eq(results[i], 0);
+				out = jwt_encode_str(jwts[i]);
+				ck_assert_ptr_ne(out, NULL);
+				ck_assert_str_eq(tokens[i], out);
+				jwt_free_str(out);
+				jwt_free(jwts[i]);
+				ctokens[i] = tokens[i];
+			}
+
+			ret = jwt_verify_batch(ctokens, results, counts[c],
+					       jkey);
+			ck_assert_int_eq(ret, 0);
+
+			/* Only the forged one fails. */
+			tokens[counts[c] / 2][strlen(tokens[0]) / 2] ^= 1;
+			ret = jwt_verify_batch(ctokens, results, counts[c],
+					       jkey);
+			ck_assert_int_eq(ret, EINVAL);
+			for (i = 0; i < counts[c]; i++) {
+				ck_assert_int_eq(results[i],
+						 i == counts[c] / 2 ? EINVAL : 0);
+			}
+
+			ret = jwt_decode_batch(jwts, ctokens, results,
+					       counts[c], jkey);
+			ck_assert_int_eq(ret, EINVAL);
+			for (i = 0; i < counts[c]; i++) {
+				if (i == counts[c] / 2) {
+					ck_assert_int_eq(results[i], EINVAL);
+					ck_assert_ptr_eq(jwts[i], NULL);
+				} else {
+					ck_assert_int_eq(results[i], 0);
+					ck_assert_str_eq(jwt_get_grant(jwts[i],
+								       "sub"),
+							 "user0");
+				}
+				jwt_free(jwts[i]);
+				jwt_free_str(tokens[i]);
+			}
+		}
+
+		jwt_key_free(jkey);
+	}
+
+	/* Other algorithms are signed one at a time. */
+	jkey = new_key("rsa_key_2048.pem", JWT_ALG_RS256);
+
+	for (i = 0; i < 2; i++) {
+		ALLOC_JWT(&jwts[i]);
+		add_grants(jwts[i]);
+	}
+
+	ret = jwt_encode_batch(jwts, tokens, results, 2, jkey);
+	ck_assert_int_eq(ret, 0);
+	for (i = 0; i < 2; i++) {
+		ck_assert_int_eq(results[i], 0);
+		ck_assert_str_eq(tokens[i], jwt_rs256_2048);
+		jwt_free_str(tokens[i]);
+	}
+
+	ret = jwt_encode_batch(jwts, tokens, results, 2, NULL);
+	ck_assert_int_eq(ret, EINVAL);
+
+	jwt_free(jwts[0]);
+	jwt_free(jwts[1]);
+	jwt_key_free(jkey);
+}
+END_TEST
+
+START_TEST(test_jwt_encode_rs256_key)
+{
+	jwt_key_t *jkey;
+	jwt_t *jwt = NULL, *new;
+	int ret;
+	char *out;
+
+	jkey = new_key("rsa_key_2048.pem", JWT_ALG_RS256);
+
+	ALLOC_JWT(&jwt);
+	add_grants(jwt);
+
+	ret = jwt_set_alg_key(jwt, JWT_ALG_RS256, jkey);
+	ck_assert_int_eq(ret, 0);
+
+	out = jwt_encode_str(jwt);
+	ck_assert_ptr_ne(out, NULL);
+	ck_assert_str_eq(out, jwt_rs256_2048);
+	jwt_free_str(out);
+
+	/* A copy shares the same key. */
+	new = jwt_dup(jwt);
+	ck_assert_ptr_ne(new, NULL);
+	jwt_free(jwt);
+
+	out = jwt_encode_str(new);
+	ck_assert_ptr_ne(out, NULL);
+	ck_assert_str_eq(out, jwt_rs256_2048);
+	jwt_free_str(out);
+
+	jwt_free(new);
+	jwt_key_free(jkey);
+}
+END_TEST
+
+START_TEST(test_jwt_decode_rs256_key)
+{
+	jwt_key_t *jkey;
+	jwt_t *jwt = NULL;
+	int ret, i;
+
+	jkey = new_key("rsa_key_2048-pub.pem", JWT_ALG_RS256);
+
+	/* The same key can be used over and over. */
+	for (i = 0; i < 3; i++) {
+		ret = jwt_decode_with_key(&jwt, jwt_rs256_2048, jkey);
+		ck_assert_int_eq(ret, 0);
+		ck_assert_ptr_ne(jwt, NULL);
+		ck_assert_int_eq(jwt_get_alg(jwt), JWT_ALG_RS256);
+		jwt_free(jwt);
+	}
+
+	jwt_key_free(jkey);
+
+	/* A private key can verify, too. */
+	jkey = new_key("rsa_key_2048.pem", JWT_ALG_RS256);
+
+	ret = jwt_decode_with_key(&jwt, jwt_rs256_2048, jkey);
+	ck_assert_int_eq(ret, 0);
+	jwt_free(jwt);
+
+	jwt_key_free(jkey);
+}
+END_TEST
+
+/* Sign with jkey and verify with the PEM public key in pub_file. */
+static void check_sign_key(jwt_key_t *jkey, jwt_alg_t alg,
+			   const char *pub_file)
+{
+	jwt_t *jwt = NULL;
+	char *out;
+	int ret;
+
+	ALLOC_JWT(&jwt);
+	add_grants(jwt);
+
+	ret = jwt_set_alg_key(jwt, alg, jkey);
+	ck_assert_int_eq(ret, 0);
+
+	out = jwt_encode_str(jwt);
+	ck_assert_ptr_ne(out, NULL);
+	jwt_free(jwt);
+
+	read_key(pub_file);
+	ret = jwt_decode(&jwt, out, key, key_len);
+	ck_assert_int_eq(ret, 0);
+	jwt_free(jwt);
+
+	jwt_free_str(out);
+}
+
+/* Sign with the PEM private key in priv_file and verify with jkey. */
+static void check_verify_key(jwt_key_t *jkey, jwt_alg_t alg,
+			     const char *priv_file)
+{
+	jwt_t *jwt = NULL;
+	char *out;
+	int ret;
+
+	ALLOC_JWT(&jwt);
+	add_grants(jwt);
+
+	read_key(priv_file);
+	ret = jwt_set_alg(jwt, alg, key, key_len);
+	ck_assert_int_eq(ret, 0);
+
+	out = jwt_encode_str(jwt);
+	ck_assert_ptr_ne(out, NULL);
+	jwt_free(jwt);
+
+	ret = jwt_decode_with_key(&jwt, out, jkey);
+	ck_assert_int_eq(ret, 0);
+	jwt_free(jwt);
+
+	jwt_free_str(out);
+}
+
+START_TEST(test_jwt_key_der)
+{
+	jwt_key_t *jkey = NULL;
+	jwt_t *jwt = NULL;
+	char *out;
+	int ret;
+
+	/* DER is found without being asked for. */
+	jkey = new_key("rsa_key_2048.der", JWT_ALG_RS256);
+
+	ALLOC_JWT(&jwt);
+	add_grants(jwt);
+	ret = jwt_set_alg_key(jwt, JWT_ALG_RS256, jkey);
+	ck_assert_int_eq(ret, 0);
+	out = jwt_encode_str(jwt);
+	ck_assert_ptr_ne(out, NULL);
+	ck_assert_str_eq(out, jwt_rs256_2048);
+	jwt_free_str(out);
+	jwt_free(jwt);
+
+	jwt_key_free(jkey);
+
+	jkey = new_key_format("rsa_key_2048-pub.der", JWT_ALG_RS256,
+			      JWT_KEY_FORMAT_DER);
+	ret = jwt_decode_with_key(&jwt, jwt_rs256_2048, jkey);
+	ck_assert_int_eq(ret, 0);
+	jwt_free(jwt);
+	jwt_key_free(jkey);
+
+	/* Also where key data is taken directly. */
+	read_key("rsa_key_2048-pub.der");
+	ret = jwt_decode(&jwt, jwt_rs256_2048, key, key_len);
+	ck_assert_int_eq(ret, 0);
+	jwt_free(jwt);
+
+	jkey = new_key("ec_key_secp384r1.der", JWT_ALG_ES384);
+	check_sign_key(jkey, JWT_ALG_ES384, "ec_key_secp384r1-pub.pem");
+	jwt_key_free(jkey);
+
+	jkey = new_key("ec_key_secp384r1-pub.der", JWT_ALG_ES384);
+	check_verify_key(jkey, JWT_ALG_ES384, "ec_key_secp384r1.pem");
+	jwt_key_free(jkey);
+
+	jkey = new_key("eddsa_key_ed25519.der", JWT_ALG_EDDSA);
+	check_sign_key(jkey, JWT_ALG_EDDSA, "eddsa_key_ed25519-pub.pem");
+	jwt_key_free(jkey);
+
+	jkey = new_key("eddsa_key_ed25519-pub.der", JWT_ALG_EDDSA);
+	check_verify_key(jkey, JWT_ALG_EDDSA, "eddsa_key_ed25519.pem");
+	jwt_key_free(jkey);
+
+	/* The format given is the one used. */
+	read_key("rsa_key_2048-pub.pem");
+	ret = jwt_key_new_format(&jkey, JWT_ALG_RS256, JWT_KEY_FORMAT_DER,
+				 key, key_len);
+	ck_assert_int_eq(ret, EINVAL);
+	ck_assert_ptr_eq(jkey, NULL);
+
+	read_key("rsa_key_2048-pub.der");
+	ret = jwt_key_new_format(&jkey, JWT_ALG_RS256, JWT_KEY_FORMAT_PEM,
+				 key, key_len);
+	ck_assert_int_eq(ret, EINVAL);
+
+	/* Cut short. */
+	ret = jwt_key_new_format(&jkey, JWT_ALG_RS256, JWT_KEY_FORMAT_DER,
+				 key, key_len - 1);
+	ck_assert_int_eq(ret, EINVAL);
+
+	ret = jwt_key_new_format(&jkey, JWT_ALG_RS256,
+				 (jwt_key_format_t)99, key, key_len);
+	ck_assert_int_eq(ret, EINVAL);
+}
+END_TEST
+
+START_TEST(test_jwt_key_raw)
+{
+	const char *backend = jwt_get_crypto_backend();
+	jwt_key_t *jkey = NULL;
+	int ret;
+
+	ret = jwt_key_new_format(&jkey, JWT_ALG_EDDSA,
+				 JWT_KEY_FORMAT_RAW_PRIV, ed25519_raw_priv,
+				 sizeof(ed25519_raw_priv));
+	ck_assert_int_eq(ret, 0);
+	check_sign_key(jkey, JWT_ALG_EDDSA, "eddsa_key_ed25519-pub.pem");
+	jwt_key_free(jkey);
+
+	ret = jwt_key_new_format(&jkey, JWT_ALG_EDDSA, JWT_KEY_FORMAT_RAW_PUB,
+				 ed25519_raw_pub, sizeof(ed25519_raw_pub));
+	ck_assert_int_eq(ret, 0);
+	check_verify_key(jkey, JWT_ALG_EDDSA, "eddsa_key_ed25519.pem");
+	jwt_key_free(jkey);
+
+	ret = jwt_key_new_format(&jkey, JWT_ALG_ES384, JWT_KEY_FORMAT_RAW_PUB,
+				 ec384_raw_pub, sizeof(ec384_raw_pub));
+	ck_assert_int_eq(ret, 0);
+	check_verify_key(jkey, JWT_ALG_ES384, "ec_key_secp384r1.pem");
+	jwt_key_free(jkey);
+
+	/* GnuTLS can't work out the public key. */
+	ret = jwt_key_new_format(&jkey, JWT_ALG_ES384, JWT_KEY_FORMAT_RAW_PRIV,
+				 ec384_raw_priv, sizeof(ec384_raw_priv));
+	if (backend && !strcmp(backend, "gnutls")) {
+		ck_assert_int_eq(ret, EINVAL);
+	} else {
+		ck_assert_int_eq(ret, 0);
+		check_sign_key(jkey, JWT_ALG_ES384,
+			       "ec_key_secp384r1-pub.pem");
+		check_verify_key(jkey, JWT_ALG_ES384,
+				 "ec_key_secp384r1.pem");
+		jwt_key_free(jkey);
+	}
+
+	/* The alg picks the curve, and this point isn't on P-256. */
+	ret = jwt_key_new_format(&jkey, JWT_ALG_ES256, JWT_KEY_FORMAT_RAW_PUB,
+				 ec384_raw_pub, sizeof(ec384_raw_pub));
+	ck_assert_int_eq(ret, EINVAL);
+
+	ret = jwt_key_new_format(&jkey, JWT_ALG_EDDSA, JWT_KEY_FORMAT_RAW_PUB,
+				 ed25519_raw_pub, sizeof(ed25519_raw_pub) - 1);
+	ck_assert_int_eq(ret, EINVAL);
+
+	/* RSA has no raw keys. */
+	ret = jwt_key_new_format(&jkey, JWT_ALG_RS256, JWT_KEY_FORMAT_RAW_PUB,
+				 ec384_raw_pub, sizeof(ec384_raw_pub));
+	ck_assert_int_eq(ret, EINVAL);
+	ck_assert_ptr_eq(jkey, NULL);
+}
+END_TEST
+
+START_TEST(test_jwt_encode_pubkey)
+{
+	jwt_key_t *jkey;
+	jwt_t *jwt = NULL;
+	int ret;
+	char *out;
+
+	jkey = new_key("rsa_key_2048-pub.pem", JWT_ALG_RS256);
+
+	ALLOC_JWT(&jwt);
+	add_grants(jwt);
+
+	ret = jwt_set_alg_key(jwt, JWT_ALG_RS256, jkey);
+	ck_assert_int_eq(ret, 0);
+
+	/* Can't sign with a public key. */
+	out = jwt_encode_str(jwt);
+	ck_assert_ptr_eq(out, NULL);
+	ck_assert_int_eq(errno, EINVAL);
+
+	jwt_free(jwt);
+	jwt_key_free(jkey);
+}
+END_TEST
+
+START_TEST(test_jwt_key_alg_mismatch)
+{
+	jwt_key_t *jkey;
+	jwt_t *jwt = NULL;
+	int ret;
+
+	jkey = new_key("rsa_key_2048-pub.pem", JWT_ALG_RS256);
+
+	/* Same family is fine. */
+	ALLOC_JWT(&jwt);
+	ret = jwt_set_alg_key(jwt, JWT_ALG_RS512, jkey);
+	ck_assert_int_eq(ret, 0);
+
+	ret = jwt_set_alg_key(jwt, JWT_ALG_HS256, jkey);
+	ck_assert_int_eq(ret, EINVAL);
+
+	ret = jwt_set_alg_key(jwt, JWT_ALG_NONE, jkey);
+	ck_assert_int_eq(ret, EINVAL);
+
+	ret = jwt_set_alg_key(jwt, JWT_ALG_NONE, NULL);
+	ck_assert_int_eq(ret, 0);
+	jwt_free(jwt);
+
+	/* A token can't switch an RSA key to HMAC. */
+	ret = jwt_decode_with_key(&jwt, jwt_hs256, jkey);
+	ck_assert_int_eq(ret, EINVAL);
+	ck_assert_ptr_eq(jwt, NULL);
+
+	jwt_key_free(jkey);
+}
+END_TEST
+
+START_TEST(test_jwt_key_cache)
+{
+	jwt_cache_stats_t stats;
+	unsigned long evictions;
+	jwt_t *jwt = NULL;
+	int ret, i;
+
+	jwt_key_cache_set_size(1);
+	jwt_key_cache_flush();
+
+	read_key("rsa_key_2048-pub.pem");
+
+	jwt_key_cache_get_stats(&stats);
+	ck_assert_int_eq(stats.size, 1);
+	ck_assert_int_eq(stats.entries, 0);
+	evictions = stats.evictions;
+
+	/* First one parses, the rest reuse it. */
+	for (i = 0; i < 3; i++) {
+		unsigned long hits = stats.hits, misses = stats.misses;
+
+		ret = jwt_decode(&jwt, jwt_rs256_2048, key, key_len);
+		ck_assert_int_eq(ret, 0);
+		jwt_free(jwt);
+
+		jwt_key_cache_get_stats(&stats);
+		ck_assert_int_eq(stats.entries, 1);
+		ck_assert_int_eq(stats.hits, hits + (i ? 1 : 0));
+		ck_assert_int_eq(stats.misses, misses + (i ? 0 : 1));
+	}
+
+	/* A different key pushes out the old one. */
+	ret = jwt_decode(&jwt, jwt_hs256, key256, sizeof(key256));
+	ck_assert_int_eq(ret, 0);
+	jwt_free(jwt);
+
+	jwt_key_cache_get_stats(&stats);
+	ck_assert_int_eq(stats.entries, 1);
+	ck_assert_int_eq(stats.evictions, evictions + 1);
+
+	/* Bad keys are not cached. */
+	ret = jwt_decode(&jwt, jwt_rs256_2048, key256, sizeof(key256));
+	ck_assert_int_ne(ret, 0);
+
+	/* Turned off, nothing is kept. */
+	jwt_key_cache_set_size(0);
+	jwt_key_cache_get_stats(&stats);
+	ck_assert_int_eq(stats.entries, 0);
+
+	ret = jwt_decode(&jwt, jwt_rs256_2048, key, key_len);
+	ck_assert_int_eq(ret, 0);
+	jwt_free(jwt);
+
+	jwt_key_cache_get_stats(&stats);
+	ck_assert_int_eq(stats.entries, 0);
+
+	jwt_key_cache_set_size(16);
+}
+END_TEST
+
+static char *hs256_token_exp(long exp)
+{
+	jwt_t *jwt = NULL;
+	char *out;
+	int ret;
+
+	ALLOC_JWT(&jwt);
+	add_grants(jwt);
+	if (exp) {
+		ret = jwt_add_grant_int(jwt, "exp", exp);
+		ck_assert_int_eq(ret, 0);
+	}
+	ret = jwt_set_alg(jwt, JWT_ALG_HS256, key256, sizeof(key256));
+	ck_assert_int_eq(ret, 0);
+
+	out = jwt_encode_str(jwt);
+	ck_assert_ptr_ne(out, NULL);
+	jwt_free(jwt);
+
+	return out;
+}
+
+static void token_cache_check(int ret, jwt_t *jwt, unsigned long hits,
+			      unsigned long misses, unsigned int entries)
+{
+	jwt_cache_stats_t stats;
+
+	ck_assert_int_eq(ret, 0);
+	ck_assert_int_eq(jwt_get_alg(jwt), JWT_ALG_RS256);
+	ck_assert_str_eq(jwt_get_grant(jwt, "sub"), "user0");
+	ck_assert_str_eq(jwt_get_header(jwt, "typ"), "JWT");
+	jwt_free(jwt);
+
+	jwt_token_cache_get_stats(&stats);
+	ck_assert_int_eq(stats.hits, hits);
+	ck_assert_int_eq(stats.misses, misses);
+	ck_assert_int_eq(stats.entries, entries);
+}
+
+START_TEST(test_jwt_token_cache)
+{
+	jwt_key_t *jkey, *jkey2;
+	jwt_cache_stats_t stats;
+	unsigned long hits, misses;
+	jwt_t *jwt = NULL;
+	char *token;
+	int ret;
+
+	ret = jwt_token_cache_set_size(64);
+	ck_assert_int_eq(ret, 0);
+
+	jwt_token_cache_get_stats(&stats);
+	ck_assert_int_eq(stats.size, 64);
+	ck_assert_int_eq(stats.entries, 0);
+	hits = stats.hits;
+	misses = stats.misses;
+
+	/* Verified the first time, copied from the cache after. */
+	read_key("rsa_key_2048-pub.pem");
+	ret = jwt_decode(&jwt, jwt_rs256_2048, key, key_len);
+	token_cache_check(ret, jwt, hits, ++misses, 1);
+
+	ret = jwt_decode(&jwt, jwt_rs256_2048, key, key_len);
+	ck_assert_int_eq(ret, 0);
+
+	/* Changing what came back leaves the cache alone. */
+	ret = jwt_add_grant(jwt, "extra", "yes");
+	ck_assert_int_eq(ret, 0);
+	ret = jwt_del_grants(jwt, "sub");
+	ck_assert_int_eq(ret, 0);
+	jwt_free(jwt);
+
+	ret = jwt_decode(&jwt, jwt_rs256_2048, key, key_len);
+	ck_assert_ptr_eq(jwt_get_grant(jwt, "extra"), NULL);
+	token_cache_check(ret, jwt, hits += 2, misses, 1);
+
+	/* A prepared key is a different key, even with the same bytes. */
+	jkey = new_key("rsa_key_2048-pub.pem", JWT_ALG_RS256);
+	jkey2 = new_key("rsa_key_2048-pub.pem", JWT_ALG_RS256);
+
+	ret = jwt_decode_with_key(&jwt, jwt_rs256_2048, jkey);
+	token_cache_check(ret, jwt, hits, ++misses, 2);
+	ret = jwt_decode_with_key(&jwt, jwt_rs256_2048, jkey);
+	token_cache_check(ret, jwt, ++hits, misses, 2);
+	ret = jwt_decode_with_key(&jwt, jwt_rs256_2048, jkey2);
+	token_cache_check(ret, jwt, hits, ++misses, 3);
+
+	/* A token that failed is looked for, but never kept. */
+	read_key("rsa_key_4096-pub.pem");
+	ret = jwt_decode(&jwt, jwt_rs256_2048, key, key_len);
+	ck_assert_int_ne(ret, 0);
+	ret = jwt_decode(&jwt, jwt_rs256_2048, key, key_len);
+	ck_assert_int_ne(ret, 0);
+
+	jwt_token_cache_get_stats(&stats);
+	ck_assert_int_eq(stats.misses, misses += 2);
+	ck_assert_int_eq(stats.entries, 3);
+
+	/* Expired tokens decode as before, but are not kept. */
+	token = hs256_token_exp(time(NULL) - 10);
+	ret = jwt_decode(&jwt, token, key256, sizeof(key256));
+	ck_assert_int_eq(ret, 0);
+	jwt_free(jwt);
+	jwt_free_str(token);
+
+	jwt_token_cache_get_stats(&stats);
+	ck_assert_int_eq(stats.entries, 3);
+
+	/* Entries go once their time is up. */
+	jwt_token_cache_flush();
+	ret = jwt_token_cache_set_ttl(1);
+	ck_assert_int_eq(ret, 0);
+
+	token = hs256_token_exp(time(NULL) + 3600);
+	ret = jwt_decode(&jwt, token, key256, sizeof(key256));
+	ck_assert_int_eq(ret, 0);
+	jwt_free(jwt);
+
+	jwt_token_cache_get_stats(&stats);
+	ck_assert_int_eq(stats.entries, 1);
+	hits = stats.hits;
+	misses = stats.misses;
+
+	sleep(2);
+
+	ret = jwt_decode(&jwt, token, key256, sizeof(key256));
+	ck_assert_int_eq(ret, 0);
+	jwt_free(jwt);
+	jwt_free_str(token);
+
+	jwt_token_cache_get_stats(&stats);
+	ck_assert_int_eq(stats.hits, hits);
+	ck_assert_int_eq(stats.misses, misses + 1);
+
+	ret = jwt_token_cache_set_ttl(0);
+	ck_assert_int_eq(ret, EINVAL);
+	ret = jwt_token_cache_set_ttl(300);
+	ck_assert_int_eq(ret, 0);
+
+	/* Turned off, nothing is kept or looked for. */
+	ret = jwt_token_cache_set_size(0);
+	ck_assert_int_eq(ret, 0);
+
+	ret = jwt_decode_with_key(&jwt, jwt_rs256_2048, jkey);
+	ck_assert_int_eq(ret, 0);
+	jwt_free(jwt);
+
+	jwt_token_cache_get_stats(&stats);
+	ck_assert_int_eq(stats.size, 0);
+	ck_assert_int_eq(stats.entries, 0);
+	ck_assert_int_eq(stats.misses, misses + 1);
+
+	jwt_key_free(jkey);
+	jwt_key_free(jkey2);
+}
+END_TEST
+
+static void reject_cache_check(int ret, unsigned long hits,
+			       unsigned long misses, unsigned int entries)
+{
+	jwt_cache_stats_t stats;
+
+	ck_assert_int_eq(ret, EINVAL);
+
+	jwt_reject_cache_get_stats(&stats);
+	ck_assert_int_eq(stats.hits, hits);
+	ck_assert_int_eq(stats.misses, misses);
+	ck_assert_int_eq(stats.entries, entries);
+}
+
+START_TEST(test_jwt_reject_cache)
+{
+	jwt_cache_stats_t stats;
+	jwt_key_t *jkey;
+	jwt_t *jwt = NULL;
+	int ret;
+
+	ret = jwt_reject_cache_set_size(64);
+	ck_assert_int_eq(ret, 0);
+
+	jwt_reject_cache_get_stats(&stats);
+	ck_assert_int_eq(stats.size, 64);
+	ck_assert_int_eq(stats.entries, 0);
+	ck_assert_int_eq(stats.hits, 0);
+	ck_assert_int_eq(stats.misses, 0);
+
+	/* Checked the first time, refused from the cache after. */
+	read_key("rsa_key_4096-pub.pem");
+	ret = jwt_decode(&jwt, jwt_rs256_2048, key, key_len);
+	reject_cache_check(ret, 0, 1, 1);
+	ck_assert_ptr_eq(jwt, NULL);
+
+	ret = jwt_decode(&jwt, jwt_rs256_2048, key, key_len);
+	reject_cache_check(ret, 1, 1, 1);
+	ck_assert_ptr_eq(jwt, NULL);
+
+	/* Only for the key it failed with. */
+	read_key("rsa_key_2048-pub.pem");
+	ret = jwt_decode(&jwt, jwt_rs256_2048, key, key_len);
+	ck_assert_int_eq(ret, 0);
+	jwt_free(jwt);
+
+	jkey = new_key("rsa_key_4096-pub.pem", JWT_ALG_RS256);
+	ret = jwt_decode_with_key(&jwt, jwt_rs256_2048, jkey);
+	reject_cache_check(ret, 1, 3, 2);
+	ret = jwt_decode_with_key(&jwt, jwt_rs256_2048, jkey);
+	reject_cache_check(ret, 2, 3, 2);
+
+	/* Malformed tokens are not kept. */
+	ret = jwt_decode(&jwt, "eyJhbGciOiJIUzI1NiJ9.e30", key256,
+			 sizeof(key256));
+	reject_cache_check(ret, 2, 4, 2);
+
+	/* Entries go once their time is up. */
+	jwt_reject_cache_flush();
+	ret = jwt_reject_cache_set_ttl(1);
+	ck_assert_int_eq(ret, 0);
+
+	ret = jwt_decode_with_key(&jwt, jwt_rs256_2048, jkey);
+	reject_cache_check(ret, 2, 5, 1);
+
+	sleep(2);
+
+	ret = jwt_decode_with_key(&jwt, jwt_rs256_2048, jkey);
+	reject_cache_check(ret, 2, 6, 1);
+
+	jwt_reject_cache_get_stats(&stats);
+	ck_assert_int_eq(stats.evictions, 1);
+
+	ret = jwt_reject_cache_set_ttl(0);
+	ck_assert_int_eq(ret, EINVAL);
+	ret = jwt_reject_cache_set_ttl(10);
+	ck_assert_int_eq(ret, 0);
+
+	/* Turned off, nothing is kept or looked for. */
+	ret = jwt_reject_cache_set_size(0);
+	ck_assert_int_eq(ret, 0);
+
+	ret = jwt_decode_with_key(&jwt, jwt_rs256_2048, jkey);
+	reject_cache_check(ret, 2, 6, 0);
+
+	jwt_reject_cache_get_stats(&stats);
+	ck_assert_int_eq(stats.size, 0);
+
+	jwt_key_free(jkey);
+}
+END_TEST
+
+static unsigned long alloc_count, alloc_fail_at;
+
+static void *fail_malloc(size_t size)
+{
+	return alloc_count++ == alloc_fail_at ? NULL : malloc(size);
+}
+
+static void *fail_realloc(void *ptr, size_t size)
+{
+	return alloc_count++ == alloc_fail_at ? NULL : realloc(ptr, size);
+}
+
+/* Fail each allocation of a decode in turn. Whatever that does to the
+ * decode, the token must not be remembered as forged. */
+static void reject_cache_transient(const char *token, jwt_key_t *jkey,
+				   const unsigned char *raw, int raw_len)
+{
+	jwt_t *jwt;
+	int ret;
+
+	for (alloc_fail_at = 0;; alloc_fail_at++) {
+		alloc_count = 0;
+		ret = jwt_set_alloc(fail_malloc, fail_realloc, free);
+		ck_assert_int_eq(ret, 0);
+
+		if (jkey)
+			ret = jwt_decode_with_key(&jwt, token, jkey);
+		else
+			ret = jwt_decode(&jwt, token, raw, raw_len);
+
+		jwt_set_alloc(malloc, realloc, free);
+
+		/* Got through without hitting the failure. */
+		if (alloc_count <= alloc_fail_at) {
+			ck_assert_int_eq(ret, 0);
+			jwt_free(jwt);
+			break;
+		}
+
+		/* Not every failure reaches us, jansson shrugs some off. */
+		if (ret == 0)
+			jwt_free(jwt);
+
+		if (jkey)
+			ret = jwt_decode_with_key(&jwt, token, jkey);
+		else
+			ret = jwt_decode(&jwt, token, raw, raw_len);
+		ck_assert_int_eq(ret, 0);
+		jwt_free(jwt);
+	}
+}
+
+START_TEST(test_jwt_reject_cache_transient)
+{
+	jwt_cache_stats_t stats;
+	jwt_key_t *jkey;
+	int ret;
+
+	ret = jwt_reject_cache_set_size(64);
+	ck_assert_int_eq(ret, 0);
+	jwt_reject_cache_flush();
+
+	jkey = new_key("rsa_key_2048-pub.pem", JWT_ALG_RS256);
+	reject_cache_transient(jwt_rs256_2048, jkey, NULL, 0);
+	jwt_key_free(jkey);
+
+	reject_cache_transient(jwt_hs256, NULL, key256, sizeof(key256));
+
+	jwt_reject_cache_get_stats(&stats);
+	ck_assert_int_eq(stats.entries, 0);
+
+	ret = jwt_reject_cache_set_size(0);
+	ck_assert_int_eq(ret, 0);
+}
+END_TEST
+
+START_TEST(test_jwt_init_shutdown)
+{
+	jwt_cache_stats_t stats;
+	jwt_key_t *jkey;
+	jwt_t *jwt = NULL;
+	char *out;
+	int ret;
+
+	ret = jwt_init();
+	ck_assert_int_eq(ret, 0);
+
+	/* Repeated calls are fine. */
+	ret = jwt_init();
+	ck_assert_int_eq(ret, 0);
+
+	ret = jwt_init_libctx(NULL);
+	ck_assert_int_eq(ret, EINVAL);
+
+	jkey = new_key("rsa_key_2048.pem", JWT_ALG_RS256);
+
+	ALLOC_JWT(&jwt);
+	add_grants(jwt);
+	ret = jwt_set_alg(jwt, JWT_ALG_HS256, key256, sizeof(key256));
+	ck_assert_int_eq(ret, 0);
+
+	out = jwt_encode_str(jwt);
+	ck_assert_str_eq(out, jwt_hs256);
+	jwt_free_str(out);
+
+	/* Keys outlive the shutdown, and the library sets itself up again
+	 * when it is next used. */
+	jwt_shutdown();
+
+	jwt_key_cache_get_stats(&stats);
+	ck_assert_int_eq(stats.entries, 0);
+
+	out = jwt_encode_str(jwt);
+	ck_assert_str_eq(out, jwt_hs256);
+	jwt_free_str(out);
+	jwt_free(jwt);
+
+	ret = jwt_decode_with_key(&jwt, jwt_rs256_2048, jkey);
+	ck_assert_int_eq(ret, 0);
+	ck_assert_ptr_ne(jwt, NULL);
+	jwt_free(jwt);
+
+	jwt_key_free(jkey);
+}
+END_TEST
+
+#define THREADS		4
+#define THREAD_LOOPS	100
+
+static void *key_thread(void *arg)
+{
+	jwt_key_t **keys = arg;
+	jwt_t *jwt;
+	char *out;
+	int i, ret;
+
+	for (i = 0; i < THREAD_LOOPS; i++) {
+		out = encode_with_key(JWT_ALG_HS256, keys[0]);
+		ck_assert_str_eq(out, jwt_hs256);
+		jwt_free_str(out);
+
+		ret = jwt_decode_with_key(&jwt, jwt_rs256_2048, keys[1]);
+		ck_assert_int_eq(ret, 0);
+		jwt_free(jwt);
+
+		ret = jwt_decode_with_key(&jwt, jwt_hs256, keys[1]);
+		ck_assert_int_eq(ret, EINVAL);
+	}
+
+	return NULL;
+}
+
+START_TEST(test_jwt_key_threads)
+{
+	pthread_t threads[THREADS];
+	jwt_key_t *keys[2] = { NULL, NULL };
+	int i, ret;
+
+	ret = jwt_key_new(&keys[0], JWT_ALG_HS256, key256, sizeof(key256));
+	ck_assert_int_eq(ret, 0);
+	keys[1] = new_key("rsa_key_2048-pub.pem", JWT_ALG_RS256);
+
+	for (i = 0; i < THREADS; i++) {
+		ret = pthread_create(&threads[i], NULL, key_thread, keys);
+		ck_assert_int_eq(ret, 0);
+	}
+
+	for (i = 0; i < THREADS; i++)
+		pthread_join(threads[i], NULL);
+
+	jwt_key_free(keys[0]);
+	jwt_key_free(keys[1]);
+}
+END_TEST
+
+static pthread_mutex_t release_lock = PTHREAD_MUTEX_INITIALIZER;
+static int release_stop;
+
+static int release_stopped(void)
+{
+	int stop;
+
+	pthread_mutex_lock(&release_lock);
+	stop = release_stop;
+	pthread_mutex_unlock(&release_lock);
+
+	return stop;
+}
+
+static void *release_thread(void *arg)
+{
+	jwt_key_t *jkey = arg;
+	char *out;
+
+	while (!release_stopped()) {
+		out = encode_with_key(JWT_ALG_HS256, jkey);
+		ck_assert_str_eq(out, jwt_hs256);
+		jwt_free_str(out);
+	}
+
+	return NULL;
+}
+
+/* Keys released on one thread must not pull contexts out from under
+ * another thread that is signing with a key of its own. */
+START_TEST(test_jwt_key_release_threads)
+{
+	static const unsigned char other256[32] =
+		"ABCDEFGHIJKLMNOPQRSTUVWXYZ012345";
+	pthread_t thread;
+	jwt_key_t *jkey = NULL, *other;
+	jwt_t *jwt;
+	char *out;
+	int i, ret;
+
+	ret = jwt_key_new(&jkey, JWT_ALG_HS256, key256, sizeof(key256));
+	ck_assert_int_eq(ret, 0);
+
+	release_stop = 0;
+	ret = pthread_create(&thread, NULL, release_thread, jkey);
+	ck_assert_int_eq(ret, 0);
+
+	/* Cache evictions release keys too. */
+	jwt_key_cache_set_size(1);
+
+	for (i = 0; i < THREAD_LOOPS * 10; i++) {
+		ret = jwt_key_new(&other, JWT_ALG_HS256, key256,
+				  sizeof(key256));
+		ck_assert_int_eq(ret, 0);
+		out = encode_with_key(JWT_ALG_HS256, other);
+		ck_assert_str_eq(out, jwt_hs256);
+		jwt_free_str(out);
+		jwt_key_free(other);
+
+		ret = jwt_decode(&jwt, jwt_hs256, i % 2 ? key256 : other256,
+				 sizeof(key256));
+		ck_assert_int_eq(ret, i % 2 ? 0 : EINVAL);
+		jwt_free(jwt);
+	}
+
+	pthread_mutex_lock(&release_lock);
+	release_stop = 1;
+	pthread_mutex_unlock(&release_lock);
+	pthread_join(thread, NULL);
+
+	jwt_key_cache_set_size(16);
+	jwt_key_free(jkey);
+}
+END_TEST
+
+START_TEST(test_jwt_keyring)
+{
+	jwt_keyring_t *ring = NULL;
+	jwt_key_t *jkey, *rkey, *got;
+	jwt_t *jwt;
+	char *out;
+	int ret;
+
+	ret = jwt_keyring_new(&ring, NULL);
+	ck_assert_int_eq(ret, 0);
+	ck_assert_ptr_ne(ring, NULL);
+	ck_assert_int_eq(jwt_keyring_generation(ring), 0);
+	ck_assert_ptr_eq(jwt_keyring_get(ring), NULL);
+
+	/* An empty keyring must not accept anything, unsigned or not. */
+	ret = jwt_decode_keyring(&jwt, jwt_hs256, ring);
+	ck_assert_int_eq(ret, EINVAL);
+	ck_assert_ptr_eq(jwt, NULL);
+
+	ret = jwt_key_new(&jkey, JWT_ALG_HS256, key256, sizeof(key256));
+	ck_assert_int_eq(ret, 0);
+
+	ret = jwt_keyring_set(ring, jkey);
+	ck_assert_int_eq(ret, 0);
+	ck_assert_int_eq(jwt_keyring_generation(ring), 1);
+
+	got = jwt_keyring_get(ring);
+	ck_assert_ptr_eq(got, jkey);
+
+	ret = jwt_decode_keyring(&jwt, jwt_hs256, ring);
+	ck_assert_int_eq(ret, 0);
+	jwt_free(jwt);
+
+	/* After a rotation, a key already handed out stays usable. */
+	rkey = new_key("rsa_key_2048.pem", JWT_ALG_RS256);
+	ret = jwt_keyring_set(ring, rkey);
+	ck_assert_int_eq(ret, 0);
+	ck_assert_int_eq(jwt_keyring_generation(ring), 2);
+	jwt_key_free(rkey);
+	jwt_key_free(jkey);
+
+	out = encode_with_key(JWT_ALG_HS256, got);
+	ck_assert_str_eq(out, jwt_hs256);
+	jwt_free_str(out);
+	jwt_key_free(got);
+
+	ret = jwt_decode_keyring(&jwt, jwt_hs256, ring);
+	ck_assert_int_eq(ret, EINVAL);
+
+	ret = jwt_decode_keyring(&jwt, jwt_rs256_2048, ring);
+	ck_assert_int_eq(ret, 0);
+	jwt_free(jwt);
+
+	ret = jwt_keyring_set(ring, NULL);
+	ck_assert_int_eq(ret, 0);
+	ck_assert_ptr_eq(jwt_keyring_get(ring), NULL);
+
+	ret = jwt_keyring_set(NULL, NULL);
+	ck_assert_int_eq(ret, EINVAL);
+
+	ret = jwt_keyring_new(NULL, NULL);
+	ck_assert_int_eq(ret, EINVAL);
+
+	jwt_keyring_free(ring);
+}
+END_TEST
+
+#define RING_ROTATIONS	200
+
+/* Whatever the keyring hands out must stay valid until released. */
+static void *keyring_thread(void *arg)
+{
+	jwt_keyring_t *ring = arg;
+	jwt_key_t *jkey;
+	jwt_t *jwt;
+	char *out;
+	int i, ret;
+
+	for (i = 0; i < THREAD_LOOPS; i++) {
+		jkey = jwt_keyring_get(ring);
+		ck_assert_ptr_ne(jkey, NULL);
+
+		out = encode_with_key(JWT_ALG_HS256, jkey);
+
+		ret = jwt_decode_with_key(&jwt, out, jkey);
+		ck_assert_int_eq(ret, 0);
+		jwt_free(jwt);
+
+		jwt_key_free(jkey);
+
+		/* Signed with a key that may have been rotated out since. */
+		ret = jwt_decode_keyring(&jwt, out, ring);
+		ck_assert(ret == 0 || ret == EINVAL);
+		jwt_free(jwt);
+
+		jwt_free_str(out);
+	}
+
+	return NULL;
+}
+
+START_TEST(test_jwt_keyring_threads)
+{
+	pthread_t threads[THREADS];
+	unsigned char data[sizeof(key256)];
+	jwt_keyring_t *ring;
+	jwt_key_t *jkey;
+	int i, ret;
+
+	ret = jwt_key_new(&jkey, JWT_ALG_HS256, key256, sizeof(key256));
+	ck_assert_int_eq(ret, 0);
+
+	ret = jwt_keyring_new(&ring, jkey);
+	ck_assert_int_eq(ret, 0);
+	jwt_key_free(jkey);
+
+	for (i = 0; i < THREADS; i++) {
+		ret = pthread_create(&threads[i], NULL, keyring_thread, ring);
+		ck_assert_int_eq(ret, 0);
+	}
+
+	/* Each key is only held by the keyring and its readers. */
+	memcpy(data, key256, sizeof(data));
+	for (i = 0; i < RING_ROTATIONS; i++) {
+		data[0] = i;
+
+		ret = jwt_key_new(&jkey, JWT_ALG_HS256, data, sizeof(data));
+		ck_assert_int_eq(ret, 0);
+
+		ret = jwt_keyring_set(ring, jkey);
+		ck_assert_int_eq(ret, 0);
+		jwt_key_free(jkey);
+	}
+
+	for (i = 0; i < THREADS; i++)
+		pthread_join(threads[i], NULL);
+
+	ck_assert_int_eq(jwt_keyring_generation(ring), RING_ROTATIONS + 1);
+
+	jwt_keyring_free(ring);
+}
+END_TEST
+
+static Suite *libjwt_suite(void)
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s = suite_create("LibJWT Prepared Keys");
+
+	tc_core = tcase_create("jwt_key");
+
+	tcase_add_test(tc_core, test_jwt_key_new);
+	tcase_add_test(tc_core, test_jwt_key_new_invalid);
+	tcase_add_test(tc_core, test_jwt_encode_hs256_key);
+	tcase_add_test(tc_core, test_jwt_decode_hs256_key);
+	tcase_add_test(tc_core, test_jwt_hmac_key_reuse);
+	tcase_add_test(tc_core, test_jwt_decode_batch);
+	tcase_add_test(tc_core, test_jwt_encode_batch);
+	tcase_add_test(tc_core, test_jwt_encode_rs256_key);
+	tcase_add_test(tc_core, test_jwt_decode_rs256_key);
+	tcase_add_test(tc_core, test_jwt_key_der);
+	tcase_add_test(tc_core, test_jwt_key_raw);
+	tcase_add_test(tc_core, test_jwt_encode_pubkey);
+	tcase_add_test(tc_core, test_jwt_key_alg_mismatch);
+	tcase_add_test(tc_core, test_jwt_key_cache);
+	tcase_add_test(tc_core, test_jwt_token_cache);
+	tcase_add_test(tc_core, test_jwt_reject_cache);
+	tcase_add_test(tc_core, test_jwt_reject_cache_transient);
+	tcase_add_test(tc_core, test_jwt_init_shutdown);
+	tcase_add_test(tc_core, test_jwt_key_threads);
+	tcase_add_test(tc_core, test_jwt_key_release_threads);
+	tcase_add_test(tc_core, test_jwt_keyring);
+	tcase_add_test(tc_core, test_jwt_keyring_threads);
+
+	tcase_set_timeout(tc_core, 30);
+
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
+
+int main(int argc, char *argv[])
+{
+	int number_failed;
+	Suite *s;
+	SRunner *sr;
+
+	s = libjwt_suite();
+	sr = srunner_create(s);
+
+	srunner_run_all(sr, CK_VERBOSE);
+	number_failed = srunner_ntests_failed(sr);
+	srunner_free(sr);
+
+	return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -211,6 +211,61 @@ START_TEST(test_jwt_decode_invalid_body)
 }
 END_TEST
 
+/* Payloads of many lengths, so every way through the decoder is taken,
+ * and each of them made non-canonical in a few places. */
+START_TEST(test_jwt_decode_b64_strict)
+{
+	/* Around 1011 the claims fill one of jansson's 1 KiB reads. */
+	static const size_t lens[] = { 0, 1, 2, 3, 10, 30, 31, 32, 33, 47, 48,
+				       49, 100, 1000, 1010, 1011, 1012, 2047,
+				       16384 };
+	static const char bad[] = { '+', '/', '=', ' ', '\x80', '\xff' };
+	char *claim, *token, *body, *end, *p, save;
+	size_t i, j, k;
+	jwt_t *jwt;
+	int ret;
+
+	for (i = 0; i < sizeof(lens) / sizeof(lens[0]); i++) {
+		claim = malloc(lens[i] + 1);
+		ck_assert_ptr_ne(claim, NULL);
+		for (j = 0; j < lens[i]; j++)
+			claim[j] = ' ' + (j * 7) % 95;
+		claim[lens[i]] = '\0';
+
+		ret = jwt_new(&jwt);
+		ck_assert_int_eq(ret, 0);
+		ret = jwt_add_grant(jwt, "claim", claim);
+		ck_assert_int_eq(ret, 0);
+		token = jwt_encode_str(jwt);
+		ck_assert_ptr_ne(token, NULL);
+		jwt_free(jwt);
+
+		ret = jwt_decode(&jwt, token, NULL, 0);
+		ck_assert_int_eq(ret, 0);
+		ck_assert_str_eq(jwt_get_grant(jwt, "claim"), claim);
+		jwt_free(jwt);
+
+		body = strchr(token, '.') + 1;
+		end = strchr(body, '.');
+
+		for (j = 0; j < sizeof(bad); j++) {
+			for (k = 0; k < 3; k++) {
+				p = body + (end - body - 1) * k / 2;
+				save = *p;
+				*p = bad[j];
+				ret = jwt_decode(&jwt, token, NULL, 0);
+				ck_assert_int_eq(ret, EINVAL);
+				ck_assert(jwt == NULL);
+				*p = save;
+			}
+		}
+
+		free(claim);
+		jwt_free_str(token);
+	}
+}
+END_TEST
+
 START_TEST(test_jwt_decode_hs256)
 {
 	const char token[] = "eyJ0eXAiOiJKV1QiLCJhbGciOiJIUzI1NiJ9.eyJpc3Mi"
@@ -228,6 +283,102 @@ START_TEST(test_jwt_decode_hs256)
 }
 END_TEST
 
+START_TEST(test_jwt_decode_hs256_invalid_sig)
+{
+	const char head[] = "eyJ0eXAiOiJKV1QiLCJhbGciOiJIUzI1NiJ9.eyJpc3Mi"
+			    "OiJmaWxlcy5jeXBocmUuY29tIiwic3ViIjoidXNlcjAif"
+			    "Q.";
+	const char *sigs[] = {
+		/* Wrong MAC. */
+		"dLFbrHVViu1e3VD1yeCd9aaLNed-bfXhSsF0Gh56fAg",
+		/* Right MAC, but not the canonical encoding of it. */
+		"dLFbrHVViu1e3VD1yeCd9aaLNed-bfXhSsF0Gh56fBh",
+		"dLFbrHVViu1e3VD1yeCd9aaLNed-bfXhSsF0Gh56fBg=",
+		"dLFbrHVViu1e3VD1yeCd9aaLNed+bfXhSsF0Gh56fBg",
+		/* Truncated and extended. */
+		"dLFbrHVViu1e3VD1yeCd9aaLNed-bfXhSsF0Gh56fB",
+		"dLFbrHVViu1e3VD1yeCd9aaLNed-bfXhSsF0Gh56fBgA",
+		"dLFbrHVViu1e3VD1yeCd9aaLNed-bfXhSsF0Gh56fBgdLFbrHVViu1e3V"
+		"D1yeCd9aaLNed-bfXhSsF0Gh56fBgdLFbrHVViu1e3VD1yeCd9aaLNed",
+		"",
+	};
+	unsigned char key256[32] = "012345678901234567890123456789XY";
+	char token[256];
+	unsigned int i;
+	jwt_t *jwt;
+	int ret;
+
+	for (i = 0; i < sizeof(sigs) / sizeof(sigs[0]); i++) {
+		snprintf(token, sizeof(token), "%s%s", head, sigs[i]);
+
+		ret = jwt_decode(&jwt, token, key256, sizeof(key256));
+		ck_assert_int_eq(ret, EINVAL);
+		ck_assert(jwt == NULL);
+	}
+}
+END_TEST
+
+static unsigned long allocs;
+
+static void *count_malloc(size_t size)
+{
+	allocs++;
+	return malloc(size);
+}
+
+static void *count_realloc(void *ptr, size_t size)
+{
+	allocs++;
+	return realloc(ptr, size);
+}
+
+START_TEST(test_jwt_decode_verify_first)
+{
+	unsigned char key256[32] = "012345678901234567890123456789XY";
+	char name[16], *token, *c;
+	jwt_t *jwt;
+	int i, ret;
+
+	ret = jwt_new(&jwt);
+	ck_assert_int_eq(ret, 0);
+	for (i = 0; i < 500; i++) {
+		snprintf(name, sizeof(name), "claim%d", i);
+		ret = jwt_add_grant_int(jwt, name, i);
+		ck_assert_int_eq(ret, 0);
+	}
+	ret = jwt_set_alg(jwt, JWT_ALG_HS256, key256, sizeof(key256));
+	ck_assert_int_eq(ret, 0);
+	token = jwt_encode_str(jwt);
+	ck_assert_ptr_ne(token, NULL);
+	jwt_free(jwt);
+
+	ret = jwt_set_alloc(count_malloc, count_realloc, free);
+	ck_assert_int_eq(ret, 0);
+
+	/* Parsing the claims takes an allocation or more each. */
+	allocs = 0;
+	ret = jwt_decode(&jwt, token, key256, sizeof(key256));
+	ck_assert_int_eq(ret, 0);
+	ck_assert_int_gt(allocs, 500);
+	jwt_free(jwt);
+
+	/* A forged token is turned away with the claims still encoded. */
+	c = token + strlen(token) - 8;
+	*c = *c == 'A' ? 'B' : 'A';
+
+	allocs = 0;
+	ret = jwt_decode(&jwt, token, key256, sizeof(key256));
+	ck_assert_int_eq(ret, EINVAL);
+	ck_assert(jwt == NULL);
+	ck_assert_int_lt(allocs, 50);
+
+	ret = jwt_set_alloc(malloc, realloc, free);
+	ck_assert_int_eq(ret, 0);
+
+	jwt_free_str(token);
+}
+END_TEST
+
 START_TEST(test_jwt_decode_hs256_issue_1)
 {
 	const char token[] = "eyJhbGciOiJIUzI1NiIsInR5cCI6IkpXVCJ9.eyJzdWIi"
@@ -330,10 +481,13 @@ static Suite *libjwt_suite(void)
 	tcase_add_test(tc_core, test_jwt_decode_alg_none_with_key);
 	tcase_add_test(tc_core, test_jwt_decode_invalid_body);
 	tcase_add_test(tc_core, test_jwt_decode_invalid_final_dot);
+	tcase_add_test(tc_core, test_jwt_decode_b64_strict);
 	tcase_add_test(tc_core, test_jwt_decode_hs256);
+	tcase_add_test(tc_core, test_jwt_decode_hs256_invalid_sig);
 	tcase_add_test(tc_core, test_jwt_decode_hs384);
 	tcase_add_test(tc_core, test_jwt_decode_hs512);
 
+	tcase_add_test(tc_core, test_jwt_decode_verify_first);
 	tcase_add_test(tc_core, test_jwt_decode_hs256_issue_1);
 	tcase_add_test(tc_core, test_jwt_decode_hs256_issue_2);
 